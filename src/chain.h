@@ -144,6 +144,10 @@ enum BlockStatus : uint32_t {
      * on a background chainstate. See `doc/assumeutxo.md`.
      */
     BLOCK_ASSUMED_VALID      =   256,
+
+    //! nDataChecksum holds the CRC32C of the block as we stored it after validating it.
+    //! The checksum is stored in a block tree record of its own, see CBlockTreeDB.
+    BLOCK_HAVE_CHECKSUM      =   512,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -175,6 +179,9 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos GUARDED_BY(::cs_main){0};
 
+    //! CRC32C of the serialized block in blk?????.dat, valid if nStatus has BLOCK_HAVE_CHECKSUM
+    uint32_t nDataChecksum GUARDED_BY(::cs_main){0};
+
     //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
     arith_uint256 nChainTrust{};
 
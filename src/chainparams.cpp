@@ -461,7 +461,7 @@ public:
         m_assumeutxo_data = MapAssumeutxo{
             {
                 110,
-                {AssumeutxoHash{uint256S("0x1ebbf5850204c0bdb15bf030f47c7fe91d45c44c712697e4509ba67adb01c618")}, 110},
+                {AssumeutxoHash{uint256S("0x020a8579c585f3b7f8219f05d2c6940dbeb168c25426b5e2e9e2fee98061516e")}, 110},
             },
             {
                 200,
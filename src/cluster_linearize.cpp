@@ -0,0 +1,111 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <cluster_linearize.h>
+
+#include <util/check.h>
+
+#include <functional>
+#include <queue>
+
+namespace {
+/** Order the transactions after their parents, taking the best of those ready first. */
+template <typename Worse>
+std::vector<uint32_t> TopologicalOrder(const std::vector<std::vector<uint32_t>>& parents, Worse worse)
+{
+    const uint32_t n = parents.size();
+    std::vector<std::vector<uint32_t>> children(n);
+    std::vector<size_t> missing(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        missing[i] = parents[i].size();
+        for (const uint32_t parent : parents[i]) {
+            children[parent].push_back(i);
+        }
+    }
+    std::priority_queue<uint32_t, std::vector<uint32_t>, Worse> ready{worse};
+    for (uint32_t i = 0; i < n; ++i) {
+        if (missing[i] == 0) ready.push(i);
+    }
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    while (!ready.empty()) {
+        const uint32_t i{ready.top()};
+        ready.pop();
+        order.push_back(i);
+        for (const uint32_t child : children[i]) {
+            if (--missing[child] == 0) ready.push(child);
+        }
+    }
+    Assume(order.size() == n);
+    return order;
+}
+} // namespace
+
+std::vector<uint32_t> LinearizeCluster(const std::vector<FeeFrac>& txs, const std::vector<std::vector<uint32_t>>& parents)
+{
+    const uint32_t n = txs.size();
+    if (n > MAX_CLUSTER_ANCESTOR_LINEARIZE) {
+        return TopologicalOrder(parents, [&txs](uint32_t a, uint32_t b) {
+            if (txs[b].HigherThan(txs[a])) return true;
+            if (txs[a].HigherThan(txs[b])) return false;
+            return a > b;
+        });
+    }
+
+    // Small enough for the ancestor sets to be bitmasks.
+    const std::vector<uint32_t> topo{TopologicalOrder(parents, std::greater<uint32_t>{})};
+    std::vector<uint64_t> ancestors(n);
+    for (const uint32_t i : topo) {
+        ancestors[i] = uint64_t{1} << i;
+        for (const uint32_t parent : parents[i]) {
+            ancestors[i] |= ancestors[parent];
+        }
+    }
+    std::vector<FeeFrac> ancestor_feerates(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        for (uint32_t j = 0; j < n; ++j) {
+            if ((ancestors[i] >> j) & 1) ancestor_feerates[i] += txs[j];
+        }
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    uint64_t remaining{n == 64 ? ~uint64_t{0} : (uint64_t{1} << n) - 1};
+    while (remaining) {
+        uint32_t best{n};
+        for (uint32_t i = 0; i < n; ++i) {
+            if (((remaining >> i) & 1) && (best == n || ancestor_feerates[i].HigherThan(ancestor_feerates[best]))) {
+                best = i;
+            }
+        }
+        const uint64_t taken{ancestors[best] & remaining};
+        for (const uint32_t i : topo) {
+            if ((taken >> i) & 1) order.push_back(i);
+        }
+        remaining &= ~taken;
+        for (uint32_t i = 0; i < n; ++i) {
+            const uint64_t gone{ancestors[i] & taken};
+            if (!((remaining >> i) & 1) || !gone) continue;
+            for (uint32_t j = 0; j < n; ++j) {
+                if ((gone >> j) & 1) ancestor_feerates[i] -= txs[j];
+            }
+        }
+    }
+    return order;
+}
+
+std::vector<LinearizationChunk> ChunkLinearization(const std::vector<FeeFrac>& txs)
+{
+    std::vector<LinearizationChunk> chunks;
+    for (uint32_t i = 0; i < txs.size(); ++i) {
+        chunks.push_back({i + 1, txs[i]});
+        while (chunks.size() > 1 && chunks.back().feerate.HigherThan(chunks[chunks.size() - 2].feerate)) {
+            const LinearizationChunk last{chunks.back()};
+            chunks.pop_back();
+            chunks.back().end = last.end;
+            chunks.back().feerate += last.feerate;
+        }
+    }
+    return chunks;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CLUSTER_LINEARIZE_H
+#define BITCOIN_CLUSTER_LINEARIZE_H
+
+#include <consensus/amount.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/** Clusters with up to this many transactions are linearized by ancestor set feerate */
+static constexpr size_t MAX_CLUSTER_ANCESTOR_LINEARIZE{64};
+
+/** Combined fee and virtual size of one or more transactions. */
+struct FeeFrac {
+    CAmount fee{0};
+    int64_t size{0};
+
+    FeeFrac& operator+=(const FeeFrac& other)
+    {
+        fee += other.fee;
+        size += other.size;
+        return *this;
+    }
+
+    FeeFrac& operator-=(const FeeFrac& other)
+    {
+        fee -= other.fee;
+        size -= other.size;
+        return *this;
+    }
+
+    /** Whether this pays a strictly higher feerate than other. */
+    bool HigherThan(const FeeFrac& other) const
+    {
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b), in integers
+        // wide enough to hold the products exactly.
+        return Mul(fee, other.size) > Mul(other.fee, size);
+    }
+
+private:
+#ifdef __SIZEOF_INT128__
+    static __int128 Mul(int64_t a, int64_t b)
+    {
+        return static_cast<__int128>(a) * b;
+    }
+#else
+    /** a * b as its upper 64 bits and lower 32 bits, for sizes below 2^31. */
+    static std::pair<int64_t, uint32_t> Mul(int64_t a, int64_t b)
+    {
+        assert(b >= 0 && b <= std::numeric_limits<int32_t>::max());
+        const int64_t low{int64_t{static_cast<uint32_t>(a)} * b};
+        const int64_t high{(a >> 32) * b};
+        return {high + (low >> 32), static_cast<uint32_t>(low)};
+    }
+#endif
+};
+
+/** Consecutive transactions of a linearization that are best mined together. */
+struct LinearizationChunk {
+    //! One past the position of the chunk's last transaction.
+    uint32_t end;
+    FeeFrac feerate;
+};
+
+/**
+ * Order the transactions of a cluster such that each comes after its parents,
+ * with the highest feerate groups of transactions as early as possible.
+ *
+ * Clusters up to MAX_CLUSTER_ANCESTOR_LINEARIZE transactions repeatedly take
+ * the transaction with the best ancestor set feerate, along with its ancestors.
+ * Larger ones take the best individual feerate among the transactions whose
+ * parents are all taken, which ChunkLinearization() then makes up for.
+ *
+ * @param[in] txs      Fee and size of every transaction.
+ * @param[in] parents  For every transaction, the positions in txs of its parents.
+ * @returns the positions in txs, in linearized order.
+ */
+std::vector<uint32_t> LinearizeCluster(const std::vector<FeeFrac>& txs, const std::vector<std::vector<uint32_t>>& parents);
+
+/**
+ * Split a linearization into chunks of non-increasing feerate, merging each
+ * transaction into the chunks before it for as long as that improves their
+ * feerate.
+ *
+ * @param[in] txs  Fee and size of every transaction, in linearized order.
+ */
+std::vector<LinearizationChunk> ChunkLinearization(const std::vector<FeeFrac>& txs);
+
+#endif // BITCOIN_CLUSTER_LINEARIZE_H
@@ -32,7 +32,10 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
 std::unique_ptr<CCoinsViewCursor> CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewBacked(baseIn), m_cache_coins_memory_resource{},
+    cacheCoins{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &m_cache_coins_memory_resource},
+    cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -236,10 +239,48 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    // Hand the pool's chunks back, otherwise the emptied cache would keep
+    // reporting its peak memory usage.
+    ReallocateCache();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+size_t CCoinsViewCache::ExtractDirty(CCoinsMap& coins, bool evict_clean)
+{
+    size_t usage{0};
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            if (evict_clean) {
+                cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+                it = cacheCoins.erase(it);
+            } else {
+                ++it;
+            }
+            continue;
+        }
+        usage += it->second.coin.DynamicMemoryUsage();
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            coins.emplace(it->first, std::move(it->second));
+            it = cacheCoins.erase(it);
+        } else {
+            coins.emplace(it->first, it->second);
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return usage;
+}
+
+bool CCoinsViewCache::EmplaceFetchedCoin(const COutPoint& outpoint, Coin&& coin)
+{
+    if (coin.IsSpent()) return false;
+    const auto [it, inserted] = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted) cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    return inserted;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -276,7 +317,56 @@ void CCoinsViewCache::ReallocateCache()
     // Cache should be empty when we're calling this.
     assert(cacheCoins.size() == 0);
     cacheCoins.~CCoinsMap();
-    ::new (&cacheCoins) CCoinsMap();
+    m_cache_coins_memory_resource.~CCoinsMapMemoryResource();
+    ::new (&m_cache_coins_memory_resource) CCoinsMapMemoryResource{};
+    ::new (&cacheCoins) CCoinsMap{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &m_cache_coins_memory_resource};
+}
+
+bool CCoinsViewPending::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    if (m_pending) {
+        CCoinsMap::const_iterator it = m_pending->find(outpoint);
+        if (it != m_pending->end()) {
+            if (it->second.coin.IsSpent()) return false;
+            coin = it->second.coin;
+            return true;
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPending::HaveCoin(const COutPoint &outpoint) const
+{
+    if (m_pending) {
+        CCoinsMap::const_iterator it = m_pending->find(outpoint);
+        if (it != m_pending->end()) return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewPending::GetBestBlock() const
+{
+    return m_pending ? m_pending_best_block : base->GetBestBlock();
+}
+
+bool CCoinsViewPending::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    // Writes must not overtake the pending batch.
+    assert(!m_pending);
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+void CCoinsViewPending::SetPending(const CCoinsMap& coins, const uint256& best_block)
+{
+    assert(!m_pending);
+    m_pending = &coins;
+    m_pending_best_block = best_block;
+}
+
+void CCoinsViewPending::ClearPending()
+{
+    m_pending = nullptr;
+    m_pending_best_block.SetNull();
 }
 
 static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxOut(), PROTOCOL_VERSION);
@@ -11,6 +11,7 @@
 #include <memusage.h>
 #include <primitives/transaction.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 #include <util/hasher.h>
 
@@ -36,20 +37,21 @@ public:
     //! whether containing transaction was a coinbase
     unsigned int fCoinBase : 1;
 
-    //! at which height this containing transaction was included in the active block chain
-    uint32_t nHeight : 31;
+    // nowp: whether transaction is a coinstake. Shares a word with the
+    // coinbase flag and height, which keeps cache entries free of padding.
+    unsigned int fCoinStake : 1;
 
-    // nowp: whether transaction is a coinstake
-    bool fCoinStake;
+    //! at which height this containing transaction was included in the active block chain
+    uint32_t nHeight : 30;
 
     // nowp: transaction timestamp
     unsigned int nTime;
 
     //! construct a Coin from a CTxOut and height/coinbase information.
     Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn) :
-        out(std::move(outIn)), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn) {}
+        out(std::move(outIn)), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nTime(nTimeIn) {}
     Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn) :
-        out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn) {}
+        out(outIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nTime(nTimeIn) {}
 
     void Clear() {
         out.SetNull();
@@ -60,7 +62,7 @@ public:
     }
 
     //! empty constructor
-    Coin() : fCoinBase(false), nHeight(0), fCoinStake(false), nTime(0) { }
+    Coin() : fCoinBase(false), fCoinStake(false), nHeight(0), nTime(0) { }
 
     bool IsCoinBase() const {
         return fCoinBase;
@@ -156,7 +158,22 @@ struct CCoinsCacheEntry
     CCoinsCacheEntry(Coin&& coin_, unsigned char flag) : coin(std::move(coin_)), flags(flag) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * PoolAllocator's MAX_BLOCK_SIZE_BYTES parameter here uses sizeof the data, and adds the size
+ * of 4 pointers. We do not know the exact node size used in the std::unordered_node implementation
+ * because it is implementation defined. Most implementations have an overhead of 1 or 2 pointers,
+ * so nodes can be connected in a linked list, and in some cases the hash value is stored as well.
+ * Using an additional sizeof(void*)*4 for MAX_BLOCK_SIZE_BYTES should thus be sufficient so that
+ * all implementations can allocate the nodes from the PoolAllocator.
+ */
+using CCoinsMap = std::unordered_map<COutPoint,
+                                     CCoinsCacheEntry,
+                                     SaltedOutpointHasher,
+                                     std::equal_to<COutPoint>,
+                                     PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                                                   sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>>;
+
+using CCoinsMapMemoryResource = CCoinsMap::allocator_type::ResourceType;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -243,6 +260,7 @@ protected:
      * declared as "const".
      */
     mutable uint256 hashBlock;
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource{};
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -314,6 +332,29 @@ public:
      */
     bool Flush();
 
+    /**
+     * Copy the modifications applied to this cache into coins, without
+     * writing them to the base view, and mark the copied entries as
+     * unmodified. Spent entries are moved rather than copied, as nothing is
+     * left to keep for them. If evict_clean, entries that were already
+     * unmodified are dropped from the cache as well.
+     *
+     * The base view must serve coins ahead of its own state until coins has
+     * been written to it, see CCoinsViewPending.
+     *
+     * @returns the memory usage of the coins copied.
+     */
+    size_t ExtractDirty(CCoinsMap& coins, bool evict_clean);
+
+    /**
+     * Add a coin that was read from the base view ahead of time, unmodified,
+     * unless the cache already has an entry for outpoint. The caller must
+     * make sure that coin is still what the base view has for outpoint.
+     *
+     * @returns whether the coin was added.
+     */
+    bool EmplaceFetchedCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -382,4 +423,31 @@ private:
 
 };
 
+/**
+ * A view that serves coins from a batch which is being written to its base
+ * view concurrently, so that a cache on top of it can keep going (and drop
+ * entries) before the write has completed. The batch itself is never
+ * modified through this view.
+ */
+class CCoinsViewPending final : public CCoinsViewBacked
+{
+public:
+    explicit CCoinsViewPending(CCoinsView* view) : CCoinsViewBacked(view) {}
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+
+    //! Serve coins ahead of the base view until ClearPending() is called.
+    void SetPending(const CCoinsMap& coins, const uint256& best_block);
+    void ClearPending();
+    bool HasPending() const { return m_pending != nullptr; }
+    bool IsPending(const COutPoint& outpoint) const { return m_pending && m_pending->count(outpoint); }
+
+private:
+    const CCoinsMap* m_pending{nullptr};
+    uint256 m_pending_best_block;
+};
+
 #endif // BITCOIN_COINS_H
@@ -4,8 +4,11 @@
 
 #include <dbwrapper.h>
 
+#include <logging.h>
 #include <memory>
 #include <random.h>
+#include <util/thread.h>
+#include <util/time.h>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -97,12 +100,14 @@ static void SetMaxOpenFiles(leveldb::Options *options) {
              options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const DBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = nCacheSize * profile.write_buffer_percent / 100;
+    options.block_cache = leveldb::NewLRUCache(nCacheSize - 2 * options.write_buffer_size); // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = profile.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(profile.bloom_bits) : nullptr;
+    options.block_size = profile.block_size;
+    options.max_file_size = profile.max_file_size;
     options.compression = leveldb::kNoCompression;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
@@ -114,7 +119,7 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const DBProfile& profile)
     : m_name{fs::PathToString(path.stem())}
 {
     penv = nullptr;
@@ -122,7 +127,7 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -168,10 +173,14 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", fs::PathToString(path), HexStr(obfuscate_key));
+
+    m_idle_compaction = profile.idle_compaction && !fMemory;
+    if (m_idle_compaction) g_db_compaction.Register(*this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    if (m_idle_compaction) g_db_compaction.Unregister(*this);
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -212,6 +221,147 @@ size_t CDBWrapper::DynamicMemoryUsage() const
     return parsed.value();
 }
 
+std::vector<int> CDBWrapper::GetFilesPerLevel() const
+{
+    std::vector<int> files;
+    std::string value;
+    while (pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", files.size()), &value)) {
+        files.push_back(ToIntegral<int>(value).value_or(0));
+    }
+    return files;
+}
+
+bool CDBWrapper::CompactNextSlice()
+{
+    std::unique_ptr<leveldb::Iterator> it{pdb->NewIterator(iteroptions)};
+    it->Seek(m_compaction_cursor);
+    if (!it->Valid()) {
+        m_compaction_cursor.clear();
+        return false;
+    }
+    // The slice ends where the prefix after the current one begins. Keys
+    // shorter than the prefix are slices of their own.
+    std::string begin{it->key().data(), std::min<size_t>(it->key().size(), 2)};
+    std::string end{begin};
+    while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) end.pop_back();
+    if (!end.empty()) ++end.back();
+    it.reset();
+
+    const leveldb::Slice begin_slice{begin};
+    const leveldb::Slice end_slice{end};
+    pdb->CompactRange(&begin_slice, end.empty() ? nullptr : &end_slice);
+    m_compaction_cursor = end;
+    return !end.empty();
+}
+
+DBCompactionScheduler g_db_compaction;
+
+void DBCompactionScheduler::Register(CDBWrapper& db)
+{
+    WITH_LOCK(m_dbs_mutex, m_dbs.push_back({&db, std::nullopt, std::nullopt}));
+    LOCK(m_stats_mutex);
+    DBStats& stats{m_stats[&db]};
+    stats.name = db.GetName();
+    stats.files_per_level = db.GetFilesPerLevel();
+}
+
+void DBCompactionScheduler::Unregister(CDBWrapper& db)
+{
+    {
+        LOCK(m_dbs_mutex);
+        m_dbs.erase(std::remove_if(m_dbs.begin(), m_dbs.end(), [&](const Entry& entry) { return entry.db == &db; }), m_dbs.end());
+    }
+    WITH_LOCK(m_stats_mutex, m_stats.erase(&db));
+}
+
+void DBCompactionScheduler::NotifyBusy()
+{
+    m_last_busy = GetTime<std::chrono::seconds>().count();
+}
+
+bool DBCompactionScheduler::IsIdle() const
+{
+    return GetTime<std::chrono::seconds>().count() - m_last_busy >= DB_COMPACTION_IDLE_TIME.count();
+}
+
+int DBCompactionScheduler::RunOnce(std::chrono::milliseconds budget)
+{
+    if (!IsIdle()) {
+        WITH_LOCK(m_stats_mutex, ++m_deferred);
+        return 0;
+    }
+    const auto start{std::chrono::steady_clock::now()};
+    int slices{0};
+    LOCK(m_dbs_mutex);
+    // Databases that need no work are skipped, at most once each.
+    for (size_t skipped = 0; skipped < m_dbs.size() && !m_interrupt;) {
+        if (m_next >= m_dbs.size()) m_next = 0;
+        Entry& entry{m_dbs[m_next]};
+        if (!entry.pass_start) {
+            if (entry.last_pass_start && *entry.last_pass_start > m_last_busy) {
+                ++m_next;
+                ++skipped;
+                continue;
+            }
+            entry.pass_start = GetTime<std::chrono::seconds>().count();
+        }
+
+        const auto slice_start{std::chrono::steady_clock::now()};
+        const bool more{entry.db->CompactNextSlice()};
+        const auto slice_time{std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - slice_start)};
+        ++slices;
+        if (!more) {
+            LogPrint(BCLog::LEVELDB, "Compacted %s while idle\n", entry.db->GetName());
+            entry.last_pass_start = entry.pass_start;
+            entry.pass_start.reset();
+            ++m_next;
+        }
+        {
+            LOCK(m_stats_mutex);
+            DBStats& stats{m_stats[entry.db]};
+            ++stats.slices;
+            if (!more) ++stats.passes;
+            stats.time += slice_time;
+            stats.files_per_level = entry.db->GetFilesPerLevel();
+        }
+        if (std::chrono::steady_clock::now() - start >= budget || !IsIdle()) break;
+    }
+    return slices;
+}
+
+void DBCompactionScheduler::Start()
+{
+    assert(!m_thread.joinable());
+    m_interrupt.reset();
+    m_running = true;
+    m_thread = std::thread(&util::TraceThread, "dbcompact", [this] {
+        while (m_interrupt.sleep_for(DB_COMPACTION_INTERVAL)) {
+            RunOnce(DB_COMPACTION_BUDGET);
+        }
+    });
+}
+
+void DBCompactionScheduler::Stop()
+{
+    if (!m_thread.joinable()) return;
+    m_interrupt();
+    m_thread.join();
+    m_running = false;
+}
+
+DBCompactionScheduler::Stats DBCompactionScheduler::GetStats() const
+{
+    Stats stats;
+    stats.running = m_running;
+    stats.idle = IsIdle();
+    LOCK(m_stats_mutex);
+    stats.deferred = m_deferred;
+    for (const auto& [db, db_stats] : m_stats) {
+        stats.dbs.push_back(db_stats);
+    }
+    return stats;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -10,15 +10,66 @@
 #include <serialize.h>
 #include <span.h>
 #include <streams.h>
+#include <sync.h>
+#include <threadinterrupt.h>
 #include <util/strencodings.h>
 #include <util/system.h>
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+/** Default for -dbcompaction */
+static constexpr bool DEFAULT_DB_COMPACTION{true};
+/** How often the compaction scheduler checks whether there is work to do */
+static constexpr std::chrono::seconds DB_COMPACTION_INTERVAL{10};
+/** How long validation must have been idle before databases are compacted */
+static constexpr std::chrono::seconds DB_COMPACTION_IDLE_TIME{60};
+/** How long one run of the compaction scheduler keeps compacting slices */
+static constexpr std::chrono::milliseconds DB_COMPACTION_BUDGET{500};
+
+/**
+ * LevelDB settings for one kind of database. The bundled LevelDB is built
+ * without Snappy, so blocks are always stored uncompressed.
+ */
+struct DBProfile {
+    //! Bits per key of the bloom filters, 0 for none. They save disk reads
+    //! when looking up keys that do not exist.
+    int bloom_bits{10};
+    //! Approximate size of the blocks in table files. Small blocks suit point
+    //! lookups, large ones iteration.
+    size_t block_size{4 << 10};
+    //! Share of the cache, in percent, of each of the up to two write buffers.
+    //! The rest of the cache holds blocks.
+    int write_buffer_percent{25};
+    //! Size at which LevelDB starts a new table file. Larger files mean fewer,
+    //! but longer, compactions.
+    size_t max_file_size{2 << 20};
+    //! Whether g_db_compaction compacts the database while validation is idle.
+    bool idle_compaction{false};
+};
+
+//! Settings of databases without a profile of their own.
+static constexpr DBProfile DB_PROFILE_DEFAULT{};
+//! The chainstate is mostly point lookups of coins, many of which do not exist.
+static constexpr DBProfile DB_PROFILE_CHAINSTATE{/*bloom_bits=*/10, /*block_size=*/4 << 10, /*write_buffer_percent=*/25, /*max_file_size=*/8 << 20, /*idle_compaction=*/true};
+//! The block index is read in full at startup and rewritten as blocks are validated.
+static constexpr DBProfile DB_PROFILE_BLOCK_INDEX{/*bloom_bits=*/0, /*block_size=*/16 << 10, /*write_buffer_percent=*/25, /*max_file_size=*/8 << 20, /*idle_compaction=*/true};
+//! The txindex is written in bulk and looked up by txid.
+static constexpr DBProfile DB_PROFILE_TXINDEX{/*bloom_bits=*/10, /*block_size=*/4 << 10, /*write_buffer_percent=*/35, /*max_file_size=*/8 << 20, /*idle_compaction=*/true};
+//! The other indexes are written in height order and mostly read the same way.
+static constexpr DBProfile DB_PROFILE_INDEX{/*bloom_bits=*/10, /*block_size=*/16 << 10, /*write_buffer_percent=*/25, /*max_file_size=*/2 << 20, /*idle_compaction=*/false};
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -201,6 +252,12 @@ private:
     //! the name of this database
     std::string m_name;
 
+    //! whether the database is registered with g_db_compaction
+    bool m_idle_compaction{false};
+
+    //! first key of the next slice CompactNextSlice() compacts
+    std::string m_compaction_cursor;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -220,8 +277,10 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] profile     LevelDB settings suited to how the database is used.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false,
+               const DBProfile& profile = DB_PROFILE_DEFAULT);
     ~CDBWrapper();
 
     CDBWrapper(const CDBWrapper&) = delete;
@@ -293,6 +352,11 @@ public:
     // Get an estimate of LevelDB memory usage (in bytes).
     size_t DynamicMemoryUsage() const;
 
+    const std::string& GetName() const { return m_name; }
+
+    //! Number of table files at each level of the database.
+    std::vector<int> GetFilesPerLevel() const;
+
     CDBIterator *NewIterator()
     {
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
@@ -334,6 +398,93 @@ public:
         leveldb::Slice slKey2((const char*)ssKey2.data(), ssKey2.size());
         pdb->CompactRange(&slKey1, &slKey2);
     }
+
+    /**
+     * Compact the keys sharing the next two-byte prefix present in the
+     * database, so that the whole database can be compacted in small steps.
+     *
+     * @returns false once the last slice has been compacted; the next call
+     *          starts over from the first key.
+     */
+    bool CompactNextSlice();
 };
 
+/**
+ * Compacts the databases whose DBProfile asks for it, a slice of keys at a
+ * time and only while validation is idle. LevelDB compacts in the background
+ * as it sees fit, and those compactions compete with block connection for
+ * disk bandwidth; compacting ahead while there is nothing else to do leaves
+ * less of that work for busy times.
+ */
+class DBCompactionScheduler
+{
+public:
+    struct DBStats {
+        std::string name;
+        //! Slices compacted
+        uint64_t slices{0};
+        //! Complete passes over the database
+        uint64_t passes{0};
+        //! Time spent compacting
+        std::chrono::microseconds time{0};
+        //! Table files at each level, as of the last compaction
+        std::vector<int> files_per_level;
+    };
+
+    struct Stats {
+        bool running{false};
+        bool idle{false};
+        //! Runs that found validation busy
+        uint64_t deferred{0};
+        std::vector<DBStats> dbs;
+    };
+
+    void Register(CDBWrapper& db) EXCLUSIVE_LOCKS_REQUIRED(!m_dbs_mutex, !m_stats_mutex);
+    void Unregister(CDBWrapper& db) EXCLUSIVE_LOCKS_REQUIRED(!m_dbs_mutex, !m_stats_mutex);
+
+    /** Note that validation is working, which defers compaction by DB_COMPACTION_IDLE_TIME. */
+    void NotifyBusy();
+    bool IsIdle() const;
+
+    /**
+     * If validation is idle, compact slices of the registered databases
+     * until budget is used up. Databases that have been compacted in full
+     * since validation was last busy are skipped.
+     *
+     * @returns the number of slices compacted.
+     */
+    int RunOnce(std::chrono::milliseconds budget) EXCLUSIVE_LOCKS_REQUIRED(!m_dbs_mutex, !m_stats_mutex);
+
+    /** Run every DB_COMPACTION_INTERVAL on a thread of its own. */
+    void Start();
+    void Stop();
+
+    Stats GetStats() const EXCLUSIVE_LOCKS_REQUIRED(!m_stats_mutex);
+
+private:
+    struct Entry {
+        CDBWrapper* db;
+        //! When the pass in progress started, if any
+        std::optional<int64_t> pass_start;
+        //! When the last complete pass started
+        std::optional<int64_t> last_pass_start;
+    };
+
+    //! Held while compacting, so that a database is not closed underneath.
+    Mutex m_dbs_mutex;
+    std::vector<Entry> m_dbs GUARDED_BY(m_dbs_mutex);
+    size_t m_next GUARDED_BY(m_dbs_mutex){0};
+
+    mutable Mutex m_stats_mutex;
+    std::map<const CDBWrapper*, DBStats> m_stats GUARDED_BY(m_stats_mutex);
+    uint64_t m_deferred GUARDED_BY(m_stats_mutex){0};
+
+    std::atomic<int64_t> m_last_busy{0};
+    std::atomic<bool> m_running{false};
+    CThreadInterrupt m_interrupt;
+    std::thread m_thread;
+};
+
+extern DBCompactionScheduler g_db_compaction;
+
 #endif // BITCOIN_DBWRAPPER_H
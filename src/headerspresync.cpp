@@ -0,0 +1,40 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <headerspresync.h>
+
+#include <pow.h>
+
+#include <utility>
+
+HeadersPresyncState::AppendResult HeadersPresyncState::Append(const std::vector<CBlockHeader>& headers,
+                                                              const Consensus::Params& params, size_t max_headers)
+{
+    if (headers.empty()) return AppendResult::OK;
+    if (m_headers.size() + headers.size() > max_headers) return AppendResult::TOO_MANY;
+
+    const size_t old_size{m_index.size()};
+    for (const CBlockHeader& header : headers) {
+        const CBlockIndex& prev{Tip()};
+        if (header.nBits != GetNextTargetRequired(&prev, header.nFlags & CBlockIndex::BLOCK_PROOF_OF_STAKE, params)) {
+            m_index.resize(old_size);
+            return AppendResult::BAD_DIFFBITS;
+        }
+        CBlockIndex& index{m_index.emplace_back(header)};
+        // Staged entries are only ever read through pprev.
+        index.pprev = const_cast<CBlockIndex*>(&prev);
+        index.nHeight = prev.nHeight + 1;
+        index.nChainTrust = prev.nChainTrust + GetBlockTrust(index);
+    }
+
+    m_headers.insert(m_headers.end(), headers.begin(), headers.end());
+    m_tip_hash = m_headers.back().GetHash();
+    return AppendResult::OK;
+}
+
+std::vector<CBlockHeader> HeadersPresyncState::TakeHeaders()
+{
+    m_index.clear();
+    return std::exchange(m_headers, {});
+}
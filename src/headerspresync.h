@@ -0,0 +1,86 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HEADERSPRESYNC_H
+#define BITCOIN_HEADERSPRESYNC_H
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <deque>
+#include <vector>
+
+namespace Consensus {
+struct Params;
+} // namespace Consensus
+
+/** Maximum number of headers a single peer may have staged before the chain
+ *  is abandoned (roughly 1.7MB per peer). This also bounds how many headers a
+ *  peer gets hashed for staging until one of its chains reaches the index. */
+static constexpr size_t MAX_PRESYNC_HEADERS{20000};
+
+/**
+ * Headers received from one peer that connect to the block index, but do not
+ * (yet) carry enough chain trust to be worth indexing.
+ *
+ * Every header that reaches AcceptBlockHeader() takes cs_main and becomes a
+ * permanent CBlockIndex entry, so a peer feeding us a long low-trust fork used
+ * to cost memory and cs_main time we never get back. Instead such headers are
+ * parked here, outside the block index, until the accumulated trust of the
+ * chain they build reaches our threshold; only then are they handed to
+ * ProcessNewBlockHeaders() in one go. A chain that outgrows
+ * MAX_PRESYNC_HEADERS without getting there is dropped.
+ *
+ * The trust of a proof-of-stake header comes from its nBits alone, so every
+ * staged header's nBits is checked against GetNextTargetRequired() on top of
+ * the staged chain, as ContextualCheckBlockHeader() will once it is indexed,
+ * before it counts. Proof-of-work is verified before headers are staged, so
+ * committing a staged chain only costs PoW cache lookups under cs_main.
+ */
+class HeadersPresyncState
+{
+public:
+    enum class AppendResult {
+        OK,
+        TOO_MANY,     //!< would exceed max_headers
+        BAD_DIFFBITS, //!< a header's nBits does not follow from the chain before it
+    };
+
+    /** Start staging on top of an indexed block, which must outlive the state. */
+    explicit HeadersPresyncState(const CBlockIndex& fork) : m_fork{fork} {}
+
+    HeadersPresyncState(const HeadersPresyncState&) = delete;
+    HeadersPresyncState& operator=(const HeadersPresyncState&) = delete;
+
+    /** Whether a batch starting with this header continues the staged chain. */
+    bool Extends(const CBlockHeader& header) const { return header.hashPrevBlock == GetTipHash(); }
+
+    /** Append a continuous batch of headers that Extends() the staged chain.
+     *  Leaves the state untouched unless the result is OK. */
+    AppendResult Append(const std::vector<CBlockHeader>& headers, const Consensus::Params& params,
+                        size_t max_headers = MAX_PRESYNC_HEADERS);
+
+    /** Chain trust at the staged tip, including the fork point. */
+    const arith_uint256& GetChainTrust() const { return Tip().nChainTrust; }
+
+    const uint256& GetTipHash() const { return m_index.empty() ? *m_fork.phashBlock : m_tip_hash; }
+    size_t Size() const { return m_headers.size(); }
+
+    /** Hand out the staged headers, oldest first, leaving the state empty. */
+    std::vector<CBlockHeader> TakeHeaders();
+
+private:
+    const CBlockIndex& Tip() const { return m_index.empty() ? m_fork : m_index.back(); }
+
+    const CBlockIndex& m_fork;
+    std::vector<CBlockHeader> m_headers;
+    //! An unindexed entry per staged header, linked back to m_fork, for the
+    //! difficulty rules to walk. A deque, so pprev pointers stay valid.
+    std::deque<CBlockIndex> m_index;
+    uint256 m_tip_hash;
+};
+
+#endif // BITCOIN_HEADERSPRESYNC_H
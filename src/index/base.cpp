@@ -31,8 +31,8 @@ static void FatalError(const char* fmt, const Args&... args)
     StartShutdown();
 }
 
-BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate) :
-    CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate)
+BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate, const DBProfile& profile) :
+    CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate, profile)
 {}
 
 bool BaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
@@ -15,6 +15,7 @@
 #include <clientversion.h>
 #include <compat.h>
 #include <consensus/consensus.h>
+#include <crypto/common.h>
 #include <crypto/sha256.h>
 #include <fs.h>
 #include <i2p.h>
@@ -661,6 +662,10 @@ void CNode::CopyStats(CNodeStats& stats)
         X(mapRecvBytesPerMsgCmd);
         X(nRecvBytes);
     }
+    {
+        LOCK(m_msg_latency_mutex);
+        X(m_msg_latency);
+    }
     X(m_permissionFlags);
     if (m_tx_relay != nullptr) {
         stats.minFeeFilter = m_tx_relay->minFeeFilter;
@@ -697,7 +702,9 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
         if (m_deserializer->Complete()) {
             // decompose a transport agnostic CNetMessage from the deserializer
             bool reject_message{false};
+            const int64_t deserialize_start{GetTimeMicros()};
             CNetMessage msg = m_deserializer->GetMessage(time, reject_message);
+            msg.m_deserialize_time = std::chrono::microseconds{GetTimeMicros() - deserialize_start};
             if (reject_message) {
                 // Message deserialization failed.  Drop the message but don't disconnect the peer.
                 // store the size of the corrupt message
@@ -713,6 +720,7 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
             }
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += msg.m_raw_message_size;
+            msg.m_known_type = i->first == msg.m_type;
 
             // push the message to the process queue,
             vRecvMsg.push_back(std::move(msg));
@@ -1656,6 +1664,7 @@ void CConnman::SocketHandlerConnected(const std::vector<CNode*>& nodes,
                         // vRecvMsg contains only completed CNetMessage
                         // the single possible partially deserialized message are held by TransportDeserializer
                         nSizeAdded += it->m_raw_message_size;
+                        m_msgproc->PreprocessMessage(*pnode, *it);
                     }
                     {
                         LOCK(pnode->cs_vProcessMsg);
@@ -3003,6 +3012,44 @@ uint64_t CConnman::GetOutboundTargetBytesLeft() const
     return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
 }
 
+void LatencyHistogram::Add(std::chrono::microseconds duration)
+{
+    const uint64_t micros = std::max<int64_t>(count_microseconds(duration), 0);
+    ++m_buckets[std::min<size_t>(CountBits(micros), NUM_BUCKETS - 1)];
+    ++m_count;
+    m_total += std::chrono::microseconds{micros};
+}
+
+LatencyHistogram& LatencyHistogram::operator+=(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        m_buckets[i] += other.m_buckets[i];
+    }
+    m_count += other.m_count;
+    m_total += other.m_total;
+    return *this;
+}
+
+void CConnman::RecordMsgLatency(CNode& node, const CNetMessage& msg, std::chrono::microseconds queue_time,
+                                std::chrono::microseconds process_time)
+{
+    // Like the byte counters, only known message types get their own entry.
+    const std::string& msg_type = msg.m_known_type ? msg.m_type : NET_MESSAGE_COMMAND_OTHER;
+    const auto record = [&](MsgLatencyStats& stats) {
+        stats.m_queue.Add(queue_time);
+        stats.m_deserialize.Add(msg.m_deserialize_time);
+        stats.m_process.Add(process_time);
+    };
+    WITH_LOCK(node.m_msg_latency_mutex, record(node.m_msg_latency[msg_type]));
+    WITH_LOCK(m_msg_latency_mutex, record(m_msg_latency[msg_type]));
+}
+
+mapMsgCmdLatency CConnman::GetMsgLatencyStats() const
+{
+    LOCK(m_msg_latency_mutex);
+    return m_msg_latency;
+}
+
 uint64_t CConnman::GetTotalBytesRecv() const
 {
     return nTotalBytesRecv;
@@ -27,7 +27,9 @@
 #include <util/check.h>
 #include <util/sock.h>
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
@@ -43,6 +45,7 @@ class AddrMan;
 class BanMan;
 class CNode;
 class CScheduler;
+struct PreparsedMessage;
 struct bilingual_str;
 
 /** Default for -whitelistrelay. */
@@ -252,6 +255,26 @@ extern std::set<std::pair<COutPoint, unsigned int>> setStakeSeen;
 extern const std::string NET_MESSAGE_COMMAND_OTHER;
 typedef std::map<std::string, uint64_t> mapMsgCmdSize; //command, total bytes
 
+/** Fixed-bucket histogram of durations. Bucket 0 counts durations below 1us,
+ *  bucket i the range [2^(i-1), 2^i) us, and the last one everything longer. */
+struct LatencyHistogram {
+    static constexpr size_t NUM_BUCKETS{26};
+    std::array<uint64_t, NUM_BUCKETS> m_buckets{};
+    uint64_t m_count{0};
+    std::chrono::microseconds m_total{0};
+
+    void Add(std::chrono::microseconds duration);
+    LatencyHistogram& operator+=(const LatencyHistogram& other);
+};
+
+/** Where time goes for messages of one type */
+struct MsgLatencyStats {
+    LatencyHistogram m_queue;       //!< from receipt until the message handler takes it
+    LatencyHistogram m_deserialize; //!< transport decoding and ahead-of-time payload parsing
+    LatencyHistogram m_process;     //!< ProcessMessage()
+};
+typedef std::map<std::string, MsgLatencyStats> mapMsgCmdLatency; //command, timings
+
 class CNodeStats
 {
 public:
@@ -275,6 +298,7 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdLatency m_msg_latency;
     NetPermissionFlags m_permissionFlags;
     std::chrono::microseconds m_last_ping_time;
     std::chrono::microseconds m_min_ping_time;
@@ -303,6 +327,10 @@ public:
     uint32_t m_message_size{0};          //!< size of the payload
     uint32_t m_raw_message_size{0};      //!< used wire size of the message (including header/checksum)
     std::string m_type;
+    bool m_known_type{false};            //!< whether m_type is one we account statistics under
+    std::chrono::microseconds m_deserialize_time{0}; //!< time spent decoding the message so far
+    //! payload decoded ahead of the message handler, see NetEventsInterface::PreprocessMessage()
+    std::shared_ptr<PreparsedMessage> m_preparsed;
 
     CNetMessage(CDataStream&& recv_in) : m_recv(std::move(recv_in)) {}
 
@@ -725,6 +753,9 @@ private:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd GUARDED_BY(cs_vSend);
     mapMsgCmdSize mapRecvBytesPerMsgCmd GUARDED_BY(cs_vRecv);
+
+    mutable Mutex m_msg_latency_mutex;
+    mapMsgCmdLatency m_msg_latency GUARDED_BY(m_msg_latency_mutex);
 };
 
 /**
@@ -739,6 +770,16 @@ public:
     /** Handle removal of a peer (clear state) */
     virtual void FinalizeNode(const CNode& node) = 0;
 
+    /**
+    * Called from the socket handler thread for each complete message, before it
+    * is queued for ProcessMessages(), so that decoding can start early.
+    * Implementations may take ownership of msg.m_recv through msg.m_preparsed.
+    *
+    * @param[in]   node            The node which we have received the message from.
+    * @param[in]   msg             The received message.
+    */
+    virtual void PreprocessMessage(CNode& node, CNetMessage& msg) {}
+
     /**
     * Process protocol messages received from a given node
     *
@@ -956,6 +997,13 @@ public:
     uint64_t GetTotalBytesRecv() const;
     uint64_t GetTotalBytesSent() const;
 
+    /** Account the time a message spent queued, being decoded and being processed,
+     *  for the peer it came from as well as in the node-wide totals. */
+    void RecordMsgLatency(CNode& node, const CNetMessage& msg, std::chrono::microseconds queue_time,
+                          std::chrono::microseconds process_time) LOCKS_EXCLUDED(m_msg_latency_mutex);
+    /** Message timings of all peers since startup, including disconnected ones */
+    mapMsgCmdLatency GetMsgLatencyStats() const LOCKS_EXCLUDED(m_msg_latency_mutex);
+
     /** Get a unique deterministic randomizer. */
     CSipHasher GetDeterministicRandomizer(uint64_t id) const;
 
@@ -1111,6 +1159,8 @@ private:
     mutable RecursiveMutex cs_totalBytesSent;
     std::atomic<uint64_t> nTotalBytesRecv{0};
     uint64_t nTotalBytesSent GUARDED_BY(cs_totalBytesSent) {0};
+    mutable Mutex m_msg_latency_mutex;
+    mapMsgCmdLatency m_msg_latency GUARDED_BY(m_msg_latency_mutex);
 
     // outbound limit & stats
     uint64_t nMaxOutboundTotalBytesSentInCycle GUARDED_BY(cs_totalBytesSent) {0};
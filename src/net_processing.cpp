@@ -14,12 +14,14 @@
 #include <consensus/amount.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <headerspresync.h>
 #include <index/blockfilterindex.h>
 #include <merkleblock.h>
 #include <netbase.h>
 #include <netmessagemaker.h>
 #include <node/blockstorage.h>
 #include <policy/policy.h>
+#include <pow.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <random.h>
@@ -32,17 +34,21 @@
 #include <txorphanage.h>
 #include <txrequest.h>
 #include <util/check.h> // For NDEBUG compile time check
+#include <util/hasher.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/threadpool.h>
 #include <util/trace.h>
 #include <validation.h>
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <future>
 #include <memory>
 #include <optional>
 #include <typeinfo>
+#include <unordered_map>
 
 #include <kernel.h>
 
@@ -103,6 +109,10 @@ static constexpr auto OVERLOADED_PEER_TX_DELAY{2s};
 static constexpr auto GETDATA_TX_INTERVAL{60s};
 /** Limit to avoid sending big packets. Not used in processing incoming GETDATA for compatibility */
 static const unsigned int MAX_GETDATA_SZ = 1000;
+/** Maximum number of orphans resolved for a peer per message handler loop. */
+static constexpr size_t MAX_ORPHAN_BATCH_TXS{25};
+/** Maximum total weight of orphans resolved for a peer per message handler loop. */
+static constexpr int64_t MAX_ORPHAN_BATCH_WEIGHT{2 * MAX_STANDARD_TX_WEIGHT};
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Time during which a peer must stall block download progress before being disconnected. */
@@ -146,6 +156,9 @@ static constexpr auto OUTBOUND_INVENTORY_BROADCAST_INTERVAL{2s};
 static constexpr unsigned int INVENTORY_BROADCAST_PER_SECOND = 7;
 /** Maximum number of inventory items to send per transmission. */
 static constexpr unsigned int INVENTORY_BROADCAST_MAX = INVENTORY_BROADCAST_PER_SECOND * count_seconds(INBOUND_INVENTORY_BROADCAST_INTERVAL);
+/** How often the shared transaction announcement order is rebuilt. Peers
+ *  trickle at least this far apart on average, so each batch is used many times. */
+static constexpr auto TX_INV_BATCH_INTERVAL{1s};
 /** The number of most recently announced transactions a peer can request. */
 static constexpr unsigned int INVENTORY_MAX_RECENT_RELAY = 3500;
 /** Verify that INVENTORY_MAX_RECENT_RELAY is enough to cache everything typically
@@ -314,6 +327,7 @@ public:
     /** Implement NetEventsInterface */
     void InitializeNode(CNode* pnode) override;
     void FinalizeNode(const CNode& node) override;
+    void PreprocessMessage(CNode& node, CNetMessage& msg) override;
     bool ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt) override;
     bool SendMessages(CNode* pto) override EXCLUSIVE_LOCKS_REQUIRED(pto->cs_sendProcessing);
 
@@ -331,6 +345,11 @@ public:
                         const std::chrono::microseconds time_received, const std::atomic<bool>& interruptMsgProc) override;
 
 private:
+    /** ProcessMessage() with the payload possibly already decoded by PreprocessMessage(). */
+    void ProcessMessage(CNode& pfrom, const std::string& msg_type, CDataStream& vRecv,
+                        const std::chrono::microseconds time_received, const std::atomic<bool>& interruptMsgProc,
+                        const PreparsedMessage* preparsed);
+
     void _RelayTransaction(const uint256& txid, const uint256& wtxid)
         EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -379,11 +398,44 @@ private:
      */
     bool MaybeDiscourageAndDisconnect(CNode& pnode, Peer& peer);
 
+    /**
+     * Resolve orphans from a peer's work set against the mempool, parents
+     * before children, taking at most MAX_ORPHAN_BATCH_TXS/MAX_ORPHAN_BATCH_WEIGHT
+     * per call so that one peer's orphan storm cannot monopolize the handler.
+     * Whatever is left stays in the work set for the peer's next turn.
+     */
     void ProcessOrphanTx(std::set<uint256>& orphan_work_set) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans);
+    /** Submit one orphan to the mempool and act on the result. */
+    void ResolveOrphanTx(const CTransactionRef& porphanTx, NodeId from_peer, std::set<uint256>& orphan_work_set) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans);
     /** Process a single headers message from a peer. */
     void ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
                                const std::vector<CBlockHeader>& headers,
                                bool via_compact_block);
+    /** Verify the proof-of-work of headers[first..] on m_msgparse_pool. Must
+     *  not be called with cs_main held; this is the expensive part of header
+     *  acceptance, and it leaves the results in the PoW cache. */
+    bool CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, size_t first) LOCKS_EXCLUDED(::cs_main);
+    /** What ProcessHeadersMessage() does with a batch, see PlanHeadersStaging(). */
+    enum class HeadersStaging {
+        ACCEPT,  //!< into the block index, after any staged headers leading up to it
+        STAGE,   //!< into the peer's HeadersPresyncState once its PoW checks out
+        DROP,    //!< nothing, and without hashing it
+        INVALID, //!< punish the peer for a header with the wrong nBits
+    };
+    /**
+     * Decide, before any of headers[first..] is hashed, whether they go into
+     * the block index or are staged because the chain they build has less
+     * trust than our tip (or nMinimumChainWork). Only headers whose nBits have
+     * been checked add trust.
+     * For STAGE, staging is the state to install once the PoW checks out. For
+     * ACCEPT, any previously staged headers leading up to the batch are moved
+     * into presynced, followed by the batch. Until one of its chains reaches
+     * the block index, a peer gets at most MAX_PRESYNC_HEADERS headers hashed
+     * for staging, and DROP is returned beyond that.
+     */
+    HeadersStaging PlanHeadersStaging(CNode& pfrom, const std::vector<CBlockHeader>& headers, size_t first,
+                                      std::unique_ptr<HeadersPresyncState>& staging,
+                                      std::vector<CBlockHeader>& presynced, BlockValidationState& state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     void SendBlockTransactions(CNode& pfrom, const CBlock& block, const BlockTransactionsRequest& req);
 
@@ -435,6 +487,9 @@ private:
     /** Whether this node is running in blocks only mode */
     const bool m_ignore_incoming_txs;
 
+    /** Workers decoding tx/headers/block/cmpctblock payloads ahead of the message handler */
+    ThreadPool m_msgparse_pool{"msgparse"};
+
     /** Whether we've completed initial sync yet, for determining when to turn
       * on extra block-relay-only peers. */
     bool m_initial_sync_finished{false};
@@ -576,6 +631,25 @@ private:
     /** Expiration-time ordered list of (expire time, relay map entry) pairs. */
     std::deque<std::pair<std::chrono::microseconds, MapRelay::iterator>> g_relay_expiration GUARDED_BY(cs_main);
 
+    /**
+     * Transaction announcements are put in mempool order once per
+     * TX_INV_BATCH_INTERVAL for all peers, instead of by every peer on every
+     * trickle with a mempool lookup per comparison. Relayed hashes (and any a
+     * peer finds missing from the current batch) collect in m_tx_inv_pending
+     * until GetTxInvBatch() resolves them under a single mempool lock.
+     */
+    struct TxInvBatch {
+        std::chrono::microseconds m_next_build{0};
+        /** Transactions in CompareMiningOrder() order */
+        std::vector<TxMempoolInfo> m_txs;
+        /** Position in m_txs by txid and wtxid, -1 if it had left the mempool */
+        std::unordered_map<uint256, int, SaltedTxidHasher> m_rank;
+    };
+    TxInvBatch m_tx_inv_batch GUARDED_BY(cs_main);
+    /** Hashes waiting for the next batch, mapped to whether they are wtxids */
+    std::unordered_map<uint256, bool, SaltedTxidHasher> m_tx_inv_pending GUARDED_BY(cs_main);
+    const TxInvBatch& GetTxInvBatch(std::chrono::microseconds now) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     /**
      * When a peer sends us a valid block, instruct it to announce blocks to us
      * using CMPCTBLOCK if possible by adding its nodeid to the end of
@@ -708,6 +782,10 @@ struct CNodeState {
     const CBlockIndex* pindexBestHeaderSent{nullptr};
     //! Length of current-streak of unconnecting headers announcements
     int nUnconnectingHeaders{0};
+    //! Headers from this peer that connect, but do not yet carry enough trust to be indexed.
+    std::unique_ptr<HeadersPresyncState> m_headers_presync;
+    //! Headers hashed for m_headers_presync since one of this peer's chains was last indexed.
+    size_t m_presync_headers_hashed{0};
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted{false};
     //! When to potentially disconnect peer for stalling headers download
@@ -1227,7 +1305,7 @@ void PeerManagerImpl::ReattemptInitialBroadcast(CScheduler& scheduler)
     // Schedule next run for 10-15 minutes in the future.
     // We add randomness on every cycle to avoid the possibility of P2P fingerprinting.
     const std::chrono::milliseconds delta = 10min + GetRandMillis(5min);
-    scheduler.scheduleFromNow([&] { ReattemptInitialBroadcast(scheduler); }, delta);
+    scheduler.scheduleFromNow([&] { ReattemptInitialBroadcast(scheduler); }, delta, "net");
 }
 
 void PeerManagerImpl::FinalizeNode(const CNode& node)
@@ -1519,6 +1597,8 @@ PeerManagerImpl::PeerManagerImpl(const CChainParams& chainparams, CConnman& conn
       m_mempool(pool),
       m_ignore_incoming_txs(ignore_incoming_txs)
 {
+    const int64_t parse_threads{std::clamp<int64_t>(gArgs.GetIntArg("-msgparsethreads", DEFAULT_MSGPARSE_THREADS), 0, MAX_MSGPARSE_THREADS)};
+    m_msgparse_pool.Start(parse_threads);
 }
 
 void PeerManagerImpl::StartScheduledTasks(CScheduler& scheduler)
@@ -1528,11 +1608,14 @@ void PeerManagerImpl::StartScheduledTasks(CScheduler& scheduler)
     // combine them in one function and schedule at the quicker (peer-eviction)
     // timer.
     static_assert(EXTRA_PEER_CHECK_INTERVAL < STALE_CHECK_INTERVAL, "peer eviction timer should be less than stale tip check timer");
-    scheduler.scheduleEvery([this] { this->CheckForStaleTipAndEvictPeers(); }, std::chrono::seconds{EXTRA_PEER_CHECK_INTERVAL});
+    // Both run on their own queue, so that slow wallet or validation interface
+    // tasks cannot hold them up, with eviction going first when both are due.
+    scheduler.scheduleEvery([this] { this->CheckForStaleTipAndEvictPeers(); }, std::chrono::seconds{EXTRA_PEER_CHECK_INTERVAL},
+                            "net", CScheduler::Priority::HIGH);
 
     // schedule next run for 10-15 minutes in the future
     const std::chrono::milliseconds delta = 10min + GetRandMillis(5min);
-    scheduler.scheduleFromNow([&] { ReattemptInitialBroadcast(scheduler); }, delta);
+    scheduler.scheduleFromNow([&] { ReattemptInitialBroadcast(scheduler); }, delta, "net");
 }
 
 /**
@@ -1753,6 +1836,7 @@ void PeerManagerImpl::RelayTransaction(const uint256& txid, const uint256& wtxid
 
 void PeerManagerImpl::_RelayTransaction(const uint256& txid, const uint256& wtxid)
 {
+    m_tx_inv_pending.emplace(txid, false);
     m_connman.ForEachNode([&txid, &wtxid](CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(::cs_main) {
         AssertLockHeld(::cs_main);
 
@@ -2111,6 +2195,92 @@ void PeerManagerImpl::SendBlockTransactions(CNode& pfrom, const CBlock& block, c
     m_connman.PushMessage(&pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+bool PeerManagerImpl::CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, size_t first)
+{
+    if (first >= headers.size()) return true;
+    const Consensus::Params& consensus = m_chainparams.GetConsensus();
+    const size_t workers{std::max<size_t>(1, m_msgparse_pool.WorkerCount())};
+    const size_t chunk_size{(headers.size() - first + workers - 1) / workers};
+
+    std::vector<std::future<bool>> results;
+    for (size_t begin = first; begin < headers.size(); begin += chunk_size) {
+        const size_t end{std::min(headers.size(), begin + chunk_size)};
+        results.push_back(m_msgparse_pool.Submit([&headers, &consensus, begin, end] {
+            for (size_t i = begin; i < end; ++i) {
+                if (headers[i].nFlags & CBlockIndex::BLOCK_PROOF_OF_STAKE) continue;
+                if (!CheckPOW(headers[i], consensus)) return false;
+            }
+            return true;
+        }));
+    }
+    // Wait for every task, they all reference headers.
+    bool valid{true};
+    for (std::future<bool>& result : results) {
+        valid &= result.get();
+    }
+    return valid;
+}
+
+PeerManagerImpl::HeadersStaging PeerManagerImpl::PlanHeadersStaging(CNode& pfrom, const std::vector<CBlockHeader>& headers, size_t first,
+                                                                    std::unique_ptr<HeadersPresyncState>& staging,
+                                                                    std::vector<CBlockHeader>& presynced, BlockValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    // Already known, nothing to stage.
+    if (first == headers.size()) return HeadersStaging::ACCEPT;
+
+    CNodeState* nodestate = State(pfrom.GetId());
+    std::unique_ptr<HeadersPresyncState>& presync = nodestate->m_headers_presync;
+    const CBlockIndex* pindex_prev{m_chainman.m_blockman.LookupBlockIndex(headers[first].hashPrevBlock)};
+    if (pindex_prev) {
+        // Connects to the block index directly; any staged chain is superseded.
+        presync.reset();
+        staging = std::make_unique<HeadersPresyncState>(*pindex_prev);
+    } else if (presync && presync->Extends(headers[first])) {
+        staging = std::move(presync);
+    } else {
+        // Unconnecting; let ProcessNewBlockHeaders() deal with it as before.
+        return HeadersStaging::ACCEPT;
+    }
+
+    const std::vector<CBlockHeader> fresh(headers.begin() + first, headers.end());
+    const size_t staged_before{staging->Size()};
+    switch (staging->Append(fresh, m_chainparams.GetConsensus())) {
+    case HeadersPresyncState::AppendResult::OK:
+        break;
+    case HeadersPresyncState::AppendResult::TOO_MANY:
+        LogPrint(BCLog::NET, "peer=%d: dropping %u presynced headers, chain trust %s still too low\n",
+                 pfrom.GetId(), staging->Size(), staging->GetChainTrust().ToString());
+        staging.reset();
+        return HeadersStaging::DROP;
+    case HeadersPresyncState::AppendResult::BAD_DIFFBITS:
+        staging.reset();
+        state.Invalid(BlockValidationResult::BLOCK_INVALID_HEADER, "bad-diffbits", "incorrect proof of work/stake");
+        return HeadersStaging::INVALID;
+    }
+
+    const arith_uint256 threshold{std::max(nMinimumChainWork, m_chainman.ActiveChain().Tip()->nChainTrust)};
+    if (staging->GetChainTrust() >= threshold) {
+        if (staged_before > 0) {
+            LogPrint(BCLog::NET, "peer=%d: %u presynced headers reached chain trust %s, accepting\n",
+                     pfrom.GetId(), staging->Size(), staging->GetChainTrust().ToString());
+            presynced = staging->TakeHeaders();
+        }
+        staging.reset();
+        return HeadersStaging::ACCEPT;
+    }
+
+    // Staging means hashing headers that have not proven any trust yet, so
+    // that is bounded per peer until one of its chains gets indexed.
+    if (nodestate->m_presync_headers_hashed + fresh.size() > MAX_PRESYNC_HEADERS) {
+        LogPrint(BCLog::NET, "peer=%d: ignoring %u low-trust headers, %u already hashed for staging\n",
+                 pfrom.GetId(), fresh.size(), nodestate->m_presync_headers_hashed);
+        staging.reset();
+        return HeadersStaging::DROP;
+    }
+    return HeadersStaging::STAGE;
+}
+
 void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
                                             const std::vector<CBlockHeader>& headers,
                                             bool via_compact_block)
@@ -2124,7 +2294,12 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
     }
 
     bool received_new_header = false;
+    size_t first_new_header{0};
     const CBlockIndex *pindexLast = nullptr;
+    HeadersStaging staging_plan;
+    std::unique_ptr<HeadersPresyncState> staging;
+    std::vector<CBlockHeader> presynced;
+    BlockValidationState staging_state;
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom.GetId());
@@ -2137,7 +2312,8 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
         //   don't connect before giving DoS points
         // - Once a headers message is received that is valid and does connect,
         //   nUnconnectingHeaders gets reset back to 0.
-        if (!m_chainman.m_blockman.LookupBlockIndex(headers[0].hashPrevBlock) && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
+        const bool extends_presync{nodestate->m_headers_presync && nodestate->m_headers_presync->Extends(headers[0])};
+        if (!extends_presync && !m_chainman.m_blockman.LookupBlockIndex(headers[0].hashPrevBlock) && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
             nodestate->nUnconnectingHeaders++;
             m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETHEADERS, m_chainman.ActiveChain().GetLocator(pindexBestHeader), uint256()));
             LogPrint(BCLog::NET, "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
@@ -2170,17 +2346,75 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
         if (!m_chainman.m_blockman.LookupBlockIndex(hashLastBlock)) {
             received_new_header = true;
         }
+
+        // Headers we already have form a prefix of the batch (their ancestors
+        // are indexed too); AcceptBlockHeader() won't check their PoW again.
+        while (first_new_header < nCount && m_chainman.m_blockman.LookupBlockIndex(headers[first_new_header].GetHash())) {
+            ++first_new_header;
+        }
+
+        staging_plan = PlanHeadersStaging(pfrom, headers, first_new_header, staging, presynced, staging_state);
+    }
+    if (staging_plan == HeadersStaging::INVALID) {
+        MaybePunishNodeForBlock(pfrom.GetId(), staging_state, via_compact_block, "invalid header received");
+        return;
+    }
+    if (staging_plan == HeadersStaging::DROP) return;
+
+    // Hash the whole batch in parallel before going back to cs_main, so that
+    // AcceptBlockHeader() only has to look the results up in the PoW cache.
+    if (!CheckHeadersProofOfWork(headers, first_new_header)) {
+        BlockValidationState state;
+        state.Invalid(BlockValidationResult::BLOCK_INVALID_HEADER, "high-hash", "proof of work failed");
+        MaybePunishNodeForBlock(pfrom.GetId(), state, via_compact_block, "invalid header received");
+        return;
+    }
+
+    if (staging_plan == HeadersStaging::STAGE) {
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom.GetId());
+        nodestate->m_presync_headers_hashed += nCount - first_new_header;
+        nodestate->m_headers_presync = std::move(staging);
+        if (nCount == MAX_HEADERS_RESULTS) {
+            // Ask for more, continuing from the staged tip rather than the block index.
+            CBlockLocator locator{m_chainman.ActiveChain().GetLocator()};
+            locator.vHave.insert(locator.vHave.begin(), nodestate->m_headers_presync->GetTipHash());
+            LogPrint(BCLog::NET, "more getheaders (presync, %u staged) to end to peer=%d\n", nodestate->m_headers_presync->Size(), pfrom.GetId());
+            m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETHEADERS, locator, uint256()));
+        }
+        return;
     }
 
     int32_t& nPoSTemperature = mapPoSTemperature[pfrom.addr];
-    BlockValidationState state;
-    if (!m_chainman.ProcessNewBlockHeaders(nPoSTemperature, pfrom.lastAcceptedHeader, headers, state, m_chainparams, &pindexLast)) {
-        if (state.IsInvalid()) {
-            MaybePunishNodeForBlock(pfrom.GetId(), state, via_compact_block, "invalid header received");
-            return;
+    const auto accept_headers = [&](const std::vector<CBlockHeader>& batch) {
+        BlockValidationState state;
+        if (!m_chainman.ProcessNewBlockHeaders(nPoSTemperature, pfrom.lastAcceptedHeader, batch, state, m_chainparams, &pindexLast)) {
+            if (state.IsInvalid()) {
+                MaybePunishNodeForBlock(pfrom.GetId(), state, via_compact_block, "invalid header received");
+                return false;
+            }
+        }
+        pfrom.lastAcceptedHeader = batch.back().GetHash();
+        return true;
+    };
+    if (presynced.empty()) {
+        if (!accept_headers(headers)) return;
+    } else {
+        // A staged chain just became worth indexing. Feed it through in
+        // message-sized pieces so PoS temperature is tracked as if it had
+        // been accepted as it arrived.
+        for (size_t begin = 0; begin < presynced.size(); begin += MAX_HEADERS_RESULTS) {
+            const size_t end{std::min<size_t>(presynced.size(), begin + MAX_HEADERS_RESULTS)};
+            if (!accept_headers({presynced.begin() + begin, presynced.begin() + end})) return;
+        }
+        if (nPoSTemperature >= MAX_CONSECUTIVE_POS_HEADERS) {
+            nPoSTemperature = (MAX_CONSECUTIVE_POS_HEADERS*3)/4;
+            if (Params().NetworkIDString() != "test") {
+                Misbehaving(pfrom.GetId(), 100, "too many consecutive pos headers");
+                return;
+            }
         }
     }
-    pfrom.lastAcceptedHeader = headers.back().GetHash();
 
     {
         LOCK(cs_main);
@@ -2189,6 +2423,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
             LogPrint(BCLog::NET, "peer=%d: resetting nUnconnectingHeaders (%d -> 0)\n", pfrom.GetId(), nodestate->nUnconnectingHeaders);
         }
         nodestate->nUnconnectingHeaders = 0;
+        if (received_new_header) nodestate->m_presync_headers_hashed = 0;
 
         assert(pindexLast);
         UpdateBlockAvailability(pfrom.GetId(), pindexLast->GetBlockHash());
@@ -2315,69 +2550,80 @@ void PeerManagerImpl::ProcessOrphanTx(std::set<uint256>& orphan_work_set)
     AssertLockHeld(cs_main);
     AssertLockHeld(g_cs_orphans);
 
-    while (!orphan_work_set.empty()) {
-        const uint256 orphanHash = *orphan_work_set.begin();
-        orphan_work_set.erase(orphan_work_set.begin());
+    size_t budget_txs{MAX_ORPHAN_BATCH_TXS};
+    int64_t budget_weight{MAX_ORPHAN_BATCH_WEIGHT};
+    while (!orphan_work_set.empty() && budget_txs > 0 && budget_weight > 0) {
+        // Children unlocked by accepted orphans are added back to the work set
+        // and picked up by the next batch, budget permitting.
+        const auto batch = m_orphanage.GetWorkBatch(orphan_work_set, budget_txs, budget_weight);
+        if (batch.empty()) break;
+        for (const auto& [porphanTx, from_peer] : batch) {
+            budget_txs--;
+            budget_weight -= GetTransactionWeight(*porphanTx);
+            ResolveOrphanTx(porphanTx, from_peer, orphan_work_set);
+        }
+    }
+}
 
-        const auto [porphanTx, from_peer] = m_orphanage.GetTx(orphanHash);
-        if (porphanTx == nullptr) continue;
+void PeerManagerImpl::ResolveOrphanTx(const CTransactionRef& porphanTx, NodeId from_peer, std::set<uint256>& orphan_work_set)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(g_cs_orphans);
 
-        const MempoolAcceptResult result = m_chainman.ProcessTransaction(porphanTx);
-        const TxValidationState& state = result.m_state;
+    const uint256& orphanHash = porphanTx->GetHash();
+    const MempoolAcceptResult result = m_chainman.ProcessTransaction(porphanTx);
+    const TxValidationState& state = result.m_state;
 
-        if (result.m_result_type == MempoolAcceptResult::ResultType::VALID) {
-            LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-            _RelayTransaction(orphanHash, porphanTx->GetWitnessHash());
-            m_orphanage.AddChildrenToWorkSet(*porphanTx, orphan_work_set);
-            m_orphanage.EraseTx(orphanHash);
-            for (const CTransactionRef& removedTx : result.m_replaced_transactions.value()) {
-                AddToCompactExtraTransactions(removedTx);
-            }
-            break;
-        } else if (state.GetResult() != TxValidationResult::TX_MISSING_INPUTS) {
-            if (state.IsInvalid()) {
-                LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s from peer=%d. %s\n",
-                    orphanHash.ToString(),
-                    from_peer,
-                    state.ToString());
-                // Maybe punish peer that gave us an invalid orphan tx
-                MaybePunishNodeForTx(from_peer, state);
-            }
-            // Has inputs but not accepted to mempool
-            // Probably non-standard or insufficient fee
-            LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-            if (state.GetResult() != TxValidationResult::TX_WITNESS_STRIPPED) {
-                // We can add the wtxid of this transaction to our reject filter.
-                // Do not add txids of witness transactions or witness-stripped
-                // transactions to the filter, as they can have been malleated;
-                // adding such txids to the reject filter would potentially
-                // interfere with relay of valid transactions from peers that
-                // do not support wtxid-based relay. See
-                // https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                // We can remove this restriction (and always add wtxids to
-                // the filter even for witness stripped transactions) once
-                // wtxid-based relay is broadly deployed.
-                // See also comments in https://github.com/bitcoin/bitcoin/pull/18044#discussion_r443419034
-                // for concerns around weakening security of unupgraded nodes
-                // if we start doing this too early.
-                m_recent_rejects.insert(porphanTx->GetWitnessHash());
-                // If the transaction failed for TX_INPUTS_NOT_STANDARD,
-                // then we know that the witness was irrelevant to the policy
-                // failure, since this check depends only on the txid
-                // (the scriptPubKey being spent is covered by the txid).
-                // Add the txid to the reject filter to prevent repeated
-                // processing of this transaction in the event that child
-                // transactions are later received (resulting in
-                // parent-fetching by txid via the orphan-handling logic).
-                if (state.GetResult() == TxValidationResult::TX_INPUTS_NOT_STANDARD && porphanTx->GetWitnessHash() != porphanTx->GetHash()) {
-                    // We only add the txid if it differs from the wtxid, to
-                    // avoid wasting entries in the rolling bloom filter.
-                    m_recent_rejects.insert(porphanTx->GetHash());
-                }
+    if (result.m_result_type == MempoolAcceptResult::ResultType::VALID) {
+        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+        _RelayTransaction(orphanHash, porphanTx->GetWitnessHash());
+        m_orphanage.AddChildrenToWorkSet(*porphanTx, orphan_work_set);
+        m_orphanage.EraseTx(orphanHash);
+        for (const CTransactionRef& removedTx : result.m_replaced_transactions.value()) {
+            AddToCompactExtraTransactions(removedTx);
+        }
+    } else if (state.GetResult() != TxValidationResult::TX_MISSING_INPUTS) {
+        if (state.IsInvalid()) {
+            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s from peer=%d. %s\n",
+                orphanHash.ToString(),
+                from_peer,
+                state.ToString());
+            // Maybe punish peer that gave us an invalid orphan tx
+            MaybePunishNodeForTx(from_peer, state);
+        }
+        // Has inputs but not accepted to mempool
+        // Probably non-standard or insufficient fee
+        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+        if (state.GetResult() != TxValidationResult::TX_WITNESS_STRIPPED) {
+            // We can add the wtxid of this transaction to our reject filter.
+            // Do not add txids of witness transactions or witness-stripped
+            // transactions to the filter, as they can have been malleated;
+            // adding such txids to the reject filter would potentially
+            // interfere with relay of valid transactions from peers that
+            // do not support wtxid-based relay. See
+            // https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            // We can remove this restriction (and always add wtxids to
+            // the filter even for witness stripped transactions) once
+            // wtxid-based relay is broadly deployed.
+            // See also comments in https://github.com/bitcoin/bitcoin/pull/18044#discussion_r443419034
+            // for concerns around weakening security of unupgraded nodes
+            // if we start doing this too early.
+            m_recent_rejects.insert(porphanTx->GetWitnessHash());
+            // If the transaction failed for TX_INPUTS_NOT_STANDARD,
+            // then we know that the witness was irrelevant to the policy
+            // failure, since this check depends only on the txid
+            // (the scriptPubKey being spent is covered by the txid).
+            // Add the txid to the reject filter to prevent repeated
+            // processing of this transaction in the event that child
+            // transactions are later received (resulting in
+            // parent-fetching by txid via the orphan-handling logic).
+            if (state.GetResult() == TxValidationResult::TX_INPUTS_NOT_STANDARD && porphanTx->GetWitnessHash() != porphanTx->GetHash()) {
+                // We only add the txid if it differs from the wtxid, to
+                // avoid wasting entries in the rolling bloom filter.
+                m_recent_rejects.insert(porphanTx->GetHash());
             }
-            m_orphanage.EraseTx(orphanHash);
-            break;
         }
+        m_orphanage.EraseTx(orphanHash);
     }
 }
 
@@ -2561,10 +2807,78 @@ void PeerManagerImpl::ProcessBlock(CNode& node, const std::shared_ptr<const CBlo
     }
 }
 
+void PreparsedMessage::Parse(const std::string& msg_type)
+{
+    // Read through a SpanReader so that m_payload stays intact for the fallback path.
+    SpanReader s{m_payload.GetType(), m_payload.GetVersion(), MakeUCharSpan(m_payload)};
+    if (msg_type == NetMsgType::TX) {
+        s >> m_tx;
+        PreCheckMempoolTransaction(*m_tx, m_tx_state);
+    } else if (msg_type == NetMsgType::HEADERS) {
+        const unsigned int count = ReadCompactSize(s);
+        if (count > MAX_HEADERS_RESULTS) return; // leave it to the handler to punish
+        m_headers.resize(count);
+        for (CBlockHeader& header : m_headers) {
+            s >> header;
+            ReadCompactSize(s); // ignore tx count; assume it is 0.
+            ReadCompactSize(s); // needed for vchBlockSig.
+        }
+    } else if (msg_type == NetMsgType::BLOCK) {
+        m_block = std::make_shared<CBlock>();
+        s >> *m_block;
+    } else if (msg_type == NetMsgType::CMPCTBLOCK) {
+        m_cmpctblock.emplace();
+        s >> *m_cmpctblock;
+    } else {
+        return;
+    }
+    m_parsed = true;
+}
+
+void PeerManagerImpl::PreprocessMessage(CNode& node, CNetMessage& msg)
+{
+    // The serialization version is only settled once the handshake is complete.
+    if (!node.fSuccessfullyConnected) return;
+    if (msg.m_type != NetMsgType::TX && msg.m_type != NetMsgType::HEADERS &&
+        msg.m_type != NetMsgType::BLOCK && msg.m_type != NetMsgType::CMPCTBLOCK) {
+        return;
+    }
+
+    msg.SetVersion(node.GetCommonVersion());
+    msg.m_recv.SetType(msg.m_recv.GetType() | SER_POSMARKER);
+    auto preparsed = std::make_shared<PreparsedMessage>(std::move(msg.m_recv));
+    // The task only holds a weak reference: m_done keeps the task alive, and the
+    // message may be dropped (peer disconnected) before a worker gets to it.
+    std::weak_ptr<PreparsedMessage> weak{preparsed};
+    preparsed->m_done = m_msgparse_pool.Submit([weak, msg_type = msg.m_type] {
+        const auto preparsed = weak.lock();
+        if (!preparsed) return;
+        const int64_t parse_start{GetTimeMicros()};
+        try {
+            preparsed->Parse(msg_type);
+        } catch (const std::exception&) {
+            // Reported by ProcessMessage() when it parses the payload again.
+            preparsed->m_parsed = false;
+        }
+        preparsed->m_parse_time = std::chrono::microseconds{GetTimeMicros() - parse_start};
+    });
+    msg.m_preparsed = std::move(preparsed);
+}
+
 void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDataStream& vRecv,
                                      const std::chrono::microseconds time_received,
                                      const std::atomic<bool>& interruptMsgProc)
 {
+    ProcessMessage(pfrom, msg_type, vRecv, time_received, interruptMsgProc, /*preparsed=*/nullptr);
+}
+
+void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDataStream& vRecv,
+                                     const std::chrono::microseconds time_received,
+                                     const std::atomic<bool>& interruptMsgProc,
+                                     const PreparsedMessage* preparsed)
+{
+    if (preparsed && !preparsed->m_parsed) preparsed = nullptr;
+
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(msg_type), vRecv.size(), pfrom.GetId());
 
     PeerRef peer = GetPeerRef(pfrom.GetId());
@@ -3303,7 +3617,11 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         if (m_chainman.ActiveChainstate().IsInitialBlockDownload()) return;
 
         CTransactionRef ptx;
-        vRecv >> ptx;
+        if (preparsed) {
+            ptx = preparsed->m_tx;
+        } else {
+            vRecv >> ptx;
+        }
         const CTransaction& tx = *ptx;
 
         const uint256& txid = ptx->GetHash();
@@ -3354,7 +3672,11 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             return;
         }
 
-        const MempoolAcceptResult result = m_chainman.ProcessTransaction(ptx);
+        // A transaction that already failed the context-free checks would be
+        // rejected by the mempool with the same state, so skip the round trip.
+        const MempoolAcceptResult result = preparsed && preparsed->m_tx_state.IsInvalid() ?
+            MempoolAcceptResult::Failure(preparsed->m_tx_state) :
+            m_chainman.ProcessTransaction(ptx);
         const TxValidationState& state = result.m_state;
 
         if (result.m_result_type == MempoolAcceptResult::ResultType::VALID) {
@@ -3510,7 +3832,11 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         }
 
         CBlockHeaderAndShortTxIDs cmpctblock;
-        vRecv >> cmpctblock;
+        if (preparsed) {
+            cmpctblock = *preparsed->m_cmpctblock;
+        } else {
+            vRecv >> cmpctblock;
+        }
 
         bool received_new_header = false;
 
@@ -3812,20 +4138,26 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         std::vector<CBlockHeader> headers;
 
         // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
-        unsigned int nCount = ReadCompactSize(vRecv);
+        unsigned int nCount = preparsed ? preparsed->m_headers.size() : ReadCompactSize(vRecv);
         if (nCount > MAX_HEADERS_RESULTS) {
             Misbehaving(pfrom.GetId(), 20, strprintf("headers message size = %u", nCount));
             return;
         }
-        headers.resize(nCount);
+        if (preparsed) {
+            headers = preparsed->m_headers;
+        } else {
+            headers.resize(nCount);
+        }
         {
             LOCK(cs_main);
             int32_t& nPoSTemperature = mapPoSTemperature[pfrom.addr];
             int nTmpPoSTemperature = nPoSTemperature;
             for (unsigned int n = 0; n < nCount; n++) {
-                vRecv >> headers[n];
-                ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
-                ReadCompactSize(vRecv); // needed for vchBlockSig.
+                if (!preparsed) {
+                    vRecv >> headers[n];
+                    ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+                    ReadCompactSize(vRecv); // needed for vchBlockSig.
+                }
 
                 // nowp: quick check to see if we should ban peers for PoS spam
                 // note: at this point we don't know if PoW headers are valid - we just assume they are
@@ -3858,8 +4190,13 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         }
 
 
-        std::shared_ptr<CBlock> pblock2 = std::make_shared<CBlock>();
-        vRecv >> *pblock2;
+        std::shared_ptr<CBlock> pblock2;
+        if (preparsed) {
+            pblock2 = preparsed->m_block;
+        } else {
+            pblock2 = std::make_shared<CBlock>();
+            vRecv >> *pblock2;
+        }
         int64_t nTimeNow = GetTimeSeconds();
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock2->GetHash().ToString(), pfrom.GetId());
@@ -4311,6 +4648,14 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
     CNetMessage& msg(msgs.front());
+    const auto queue_time{GetTime<std::chrono::microseconds>() - msg.m_time};
+
+    if (msg.m_preparsed) {
+        // Usually long done by now; otherwise this is the wait we would have spent parsing.
+        msg.m_preparsed->m_done.wait();
+        msg.m_recv = std::move(msg.m_preparsed->m_payload);
+        msg.m_deserialize_time += msg.m_preparsed->m_parse_time;
+    }
 
     TRACE6(net, inbound_message,
         pfrom->GetId(),
@@ -4327,8 +4672,9 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
 
     msg.SetVersion(pfrom->GetCommonVersion());
 
+    const int64_t process_start{GetTimeMicros()};
     try {
-        ProcessMessage(*pfrom, msg.m_type, msg.m_recv, msg.m_time, interruptMsgProc);
+        ProcessMessage(*pfrom, msg.m_type, msg.m_recv, msg.m_time, interruptMsgProc, msg.m_preparsed.get());
         if (interruptMsgProc) return false;
         {
             LOCK(peer->m_getdata_requests_mutex);
@@ -4339,6 +4685,7 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
     } catch (...) {
         LogPrint(BCLog::NET, "%s(%s, %u bytes): Unknown exception caught\n", __func__, SanitizeString(msg.m_type), msg.m_message_size);
     }
+    m_connman.RecordMsgLatency(*pfrom, msg, queue_time, std::chrono::microseconds{GetTimeMicros() - process_start});
 
     return fMoreWork;
 }
@@ -4682,25 +5029,32 @@ void PeerManagerImpl::MaybeSendFeefilter(CNode& pto, std::chrono::microseconds c
 }
 */
 
-namespace {
-class CompareInvMempoolOrder
+const PeerManagerImpl::TxInvBatch& PeerManagerImpl::GetTxInvBatch(std::chrono::microseconds now)
 {
-    CTxMemPool *mp;
-    bool m_wtxid_relay;
-public:
-    explicit CompareInvMempoolOrder(CTxMemPool *_mempool, bool use_wtxid)
-    {
-        mp = _mempool;
-        m_wtxid_relay = use_wtxid;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
-    {
-        /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a, m_wtxid_relay);
-    }
-};
+    AssertLockHeld(cs_main);
+    TxInvBatch& batch = m_tx_inv_batch;
+    if (now < batch.m_next_build) return batch;
+
+    std::vector<GenTxid> gtxids;
+    gtxids.reserve(m_tx_inv_pending.size());
+    for (const auto& [hash, is_wtxid] : m_tx_inv_pending) {
+        gtxids.push_back(is_wtxid ? GenTxid::Wtxid(hash) : GenTxid::Txid(hash));
+    }
+    batch.m_txs = m_mempool.infoSorted(gtxids);
+    batch.m_rank.clear();
+    batch.m_rank.reserve(2 * batch.m_txs.size());
+    for (int i = 0; i < (int)batch.m_txs.size(); ++i) {
+        batch.m_rank.emplace(batch.m_txs[i].tx->GetHash(), i);
+        batch.m_rank.emplace(batch.m_txs[i].tx->GetWitnessHash(), i);
+    }
+    // Anything asked for that is no longer in the mempool gets dropped from
+    // the peers' queues the next time they trickle.
+    for (const auto& [hash, is_wtxid] : m_tx_inv_pending) {
+        batch.m_rank.emplace(hash, -1);
+    }
+    m_tx_inv_pending.clear();
+    batch.m_next_build = now + TX_INV_BATCH_INTERVAL;
+    return batch;
 }
 
 bool PeerManagerImpl::SetupAddressRelay(const CNode& node, Peer& peer)
@@ -4996,25 +5350,34 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
 
                 // Determine transactions to relay
                 if (fSendTrickle) {
-                    // Produce a vector with all candidates for sending
-                    std::vector<std::set<uint256>::iterator> vInvTx;
+                    // Produce a vector with all candidates for sending, tagged
+                    // with their position in the shared announcement order.
+                    const TxInvBatch& batch = GetTxInvBatch(current_time);
+                    std::vector<std::pair<int, std::set<uint256>::iterator>> vInvTx;
                     vInvTx.reserve(pto->m_tx_relay->setInventoryTxToSend.size());
                     for (std::set<uint256>::iterator it = pto->m_tx_relay->setInventoryTxToSend.begin(); it != pto->m_tx_relay->setInventoryTxToSend.end(); it++) {
-                        vInvTx.push_back(it);
+                        const auto rank = batch.m_rank.find(*it);
+                        if (rank == batch.m_rank.end()) {
+                            // Queued after this batch was built; it goes into the next one.
+                            m_tx_inv_pending.emplace(*it, state.m_wtxid_relay);
+                            continue;
+                        }
+                        vInvTx.emplace_back(rank->second, it);
                     }
                     CAmount filterrate = 0;
                     // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                     // A heap is used so that not all items need sorting if only a few are being sent.
-                    CompareInvMempoolOrder compareInvMempoolOrder(&m_mempool, state.m_wtxid_relay);
-                    std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                    // As std::make_heap produces a max-heap, the lowest positions must sort last.
+                    const auto compareInvOrder = [](const auto& a, const auto& b) { return a.first > b.first; };
+                    std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvOrder);
                     // No reason to drain out at many times the network's capacity,
                     // especially since we have many peers and some will draw much shorter delays.
                     unsigned int nRelayedTransactions = 0;
                     LOCK(pto->m_tx_relay->cs_filter);
                     while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                         // Fetch the top element from the heap
-                        std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                        std::set<uint256>::iterator it = vInvTx.back();
+                        std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvOrder);
+                        const auto [rank, it] = vInvTx.back();
                         vInvTx.pop_back();
                         uint256 hash = *it;
                         CInv inv(state.m_wtxid_relay ? MSG_WTX : MSG_TX, hash);
@@ -5025,8 +5388,12 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
                             continue;
                         }
                         // Not in the mempool anymore? don't bother sending it.
-                        auto txinfo = m_mempool.info(ToGenTxid(inv));
-                        if (!txinfo.tx) {
+                        if (rank < 0) {
+                            continue;
+                        }
+                        TxMempoolInfo txinfo = batch.m_txs[rank];
+                        // The batch may predate a block or an eviction.
+                        if (!m_mempool.exists(GenTxid::Txid(txinfo.tx->GetHash()))) {
                             continue;
                         }
                         auto txid = txinfo.tx->GetHash();
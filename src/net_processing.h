@@ -6,9 +6,17 @@
 #ifndef BITCOIN_NET_PROCESSING_H
 #define BITCOIN_NET_PROCESSING_H
 
+#include <blockencodings.h>
+#include <consensus/validation.h>
 #include <net.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <streams.h>
 #include <validationinterface.h>
 
+#include <future>
+#include <optional>
+
 class AddrMan;
 class CChainParams;
 class CTxMemPool;
@@ -20,6 +28,10 @@ static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 static const bool DEFAULT_PEERBLOOMFILTERS = false;
 static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Default for -msgparsethreads, number of threads decoding messages ahead of the message handler */
+static const int DEFAULT_MSGPARSE_THREADS = 2;
+/** Maximum for -msgparsethreads */
+static const int MAX_MSGPARSE_THREADS = 16;
 /** Threshold for marking a node to be discouraged, e.g. disconnected and added to the discouragement filter. */
 static const int DISCOURAGEMENT_THRESHOLD{100};
 
@@ -34,6 +46,39 @@ struct CNodeStateStats {
     bool m_addr_relay_enabled{false};
 };
 
+/**
+ * Payload of a tx, headers, block or cmpctblock message decoded on the
+ * message preprocessing pool before the message handler gets to it.
+ * Public for unit testing.
+ *
+ * The raw payload is parked here while a worker reads it and is handed back to
+ * the CNetMessage by ProcessMessages(). If decoding failed, m_parsed stays false
+ * and ProcessMessage() parses the payload itself, so malformed messages are
+ * reported exactly as before.
+ */
+struct PreparsedMessage {
+    CDataStream m_payload;
+    std::future<void> m_done;
+    bool m_parsed{false};
+    //! time the worker spent in Parse()
+    std::chrono::microseconds m_parse_time{0};
+
+    //! tx: the transaction and the result of PreCheckMempoolTransaction()
+    CTransactionRef m_tx;
+    TxValidationState m_tx_state;
+    //! headers: only filled in when the count is within MAX_HEADERS_RESULTS
+    std::vector<CBlockHeader> m_headers;
+    //! block
+    std::shared_ptr<CBlock> m_block;
+    //! cmpctblock
+    std::optional<CBlockHeaderAndShortTxIDs> m_cmpctblock;
+
+    explicit PreparsedMessage(CDataStream&& payload) : m_payload(std::move(payload)) {}
+
+    /** Decode m_payload according to msg_type, without consuming it. */
+    void Parse(const std::string& msg_type);
+};
+
 class PeerManager : public CValidationInterface, public NetEventsInterface
 {
 public:
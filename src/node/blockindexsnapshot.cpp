@@ -0,0 +1,392 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/blockindexsnapshot.h>
+
+#include <chain.h>
+#include <crypto/common.h>
+#include <logging.h>
+#include <random.h>
+#include <txdb.h>
+#include <util/system.h>
+#include <util/threadpool.h>
+#include <util/time.h>
+
+#include <crc32c/crc32c.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace node {
+namespace {
+constexpr unsigned char SNAPSHOT_MAGIC[8] = {'n', 'o', 'w', 'p', 'b', 'i', 'd', 'x'};
+constexpr uint32_t SNAPSHOT_VERSION{1};
+constexpr size_t SNAPSHOT_HEADER_SIZE{48};
+
+struct SnapshotHeader {
+    uint64_t id{0};
+    uint64_t count{0};
+    int32_t last_blockfile{0};
+    uint32_t last_file_blocks{0};
+    uint32_t last_file_size{0};
+    uint32_t records_crc{0};
+};
+
+/** Sequential little-endian writer over a fixed-size record. */
+class RecordWriter
+{
+    unsigned char* m_ptr;
+
+public:
+    explicit RecordWriter(unsigned char* ptr) : m_ptr{ptr} {}
+    void Bytes(const unsigned char* src, size_t len) { std::memcpy(m_ptr, src, len); m_ptr += len; }
+    void Hash(const uint256& h) { Bytes(h.begin(), h.size()); }
+    void U32(uint32_t x) { WriteLE32(m_ptr, x); m_ptr += 4; }
+    void U64(uint64_t x) { WriteLE64(m_ptr, x); m_ptr += 8; }
+};
+
+/** Sequential little-endian reader over a fixed-size record. */
+class RecordReader
+{
+    const unsigned char* m_ptr;
+
+public:
+    explicit RecordReader(const unsigned char* ptr) : m_ptr{ptr} {}
+    void Bytes(unsigned char* dst, size_t len) { std::memcpy(dst, m_ptr, len); m_ptr += len; }
+    uint256 Hash() { uint256 h; Bytes(h.begin(), h.size()); return h; }
+    uint32_t U32() { uint32_t x = ReadLE32(m_ptr); m_ptr += 4; return x; }
+    uint64_t U64() { uint64_t x = ReadLE64(m_ptr); m_ptr += 8; return x; }
+};
+
+void EncodeHeader(unsigned char* ptr, const SnapshotHeader& header)
+{
+    RecordWriter w{ptr};
+    w.Bytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    w.U32(SNAPSHOT_VERSION);
+    w.U32(header.last_blockfile);
+    w.U64(header.id);
+    w.U64(header.count);
+    w.U32(header.last_file_blocks);
+    w.U32(header.last_file_size);
+    w.U32(header.records_crc);
+    w.U32(crc32c::Crc32c(ptr, SNAPSHOT_HEADER_SIZE - 4));
+}
+
+bool DecodeHeader(const unsigned char* ptr, SnapshotHeader& header)
+{
+    if (std::memcmp(ptr, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) return false;
+    if (ReadLE32(ptr + SNAPSHOT_HEADER_SIZE - 4) != crc32c::Crc32c(ptr, SNAPSHOT_HEADER_SIZE - 4)) return false;
+    RecordReader r{ptr + sizeof(SNAPSHOT_MAGIC)};
+    if (r.U32() != SNAPSHOT_VERSION) return false;
+    header.last_blockfile = r.U32();
+    header.id = r.U64();
+    header.count = r.U64();
+    header.last_file_blocks = r.U32();
+    header.last_file_size = r.U32();
+    header.records_crc = r.U32();
+    return true;
+}
+
+void EncodeRecord(unsigned char* ptr, const CBlockIndex& index, const uint256& hash_prev) EXCLUSIVE_LOCKS_REQUIRED(::cs_main)
+{
+    RecordWriter w{ptr};
+    w.Hash(index.GetBlockHash());
+    w.Hash(hash_prev);
+    w.Hash(index.hashMerkleRoot);
+    w.Hash(index.hashProofOfStake);
+    w.Hash(index.prevoutStake.hash);
+    w.U32(index.prevoutStake.n);
+    w.U32(index.nHeight);
+    w.U32(index.nFile);
+    w.U32(index.nDataPos);
+    w.U32(index.nUndoPos);
+    w.U32(index.nDataChecksum);
+    w.U32(index.nTx);
+    w.U32(index.nStatus);
+    w.U32(index.nVersion);
+    w.U32(index.nTime);
+    w.U32(index.nBits);
+    w.U32(index.nNonce);
+    w.U32(index.nFlags);
+    w.U32(index.nStakeTime);
+    w.U64(index.nMint);
+    w.U64(index.nMoneySupply);
+    w.U64(index.nStakeModifier);
+}
+
+/**
+ * Fill in everything but phashBlock and pprev. Runs on worker threads while
+ * the caller holds cs_main; the entry is not reachable by anyone else yet.
+ */
+void DecodeRecord(const unsigned char* ptr, CBlockIndex& index, uint256& hash, uint256& hash_prev) NO_THREAD_SAFETY_ANALYSIS
+{
+    RecordReader r{ptr};
+    hash = r.Hash();
+    hash_prev = r.Hash();
+    index.hashMerkleRoot = r.Hash();
+    index.hashProofOfStake = r.Hash();
+    index.prevoutStake.hash = r.Hash();
+    index.prevoutStake.n = r.U32();
+    index.nHeight = r.U32();
+    index.nFile = r.U32();
+    index.nDataPos = r.U32();
+    index.nUndoPos = r.U32();
+    index.nDataChecksum = r.U32();
+    index.nTx = r.U32();
+    index.nStatus = r.U32();
+    index.nVersion = r.U32();
+    index.nTime = r.U32();
+    index.nBits = r.U32();
+    index.nNonce = r.U32();
+    index.nFlags = r.U32();
+    index.nStakeTime = r.U32();
+    index.nMint = r.U64();
+    index.nMoneySupply = r.U64();
+    index.nStakeModifier = r.U64();
+}
+
+/** Read-only view of a whole file, memory mapped where the platform allows. */
+class MappedFile
+{
+public:
+    explicit MappedFile(const fs::path& path)
+    {
+#ifndef WIN32
+        int fd = open(fs::PathToString(path).c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                m_data = static_cast<const unsigned char*>(addr);
+                m_size = st.st_size;
+                posix_madvise(addr, m_size, POSIX_MADV_WILLNEED);
+            }
+        }
+        close(fd);
+#else
+        FILE* file = fsbridge::fopen(path, "rb");
+        if (!file) return;
+        unsigned char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+            m_buffer.insert(m_buffer.end(), buf, buf + n);
+        }
+        fclose(file);
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef WIN32
+        if (m_data) munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const unsigned char* m_data{nullptr};
+    size_t m_size{0};
+#ifdef WIN32
+    std::vector<unsigned char> m_buffer;
+#endif
+};
+
+/** Run fn(begin, end) over [0, count) split across the pool, returning whether all chunks succeeded. */
+template <typename Fn>
+bool ForEachChunk(ThreadPool& pool, size_t count, size_t num_chunks, Fn fn)
+{
+    const size_t chunk = (count + num_chunks - 1) / num_chunks;
+    std::vector<std::future<bool>> results;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        const size_t end = std::min(count, begin + chunk);
+        results.push_back(pool.Submit([&fn, begin, end] { return fn(begin, end); }));
+    }
+    bool ok{true};
+    for (auto& result : results) {
+        ok &= result.get();
+    }
+    return ok;
+}
+
+bool LoadFromMappedFile(const MappedFile& file, CBlockTreeDB& block_tree_db, uint64_t expected_id, BlockMap& block_index)
+    EXCLUSIVE_LOCKS_REQUIRED(::cs_main)
+{
+    SnapshotHeader header;
+    if (!file.data() || file.size() < SNAPSHOT_HEADER_SIZE || !DecodeHeader(file.data(), header)) {
+        return error("%s: missing or malformed block index snapshot", __func__);
+    }
+    if (header.id != expected_id) {
+        return error("%s: block index snapshot does not match the block tree database", __func__);
+    }
+    if (header.count > (file.size() - SNAPSHOT_HEADER_SIZE) / BLOCK_INDEX_SNAPSHOT_RECORD_SIZE ||
+        file.size() != SNAPSHOT_HEADER_SIZE + header.count * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE) {
+        return error("%s: block index snapshot has unexpected size", __func__);
+    }
+
+    // The block file bookkeeping is written with every flush, so a mismatch
+    // means someone (e.g. an older version) changed the database after us.
+    int last_blockfile{0};
+    block_tree_db.ReadLastBlockFile(last_blockfile);
+    CBlockFileInfo info;
+    block_tree_db.ReadBlockFileInfo(last_blockfile, info);
+    if (last_blockfile != header.last_blockfile || info.nBlocks != header.last_file_blocks || info.nSize != header.last_file_size) {
+        return error("%s: block index snapshot is stale", __func__);
+    }
+
+    const unsigned char* records = file.data() + SNAPSHOT_HEADER_SIZE;
+    const size_t count = header.count;
+    if (crc32c::Crc32c(records, count * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE) != header.records_crc) {
+        return error("%s: block index snapshot checksum mismatch", __func__);
+    }
+
+    ThreadPool pool{"loadblkidx"};
+    size_t num_chunks{1};
+    if (count >= BLOCK_INDEX_SNAPSHOT_PARALLEL_MIN) {
+        const int threads = std::clamp(GetNumCores(), 1, MAX_BLOCK_INDEX_SNAPSHOT_THREADS);
+        pool.Start(threads);
+        num_chunks = threads;
+    }
+
+    std::vector<std::unique_ptr<CBlockIndex>> entries(count);
+    std::vector<uint256> hashes(count);
+    std::vector<uint256> prev_hashes(count);
+    ForEachChunk(pool, count, num_chunks, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            entries[i] = std::make_unique<CBlockIndex>();
+            DecodeRecord(records + i * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE, *entries[i], hashes[i], prev_hashes[i]);
+        }
+        return true;
+    });
+
+    // Inserting into the map is the only inherently serial step.
+    BlockMap loaded;
+    loaded.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto [it, inserted] = loaded.emplace(hashes[i], entries[i].get());
+        if (!inserted) {
+            return error("%s: duplicate entry %s in block index snapshot", __func__, hashes[i].ToString());
+        }
+        it->second->phashBlock = &it->first;
+    }
+
+    const bool linked = ForEachChunk(pool, count, num_chunks, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (prev_hashes[i].IsNull()) continue;
+            auto it = loaded.find(prev_hashes[i]);
+            if (it == loaded.end()) return false;
+            entries[i]->pprev = it->second;
+        }
+        return true;
+    });
+    if (!linked) {
+        return error("%s: block index snapshot is missing a parent entry", __func__);
+    }
+
+    for (auto& entry : entries) {
+        entry.release();
+    }
+    block_index.swap(loaded);
+    return true;
+}
+} // namespace
+
+bool WriteBlockIndexSnapshot(const fs::path& path, CBlockTreeDB& block_tree_db, const BlockMap& block_index)
+{
+    AssertLockHeld(::cs_main);
+    const int64_t start = GetTimeMicros();
+
+    SnapshotHeader header;
+    header.id = GetRand(std::numeric_limits<uint64_t>::max());
+    header.count = block_index.size();
+    block_tree_db.ReadLastBlockFile(header.last_blockfile);
+    CBlockFileInfo info;
+    block_tree_db.ReadBlockFileInfo(header.last_blockfile, info);
+    header.last_file_blocks = info.nBlocks;
+    header.last_file_size = info.nSize;
+
+    // Height order keeps parents ahead of their children, which is the order
+    // LoadBlockIndex() walks them in.
+    std::vector<const CBlockIndex*> sorted;
+    sorted.reserve(block_index.size());
+    for (const auto& [hash, pindex] : block_index) {
+        sorted.push_back(pindex);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    std::vector<unsigned char> buffer(SNAPSHOT_HEADER_SIZE + sorted.size() * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE);
+    unsigned char* records = buffer.data() + SNAPSHOT_HEADER_SIZE;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const CBlockIndex* pindex = sorted[i];
+        EncodeRecord(records + i * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE, *pindex, pindex->pprev ? pindex->pprev->GetBlockHash() : uint256());
+    }
+    header.records_crc = crc32c::Crc32c(records, sorted.size() * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE);
+    EncodeHeader(buffer.data(), header);
+
+    fs::path path_tmp = path;
+    path_tmp += ".new";
+    FILE* file = fsbridge::fopen(path_tmp, "wb");
+    if (!file) {
+        return error("%s: failed to open %s", __func__, fs::PathToString(path_tmp));
+    }
+    const bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && FileCommit(file);
+    fclose(file);
+    if (!written || !RenameOver(path_tmp, path)) {
+        return error("%s: failed to write %s", __func__, fs::PathToString(path));
+    }
+    if (!block_tree_db.WriteBlockIndexSnapshotId(header.id)) {
+        return error("%s: failed to record block index snapshot", __func__);
+    }
+
+    LogPrintf("Wrote block index snapshot with %u entries in %dms\n", header.count, (GetTimeMicros() - start) / 1000);
+    return true;
+}
+
+bool LoadBlockIndexSnapshot(const fs::path& path, CBlockTreeDB& block_tree_db, BlockMap& block_index)
+{
+    AssertLockHeld(::cs_main);
+    const int64_t start = GetTimeMicros();
+
+    uint64_t id;
+    const bool have_id{block_tree_db.ReadBlockIndexSnapshotId(id)};
+    // Forget the snapshot before anything else can modify the database.
+    if (have_id && !block_tree_db.EraseBlockIndexSnapshotId()) {
+        return error("%s: failed to clear block index snapshot id", __func__);
+    }
+
+    bool loaded{false};
+    // The block index may be reloaded on top of the entries it already has;
+    // the snapshot only describes a fresh one.
+    if (have_id && block_index.empty()) {
+        const MappedFile file{path};
+        loaded = LoadFromMappedFile(file, block_tree_db, id, block_index);
+    }
+
+    std::error_code ec;
+    fs::remove(path, ec);
+
+    if (loaded) {
+        LogPrintf("Loaded %u block index entries from snapshot in %dms\n", block_index.size(), (GetTimeMicros() - start) / 1000);
+    }
+    return loaded;
+}
+} // namespace node
@@ -0,0 +1,47 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_BLOCKINDEXSNAPSHOT_H
+#define BITCOIN_NODE_BLOCKINDEXSNAPSHOT_H
+
+#include <fs.h>
+#include <node/blockstorage.h>
+#include <sync.h>
+
+#include <cstddef>
+
+class CBlockTreeDB;
+
+namespace node {
+/**
+ * The block index snapshot is a flat file of fixed-size records, one per
+ * block index entry, written at clean shutdown after the block tree database
+ * has been flushed. At the next startup it is memory mapped and decoded in
+ * parallel, which avoids iterating LevelDB and recomputing every header hash.
+ *
+ * A random identifier is stored both in the file and in the block tree
+ * database. The database copy is erased as soon as startup looks at it, so
+ * a snapshot is used at most once and never after an unclean shutdown: in
+ * that case LoadBlockIndexGuts() is used as before.
+ */
+static constexpr size_t BLOCK_INDEX_SNAPSHOT_RECORD_SIZE{240};
+/** Below this many entries, decoding is not worth handing to worker threads */
+static constexpr size_t BLOCK_INDEX_SNAPSHOT_PARALLEL_MIN{10000};
+/** Upper bound on the number of threads used to decode a snapshot */
+static constexpr int MAX_BLOCK_INDEX_SNAPSHOT_THREADS{8};
+
+/** Serialize block_index to path and record its identifier in block_tree_db. */
+bool WriteBlockIndexSnapshot(const fs::path& path, CBlockTreeDB& block_tree_db, const BlockMap& block_index)
+    EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+
+/**
+ * Populate block_index from the snapshot at path, if it is still empty.
+ * Returns false, leaving block_index as it was, if there is no usable
+ * snapshot. The snapshot is consumed either way.
+ */
+bool LoadBlockIndexSnapshot(const fs::path& path, CBlockTreeDB& block_tree_db, BlockMap& block_index)
+    EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+} // namespace node
+
+#endif // BITCOIN_NODE_BLOCKINDEXSNAPSHOT_H
@@ -8,28 +8,352 @@
 #include <chainparams.h>
 #include <clientversion.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
 #include <flatfile.h>
 #include <fs.h>
 #include <hash.h>
 #include <kernel.h>
+#include <node/blockindexsnapshot.h>
 #include <pow.h>
 #include <reverse_iterator.h>
 #include <shutdown.h>
 #include <signet.h>
 #include <streams.h>
 #include <undo.h>
+#include <sync.h>
 #include <util/syscall_sandbox.h>
 #include <util/system.h>
 #include <validation.h>
 
+#include <crc32c/crc32c.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace node {
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
+bool fParanoidBlockReads{DEFAULT_PARANOID_BLOCK_READS};
+
+namespace {
+/** Stream that computes the CRC32C of the data serialized into it. */
+class CRC32CWriter
+{
+private:
+    const int m_type;
+    const int m_version;
+    uint32_t m_crc{0};
+
+public:
+    CRC32CWriter(int type, int version) : m_type{type}, m_version{version} {}
+
+    int GetType() const { return m_type; }
+    int GetVersion() const { return m_version; }
+
+    void write(Span<const std::byte> src)
+    {
+        m_crc = crc32c::Extend(m_crc, UCharCast(src.data()), src.size());
+    }
+
+    uint32_t GetCRC() const { return m_crc; }
+
+    template <typename T>
+    CRC32CWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+};
+
+/** Reads data from an underlying stream, while computing the CRC32C of all data read. */
+template <typename Source>
+class CRC32CVerifier : public CRC32CWriter
+{
+private:
+    Source* m_source;
+
+public:
+    explicit CRC32CVerifier(Source* source) : CRC32CWriter(source->GetType(), source->GetVersion()), m_source(source) {}
+
+    void read(Span<std::byte> dst)
+    {
+        m_source->read(dst);
+        this->write(dst);
+    }
+
+    void ignore(size_t nSize)
+    {
+        std::byte data[1024];
+        while (nSize > 0) {
+            size_t now = std::min<size_t>(nSize, 1024);
+            read({data, now});
+            nSize -= now;
+        }
+    }
+
+    template <typename T>
+    CRC32CVerifier<Source>& operator>>(T&& obj)
+    {
+        ::Unserialize(*this, obj);
+        return *this;
+    }
+};
+} // namespace
+
+uint32_t GetBlockChecksum(const CBlock& block)
+{
+    CRC32CWriter writer{SER_DISK, CLIENT_VERSION};
+    writer << block;
+    return writer.GetCRC();
+}
 
 static FILE* OpenUndoFile(const FlatFilePos& pos, bool fReadOnly = false);
 static FlatFileSeq BlockFileSeq();
 static FlatFileSeq UndoFileSeq();
 
+namespace {
+#ifndef WIN32
+/** Block files are only mapped where there is address space to spare. */
+constexpr bool MAP_BLOCK_FILES{sizeof(void*) >= 8};
+/** Number of block files kept mapped */
+constexpr size_t MAX_MAPPED_BLOCK_FILES{16};
+
+/** A read-only mapping of a whole block file, alive while any reader uses it. */
+class MappedBlockFile
+{
+public:
+    MappedBlockFile(const unsigned char* data, size_t size) : m_data{data}, m_size{size} {}
+    ~MappedBlockFile() { munmap(const_cast<unsigned char*>(m_data), m_size); }
+
+    MappedBlockFile(const MappedBlockFile&) = delete;
+    MappedBlockFile& operator=(const MappedBlockFile&) = delete;
+
+    Span<const unsigned char> Data() const { return {m_data, m_size}; }
+
+private:
+    const unsigned char* const m_data;
+    const size_t m_size;
+};
+
+/**
+ * The most recently used block files, kept mapped so that reading a block
+ * costs neither an open(), seek and close() nor a copy through stdio.
+ * Keyed by path, as tests switch between data directories.
+ */
+class BlockFileMapCache
+{
+public:
+    /** Return a mapping of path that covers at least min_size bytes, or nullptr. */
+    std::shared_ptr<const MappedBlockFile> Get(const fs::path& path, size_t min_size)
+    {
+        LOCK(m_mutex);
+        auto it = std::find_if(m_files.begin(), m_files.end(), [&](const auto& entry) { return entry.first == path; });
+        if (it != m_files.end()) {
+            if (it->second->Data().size() >= min_size) {
+                m_files.splice(m_files.begin(), m_files, it);
+                return it->second;
+            }
+            // The file has grown since it was mapped.
+            m_files.erase(it);
+        }
+        std::shared_ptr<const MappedBlockFile> file{Map(path)};
+        if (!file || file->Data().size() < min_size) return nullptr;
+        m_files.emplace_front(path, file);
+        if (m_files.size() > MAX_MAPPED_BLOCK_FILES) m_files.pop_back();
+        return file;
+    }
+
+    /** Forget the mapping of path, e.g. because the file is about to shrink. */
+    void Drop(const fs::path& path)
+    {
+        LOCK(m_mutex);
+        m_files.remove_if([&](const auto& entry) { return entry.first == path; });
+    }
+
+private:
+    static std::shared_ptr<const MappedBlockFile> Map(const fs::path& path)
+    {
+        int fd = open(fs::PathToString(path).c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        void* addr{MAP_FAILED};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) return nullptr;
+        // Reindexing, index building and rescans read blocks in file order.
+        posix_madvise(addr, st.st_size, POSIX_MADV_SEQUENTIAL);
+        return std::make_shared<const MappedBlockFile>(static_cast<const unsigned char*>(addr), st.st_size);
+    }
+
+    Mutex m_mutex;
+    //! Most recently used first.
+    std::list<std::pair<fs::path, std::shared_ptr<const MappedBlockFile>>> m_files GUARDED_BY(m_mutex);
+};
+
+BlockFileMapCache g_block_file_maps;
+
+/** The serialized block at a position, together with the mapping that holds it. */
+struct MappedBlock {
+    std::shared_ptr<const MappedBlockFile> file;
+    Span<const unsigned char> data;
+};
+#else
+struct MappedBlock {
+    Span<const unsigned char> data;
+};
+#endif
+
+/**
+ * Locate the block stored at pos (which points past its 8 byte header) in a
+ * mapped block file. Returns nullopt if the caller should read the file
+ * instead, including when the stored size does not fit the file.
+ */
+std::optional<MappedBlock> MapBlock(const FlatFilePos& pos)
+{
+#ifndef WIN32
+    if (!MAP_BLOCK_FILES || pos.nPos < 8) return std::nullopt;
+    const fs::path path{BlockFileSeq().FileName(pos)};
+    std::shared_ptr<const MappedBlockFile> file{g_block_file_maps.Get(path, pos.nPos)};
+    if (!file) return std::nullopt;
+    const uint32_t size{ReadLE32(file->Data().data() + pos.nPos - 4)};
+    if (size > MAX_SIZE) return std::nullopt;
+    const size_t end{size_t{pos.nPos} + size};
+    if (end > file->Data().size()) {
+        file = g_block_file_maps.Get(path, end);
+        if (!file) return std::nullopt;
+    }
+    return MappedBlock{file, file->Data().subspan(pos.nPos, size)};
+#else
+    return std::nullopt;
+#endif
+}
+
+void DropMappedBlockFile(const FlatFilePos& pos)
+{
+#ifndef WIN32
+    g_block_file_maps.Drop(BlockFileSeq().FileName(pos));
+#endif
+}
+
+/**
+ * Undo data of the most recently connected blocks, and the undo records that
+ * have not been written to rev files yet.
+ *
+ * Records are written in batches when the block files are flushed, which
+ * FlushStateToDisk() does before the block index that points to them is
+ * written. Until then, and for UNDO_CACHE_BLOCKS blocks in any case,
+ * disconnecting a block does not touch the disk.
+ */
+class UndoDataCache
+{
+public:
+    void Add(const BlockManager& owner, const uint256& hash, const CBlockUndo& blockundo, const FlatFilePos& pos, std::vector<uint8_t> record)
+    {
+        LOCK(m_mutex);
+        m_recent.emplace_front(hash, std::make_shared<const CBlockUndo>(blockundo));
+        if (m_recent.size() > UNDO_CACHE_BLOCKS) m_recent.pop_back();
+        m_pending_bytes += record.size();
+        m_pending[{&owner, pos.nFile}].emplace(pos.nPos, std::move(record));
+    }
+
+    bool GetRecent(const uint256& hash, CBlockUndo& blockundo)
+    {
+        LOCK(m_mutex);
+        auto it = std::find_if(m_recent.begin(), m_recent.end(), [&](const auto& entry) { return entry.first == hash; });
+        if (it == m_recent.end()) return false;
+        m_recent.splice(m_recent.begin(), m_recent, it);
+        blockundo = *it->second;
+        return true;
+    }
+
+    /** The undo data of a pending record, given the position it was stored at, past its header. */
+    std::optional<CDataStream> GetPending(const FlatFilePos& pos)
+    {
+        LOCK(m_mutex);
+        if (pos.nPos < 8) return std::nullopt;
+        for (const auto& [file, records] : m_pending) {
+            if (file.second != pos.nFile) continue;
+            auto it = records.find(pos.nPos - 8);
+            if (it != records.end()) return CDataStream{MakeUCharSpan(it->second).subspan(8), SER_DISK, CLIENT_VERSION};
+        }
+        return std::nullopt;
+    }
+
+    size_t PendingBytes() { return WITH_LOCK(m_mutex, return m_pending_bytes); }
+
+    /** Write the pending records of one block file, or of all of them, opening each rev file once. */
+    bool Write(const BlockManager& owner, std::optional<int> only_file = std::nullopt)
+    {
+        // Readers wait rather than miss a record between the map and the file.
+        LOCK(m_mutex);
+        for (auto file = m_pending.begin(); file != m_pending.end();) {
+            if (file->first.first != &owner || (only_file && file->first.second != *only_file)) {
+                ++file;
+                continue;
+            }
+            auto& records{file->second};
+            CAutoFile fileout{OpenUndoFile(FlatFilePos{file->first.second, records.begin()->first}), SER_DISK, CLIENT_VERSION};
+            if (fileout.IsNull()) return error("%s: OpenUndoFile failed", __func__);
+            unsigned int file_pos{records.begin()->first};
+            for (const auto& [pos, record] : records) {
+                if (pos != file_pos && fseek(fileout.Get(), pos, SEEK_SET) != 0) {
+                    return error("%s: fseek failed", __func__);
+                }
+                if (fwrite(record.data(), 1, record.size(), fileout.Get()) != record.size()) {
+                    return error("%s: fwrite failed", __func__);
+                }
+                file_pos = pos + record.size();
+            }
+            if (fclose(fileout.release()) != 0) return error("%s: fclose failed", __func__);
+            for (const auto& [pos, record] : records) {
+                m_pending_bytes -= record.size();
+            }
+            file = m_pending.erase(file);
+        }
+        return true;
+    }
+
+    void Clear(const BlockManager& owner)
+    {
+        LOCK(m_mutex);
+        m_recent.clear();
+        for (auto file = m_pending.begin(); file != m_pending.end();) {
+            if (file->first.first != &owner) {
+                ++file;
+                continue;
+            }
+            for (const auto& [pos, record] : file->second) {
+                m_pending_bytes -= record.size();
+            }
+            file = m_pending.erase(file);
+        }
+    }
+
+private:
+    Mutex m_mutex;
+    //! Most recently connected first.
+    std::list<std::pair<uint256, std::shared_ptr<const CBlockUndo>>> m_recent GUARDED_BY(m_mutex);
+    //! Serialized records, header and checksum included, by the BlockManager
+    //! that allocated them, block file and position.
+    std::map<std::pair<const BlockManager*, int>, std::map<unsigned int, std::vector<uint8_t>>> m_pending GUARDED_BY(m_mutex);
+    size_t m_pending_bytes GUARDED_BY(m_mutex){0};
+};
+
+UndoDataCache g_undo_data;
+} // namespace
+
 CBlockIndex* BlockManager::LookupBlockIndex(const uint256& hash) const
 {
     AssertLockHeld(cs_main);
@@ -101,7 +425,8 @@ bool BlockManager::LoadBlockIndex(
     const Consensus::Params& consensus_params,
     ChainstateManager& chainman)
 {
-    if (!m_block_tree_db->LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); })) {
+    if (!LoadBlockIndexSnapshot(GetBlockIndexSnapshotPath(), *m_block_tree_db, m_block_index) &&
+        !m_block_tree_db->LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); })) {
         return false;
     }
 
@@ -226,6 +551,8 @@ void BlockManager::Unload()
     m_last_blockfile = 0;
     m_dirty_blockindex.clear();
     m_dirty_fileinfo.clear();
+    // Records still pending refer to the block index that was just dropped.
+    g_undo_data.Clear(*this);
 }
 
 bool BlockManager::WriteBlockIndexDB()
@@ -249,6 +576,21 @@ bool BlockManager::WriteBlockIndexDB()
     return true;
 }
 
+fs::path BlockManager::GetBlockIndexSnapshotPath()
+{
+    return gArgs.GetDataDirNet() / "blocks" / "index_snapshot.dat";
+}
+
+bool BlockManager::WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(::cs_main);
+    // Only a fully flushed index matches what LoadBlockIndexGuts() would read.
+    if (!m_block_tree_db || m_block_index.empty() || !m_dirty_blockindex.empty() || !m_dirty_fileinfo.empty()) {
+        return false;
+    }
+    return node::WriteBlockIndexSnapshot(GetBlockIndexSnapshotPath(), *m_block_tree_db, m_block_index);
+}
+
 bool BlockManager::LoadBlockIndexDB(ChainstateManager& chainman)
 {
     if (!LoadBlockIndex(::Params().GetConsensus(), chainman)) {
@@ -317,52 +659,32 @@ CBlockFileInfo* BlockManager::GetBlockFileInfo(size_t n)
     return &m_blockfile_info.at(n);
 }
 
-static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+static std::vector<uint8_t> SerializeUndo(const CBlockUndo& blockundo, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return error("%s: OpenUndoFile failed", __func__);
-    }
+    std::vector<uint8_t> record;
+    CVectorWriter writer{SER_DISK, CLIENT_VERSION, record, 0};
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(blockundo, fileout.GetVersion());
-    fileout << messageStart << nSize;
+    unsigned int nSize = GetSerializeSize(blockundo, writer.GetVersion());
+    writer << messageStart << nSize;
 
     // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0) {
-        return error("%s: ftell failed", __func__);
-    }
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    writer << blockundo;
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    writer << hasher.GetHash();
 
-    return true;
+    return record;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+template <typename Stream>
+static bool ReadUndo(Stream& filein, CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
-    const FlatFilePos pos{WITH_LOCK(::cs_main, return pindex->GetUndoPos())};
-
-    if (pos.IsNull()) {
-        return error("%s: no undo data available", __func__);
-    }
-
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("%s: OpenUndoFile failed", __func__);
-    }
-
-    // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<Stream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
         verifier << pindex->pprev->GetBlockHash();
         verifier >> blockundo;
@@ -379,8 +701,35 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
     return true;
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    const FlatFilePos pos{WITH_LOCK(::cs_main, return pindex->GetUndoPos())};
+
+    if (pos.IsNull()) {
+        return error("%s: no undo data available", __func__);
+    }
+
+    if (g_undo_data.GetRecent(pindex->GetBlockHash(), blockundo)) {
+        return true;
+    }
+    if (std::optional<CDataStream> pending{g_undo_data.GetPending(pos)}) {
+        return ReadUndo(*pending, blockundo, pindex);
+    }
+
+    // Open history file to read
+    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return error("%s: OpenUndoFile failed", __func__);
+    }
+
+    return ReadUndo(filein, blockundo, pindex);
+}
+
 void BlockManager::FlushUndoFile(int block_file, bool finalize)
 {
+    if (!g_undo_data.Write(*this, block_file)) {
+        AbortNode("Writing undo data to disk failed. This is likely the result of an I/O error.");
+    }
     FlatFilePos undo_pos_old(block_file, m_blockfile_info[block_file].nUndoSize);
     if (!UndoFileSeq().Flush(undo_pos_old, finalize)) {
         AbortNode("Flushing undo file to disk failed. This is likely the result of an I/O error.");
@@ -390,10 +739,16 @@ void BlockManager::FlushUndoFile(int block_file, bool finalize)
 void BlockManager::FlushBlockFile(bool fFinalize, bool finalize_undo)
 {
     LOCK(cs_LastBlockFile);
+    // Undo data may belong to earlier block files when connecting lags behind.
+    if (!g_undo_data.Write(*this)) {
+        AbortNode("Writing undo data to disk failed. This is likely the result of an I/O error.");
+    }
     FlatFilePos block_pos_old(m_last_blockfile, m_blockfile_info[m_last_blockfile].nSize);
     if (!BlockFileSeq().Flush(block_pos_old, fFinalize)) {
         AbortNode("Flushing block file to disk failed. This is likely the result of an I/O error.");
     }
+    // Finalizing truncates the file, and a mapping past its end must not be touched.
+    if (fFinalize) DropMappedBlockFile(block_pos_old);
     // we do not always flush the undo file, as the chain tip may be lagging behind the incoming blocks,
     // e.g. during IBD or a sync after a node going offline
     if (!fFinalize || finalize_undo) FlushUndoFile(m_last_blockfile, finalize_undo);
@@ -535,11 +890,15 @@ bool BlockManager::WriteUndoDataForBlock(const CBlockUndo& blockundo, BlockValid
     AssertLockHeld(::cs_main);
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull()) {
+        std::vector<uint8_t> record{SerializeUndo(blockundo, pindex->pprev->GetBlockHash(), chainparams.MessageStart())};
         FlatFilePos _pos;
-        if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, CLIENT_VERSION) + 40)) {
+        if (!FindUndoPos(state, pindex->nFile, _pos, record.size())) {
             return error("ConnectBlock(): FindUndoPos failed");
         }
-        if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart())) {
+        // The record is written with the next batch; the undo data is stored past its header.
+        g_undo_data.Add(*this, pindex->GetBlockHash(), blockundo, _pos, std::move(record));
+        _pos.nPos += 8;
+        if (g_undo_data.PendingBytes() > MAX_PENDING_UNDO_BYTES && !g_undo_data.Write(*this)) {
             return AbortNode(state, "Failed to write undo data");
         }
         // rev files are written in block height order, whereas blk files are written as blocks come in (often out of order)
@@ -564,17 +923,25 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::P
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-    }
+    if (const std::optional<MappedBlock> mapped{MapBlock(pos)}) {
+        try {
+            SpanReader{SER_DISK, CLIENT_VERSION, mapped->data} >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        }
 
-    // Read block
-    try {
-        filein >> block;
-    } catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -596,9 +963,76 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::P
     return true;
 }
 
+/**
+ * Read a block we stored ourselves, relying on the checksum recorded when it
+ * was accepted instead of recomputing its proof-of-work hash. Returns false
+ * if the file could not be read or the data does not match the checksum.
+ */
+static bool ReadTrustedBlockFromDisk(CBlock& block, const FlatFilePos& pos, uint32_t checksum, const Consensus::Params& consensusParams)
+{
+    block.SetNull();
+
+    if (const std::optional<MappedBlock> mapped{MapBlock(pos)}) {
+        const uint32_t crc{crc32c::Crc32c(mapped->data.data(), mapped->data.size())};
+        if (crc != checksum) {
+            return error("%s: Checksum mismatch at %s (expected %08x, got %08x)", __func__, pos.ToString(), checksum, crc);
+        }
+        try {
+            SpanReader{SER_DISK, CLIENT_VERSION, mapped->data} >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        }
+
+        CRC32CVerifier<CAutoFile> verifier(&filein);
+        try {
+            verifier >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        if (verifier.GetCRC() != checksum) {
+            return error("%s: Checksum mismatch at %s (expected %08x, got %08x)", __func__, pos.ToString(), checksum, verifier.GetCRC());
+        }
+    }
+
+    // Signet only: check block solution
+    if (consensusParams.signet_blocks && !CheckSignetBlockSolution(block, consensusParams)) {
+        return error("ReadBlockFromDisk: Errors in block solution at %s", pos.ToString());
+    }
+
+    if (block.IsProofOfStake())
+        block.nFlags |= CBlockIndex::BLOCK_PROOF_OF_STAKE;
+
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    const FlatFilePos block_pos{WITH_LOCK(cs_main, return pindex->GetBlockPos())};
+    FlatFilePos block_pos;
+    std::optional<uint32_t> checksum;
+    {
+        LOCK(cs_main);
+        block_pos = pindex->GetBlockPos();
+        if (!fParanoidBlockReads && (pindex->nStatus & BLOCK_HAVE_CHECKSUM)) {
+            checksum = pindex->nDataChecksum;
+        }
+    }
+
+    if (checksum) {
+        if (ReadTrustedBlockFromDisk(block, block_pos, *checksum, consensusParams)) {
+            if (block.GetHash() != pindex->GetBlockHash()) {
+                return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                             pindex->ToString(), block_pos.ToString());
+            }
+            return true;
+        }
+        // Fall back to fully re-verifying the header below.
+        LogPrintf("ReadBlockFromDisk: trusted read failed for %s, re-verifying proof of work\n", pindex->GetBlockHash().ToString());
+    }
 
     if (!ReadBlockFromDisk(block, block_pos, consensusParams)) {
         return false;
@@ -612,6 +1046,19 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
+#ifndef WIN32
+    if (const std::optional<MappedBlock> mapped{MapBlock(pos)}) {
+        const unsigned char* blk_start{mapped->file->Data().data() + pos.nPos - 8};
+        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                         HexStr(Span{blk_start, CMessageHeader::MESSAGE_START_SIZE}),
+                         HexStr(message_start));
+        }
+        block.assign(mapped->data.begin(), mapped->data.end());
+        return true;
+    }
+#endif
+
     FlatFilePos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
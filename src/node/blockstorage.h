@@ -34,6 +34,7 @@ struct Params;
 
 namespace node {
 static constexpr bool DEFAULT_STOPAFTERBLOCKIMPORT{false};
+static constexpr bool DEFAULT_PARANOID_BLOCK_READS{false};
 
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
@@ -41,9 +42,15 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
+/** Number of the most recently connected blocks whose undo data is kept in memory */
+static constexpr size_t UNDO_CACHE_BLOCKS{64};
+/** Size of the undo records waiting for the next flush at which they are written anyway */
+static constexpr size_t MAX_PENDING_UNDO_BYTES{16 << 20};
 
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
+/** Re-check proof of work on every block read from disk, even when a checksum is recorded */
+extern bool fParanoidBlockReads;
 
 typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 
@@ -89,6 +96,9 @@ public:
     std::set<CBlockIndex*> m_dirty_blockindex;
 
     bool WriteBlockIndexDB() EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+    /** Dump the flushed block index for a fast start next time, see node/blockindexsnapshot.h */
+    bool WriteBlockIndexSnapshot() EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+    static fs::path GetBlockIndexSnapshotPath();
     bool LoadBlockIndexDB(ChainstateManager& chainman) EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
 
     /**
@@ -134,6 +144,9 @@ FILE* OpenBlockFile(const FlatFilePos& pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 fs::path GetBlockPosFilename(const FlatFilePos& pos);
 
+/** Checksum over the on-disk serialization of a block, recorded in its index entry */
+uint32_t GetBlockChecksum(const CBlock& block);
+
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
@@ -0,0 +1,123 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/coinsprefetch.h>
+
+#include <chain.h>
+#include <clientversion.h>
+#include <logging.h>
+#include <node/blockstorage.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <txdb.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+
+namespace node {
+int g_coins_prefetch_threads{DEFAULT_COINS_PREFETCH_THREADS};
+
+CoinsPrefetcher::CoinsPrefetcher(const CCoinsViewDB& db, int threads)
+    : m_db{db}, m_threads{threads} {}
+
+void CoinsPrefetcher::Prefetch(std::vector<FlatFilePos> positions)
+{
+    if (positions.empty()) return;
+    // Workers are only spawned once there is something to do.
+    if (m_threads > 0 && m_pool.WorkerCount() == 0) m_pool.Start(m_threads);
+    const uint64_t generation{WITH_LOCK(m_mutex, return m_generation)};
+    m_pool.Submit([this, positions = std::move(positions), generation] {
+        ReadInputs(positions, generation);
+    });
+}
+
+void CoinsPrefetcher::ReadInputs(const std::vector<FlatFilePos>& positions, uint64_t generation)
+{
+    std::unordered_set<uint256, SaltedTxidHasher> created;
+    auto outpoints = std::make_shared<std::vector<COutPoint>>();
+    for (const FlatFilePos& pos : positions) {
+        // These are only hints, so there is no need to check the block.
+        CBlock block;
+        CAutoFile filein{OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION};
+        if (filein.IsNull()) break;
+        try {
+            filein >> block;
+        } catch (const std::exception& e) {
+            LogPrint(BCLog::COINDB, "%s: cannot read block at %s: %s\n", __func__, pos.ToString(), e.what());
+            break;
+        }
+        for (const CTransactionRef& tx : block.vtx) {
+            if (!tx->IsCoinBase()) {
+                for (const CTxIn& txin : tx->vin) {
+                    if (!created.count(txin.prevout.hash)) outpoints->push_back(txin.prevout);
+                }
+            }
+            created.insert(tx->GetHash());
+        }
+    }
+
+    for (size_t begin = 0; begin < outpoints->size(); begin += COINS_PREFETCH_BATCH) {
+        const size_t end{std::min(begin + COINS_PREFETCH_BATCH, outpoints->size())};
+        m_pool.Submit([this, outpoints, begin, end, generation] {
+            FetchCoins(*outpoints, begin, end, generation);
+        });
+    }
+}
+
+void CoinsPrefetcher::FetchCoins(const std::vector<COutPoint>& outpoints, size_t begin, size_t end, uint64_t generation)
+{
+    {
+        LOCK(m_mutex);
+        if (m_generation != generation || m_coins.size() >= MAX_COINS_PREFETCHED) return;
+    }
+    std::vector<std::pair<COutPoint, Coin>> found;
+    found.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        Coin coin;
+        if (m_db.GetCoin(outpoints[i], coin)) found.emplace_back(outpoints[i], std::move(coin));
+    }
+    LOCK(m_mutex);
+    if (m_generation != generation) return;
+    for (auto& [outpoint, coin] : found) {
+        m_coins.emplace(outpoint, std::move(coin));
+    }
+}
+
+size_t CoinsPrefetcher::Apply(const CBlock& block, CCoinsViewCache& cache, const CCoinsViewPending& pending)
+{
+    LOCK(m_mutex);
+    if (m_coins.empty()) return 0;
+    size_t applied{0};
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            auto it = m_coins.find(txin.prevout);
+            if (it == m_coins.end()) continue;
+            // A write in flight may or may not have reached the database when
+            // this was read; the cache will go through pending instead.
+            if (!pending.IsPending(it->first) && cache.EmplaceFetchedCoin(it->first, std::move(it->second))) {
+                ++applied;
+            }
+            m_coins.erase(it);
+        }
+    }
+    return applied;
+}
+
+void CoinsPrefetcher::Invalidate()
+{
+    LOCK(m_mutex);
+    ++m_generation;
+    m_coins.clear();
+}
+
+void CoinsPrefetcher::Stop()
+{
+    Invalidate();
+    m_pool.Stop();
+}
+} // namespace node
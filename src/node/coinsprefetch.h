@@ -0,0 +1,93 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_COINSPREFETCH_H
+#define BITCOIN_NODE_COINSPREFETCH_H
+
+#include <coins.h>
+#include <flatfile.h>
+#include <primitives/transaction.h>
+#include <sync.h>
+#include <util/hasher.h>
+#include <util/threadpool.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class CBlock;
+class CCoinsViewDB;
+
+namespace node {
+/** Default for -prefetchthreads */
+static constexpr int DEFAULT_COINS_PREFETCH_THREADS{4};
+/** Maximum for -prefetchthreads */
+static constexpr int MAX_COINS_PREFETCH_THREADS{16};
+/** How many blocks past the one being connected have their inputs prefetched */
+static constexpr int COINS_PREFETCH_BLOCKS{16};
+/** Number of outpoints read from the database by one prefetch task */
+static constexpr size_t COINS_PREFETCH_BATCH{256};
+/** Upper bound on the number of prefetched coins waiting for their block */
+static constexpr size_t MAX_COINS_PREFETCHED{200000};
+
+/** Number of prefetch threads, 0 to disable. Set from -prefetchthreads. */
+extern int g_coins_prefetch_threads;
+
+/**
+ * Reads the inputs of blocks that are about to be connected from the coins
+ * database on a pool of worker threads, so that ConnectBlock() finds them in
+ * the coins cache instead of waiting for one LevelDB read at a time.
+ *
+ * Workers only ever read the database, and keep what they find in a side
+ * map. Apply() moves the coins a block needs into the cache on the
+ * validation thread. Whoever writes to the database must call Invalidate()
+ * afterwards, so that nothing read before the write is applied.
+ *
+ * With zero threads, Prefetch() does its work synchronously.
+ */
+class CoinsPrefetcher
+{
+public:
+    CoinsPrefetcher(const CCoinsViewDB& db, int threads);
+
+    /**
+     * Read the blocks stored at positions, given in connection order, and
+     * then the coins they spend. Outputs created within the same call are
+     * skipped, as the database cannot have them yet.
+     */
+    void Prefetch(std::vector<FlatFilePos> positions);
+
+    /**
+     * Move the prefetched coins spent by block into cache, except those that
+     * cache already has an entry for or that pending is still writing.
+     *
+     * @returns the number of coins added to cache.
+     */
+    size_t Apply(const CBlock& block, CCoinsViewCache& cache, const CCoinsViewPending& pending);
+
+    /** Drop everything read so far, including reads that are still in flight. */
+    void Invalidate();
+
+    /** Invalidate() and join the workers, e.g. before the database is reopened. */
+    void Stop();
+
+private:
+    void ReadInputs(const std::vector<FlatFilePos>& positions, uint64_t generation);
+    void FetchCoins(const std::vector<COutPoint>& outpoints, size_t begin, size_t end, uint64_t generation);
+
+    const CCoinsViewDB& m_db;
+    const int m_threads;
+
+    Mutex m_mutex;
+    //! Bumped by Invalidate(); results are only kept if it did not change while they were read.
+    uint64_t m_generation GUARDED_BY(m_mutex){0};
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> m_coins GUARDED_BY(m_mutex);
+
+    //! Declared last, so that the workers are joined before the state they use goes away.
+    ThreadPool m_pool{"prefetch"};
+};
+} // namespace node
+
+#endif // BITCOIN_NODE_COINSPREFETCH_H
@@ -29,6 +29,8 @@ using interfaces::Init;
 using interfaces::WalletLoader;
 
 namespace node {
+class BlockTemplateCache;
+
 //! NodeContext struct containing references to chain state and connection
 //! state.
 //!
@@ -46,6 +48,7 @@ struct NodeContext {
     std::unique_ptr<CConnman> connman;
     std::unique_ptr<CTxMemPool> mempool;
     std::unique_ptr<PeerManager> peerman;
+    std::unique_ptr<BlockTemplateCache> template_cache;
     std::unique_ptr<ChainstateManager> chainman;
     std::unique_ptr<BanMan> banman;
     ArgsManager* args{nullptr}; // Currently a raw pointer because the memory is not managed by this struct
@@ -39,6 +39,8 @@
 #include <wallet/wallet.h>
 
 #include <algorithm>
+#include <limits>
+#include <queue>
 #include <utility>
 
 #include <boost/thread.hpp>
@@ -133,7 +135,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     LOCK2(cs_main, m_mempool.cs);
 
-    CBlockIndex* pindexPrev = m_node->chainman->ActiveChain().Tip();
+    CBlockIndex* pindexPrev = m_chainstate.m_chain.Tip();
     assert(pindexPrev != nullptr);
     nHeight = pindexPrev->nHeight + 1;
 
@@ -147,9 +149,23 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
+    m_lock_time_cutoff = pindexPrev->GetMedianTimePast();
+
+    // Decide whether to include witness transactions
+    // This is only needed in case the witness softfork activation is reverted
+    // (which would require a very deep reorganization).
+    // Note that the mempool would accept transactions with witness data before
+    // the deployment is active, but we would only ever mine blocks after activation
+    // unless there is a massive block reorganization with the witness softfork
+    // not activated.
+    // TODO: replace this with a call to main to assess validity of a mempool
+    // transaction (which in most cases can be a no-op).
+    fIncludeWitness = IsBTC16BIPsEnabled(pindexPrev->nTime);
+
     int nPackagesSelected = 0;
-    int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, pblock->nTime);
+    // The cache follows the node's mempool, so it is of no use for any other
+    BlockTemplateCache* cache{m_node && m_node->mempool.get() == &m_mempool ? m_node->template_cache.get() : nullptr};
+    SelectTransactions(*pindexPrev, pblock->nTime, cache, nPackagesSelected);
 
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
@@ -201,19 +217,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         pblock->nVersion = gArgs.GetIntArg("-blockversion", pblock->nVersion);
     }
 
-    m_lock_time_cutoff = pindexPrev->GetMedianTimePast();
-
-    // Decide whether to include witness transactions
-    // This is only needed in case the witness softfork activation is reverted
-    // (which would require a very deep reorganization).
-    // Note that the mempool would accept transactions with witness data before
-    // the deployment is active, but we would only ever mine blocks after activation
-    // unless there is a massive block reorganization with the witness softfork
-    // not activated.
-    // TODO: replace this with a call to main to assess validity of a mempool
-    // transaction (which in most cases can be a no-op).
-    fIncludeWitness = IsBTC16BIPsEnabled(pindexPrev->nTime);
-
     int64_t nTime1 = GetTimeMicros();
 
     m_last_block_num_txs = nBlockTx;
@@ -244,21 +247,38 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+void BlockAssembler::SelectTransactions(const CBlockIndex& prev, uint32_t nTime, BlockTemplateCache* cache, int& nPackagesSelected)
 {
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        } else {
-            iit++;
+    AssertLockHeld(m_mempool.cs);
+
+    const BlockTemplateCache::Key key{prev.GetBlockHash(), nHeight, m_lock_time_cutoff, nTime, nBlockMaxWeight, fIncludeWitness};
+    std::vector<BlockTemplateCache::Entry> txs;
+    if (cache && cache->Get(key, txs, nBlockWeight, nBlockSigOpsCost, nFees)) {
+        for (BlockTemplateCache::Entry& entry : txs) {
+            pblocktemplate->block.vtx.push_back(std::move(entry.tx));
+            pblocktemplate->vTxFees.push_back(entry.fee);
+            pblocktemplate->vTxSigOpsCost.push_back(entry.sigops_cost);
         }
+        nBlockTx = txs.size();
+        return;
     }
+
+    addPackageTxs(nPackagesSelected, nTime);
+    if (!cache) return;
+
+    const std::vector<CTransactionRef>& vtx{pblocktemplate->block.vtx};
+    const size_t first_tx{vtx.size() - nBlockTx};
+    const size_t first_fee{pblocktemplate->vTxFees.size() - nBlockTx};
+    txs.reserve(nBlockTx);
+    for (size_t i = 0; i < nBlockTx; ++i) {
+        txs.push_back({vtx[first_tx + i], pblocktemplate->vTxFees[first_fee + i], pblocktemplate->vTxSigOpsCost[first_fee + i]});
+    }
+    cache->Store(key, std::move(txs), nBlockWeight, nBlockSigOpsCost, nFees, m_all_packages_fit);
 }
 
 bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const
@@ -277,19 +297,17 @@ bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost
 // - transaction finality (locktime)
 // - premature witness (in case segwit transactions are added to mempool before
 //   segwit activation)
-bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& package, uint32_t nTime) const
+bool BlockAssembler::TestTransaction(CTxMemPool::txiter it, uint32_t nTime) const
 {
-    for (CTxMemPool::txiter it : package) {
-        if (!IsFinalTx(it->GetTx(), nHeight, m_lock_time_cutoff)) {
-            return false;
-        }
-        if (!fIncludeWitness && it->GetTx().HasWitness()) {
-            return false;
-
-        // nowp: timestamp limit
-        if (it->GetTx().nTime > GetAdjustedTime() || (nTime && it->GetTx().nTime > nTime))
-            return false;
-        }
+    if (!IsFinalTx(it->GetTx(), nHeight, m_lock_time_cutoff)) {
+        return false;
+    }
+    if (!fIncludeWitness && it->GetTx().HasWitness()) {
+        return false;
+    }
+    // nowp: timestamp limit
+    if (it->GetTx().nTime > GetAdjustedTime() || (nTime && it->GetTx().nTime > nTime)) {
+        return false;
     }
     return true;
 }
@@ -313,90 +331,45 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-        indexed_modified_transaction_set &mapModifiedTx)
+// This transaction selection algorithm takes the chunks of the mempool's
+// clusters in order of decreasing feerate. The chunks of a cluster only build
+// on earlier chunks of the same cluster, and their feerates never increase,
+// so the best chunk left is always the next one of some cluster, and nothing
+// needs to be rescored as transactions get selected. Only a chunk that loses
+// transactions, to failed checks, is ranked again by what is left of it.
+void BlockAssembler::addPackageTxs(int& nPackagesSelected, uint32_t nTime)
 {
     AssertLockHeld(m_mempool.cs);
 
-    int nDescendantsUpdated = 0;
-    for (CTxMemPool::txiter it : alreadyAdded) {
-        CTxMemPool::setEntries descendants;
-        m_mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
-        for (CTxMemPool::txiter desc : descendants) {
-            if (alreadyAdded.count(desc)) {
-                continue;
-            }
-            ++nDescendantsUpdated;
-            modtxiter mit = mapModifiedTx.find(desc);
-            if (mit == mapModifiedTx.end()) {
-                CTxMemPoolModifiedEntry modEntry(desc);
-                modEntry.nSizeWithAncestors -= it->GetTxSize();
-                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-                modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
-                mapModifiedTx.insert(modEntry);
-            } else {
-                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-            }
+    // Keep track of entries that failed inclusion, to leave out what spends them
+    CTxMemPool::setEntries failedTx;
+    m_all_packages_fit = true;
+
+    // nowp: transactions timestamped after the block cannot be included, and
+    // neither can anything spending them, so rule them out up front
+    if (nTime) {
+        const auto& by_time{m_mempool.mapTx.get<tx_time>()};
+        for (auto it = by_time.upper_bound(nTime); it != by_time.end(); ++it) {
+            const CTxMemPool::txiter txit{m_mempool.mapTx.project<0>(it)};
+            if (!failedTx.count(txit)) m_mempool.CalculateDescendants(txit, failedTx);
         }
     }
-    return nDescendantsUpdated;
-}
-
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, CTxMemPool::setEntries& failedTx)
-{
-    AssertLockHeld(m_mempool.cs);
-
-    assert(it != m_mempool.mapTx.end());
-    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
-}
 
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
-
-// This transaction selection algorithm orders the mempool based
-// on feerate of a transaction including all unconfirmed ancestors.
-// Since we don't remove transactions from the mempool as we select them
-// for block inclusion, we need an alternate method of updating the feerate
-// of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated, uint32_t nTime)
-{
-    AssertLockHeld(m_mempool.cs);
-
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
-
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = m_mempool.mapTx.get<ancestor_score>().begin();
-    CTxMemPool::txiter iter;
+    // The next chunk of every cluster, best feerate on top
+    struct ChunkRef {
+        FeeFrac feerate;
+        const CTxMemPool::Cluster* cluster;
+        size_t index;
+    };
+    auto worse = [](const ChunkRef& a, const ChunkRef& b) {
+        if (b.feerate.HigherThan(a.feerate)) return true;
+        if (a.feerate.HigherThan(b.feerate)) return false;
+        return CompareIteratorByHash()(b.cluster->txs.front(), a.cluster->txs.front());
+    };
+    std::priority_queue<ChunkRef, std::vector<ChunkRef>, decltype(worse)> chunks{worse};
+    for (const auto& [id, cluster] : m_mempool.GetClusters()) {
+        chunks.push({cluster.chunks[0].feerate, &cluster, 0});
+    }
 
     // Limit the number of attempts to add transactions to the block when it is
     // close to full; this is just a simple heuristic to finish quickly if the
@@ -404,58 +377,46 @@ void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    while (mi != m_mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != m_mempool.mapTx.get<ancestor_score>().end() &&
-            SkipMapTxEntry(m_mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
-            continue;
-        }
-
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
-
-        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == m_mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
-        } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = m_mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
+    while (!chunks.empty()) {
+        const ChunkRef chunk{chunks.top()};
+        const CTxMemPool::Cluster& cluster{*chunk.cluster};
+        chunks.pop();
+
+        // Whatever failed, or spends something that did, is left out of the
+        // chunk; the rest of it stays in linearization order.
+        std::vector<CTxMemPool::txiter> package;
+        FeeFrac package_feerate;
+        int64_t packageSigOpsCost = 0;
+        for (size_t i = chunk.index ? cluster.chunks[chunk.index - 1].end : 0; i < cluster.chunks[chunk.index].end; ++i) {
+            const CTxMemPool::txiter it{cluster.txs[i]};
+            if (inBlock.count(it) || failedTx.count(it)) continue;
+            if (!TestTransaction(it, nTime)) {
+                m_mempool.CalculateDescendants(it, failedTx);
+                continue;
             }
+            package.push_back(it);
+            package_feerate += {it->GetModifiedFee(), int64_t(it->GetTxSize())};
+            packageSigOpsCost += it->GetSigOpCost();
         }
 
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
-        assert(!inBlock.count(iter));
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageSigOpsCost = modit->nSigOpCostWithAncestors;
+        // What is left of a chunk may pay less than the chunk did. If another
+        // chunk now beats it, rank it again by its own feerate; it keeps the
+        // cluster's place until then.
+        if (!package.empty() && chunk.feerate.HigherThan(package_feerate) &&
+            !chunks.empty() && chunks.top().feerate.HigherThan(package_feerate)) {
+            chunks.push({package_feerate, &cluster, chunk.index});
+            continue;
         }
+        if (chunk.index + 1 < cluster.chunks.size()) {
+            chunks.push({cluster.chunks[chunk.index + 1].feerate, &cluster, chunk.index + 1});
+        }
+        if (package.empty()) continue;
 
-        if (!TestPackage(packageSize, packageSigOpsCost)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
+        if (!TestPackage(package_feerate.size, packageSigOpsCost)) {
+            m_all_packages_fit = false;
+            // Later chunks may build on this one
+            for (const CTxMemPool::txiter it : package) {
+                m_mempool.CalculateDescendants(it, failedTx);
             }
 
             ++nConsecutiveFailed;
@@ -468,41 +429,155 @@ void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpda
             continue;
         }
 
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        m_mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-        onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
+        // This chunk will make it in; reset the failed counter.
+        nConsecutiveFailed = 0;
 
-        // Test if all tx's are Final
-        if (!TestPackageTransactions(ancestors,nTime)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
-            continue;
+        for (const CTxMemPool::txiter it : package) {
+            AddToBlock(it);
         }
 
-        // This transaction will make it in; reset the failed counter.
-        nConsecutiveFailed = 0;
+        ++nPackagesSelected;
+    }
+}
+
+BlockTemplateCache::BlockTemplateCache(const CTxMemPool& mempool)
+    : m_mempool{mempool} {}
+
+bool BlockTemplateCache::Get(const Key& key, std::vector<Entry>& txs, uint64_t& weight, uint64_t& sigops_cost, CAmount& fees)
+{
+    AssertLockHeld(m_mempool.cs);
+
+    LOCK(m_mutex);
+    // Height and lock time cutoff follow from the tip. Everything included was
+    // timestamped no later than m_key.time, and nothing left out is timestamped
+    // before m_horizon.
+    if (!m_valid || key.tip != m_key.tip || key.max_weight != m_key.max_weight ||
+        key.include_witness != m_key.include_witness || key.time < m_key.time || key.time >= m_horizon) {
+        return false;
+    }
+    // Notifications are processed in the background, so they may not have
+    // caught up with the mempool yet.
+    if (m_mempool_sequence != m_mempool.GetSequence() || m_transactions_updated != m_mempool.GetTransactionsUpdated()) {
+        return false;
+    }
+    txs = m_txs;
+    weight = m_weight;
+    sigops_cost = m_sigops_cost;
+    fees = m_fees;
+    return true;
+}
 
-        // Package can be added. Sort the entries in a valid order.
-        std::vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, sortedEntries);
+void BlockTemplateCache::Store(const Key& key, std::vector<Entry> txs, uint64_t weight, uint64_t sigops_cost, CAmount fees, bool complete)
+{
+    AssertLockHeld(m_mempool.cs);
 
-        for (size_t i = 0; i < sortedEntries.size(); ++i) {
-            AddToBlock(sortedEntries[i]);
-            // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+    LOCK(m_mutex);
+    m_valid = true;
+    m_key = key;
+    m_txs = std::move(txs);
+    m_weight = weight;
+    m_sigops_cost = sigops_cost;
+    m_fees = fees;
+    m_complete = complete;
+    m_included.clear();
+    for (const Entry& entry : m_txs) {
+        m_included.insert(entry.tx->GetHash());
+    }
+    m_excluded.clear();
+    if (m_complete) {
+        for (const CTxMemPoolEntry& entry : m_mempool.mapTx) {
+            const uint256& txid{entry.GetTx().GetHash()};
+            if (!m_included.count(txid)) m_excluded.insert(txid);
         }
+    }
+    const auto& by_time{m_mempool.mapTx.get<tx_time>()};
+    const auto later{by_time.upper_bound(key.time)};
+    m_horizon = later == by_time.end() ? std::numeric_limits<uint32_t>::max() : later->GetTx().nTime;
+    m_mempool_sequence = m_mempool.GetSequence();
+    m_transactions_updated = m_mempool.GetTransactionsUpdated();
+}
 
-        ++nPackagesSelected;
+bool BlockTemplateCache::Sync(uint64_t mempool_sequence)
+{
+    // Already part of the selection, or nothing to update
+    if (!m_valid || mempool_sequence < m_mempool_sequence) return false;
+    if (mempool_sequence > m_mempool_sequence) {
+        // The mempool changed without a notification, e.g. for a block
+        m_valid = false;
+        return false;
+    }
+    ++m_mempool_sequence;
+    ++m_transactions_updated;
+    return true;
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence)
+{
+    LOCK2(m_mempool.cs, m_mutex);
+    if (!Sync(mempool_sequence)) return;
+    if (!m_complete) {
+        // It may be worth more than something that was selected.
+        m_valid = false;
+        return;
+    }
+
+    const uint256& txid{tx->GetHash()};
+    bool eligible{tx->nTime <= m_key.time && IsFinalTx(*tx, m_key.height, m_key.lock_time_cutoff) &&
+                  (m_key.include_witness || !tx->HasWitness())};
+    for (const CTxIn& txin : tx->vin) {
+        if (m_excluded.count(txin.prevout.hash)) eligible = false;
+    }
+    if (tx->nTime > m_key.time) m_horizon = std::min(m_horizon, tx->nTime);
+    const auto it{m_mempool.mapTx.find(txid)};
+    if (!eligible || it == m_mempool.mapTx.end()) {
+        // If it is already gone, its removal comes next.
+        m_excluded.insert(txid);
+        return;
+    }
+    if (m_weight + WITNESS_SCALE_FACTOR * it->GetTxSize() >= m_key.max_weight ||
+        m_sigops_cost + it->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST) {
+        // Once the block is full, the package selection decides what goes in.
+        m_valid = false;
+        return;
+    }
+    m_txs.push_back({it->GetSharedTx(), it->GetFee(), it->GetSigOpCost()});
+    m_weight += it->GetTxWeight();
+    m_sigops_cost += it->GetSigOpCost();
+    m_fees += it->GetFee();
+    m_included.insert(txid);
+}
 
-        // Update transactions that depend on each of these
-        nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
+void BlockTemplateCache::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence)
+{
+    LOCK(m_mutex);
+    if (!Sync(mempool_sequence)) return;
+
+    const uint256& txid{tx->GetHash()};
+    if (m_excluded.erase(txid) || !m_included.count(txid)) return;
+    if (!m_complete) {
+        // The space it leaves may go to something that was left out.
+        m_valid = false;
+        return;
     }
+    // Its descendants leave along with it, so the order stays valid.
+    const auto it{std::find_if(m_txs.begin(), m_txs.end(), [&](const Entry& entry) { return entry.tx->GetHash() == txid; })};
+    m_weight -= GetTransactionWeight(*it->tx);
+    m_sigops_cost -= it->sigops_cost;
+    m_fees -= it->fee;
+    m_txs.erase(it);
+    m_included.erase(txid);
+}
+
+void BlockTemplateCache::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    // The selection is for the old tip. Rather than selecting for the new one
+    // here, under cs_main on the notification thread, the next template
+    // request does it.
+    LOCK(m_mutex);
+    m_valid = false;
+    m_txs.clear();
+    m_included.clear();
+    m_excluded.clear();
 }
 
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
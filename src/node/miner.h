@@ -7,16 +7,17 @@
 #define BITCOIN_NODE_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
 #include <node/context.h>
+#include <util/hasher.h>
+#include <validationinterface.h>
 #include <memory>
 #include <optional>
 #include <stdint.h>
+#include <unordered_set>
 #include <wallet/wallet.h>
 
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index_container.hpp>
-
 extern int64_t nLastCoinStakeSearchInterval;
 class ChainstateManager;
 
@@ -37,94 +38,91 @@ struct CBlockTemplate
     std::vector<unsigned char> vchCoinbaseCommitment;
 };
 
-// Container for tracking updates to ancestor feerate as we include (parent)
-// transactions in a block
-struct CTxMemPoolModifiedEntry {
-    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
-    {
-        iter = entry;
-        nSizeWithAncestors = entry->GetSizeWithAncestors();
-        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
-        nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
-    }
-
-    int64_t GetModifiedFee() const { return iter->GetModifiedFee(); }
-    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
-    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
-    size_t GetTxSize() const { return iter->GetTxSize(); }
-    const CTransaction& GetTx() const { return iter->GetTx(); }
-
-    CTxMemPool::txiter iter;
-    uint64_t nSizeWithAncestors;
-    CAmount nModFeesWithAncestors;
-    int64_t nSigOpCostWithAncestors;
-};
-
-/** Comparator for CTxMemPool::txiter objects.
- *  It simply compares the internal memory address of the CTxMemPoolEntry object
- *  pointed to. This means it has no meaning, and is only useful for using them
- *  as key in other indexes.
+/**
+ * The transactions BlockAssembler selected for the last block template, kept
+ * up to date as transactions enter and leave the mempool. As long as the tip
+ * stays the same, the next template reuses them instead of running the
+ * package selection again.
+ *
+ * While every eligible transaction fit into the block, a transaction entering
+ * the mempool is appended if it fits as well, and one leaving it is dropped.
+ * Transactions timestamped after the template, and those spending them, are
+ * tracked separately: the selection only stays valid up to the earliest of
+ * their timestamps. Anything else (a full block, a prioritised transaction,
+ * a missed notification) makes the next template start over.
+ *
+ * A new tip only drops the selection; the first template requested on top
+ * of it runs the package selection again.
  */
-struct CompareCTxMemPoolIter {
-    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-    {
-        return &(*a) < &(*b);
-    }
-};
+class BlockTemplateCache final : public CValidationInterface
+{
+public:
+    struct Entry {
+        CTransactionRef tx;
+        CAmount fee;
+        int64_t sigops_cost;
+    };
 
-struct modifiedentry_iter {
-    typedef CTxMemPool::txiter result_type;
-    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
-    {
-        return entry.iter;
-    }
-};
+    /** Everything the selection depends on besides the mempool. */
+    struct Key {
+        uint256 tip;
+        int height;
+        int64_t lock_time_cutoff;
+        //! Transactions timestamped later were left out.
+        uint32_t time;
+        unsigned int max_weight;
+        bool include_witness;
+    };
 
-// A comparator that sorts transactions based on number of ancestors.
-// This is sufficient to sort an ancestor package in an order that is valid
-// to appear in a block.
-struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-    {
-        if (a->GetCountWithAncestors() != b->GetCountWithAncestors()) {
-            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-        }
-        return CompareIteratorByHash()(a, b);
-    }
-};
+    explicit BlockTemplateCache(const CTxMemPool& mempool);
+
+    /**
+     * Copy the selection into txs and the totals, which include the space
+     * reserved for the coinbase, if it is still what BlockAssembler would
+     * select for key.
+     */
+    bool Get(const Key& key, std::vector<Entry>& txs, uint64_t& weight, uint64_t& sigops_cost, CAmount& fees)
+        EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs, !m_mutex);
+
+    /**
+     * Remember what BlockAssembler selected for key. complete tells whether
+     * every transaction that passed the per-transaction checks fit.
+     */
+    void Store(const Key& key, std::vector<Entry> txs, uint64_t weight, uint64_t sigops_cost, CAmount fees, bool complete)
+        EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs, !m_mutex);
+
+protected:
+    void TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) override
+        EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override
+        EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override
+        EXCLUSIVE_LOCKS_REQUIRED(!m_mutex);
 
-typedef boost::multi_index_container<
-    CTxMemPoolModifiedEntry,
-    boost::multi_index::indexed_by<
-        boost::multi_index::ordered_unique<
-            modifiedentry_iter,
-            CompareCTxMemPoolIter
-        >,
-        // sorted by modified ancestor fee rate
-        boost::multi_index::ordered_non_unique<
-            // Reuse same tag from CTxMemPool's similar index
-            boost::multi_index::tag<ancestor_score>,
-            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
-            CompareTxMemPoolEntryByAncestorFee
-        >
-    >
-> indexed_modified_transaction_set;
-
-typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
-typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
-
-struct update_for_parent_inclusion
-{
-    explicit update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+private:
+    /** Account for the notification with mempool_sequence, returning whether it still needs to be applied. */
+    bool Sync(uint64_t mempool_sequence) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
 
-    void operator() (CTxMemPoolModifiedEntry &e)
-    {
-        e.nModFeesWithAncestors -= iter->GetFee();
-        e.nSizeWithAncestors -= iter->GetTxSize();
-        e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
-    }
+    const CTxMemPool& m_mempool;
 
-    CTxMemPool::txiter iter;
+    Mutex m_mutex;
+    //! Whether there is a selection to reuse at all.
+    bool m_valid GUARDED_BY(m_mutex){false};
+    Key m_key GUARDED_BY(m_mutex);
+    std::vector<Entry> m_txs GUARDED_BY(m_mutex);
+    uint64_t m_weight GUARDED_BY(m_mutex){0};
+    uint64_t m_sigops_cost GUARDED_BY(m_mutex){0};
+    CAmount m_fees GUARDED_BY(m_mutex){0};
+    //! Whether every eligible transaction is part of the selection.
+    bool m_complete GUARDED_BY(m_mutex){false};
+    std::unordered_set<uint256, SaltedTxidHasher> m_included GUARDED_BY(m_mutex);
+    //! The other mempool transactions, only tracked while m_complete.
+    std::unordered_set<uint256, SaltedTxidHasher> m_excluded GUARDED_BY(m_mutex);
+    //! Earliest timestamp of a transaction that was left out for its timestamp.
+    uint32_t m_horizon GUARDED_BY(m_mutex){0};
+    //! The mempool state the selection reflects.
+    uint64_t m_mempool_sequence GUARDED_BY(m_mutex){0};
+    unsigned int m_transactions_updated GUARDED_BY(m_mutex){0};
 };
 
 /** Generate a new block, without valid proof-of-work */
@@ -149,6 +147,9 @@ private:
     int nHeight;
     int64_t m_lock_time_cutoff;
 
+    // Whether addPackageTxs() found room for every package it tried
+    bool m_all_packages_fit;
+
     const CChainParams& chainparams;
     const CTxMemPool& m_mempool;
     CChainState& m_chainstate;
@@ -164,6 +165,7 @@ public:
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet=nullptr, bool* pfPoSCancel=nullptr, NodeContext* m_node=nullptr);
+
     //std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
 
     inline static std::optional<int64_t> m_last_block_num_txs{};
@@ -175,32 +177,24 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Select the block's transactions, reusing those in cache if possible */
+    void SelectTransactions(const CBlockIndex& prev, uint32_t nTime, BlockTemplateCache* cache, int& nPackagesSelected)
+        EXCLUSIVE_LOCKS_REQUIRED(::cs_main, m_mempool.cs);
 
     // Methods for how to add transactions to a block.
-    /** Add transactions based on feerate including unconfirmed ancestors
-      * Increments nPackagesSelected / nDescendantsUpdated with corresponding
-      * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated, uint32_t nTime) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
+    /** Add transactions chunk by chunk, in the order of the mempool's cluster
+      * linearizations. Increments nPackagesSelected with the number of chunks
+      * selected (for logging statistics). */
+    void addPackageTxs(int& nPackagesSelected, uint32_t nTime) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
 
     // helper functions for addPackageTxs()
-    /** Remove confirmed (inBlock) entries from given set */
-    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
     /** Test if a new package would "fit" in the block */
     bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const;
-    /** Perform checks on each transaction in a package:
-      * locktime, premature-witness, serialized size (if necessary)
+    /** Perform checks on a transaction of a package:
+      * locktime, premature-witness, timestamp
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
-    bool TestPackageTransactions(const CTxMemPool::setEntries& package, uint32_t nTime) const;
-    /** Return true if given transaction from mapTx has already been evaluated,
-      * or if the transaction's cached data in mapTx is incorrect. */
-    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, CTxMemPool::setEntries& failedTx) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries);
-    /** Add descendants of given transactions to mapModifiedTx with ancestor
-      * state updated assuming given transactions are inBlock. Returns number
-      * of updated descendants. */
-    int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
+    bool TestTransaction(CTxMemPool::txiter it, uint32_t nTime) const;
 };
 
 /** Modify the extranonce in a block */
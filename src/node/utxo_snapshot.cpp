@@ -0,0 +1,183 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/utxo_snapshot.h>
+
+#include <clientversion.h>
+#include <compressor.h>
+#include <script/script.h>
+#include <streams.h>
+
+#include <crc32c/crc32c.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+
+namespace node {
+namespace {
+//! Coins of one transaction, which share everything but their index and output.
+struct TxCoins {
+    const uint256* txid;
+    uint32_t height;
+    bool coinbase;
+    bool coinstake;
+    uint32_t time;
+    size_t begin;
+    size_t end;
+};
+
+uint64_t ZigZag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+int64_t UnZigZag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+} // namespace
+
+SnapshotChunk EncodeSnapshotChunk(const std::vector<std::pair<COutPoint, Coin>>& coins)
+{
+    std::vector<TxCoins> txs;
+    for (size_t i = 0; i < coins.size(); ++i) {
+        const auto& [outpoint, coin] = coins[i];
+        if (!txs.empty()) {
+            TxCoins& tx{txs.back()};
+            if (*tx.txid == outpoint.hash && tx.height == coin.nHeight && tx.coinbase == coin.IsCoinBase() &&
+                tx.coinstake == coin.IsCoinStake() && tx.time == coin.nTime && coins[i - 1].first.n < outpoint.n) {
+                tx.end = i + 1;
+                continue;
+            }
+        }
+        txs.push_back({&outpoint.hash, coin.nHeight, coin.IsCoinBase(), coin.IsCoinStake(), coin.nTime, i, i + 1});
+    }
+    std::stable_sort(txs.begin(), txs.end(), [](const TxCoins& a, const TxCoins& b) {
+        return std::tie(a.height, a.time) < std::tie(b.height, b.time);
+    });
+
+    SnapshotChunk chunk;
+    chunk.m_coins_count = coins.size();
+    CVectorWriter writer{SER_DISK, CLIENT_VERSION, chunk.m_payload, 0};
+    writer << VARINT(uint64_t{txs.size()});
+    for (const TxCoins& tx : txs) {
+        writer << *tx.txid;
+    }
+    for (const TxCoins& tx : txs) {
+        writer << VARINT(uint64_t{tx.end - tx.begin});
+        for (size_t i = tx.begin; i < tx.end; ++i) {
+            const uint32_t n{coins[i].first.n};
+            writer << VARINT(i == tx.begin ? n : n - coins[i - 1].first.n - 1);
+        }
+    }
+    uint32_t height{0};
+    for (const TxCoins& tx : txs) {
+        writer << VARINT((uint64_t{tx.height - height} << 2) | (tx.coinbase << 1) | tx.coinstake);
+        height = tx.height;
+    }
+    uint32_t time{0};
+    for (const TxCoins& tx : txs) {
+        writer << VARINT(ZigZag(int64_t{tx.time} - time));
+        time = tx.time;
+    }
+    for (const TxCoins& tx : txs) {
+        for (size_t i = tx.begin; i < tx.end; ++i) {
+            writer << VARINT(CompressAmount(coins[i].second.out.nValue));
+        }
+    }
+    // Staking keeps paying to the same scripts, so they are stored once.
+    std::map<CScript, uint64_t> scripts;
+    for (const TxCoins& tx : txs) {
+        for (size_t i = tx.begin; i < tx.end; ++i) {
+            const CScript& script{coins[i].second.out.scriptPubKey};
+            const auto [it, inserted] = scripts.emplace(script, scripts.size() + 1);
+            if (inserted) {
+                writer << VARINT(uint64_t{0}) << Using<ScriptCompression>(script);
+            } else {
+                writer << VARINT(it->second);
+            }
+        }
+    }
+    chunk.m_checksum = crc32c::Crc32c(chunk.m_payload.data(), chunk.m_payload.size());
+    return chunk;
+}
+
+bool DecodeSnapshotChunk(const SnapshotChunk& chunk, std::vector<std::pair<COutPoint, Coin>>& coins)
+{
+    if (crc32c::Crc32c(chunk.m_payload.data(), chunk.m_payload.size()) != chunk.m_checksum) return false;
+
+    coins.clear();
+    try {
+        CDataStream reader{chunk.m_payload, SER_DISK, CLIENT_VERSION};
+        uint64_t tx_count;
+        reader >> VARINT(tx_count);
+        if (tx_count > chunk.m_coins_count) return false;
+        std::vector<uint256> txids(tx_count);
+        for (uint256& txid : txids) {
+            reader >> txid;
+        }
+
+        coins.reserve(chunk.m_coins_count);
+        std::vector<size_t> tx_ends;
+        tx_ends.reserve(tx_count);
+        for (const uint256& txid : txids) {
+            uint64_t count;
+            reader >> VARINT(count);
+            if (count == 0 || count > chunk.m_coins_count - coins.size()) return false;
+            uint64_t n{0};
+            for (uint64_t i = 0; i < count; ++i) {
+                uint64_t gap;
+                reader >> VARINT(gap);
+                if (gap > std::numeric_limits<uint32_t>::max()) return false;
+                n = i == 0 ? gap : n + 1 + gap;
+                if (n > std::numeric_limits<uint32_t>::max()) return false;
+                coins.emplace_back(COutPoint{txid, uint32_t(n)}, Coin{});
+            }
+            tx_ends.push_back(coins.size());
+        }
+        if (coins.size() != chunk.m_coins_count) return false;
+
+        uint64_t height{0};
+        for (size_t tx = 0, i = 0; tx < tx_count; ++tx) {
+            uint64_t code;
+            reader >> VARINT(code);
+            height += code >> 2;
+            if (height >= (uint64_t{1} << 30)) return false;
+            for (; i < tx_ends[tx]; ++i) {
+                Coin& coin{coins[i].second};
+                coin.nHeight = height;
+                coin.fCoinBase = (code >> 1) & 1;
+                coin.fCoinStake = code & 1;
+            }
+        }
+        int64_t time{0};
+        for (size_t tx = 0, i = 0; tx < tx_count; ++tx) {
+            uint64_t delta;
+            reader >> VARINT(delta);
+            if (delta > ZigZag(std::numeric_limits<uint32_t>::max())) return false;
+            time += UnZigZag(delta);
+            if (time < 0 || time > std::numeric_limits<uint32_t>::max()) return false;
+            for (; i < tx_ends[tx]; ++i) {
+                coins[i].second.nTime = time;
+            }
+        }
+        for (auto& [outpoint, coin] : coins) {
+            uint64_t amount;
+            reader >> VARINT(amount);
+            coin.out.nValue = DecompressAmount(amount);
+        }
+        std::vector<CScript> scripts;
+        for (auto& [outpoint, coin] : coins) {
+            uint64_t ref;
+            reader >> VARINT(ref);
+            if (ref == 0) {
+                reader >> Using<ScriptCompression>(coin.out.scriptPubKey);
+                scripts.push_back(coin.out.scriptPubKey);
+            } else if (ref <= scripts.size()) {
+                coin.out.scriptPubKey = scripts[ref - 1];
+            } else {
+                return false;
+            }
+        }
+        return reader.empty();
+    } catch (const std::ios_base::failure&) {
+        return false;
+    }
+}
+} // namespace node
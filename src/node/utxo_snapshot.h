@@ -6,10 +6,34 @@
 #ifndef BITCOIN_NODE_UTXO_SNAPSHOT_H
 #define BITCOIN_NODE_UTXO_SNAPSHOT_H
 
-#include <uint256.h>
+#include <coins.h>
+#include <primitives/transaction.h>
 #include <serialize.h>
+#include <span.h>
+#include <uint256.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <utility>
+#include <vector>
 
 namespace node {
+//! Leading bytes of the metadata of snapshots that are not in the legacy format.
+static constexpr unsigned char SNAPSHOT_MAGIC_BYTES[5]{'u', 't', 'x', 'o', 0xff};
+//! Number of coins dumptxoutset puts into one chunk of a columnar snapshot.
+static constexpr size_t SNAPSHOT_CHUNK_COINS{65536};
+//! Maximum number of threads encoding or decoding snapshot chunks.
+static constexpr int MAX_SNAPSHOT_THREADS{16};
+
+//! How the coins following the SnapshotMetadata are laid out.
+enum class SnapshotFormat : uint8_t {
+    //! A (COutPoint, Coin) record per coin.
+    LEGACY = 0,
+    //! SnapshotChunk records, see EncodeSnapshotChunk().
+    COLUMNAR = 1,
+};
+
 //! Metadata describing a serialized version of a UTXO set from which an
 //! assumeutxo CChainState can be constructed.
 class SnapshotMetadata
@@ -23,6 +47,13 @@ public:
     //! during snapshot load to estimate progress of UTXO set reconstruction.
     uint64_t m_coins_count = 0;
 
+    //! Layout of the coins in the snapshot.
+    SnapshotFormat m_format{SnapshotFormat::LEGACY};
+
+    //! MuHash3072 of the UTXO set, as reported by gettxoutsetinfo. Columnar
+    //! snapshots are checked against it while they load.
+    uint256 m_muhash;
+
     SnapshotMetadata() { }
     SnapshotMetadata(
         const uint256& base_blockhash,
@@ -31,8 +62,71 @@ public:
             m_base_blockhash(base_blockhash),
             m_coins_count(coins_count) { }
 
-    SERIALIZE_METHODS(SnapshotMetadata, obj) { READWRITE(obj.m_base_blockhash, obj.m_coins_count); }
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        if (m_format == SnapshotFormat::LEGACY) {
+            s << m_base_blockhash << m_coins_count;
+            return;
+        }
+        s << SNAPSHOT_MAGIC_BYTES << uint8_t(m_format) << m_base_blockhash << m_coins_count << m_muhash;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        // Legacy snapshots start with the block hash, which is no more
+        // likely to begin with the magic bytes than any other hash.
+        unsigned char magic[sizeof(SNAPSHOT_MAGIC_BYTES)];
+        s >> magic;
+        if (std::memcmp(magic, SNAPSHOT_MAGIC_BYTES, sizeof(magic)) != 0) {
+            m_format = SnapshotFormat::LEGACY;
+            std::memcpy(m_base_blockhash.begin(), magic, sizeof(magic));
+            s.read(AsWritableBytes(Span{m_base_blockhash.begin() + sizeof(magic), m_base_blockhash.end()}));
+            s >> m_coins_count;
+            return;
+        }
+        uint8_t format;
+        s >> format;
+        if (format != uint8_t(SnapshotFormat::COLUMNAR)) {
+            throw std::ios_base::failure("Unknown snapshot format");
+        }
+        m_format = SnapshotFormat::COLUMNAR;
+        s >> m_base_blockhash >> m_coins_count >> m_muhash;
+    }
 };
+
+/**
+ * The coins of consecutive txids in a columnar snapshot. The payload holds
+ * them column by column, see EncodeSnapshotChunk(), and is covered by a
+ * CRC32C checksum so that each chunk can be checked on its own.
+ */
+struct SnapshotChunk {
+    uint32_t m_coins_count{0};
+    std::vector<unsigned char> m_payload;
+    uint32_t m_checksum{0};
+
+    SERIALIZE_METHODS(SnapshotChunk, obj) { READWRITE(obj.m_coins_count, obj.m_payload, obj.m_checksum); }
+};
+
+/**
+ * Lay out coins as a snapshot chunk. The coins of a transaction share their
+ * txid, height, flags and nTime, which are stored once per transaction,
+ * sorted by height so that heights and times encode as small deltas.
+ * Amounts are compressed as in the coins database, and scripts both by
+ * template and by referring back to earlier scripts in the chunk.
+ *
+ * @param[in] coins  Coins in outpoint order, as read from the coins database.
+ */
+SnapshotChunk EncodeSnapshotChunk(const std::vector<std::pair<COutPoint, Coin>>& coins);
+
+/**
+ * Check and decode a snapshot chunk.
+ *
+ * @returns false if the chunk fails its checksum or does not decode to
+ *          exactly m_coins_count coins.
+ */
+[[nodiscard]] bool DecodeSnapshotChunk(const SnapshotChunk& chunk, std::vector<std::pair<COutPoint, Coin>>& coins);
 } // namespace node
 
 #endif // BITCOIN_NODE_UTXO_SNAPSHOT_H
@@ -198,17 +198,21 @@ bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&
     return true;
 }
 
-bool CheckPOW(const CBlock& block, const Consensus::Params& consensusParams)
+bool CheckPOW(const CBlockHeader& header, const Consensus::Params& consensusParams)
 {
-    if (block.IsProofOfStake())
-        return true;
-
-    if (!CheckProofOfWork(block.GetPOWHash(), block.nBits, consensusParams)) {
-        std::string str = block.IsProofOfWork() ?  "POW" : "POS";
-        LogPrintf("CheckPOW: CheckProofOfWork failed for %s, retesting without POW cache, block type %s\n", block.GetHash().ToString(), str);
+    if (!CheckProofOfWork(header.GetPOWHash(), header.nBits, consensusParams)) {
+        LogPrintf("CheckPOW: CheckProofOfWork failed for %s, retesting without POW cache\n", header.GetHash().ToString());
 
         // Retest without POW cache in case cache was corrupted:
-        return CheckProofOfWork(block.GetPOWHash(false), block.nBits, consensusParams);
+        return CheckProofOfWork(header.GetPOWHash(false), header.nBits, consensusParams);
     }
     return true;
 }
+
+bool CheckPOW(const CBlock& block, const Consensus::Params& consensusParams)
+{
+    if (block.IsProofOfStake())
+        return true;
+
+    return CheckPOW(static_cast<const CBlockHeader&>(block), consensusParams);
+}
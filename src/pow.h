@@ -21,6 +21,9 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&);
+/** Check the proof-of-work of a header, whatever its proof-of-stake flag says; callers decide which headers need it. */
+bool CheckPOW(const CBlockHeader& header, const Consensus::Params& consensusParams);
+/** Check the proof-of-work of a block, unless its coinstake makes it proof-of-stake. */
 bool CheckPOW(const CBlock& block, const Consensus::Params& consensusParams);
 
 #endif // BITCOIN_POW_H
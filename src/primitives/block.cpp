@@ -31,7 +31,7 @@ uint256 CBlockHeader::GetPOWHash(bool readCache) const
     bool found = false;
 
     if (readCache) {
-        found = cache.get(headerHash, powHash);
+        found = cache.Lookup(headerHash, powHash);
     }
 
     if (!found || cache.GetValidate()) {
@@ -41,8 +41,7 @@ uint256 CBlockHeader::GetPOWHash(bool readCache) const
             std::cerr << "PowCache failure: headerHash: " << headerHash.ToString() << ", from cache: " << powHash.ToString() << ", computed: " << powHash2.ToString() << ", correcting" << std::endl;
         }
         powHash = powHash2;
-        cache.erase(headerHash); // If it exists, replace it
-        cache.insert(headerHash, powHash2);
+        cache.Store(headerHash, powHash2);
     }
     return powHash;
 }
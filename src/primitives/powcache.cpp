@@ -52,12 +52,26 @@ void CPowCache::SetSaveInterval(int64_t saveInterval)
 
 bool CPowCache::WantsToSave() const
 {
+   LOCK(cs_powcache);
    return size() - nSavedSize >= nSaveInterval;
 }
 
+bool CPowCache::Lookup(const uint256& headerHash, uint256& powHash)
+{
+    LOCK(cs_powcache);
+    return get(headerHash, powHash);
+}
+
+void CPowCache::Store(const uint256& headerHash, const uint256& powHash)
+{
+    LOCK(cs_powcache);
+    erase(headerHash); // If it exists, replace it
+    insert(headerHash, powHash);
+}
+
 std::string CPowCache::ToString() const
 {
     std::ostringstream info;
-    info << "PowCache: elements: " << size();
+    info << "PowCache: elements: " << WITH_LOCK(cs_powcache, return size());
     return info.str();
 }
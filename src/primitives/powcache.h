@@ -32,6 +32,10 @@ private:
     int      nSaveInterval;
     bool     bValidate;
 
+    /** Guards the underlying map: headers are hashed concurrently from the
+     *  message handler's worker pool as well as under cs_main. */
+    mutable Mutex cs_powcache;
+
 public:
     static CPowCache& Instance();
 
@@ -45,13 +49,18 @@ public:
     bool GetValidate() const { return bValidate; }
     bool WantsToSave() const;
 
+    /** Thread-safe lookup of a cached PoW hash. */
+    bool Lookup(const uint256& headerHash, uint256& powHash) EXCLUSIVE_LOCKS_REQUIRED(!cs_powcache);
+    /** Thread-safe insert, replacing any existing entry for headerHash. */
+    void Store(const uint256& headerHash, const uint256& powHash) EXCLUSIVE_LOCKS_REQUIRED(!cs_powcache);
+
     std::string ToString() const;
 
-    template<typename Stream> void Serialize(Stream& s)   { SerializationOp(s, CSerActionSerialize());   }
-    template<typename Stream> void Unserialize(Stream& s) { SerializationOp(s, CSerActionUnserialize()); }
+    template<typename Stream> void Serialize(Stream& s)   { LOCK(cs_powcache); SerializationOp(s, CSerActionSerialize());   }
+    template<typename Stream> void Unserialize(Stream& s) { LOCK(cs_powcache); SerializationOp(s, CSerActionUnserialize()); }
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action)
+    inline void SerializationOp(Stream& s, Operation ser_action) EXCLUSIVE_LOCKS_REQUIRED(cs_powcache)
     {
         READWRITE(nVersion);
 
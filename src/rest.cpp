@@ -782,10 +782,11 @@ static bool rest_getutxos(const std::any& context, HTTPRequest* req, const std::
     if (!maybe_chainman) return false;
     ChainstateManager& chainman = *maybe_chainman;
     {
-        auto process_utxos = [&vOutPoints, &outs, &hits](const CCoinsView& view, const CTxMemPool& mempool) {
+        auto process_utxos = [&vOutPoints, &outs, &hits](const CCoinsView& view, const MempoolOutpointSnapshot* mempool) {
             for (const COutPoint& vOutPoint : vOutPoints) {
                 Coin coin;
-                bool hit = !mempool.isSpent(vOutPoint) && view.GetCoin(vOutPoint, coin);
+                bool hit = (!mempool || !mempool->IsSpent(vOutPoint)) &&
+                           ((mempool && mempool->GetCoin(vOutPoint, coin)) || view.GetCoin(vOutPoint, coin));
                 hits.push_back(hit);
                 if (hit) outs.emplace_back(std::move(coin));
             }
@@ -794,14 +795,16 @@ static bool rest_getutxos(const std::any& context, HTTPRequest* req, const std::
         if (fCheckMemPool) {
             const CTxMemPool* mempool = GetMemPool(context, req);
             if (!mempool) return false;
-            // use db+mempool as cache backend in case user likes to query mempool
-            LOCK2(cs_main, mempool->cs);
-            CCoinsViewCache& viewChain = chainman.ActiveChainstate().CoinsTip();
-            CCoinsViewMemPool viewMempool(&viewChain, *mempool);
-            process_utxos(viewMempool, *mempool);
+            // use db+mempool as cache backend in case user likes to query mempool,
+            // taking the mempool side from a shared snapshot so that cs_main is
+            // only held for the lookups in the chain. The snapshot is not taken
+            // atomically with them; see gettxout.
+            const std::shared_ptr<const MempoolOutpointSnapshot> snapshot{mempool->GetOutpointSnapshot()};
+            LOCK(cs_main);
+            process_utxos(chainman.ActiveChainstate().CoinsTip(), snapshot.get());
         } else {
             LOCK(cs_main);  // no need to lock mempool!
-            process_utxos(chainman.ActiveChainstate().CoinsTip(), CTxMemPool());
+            process_utxos(chainman.ActiveChainstate().CoinsTip(), nullptr);
         }
 
         for (size_t i = 0; i < hits.size(); ++i) {
@@ -13,6 +13,7 @@
 #include <consensus/params.h>
 #include <consensus/validation.h>
 #include <core_io.h>
+#include <crypto/muhash.h>
 #include <deploymentinfo.h>
 #include <fs.h>
 #include <hash.h>
@@ -38,6 +39,8 @@
 #include <undo.h>
 #include <util/strencodings.h>
 #include <util/string.h>
+#include <util/system.h>
+#include <util/threadpool.h>
 #include <util/translation.h>
 #include <validation.h>
 #include <validationinterface.h>
@@ -50,7 +53,10 @@
 #include <node/miner.h>
 #include <kernel.h>
 #include <validation.h>
+#include <algorithm>
 #include <condition_variable>
+#include <deque>
+#include <future>
 #include <memory>
 #include <mutex>
 
@@ -60,6 +66,8 @@ using node::CoinStatsHashType;
 using node::GetUTXOStats;
 using node::NodeContext;
 using node::ReadBlockFromDisk;
+using node::SnapshotChunk;
+using node::SnapshotFormat;
 using node::SnapshotMetadata;
 using node::UndoReadFromDisk;
 
@@ -1266,7 +1274,9 @@ static RPCHelpMan gettxout()
         {
             {"txid", RPCArg::Type::STR, RPCArg::Optional::NO, "The transaction id"},
             {"n", RPCArg::Type::NUM, RPCArg::Optional::NO, "vout number"},
-            {"include_mempool", RPCArg::Type::BOOL, RPCArg::Default{true}, "Whether to include the mempool. Note that an unspent output that is spent in the mempool won't appear."},
+            {"include_mempool", RPCArg::Type::BOOL, RPCArg::Default{true}, "Whether to include the mempool. Note that an unspent output that is spent in the mempool won't appear.\n"
+                "The mempool is read just before the chain, not atomically with it, so a block connected in between can make\n"
+                "an output that has just been confirmed show as unconfirmed."},
         },
         {
             RPCResult{"If the UTXO was not found", RPCResult::Type::NONE, "", ""},
@@ -1296,7 +1306,6 @@ static RPCHelpMan gettxout()
 {
     NodeContext& node = EnsureAnyNodeContext(request.context);
     ChainstateManager& chainman = EnsureChainman(node);
-    LOCK(cs_main);
 
     UniValue ret(UniValue::VOBJ);
 
@@ -1308,20 +1317,24 @@ static RPCHelpMan gettxout()
         fMempool = request.params[2].get_bool();
 
     Coin coin;
-    CChainState& active_chainstate = chainman.ActiveChainstate();
-    CCoinsViewCache* coins_view = &active_chainstate.CoinsTip();
-
+    bool found{false};
     if (fMempool) {
-        const CTxMemPool& mempool = EnsureMemPool(node);
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(coins_view, mempool);
-        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) {
-            return NullUniValue;
-        }
-    } else {
-        if (!coins_view->GetCoin(out, coin)) {
+        // The mempool side is answered from a shared snapshot, without
+        // holding cs_main or the mempool lock. It is not taken atomically
+        // with the chain lookup below: a block connected in between leaves
+        // the snapshot one block behind, which the help text documents.
+        const std::shared_ptr<const MempoolOutpointSnapshot> snapshot{EnsureMemPool(node).GetOutpointSnapshot()};
+        if (snapshot->IsSpent(out)) {
             return NullUniValue;
         }
+        found = snapshot->GetCoin(out, coin);
+    }
+
+    LOCK(cs_main);
+    CChainState& active_chainstate = chainman.ActiveChainstate();
+    CCoinsViewCache* coins_view = &active_chainstate.CoinsTip();
+    if (!found && !coins_view->GetCoin(out, coin)) {
+        return NullUniValue;
     }
 
     const CBlockIndex* pindex = active_chainstate.m_blockman.LookupBlockIndex(coins_view->GetBestBlock());
@@ -1582,6 +1595,63 @@ static RPCHelpMan getchaintips()
     };
 }
 
+static RPCHelpMan getdbcompactioninfo()
+{
+    return RPCHelpMan{"getdbcompactioninfo",
+                "\nReturns the state of the compaction of the databases while validation is idle.\n",
+                {},
+                RPCResult{
+                    RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::BOOL, "running", "Whether databases are compacted while idle (see -dbcompaction)"},
+                        {RPCResult::Type::BOOL, "idle", "Whether validation has been idle long enough for compaction to proceed"},
+                        {RPCResult::Type::NUM, "deferred", "Number of times compaction was put off because validation was busy"},
+                        {RPCResult::Type::ARR, "databases", "",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::STR, "name", "The name of the database"},
+                                {RPCResult::Type::NUM, "slices", "Number of key ranges compacted"},
+                                {RPCResult::Type::NUM, "passes", "Number of complete passes over the database"},
+                                {RPCResult::Type::NUM, "time", "Time spent compacting, in milliseconds"},
+                                {RPCResult::Type::ARR, "files_per_level", "Number of table files at each level",
+                                {
+                                    {RPCResult::Type::NUM, "", "Number of table files"},
+                                }},
+                            }},
+                        }},
+                    }},
+                RPCExamples{
+                    HelpExampleCli("getdbcompactioninfo", "")
+            + HelpExampleRpc("getdbcompactioninfo", "")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    const DBCompactionScheduler::Stats stats{g_db_compaction.GetStats()};
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("running", stats.running);
+    ret.pushKV("idle", stats.idle);
+    ret.pushKV("deferred", stats.deferred);
+    UniValue dbs(UniValue::VARR);
+    for (const DBCompactionScheduler::DBStats& db : stats.dbs) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", db.name);
+        obj.pushKV("slices", db.slices);
+        obj.pushKV("passes", db.passes);
+        obj.pushKV("time", count_milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(db.time)));
+        UniValue files(UniValue::VARR);
+        for (const int count : db.files_per_level) {
+            files.push_back(count);
+        }
+        obj.pushKV("files_per_level", files);
+        dbs.push_back(obj);
+    }
+    ret.pushKV("databases", dbs);
+    return ret;
+},
+    };
+}
+
 UniValue MempoolInfoToJSON(const CTxMemPool& pool)
 {
     // Make sure this call is atomic in the pool.
@@ -1595,6 +1665,20 @@ UniValue MempoolInfoToJSON(const CTxMemPool& pool)
     size_t maxmempool = gArgs.GetIntArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.pushKV("maxmempool", (int64_t) maxmempool);
     ret.pushKV("unbroadcastcount", uint64_t{pool.GetUnbroadcastTxs().size()});
+    ret.pushKV("minchunkfeerate", ValueFromAmount(CAmount(ChunkFeerateHistogram::FeePerK(pool.GetMinChunkFeerate()))));
+    UniValue histogram(UniValue::VARR);
+    const ChunkFeerateHistogram& buckets{pool.GetFeerateHistogram()};
+    for (size_t i = 0; i < ChunkFeerateHistogram::BUCKETS; ++i) {
+        const ChunkFeerateHistogram::Bucket& bucket{buckets[i]};
+        if (!bucket.chunks) continue;
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("feerate", ValueFromAmount(CAmount(ChunkFeerateHistogram::BucketStart(i))));
+        entry.pushKV("count", bucket.txs);
+        entry.pushKV("bytes", bucket.feerate.size);
+        entry.pushKV("fees", ValueFromAmount(bucket.feerate.fee));
+        histogram.push_back(entry);
+    }
+    ret.pushKV("fee_histogram", histogram);
     return ret;
 }
 
@@ -1613,7 +1697,18 @@ static RPCHelpMan getmempoolinfo()
                         {RPCResult::Type::STR_AMOUNT, "total_fee", "Total fees for the mempool in " + CURRENCY_UNIT + ", ignoring modified fees through prioritisetransaction"},
                         {RPCResult::Type::NUM, "maxmempool", "Maximum memory usage for the mempool"},
                         {RPCResult::Type::STR_AMOUNT, "minrelaytxfee", "Current minimum relay fee for transactions"},
-                        {RPCResult::Type::NUM, "unbroadcastcount", "Current number of transactions that haven't passed initial broadcast yet"}
+                        {RPCResult::Type::NUM, "unbroadcastcount", "Current number of transactions that haven't passed initial broadcast yet"},
+                        {RPCResult::Type::STR_AMOUNT, "minchunkfeerate", "Feerate in " + CURRENCY_UNIT + "/kvB of the transactions that are evicted first when the mempool is full"},
+                        {RPCResult::Type::ARR, "fee_histogram", "The transactions by the feerate of the chunk they would be mined in, lowest first, leaving out empty buckets",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::STR_AMOUNT, "feerate", "Lowest feerate of the bucket in " + CURRENCY_UNIT + "/kvB"},
+                                {RPCResult::Type::NUM, "count", "Number of transactions"},
+                                {RPCResult::Type::NUM, "bytes", "Sum of their virtual sizes"},
+                                {RPCResult::Type::STR_AMOUNT, "fees", "Sum of their fees in " + CURRENCY_UNIT + ", including modifications through prioritisetransaction"},
+                            }},
+                        }},
                     }},
                 RPCExamples{
                     HelpExampleCli("getmempoolinfo", "")
@@ -2477,6 +2572,8 @@ static RPCHelpMan dumptxoutset()
         "Write the serialized UTXO set to disk.",
         {
             {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "Path to the output file. If relative, will be prefixed by datadir."},
+            {"format", RPCArg::Type::STR, RPCArg::Default{"columnar"}, "\"columnar\" groups the coins by txid into compressed, checksummed chunks that load in parallel. "
+                "\"legacy\" writes one record per coin."},
         },
         RPCResult{
             RPCResult::Type::OBJ, "", "",
@@ -2491,6 +2588,7 @@ static RPCHelpMan dumptxoutset()
         },
         RPCExamples{
             HelpExampleCli("dumptxoutset", "utxo.dat")
+            + HelpExampleCli("dumptxoutset", "utxo.dat legacy")
         },
         [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
 {
@@ -2507,11 +2605,21 @@ static RPCHelpMan dumptxoutset()
             "move it out of the way first");
     }
 
+    SnapshotFormat format{SnapshotFormat::COLUMNAR};
+    if (!request.params[1].isNull()) {
+        const std::string& format_str{request.params[1].get_str()};
+        if (format_str == "legacy") {
+            format = SnapshotFormat::LEGACY;
+        } else if (format_str != "columnar") {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown snapshot format: " + format_str);
+        }
+    }
+
     FILE* file{fsbridge::fopen(temppath, "wb")};
     CAutoFile afile{file, SER_DISK, CLIENT_VERSION};
     NodeContext& node = EnsureAnyNodeContext(request.context);
     UniValue result = CreateUTXOSnapshot(
-        node, node.chainman->ActiveChainstate(), afile, path, temppath);
+        node, node.chainman->ActiveChainstate(), afile, path, temppath, format);
     fs::rename(temppath, path);
 
     result.pushKV("path", path.u8string());
@@ -2525,7 +2633,8 @@ UniValue CreateUTXOSnapshot(
     CChainState& chainstate,
     CAutoFile& afile,
     const fs::path& path,
-    const fs::path& temppath)
+    const fs::path& temppath,
+    SnapshotFormat format)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor;
     CCoinsStats stats{CoinStatsHashType::HASH_SERIALIZED};
@@ -2562,6 +2671,7 @@ UniValue CreateUTXOSnapshot(
         fs::PathToString(path), fs::PathToString(temppath)));
 
     SnapshotMetadata metadata{tip->GetBlockHash(), stats.coins_count, tip->nChainTx};
+    metadata.m_format = format;
 
     afile << metadata;
 
@@ -2569,15 +2679,63 @@ UniValue CreateUTXOSnapshot(
     Coin coin;
     unsigned int iter{0};
 
-    while (pcursor->Valid()) {
-        if (iter % 5000 == 0) node.rpc_interruption_point();
-        ++iter;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            afile << key;
-            afile << coin;
+    if (format == SnapshotFormat::COLUMNAR) {
+        // Chunks are encoded and hashed on a pool, and written in cursor order.
+        ThreadPool pool{"snapshot"};
+        pool.Start(std::clamp(GetNumCores() - 1, 1, node::MAX_SNAPSHOT_THREADS));
+        std::deque<std::future<std::pair<SnapshotChunk, MuHash3072>>> chunks;
+        MuHash3072 muhash;
+        const auto write_chunk = [&] {
+            auto [chunk, chunk_muhash] = chunks.front().get();
+            chunks.pop_front();
+            afile << chunk;
+            muhash *= chunk_muhash;
+        };
+
+        std::vector<std::pair<COutPoint, Coin>> coins;
+        const auto submit_chunk = [&] {
+            chunks.push_back(pool.Submit([coins = std::move(coins)] {
+                MuHash3072 chunk_muhash;
+                for (const auto& [outpoint, coin] : coins) {
+                    chunk_muhash.Insert(MakeUCharSpan(node::TxOutSer(outpoint, coin)));
+                }
+                return std::make_pair(node::EncodeSnapshotChunk(coins), chunk_muhash);
+            }));
+            coins.clear();
+            if (chunks.size() > 2 * pool.WorkerCount()) write_chunk();
+        };
+
+        while (pcursor->Valid()) {
+            if (iter % 5000 == 0) node.rpc_interruption_point();
+            ++iter;
+            if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+                // Keep the outputs of a transaction in one chunk.
+                if (coins.size() >= node::SNAPSHOT_CHUNK_COINS && coins.back().first.hash != key.hash) submit_chunk();
+                coins.emplace_back(key, std::move(coin));
+            }
+
+            pcursor->Next();
+        }
+        if (!coins.empty()) submit_chunk();
+        while (!chunks.empty()) write_chunk();
+
+        // The metadata has a fixed size, so it can be rewritten with the hash.
+        muhash.Finalize(metadata.m_muhash);
+        if (std::fseek(afile.Get(), 0, SEEK_SET) != 0) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to rewrite snapshot metadata");
         }
+        afile << metadata;
+    } else {
+        while (pcursor->Valid()) {
+            if (iter % 5000 == 0) node.rpc_interruption_point();
+            ++iter;
+            if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+                afile << key;
+                afile << coin;
+            }
 
-        pcursor->Next();
+            pcursor->Next();
+        }
     }
 
     afile.fclose();
@@ -2610,6 +2768,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         &getblockhash,                       },
     { "blockchain",         &getblockheader,                     },
     { "blockchain",         &getchaintips,                       },
+    { "blockchain",         &getdbcompactioninfo,                },
     { "blockchain",         &getdifficulty,                      },
     { "blockchain",         &getmempoolancestors,                },
     { "blockchain",         &getmempooldescendants,              },
@@ -24,6 +24,7 @@ class CTxMemPool;
 class UniValue;
 namespace node {
 struct NodeContext;
+enum class SnapshotFormat : uint8_t;
 } // namespace node
 
 static constexpr int NUM_GETBLOCKSTATS_PERCENTILES = 5;
@@ -63,6 +64,7 @@ UniValue CreateUTXOSnapshot(
     CChainState& chainstate,
     CAutoFile& afile,
     const fs::path& path,
-    const fs::path& tmppath);
+    const fs::path& tmppath,
+    node::SnapshotFormat format);
 
 #endif // BITCOIN_RPC_BLOCKCHAIN_H
@@ -25,6 +25,7 @@
 #include <util/strencodings.h>
 #include <util/syscall_sandbox.h>
 #include <util/system.h>
+#include <util/time.h>
 
 #include <optional>
 #include <stdint.h>
@@ -527,6 +528,50 @@ static std::string RPCMallocInfo()
 }
 #endif
 
+static RPCHelpMan getschedulerinfo()
+{
+    return RPCHelpMan{"getschedulerinfo",
+                "Returns statistics about the tasks of each scheduler queue.\n",
+                {},
+                RPCResult{
+                    RPCResult::Type::ARR, "", "",
+                    {
+                        {RPCResult::Type::OBJ, "", "",
+                        {
+                            {RPCResult::Type::STR, "name", "The name of the queue (empty for tasks scheduled without one)"},
+                            {RPCResult::Type::NUM, "pending", "Number of tasks scheduled but not started yet"},
+                            {RPCResult::Type::NUM, "tasks_run", "Number of tasks run"},
+                            {RPCResult::Type::NUM, "total_latency", "How long after they were due the tasks started, in total (in microseconds)"},
+                            {RPCResult::Type::NUM, "max_latency", "The longest any task waited past its due time to start (in microseconds)"},
+                            {RPCResult::Type::NUM, "total_run_time", "The running time of the tasks, in total (in microseconds)"},
+                        }},
+                    }
+                },
+                RPCExamples{
+                    HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    NodeContext& node = EnsureAnyNodeContext(request.context);
+    CHECK_NONFATAL(node.scheduler);
+
+    UniValue ret(UniValue::VARR);
+    for (const auto& [name, stats] : node.scheduler->GetQueueStats()) {
+        UniValue queue(UniValue::VOBJ);
+        queue.pushKV("name", name);
+        queue.pushKV("pending", uint64_t(stats.pending));
+        queue.pushKV("tasks_run", stats.tasks_run);
+        queue.pushKV("total_latency", count_microseconds(stats.total_latency));
+        queue.pushKV("max_latency", count_microseconds(stats.max_latency));
+        queue.pushKV("total_run_time", count_microseconds(stats.total_run_time));
+        ret.push_back(queue);
+    }
+    return ret;
+},
+    };
+}
+
 static RPCHelpMan getmemoryinfo()
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -807,6 +852,7 @@ static const CRPCCommand commands[] =
 { //  category              actor (function)
   //  --------------------- ------------------------
     { "control",            &getmemoryinfo,           },
+    { "control",            &getschedulerinfo,        },
     { "control",            &logging,                 },
     { "util",               &validateaddress,         },
     { "util",               &createmultisig,          },
@@ -44,6 +44,57 @@ const std::vector<std::string> CONNECTION_TYPE_DOC{
         "feeler (short-lived automatic connection for testing addresses)"
 };
 
+static RPCResult MsgLatencyDoc(const std::string& key, const std::string& description)
+{
+    const auto histogram = [](const std::string& name, const std::string& what) {
+        return RPCResult{RPCResult::Type::OBJ, name, what,
+        {
+            {RPCResult::Type::NUM, "count", "Number of messages measured"},
+            {RPCResult::Type::NUM, "total_us", "Sum of all durations in microseconds"},
+            {RPCResult::Type::ARR_FIXED, "buckets", "Message counts per duration bucket: the first counts durations under 1us,\n"
+                                                    "bucket i those in [2^(i-1), 2^i) us and the last one everything longer",
+            {
+                {RPCResult::Type::NUM, "", "Number of messages"},
+            }},
+        }};
+    };
+    return RPCResult{RPCResult::Type::OBJ_DYN, key, description,
+    {
+        {RPCResult::Type::OBJ, "msg", "Timings aggregated by message type; unknown types are listed under '" + NET_MESSAGE_COMMAND_OTHER + "'",
+        {
+            histogram("queue", "Time from receipt until the message handler picked the message up"),
+            histogram("deserialize", "Time spent decoding the message, ahead of the handler where possible"),
+            histogram("process", "Time spent handling the message"),
+        }},
+    }};
+}
+
+static UniValue LatencyHistogramToJSON(const LatencyHistogram& histogram)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("count", histogram.m_count);
+    obj.pushKV("total_us", count_microseconds(histogram.m_total));
+    UniValue buckets(UniValue::VARR);
+    for (const uint64_t n : histogram.m_buckets) {
+        buckets.push_back(n);
+    }
+    obj.pushKV("buckets", buckets);
+    return obj;
+}
+
+static UniValue MsgLatencyToJSON(const mapMsgCmdLatency& latency)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& [msg_type, stats] : latency) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("queue", LatencyHistogramToJSON(stats.m_queue));
+        obj.pushKV("deserialize", LatencyHistogramToJSON(stats.m_deserialize));
+        obj.pushKV("process", LatencyHistogramToJSON(stats.m_process));
+        ret.pushKV(msg_type, obj);
+    }
+    return ret;
+}
+
 static RPCHelpMan getconnectioncount()
 {
     return RPCHelpMan{"getconnectioncount",
@@ -159,6 +210,7 @@ static RPCHelpMan getpeerinfo()
                                                       "Only known message types can appear as keys in the object and all bytes received\n"
                                                       "of unknown message types are listed under '"+NET_MESSAGE_COMMAND_OTHER+"'."}
                     }},
+                    MsgLatencyDoc("latency_per_msg", "Timings of messages received from this peer"),
                     {RPCResult::Type::STR, "connection_type", "Type of connection: \n" + Join(CONNECTION_TYPE_DOC, ",\n") + ".\n"
                                                               "Please note this output is unlikely to be stable in upcoming releases as we iterate to\n"
                                                               "best capture connection behaviors."},
@@ -257,6 +309,7 @@ static RPCHelpMan getpeerinfo()
                 recvPerMsgCmd.pushKV(i.first, i.second);
         }
         obj.pushKV("bytesrecv_per_msg", recvPerMsgCmd);
+        obj.pushKV("latency_per_msg", MsgLatencyToJSON(stats.m_msg_latency));
         obj.pushKV("connection_type", ConnectionTypeAsString(stats.m_conn_type));
 
         ret.push_back(obj);
@@ -551,6 +604,27 @@ static RPCHelpMan getnettotals()
     };
 }
 
+static RPCHelpMan getmsglatency()
+{
+    return RPCHelpMan{"getmsglatency",
+                "\nReturns histograms of how long received messages spent queued, being decoded and being\n"
+                "processed, per message type, summed over all peers since startup.\n",
+                {},
+                MsgLatencyDoc("", ""),
+                RPCExamples{
+                    HelpExampleCli("getmsglatency", "")
+            + HelpExampleRpc("getmsglatency", "")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    NodeContext& node = EnsureAnyNodeContext(request.context);
+    const CConnman& connman = EnsureConnman(node);
+
+    return MsgLatencyToJSON(connman.GetMsgLatencyStats());
+},
+    };
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -971,6 +1045,7 @@ static const CRPCCommand commands[] =
     { "network",             &disconnectnode,          },
     { "network",             &getaddednodeinfo,        },
     { "network",             &getnettotals,            },
+    { "network",             &getmsglatency,           },
     { "network",             &getnetworkinfo,          },
     { "network",             &setban,                  },
     { "network",             &listbanned,              },
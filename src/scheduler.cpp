@@ -8,8 +8,10 @@
 #include <util/syscall_sandbox.h>
 #include <util/time.h>
 
+#include <algorithm>
 #include <assert.h>
 #include <functional>
+#include <set>
 #include <utility>
 
 CScheduler::CScheduler()
@@ -32,38 +34,50 @@ void CScheduler::serviceQueue()
     // newTaskMutex is locked throughout this loop EXCEPT
     // when the thread is waiting or when the user's function
     // is called.
+    Queue* current{nullptr};
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
-                newTaskScheduled.wait(lock);
-            }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-            while (!shouldStop() && !taskQueue.empty()) {
-                std::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until(lock, timeToWaitFor) == std::cv_status::timeout) {
-                    break; // Exit loop after timeout, it means we reached the time of the event
+            const auto now{std::chrono::system_clock::now()};
+            const auto next{NextTask(now)};
+            if (next == taskQueue.end()) {
+                // Wait until a task is due, a busy queue is done with its
+                // task, or a new task is scheduled.
+                const auto later{taskQueue.upper_bound(now)};
+                if (later == taskQueue.end()) {
+                    newTaskScheduled.wait(lock);
+                } else {
+                    newTaskScheduled.wait_until(lock, later->first);
                 }
-            }
-
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            const auto due{next->first};
+            Task task{std::move(next->second)};
+            taskQueue.erase(next);
+            current = task.queue;
+            current->running = true;
+            --current->stats.pending;
 
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 REVERSE_LOCK(lock);
-                f();
+                task.f();
             }
+
+            const auto end{std::chrono::system_clock::now()};
+            QueueStats& stats{current->stats};
+            const auto latency{std::chrono::duration_cast<std::chrono::microseconds>(std::max(now - due, std::chrono::system_clock::duration{0}))};
+            ++stats.tasks_run;
+            stats.total_latency += latency;
+            stats.max_latency = std::max(stats.max_latency, latency);
+            stats.total_run_time += std::chrono::duration_cast<std::chrono::microseconds>(end - now);
+            current->running = false;
+            current = nullptr;
+            // Threads may be waiting for this queue to be free
+            newTaskScheduled.notify_all();
         } catch (...) {
+            if (current) current->running = false;
             --nThreadsServicingQueue;
             throw;
         }
@@ -72,11 +86,38 @@ void CScheduler::serviceQueue()
     newTaskScheduled.notify_one();
 }
 
-void CScheduler::schedule(CScheduler::Function f, std::chrono::system_clock::time_point t)
+CScheduler::TaskQueue::iterator CScheduler::NextTask(std::chrono::system_clock::time_point now)
+{
+    auto best{taskQueue.end()};
+    std::set<const Queue*> seen;
+    for (auto it = taskQueue.begin(); it != taskQueue.end() && it->first <= now; ++it) {
+        const Task& task{it->second};
+        // Only the first due task of a queue may run, and only once the
+        // previous one is done.
+        if (!seen.insert(task.queue).second || task.queue->running) continue;
+        if (best == taskQueue.end() || task.priority < best->second.priority) {
+            best = it;
+            if (task.priority == Priority::HIGH) break;
+        }
+    }
+    return best;
+}
+
+void CScheduler::JoinServiceThreads()
+{
+    for (std::thread& thread : m_service_threads) {
+        if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) thread.join();
+    }
+}
+
+void CScheduler::schedule(CScheduler::Function f, std::chrono::system_clock::time_point t,
+                          const std::string& queue, Priority priority)
 {
     {
         LOCK(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        Queue& q{m_queues[queue]};
+        ++q.stats.pending;
+        taskQueue.emplace(t, Task{std::move(f), &q, priority});
     }
     newTaskScheduled.notify_one();
 }
@@ -89,10 +130,10 @@ void CScheduler::MockForward(std::chrono::seconds delta_seconds)
         LOCK(newTaskMutex);
 
         // use temp_queue to maintain updated schedule
-        std::multimap<std::chrono::system_clock::time_point, Function> temp_queue;
+        TaskQueue temp_queue;
 
-        for (const auto& element : taskQueue) {
-            temp_queue.emplace_hint(temp_queue.cend(), element.first - delta_seconds, element.second);
+        for (auto& element : taskQueue) {
+            temp_queue.emplace_hint(temp_queue.cend(), element.first - delta_seconds, std::move(element.second));
         }
 
         // point taskQueue to temp_queue
@@ -103,15 +144,17 @@ void CScheduler::MockForward(std::chrono::seconds delta_seconds)
     newTaskScheduled.notify_one();
 }
 
-static void Repeat(CScheduler& s, CScheduler::Function f, std::chrono::milliseconds delta)
+static void Repeat(CScheduler& s, CScheduler::Function f, std::chrono::milliseconds delta,
+                   const std::string& queue, CScheduler::Priority priority)
 {
     f();
-    s.scheduleFromNow([=, &s] { Repeat(s, f, delta); }, delta);
+    s.scheduleFromNow([=, &s] { Repeat(s, f, delta, queue, priority); }, delta, queue, priority);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, std::chrono::milliseconds delta)
+void CScheduler::scheduleEvery(CScheduler::Function f, std::chrono::milliseconds delta,
+                               const std::string& queue, Priority priority)
 {
-    scheduleFromNow([=] { Repeat(*this, f, delta); }, delta);
+    scheduleFromNow([=] { Repeat(*this, f, delta, queue, priority); }, delta, queue, priority);
 }
 
 size_t CScheduler::getQueueInfo(std::chrono::system_clock::time_point& first,
@@ -132,6 +175,16 @@ bool CScheduler::AreThreadsServicingQueue() const
     return nThreadsServicingQueue;
 }
 
+std::map<std::string, CScheduler::QueueStats> CScheduler::GetQueueStats() const
+{
+    LOCK(newTaskMutex);
+    std::map<std::string, QueueStats> result;
+    for (const auto& [name, queue] : m_queues) {
+        result.emplace(name, queue.stats);
+    }
+    return result;
+}
+
 
 void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue()
 {
@@ -143,7 +196,7 @@ void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue()
         if (m_are_callbacks_running) return;
         if (m_callbacks_pending.empty()) return;
     }
-    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this), std::chrono::system_clock::now());
+    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this), std::chrono::system_clock::now(), m_queue);
 }
 
 void SingleThreadedSchedulerClient::ProcessQueue()
@@ -5,14 +5,21 @@
 #ifndef BITCOIN_SCHEDULER_H
 #define BITCOIN_SCHEDULER_H
 
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <list>
 #include <map>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <sync.h>
 
+/** Number of threads servicing the node's scheduler */
+static constexpr int DEFAULT_SCHEDULER_THREADS{4};
+
 /**
  * Simple class for background tasks that should be run
  * periodically or once "after a while"
@@ -22,13 +29,16 @@
  * CScheduler* s = new CScheduler();
  * s->scheduleFromNow(doSomething, std::chrono::milliseconds{11}); // Assuming a: void doSomething() { }
  * s->scheduleFromNow([=] { this->func(argument); }, std::chrono::milliseconds{3});
- * std::thread* t = new std::thread([&] { s->serviceQueue(); });
+ * s->m_service_threads.emplace_back([&] { s->serviceQueue(); });
  *
  * ... then at program shutdown, make sure to call stop() to clean up the thread(s) running serviceQueue:
  * s->stop();
- * t->join();
- * delete t;
  * delete s; // Must be done after thread is interrupted/joined.
+ *
+ * Every task belongs to a named queue, the unnamed one by default. Tasks of
+ * one queue run one at a time in the order they are due, while tasks of
+ * different queues may run at the same time on different threads. When tasks
+ * of several queues are due, the one with the highest priority goes first.
  */
 class CScheduler
 {
@@ -36,17 +46,37 @@ public:
     CScheduler();
     ~CScheduler();
 
-    std::thread m_service_thread;
+    std::vector<std::thread> m_service_threads;
 
     typedef std::function<void()> Function;
 
+    /** Which of the due tasks of different queues runs first. */
+    enum class Priority {
+        HIGH,
+        NORMAL,
+        LOW,
+    };
+
+    /** Time spent by the tasks of one queue, see GetQueueStats(). */
+    struct QueueStats {
+        //! Tasks scheduled but not started yet
+        size_t pending{0};
+        uint64_t tasks_run{0};
+        //! How long after they were due the tasks started, in total and at worst
+        std::chrono::microseconds total_latency{0};
+        std::chrono::microseconds max_latency{0};
+        std::chrono::microseconds total_run_time{0};
+    };
+
     /** Call func at/after time t */
-    void schedule(Function f, std::chrono::system_clock::time_point t);
+    void schedule(Function f, std::chrono::system_clock::time_point t,
+                  const std::string& queue = {}, Priority priority = Priority::NORMAL);
 
     /** Call f once after the delta has passed */
-    void scheduleFromNow(Function f, std::chrono::milliseconds delta)
+    void scheduleFromNow(Function f, std::chrono::milliseconds delta,
+                         const std::string& queue = {}, Priority priority = Priority::NORMAL)
     {
-        schedule(std::move(f), std::chrono::system_clock::now() + delta);
+        schedule(std::move(f), std::chrono::system_clock::now() + delta, queue, priority);
     }
 
     /**
@@ -55,7 +85,8 @@ public:
      * The timing is not exact: Every time f is finished, it is rescheduled to run again after delta. If you need more
      * accurate scheduling, don't use this method.
      */
-    void scheduleEvery(Function f, std::chrono::milliseconds delta);
+    void scheduleEvery(Function f, std::chrono::milliseconds delta,
+                       const std::string& queue = {}, Priority priority = Priority::NORMAL);
 
     /**
      * Mock the scheduler to fast forward in time.
@@ -74,14 +105,14 @@ public:
     {
         WITH_LOCK(newTaskMutex, stopRequested = true);
         newTaskScheduled.notify_all();
-        if (m_service_thread.joinable()) m_service_thread.join();
+        JoinServiceThreads();
     }
     /** Tell any threads running serviceQueue to stop when there is no work left to be done */
     void StopWhenDrained()
     {
         WITH_LOCK(newTaskMutex, stopWhenEmpty = true);
         newTaskScheduled.notify_all();
-        if (m_service_thread.joinable()) m_service_thread.join();
+        JoinServiceThreads();
     }
 
     /**
@@ -94,14 +125,38 @@ public:
     /** Returns true if there are threads actively running in serviceQueue() */
     bool AreThreadsServicingQueue() const;
 
+    /** Returns the statistics of every queue that has been scheduled on, by name */
+    std::map<std::string, QueueStats> GetQueueStats() const;
+
 private:
+    struct Queue {
+        bool running{false};
+        QueueStats stats;
+    };
+
+    struct Task {
+        Function f;
+        //! Never null; queues are never removed from m_queues
+        Queue* queue;
+        Priority priority;
+    };
+
+    using TaskQueue = std::multimap<std::chrono::system_clock::time_point, Task>;
+
     mutable Mutex newTaskMutex;
     std::condition_variable newTaskScheduled;
-    std::multimap<std::chrono::system_clock::time_point, Function> taskQueue GUARDED_BY(newTaskMutex);
+    TaskQueue taskQueue GUARDED_BY(newTaskMutex);
+    std::map<std::string, Queue> m_queues GUARDED_BY(newTaskMutex);
     int nThreadsServicingQueue GUARDED_BY(newTaskMutex){0};
     bool stopRequested GUARDED_BY(newTaskMutex){false};
     bool stopWhenEmpty GUARDED_BY(newTaskMutex){false};
     bool shouldStop() const EXCLUSIVE_LOCKS_REQUIRED(newTaskMutex) { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+
+    /** The due task to run next, or taskQueue.end() if every queue with a due task is busy. */
+    TaskQueue::iterator NextTask(std::chrono::system_clock::time_point now) EXCLUSIVE_LOCKS_REQUIRED(newTaskMutex);
+
+    /** Join the service threads, except for the calling one. */
+    void JoinServiceThreads();
 };
 
 /**
@@ -118,6 +173,7 @@ class SingleThreadedSchedulerClient
 {
 private:
     CScheduler* m_pscheduler;
+    const std::string m_queue;
 
     Mutex m_callbacks_mutex;
     std::list<std::function<void()>> m_callbacks_pending GUARDED_BY(m_callbacks_mutex);
@@ -127,7 +183,9 @@ private:
     void ProcessQueue();
 
 public:
-    explicit SingleThreadedSchedulerClient(CScheduler* pschedulerIn) : m_pscheduler(pschedulerIn) {}
+    /** Run the callbacks as tasks of the given scheduler queue. */
+    explicit SingleThreadedSchedulerClient(CScheduler* pschedulerIn, std::string queue = {})
+        : m_pscheduler(pschedulerIn), m_queue(std::move(queue)) {}
 
     /**
      * Add a callback to be executed. Callbacks are executed serially
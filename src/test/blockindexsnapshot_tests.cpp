@@ -0,0 +1,101 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <node/blockindexsnapshot.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <fstream>
+
+using node::BlockMap;
+using node::LoadBlockIndexSnapshot;
+using node::WriteBlockIndexSnapshot;
+
+namespace {
+void UnloadMap(BlockMap& block_index)
+{
+    for (auto& entry : block_index) {
+        delete entry.second;
+    }
+    block_index.clear();
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockindexsnapshot_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    LOCK(cs_main);
+    node::BlockManager& blockman = m_node.chainman->m_blockman;
+    BOOST_REQUIRE(blockman.WriteBlockIndexDB());
+    CBlockTreeDB& db = *blockman.m_block_tree_db;
+    const fs::path path = m_path_root / "index_snapshot.dat";
+
+    BOOST_REQUIRE(WriteBlockIndexSnapshot(path, db, blockman.m_block_index));
+    BlockMap loaded;
+    BOOST_REQUIRE(LoadBlockIndexSnapshot(path, db, loaded));
+    BOOST_CHECK_EQUAL(loaded.size(), blockman.m_block_index.size());
+    for (const auto& [hash, pindex] : blockman.m_block_index) {
+        auto it = loaded.find(hash);
+        BOOST_REQUIRE(it != loaded.end());
+        const CBlockIndex* copy = it->second;
+        BOOST_CHECK(copy->GetBlockHash() == hash);
+        BOOST_CHECK(copy->GetBlockHeader().GetHash() == pindex->GetBlockHeader().GetHash());
+        BOOST_CHECK_EQUAL(copy->nHeight, pindex->nHeight);
+        BOOST_CHECK_EQUAL(copy->nStatus, pindex->nStatus);
+        BOOST_CHECK_EQUAL(copy->nFile, pindex->nFile);
+        BOOST_CHECK_EQUAL(copy->nDataPos, pindex->nDataPos);
+        BOOST_CHECK_EQUAL(copy->nUndoPos, pindex->nUndoPos);
+        BOOST_CHECK_EQUAL(copy->nDataChecksum, pindex->nDataChecksum);
+        BOOST_CHECK_EQUAL(copy->nTx, pindex->nTx);
+        BOOST_CHECK_EQUAL(copy->nMint, pindex->nMint);
+        BOOST_CHECK_EQUAL(copy->nMoneySupply, pindex->nMoneySupply);
+        BOOST_CHECK_EQUAL(copy->nFlags, pindex->nFlags);
+        BOOST_CHECK_EQUAL(copy->nStakeModifier, pindex->nStakeModifier);
+        BOOST_CHECK(copy->prevoutStake == pindex->prevoutStake);
+        BOOST_CHECK(copy->hashProofOfStake == pindex->hashProofOfStake);
+        BOOST_CHECK_EQUAL(copy->pprev == nullptr, pindex->pprev == nullptr);
+        if (pindex->pprev) BOOST_CHECK(copy->pprev->GetBlockHash() == pindex->pprev->GetBlockHash());
+    }
+    UnloadMap(loaded);
+
+    // A snapshot is consumed by loading it.
+    BOOST_CHECK(!fs::exists(path));
+    BOOST_CHECK(!LoadBlockIndexSnapshot(path, db, loaded));
+    BOOST_CHECK(loaded.empty());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_rejects_corruption)
+{
+    LOCK(cs_main);
+    node::BlockManager& blockman = m_node.chainman->m_blockman;
+    BOOST_REQUIRE(blockman.WriteBlockIndexDB());
+    CBlockTreeDB& db = *blockman.m_block_tree_db;
+    const fs::path path = m_path_root / "index_snapshot.dat";
+
+    BOOST_REQUIRE(WriteBlockIndexSnapshot(path, db, blockman.m_block_index));
+    {
+        std::fstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+        file.seekg(-1, std::ios::end);
+        const char last = file.get();
+        file.seekp(-1, std::ios::end);
+        file.put(last ^ 1);
+    }
+    BlockMap loaded;
+    BOOST_CHECK(!LoadBlockIndexSnapshot(path, db, loaded));
+    BOOST_CHECK(loaded.empty());
+
+    // Without the identifier in the database, the file is ignored.
+    BOOST_REQUIRE(WriteBlockIndexSnapshot(path, db, blockman.m_block_index));
+    BOOST_REQUIRE(db.EraseBlockIndexSnapshotId());
+    BOOST_CHECK(!LoadBlockIndexSnapshot(path, db, loaded));
+    BOOST_CHECK(loaded.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <streams.h>
 #include <test/util/setup_common.h>
 #include <txdb.h>
+#include <txmempool.h>
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
@@ -609,7 +610,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map{0, CCoinsMap::hasher{}, CCoinsMap::key_equal{}, &resource};
     InsertCoinsMapEntry(map, value, flags);
     BOOST_CHECK(view.BatchWrite(map, {}));
 }
@@ -878,4 +880,78 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(coin_packed_flags)
+{
+    Coin coin{CTxOut{1, CScript{}}, MEMPOOL_HEIGHT, /*fCoinBaseIn=*/true, /*fCoinStakeIn=*/true, /*nTimeIn=*/12345};
+    BOOST_CHECK(coin.IsCoinBase());
+    BOOST_CHECK(coin.IsCoinStake());
+    BOOST_CHECK_EQUAL(coin.nHeight, MEMPOOL_HEIGHT);
+    BOOST_CHECK_EQUAL(coin.nTime, 12345U);
+    // The coinstake flag shares a word with the height, so there is no padding.
+    BOOST_CHECK(sizeof(Coin) <= sizeof(CTxOut) + 2 * sizeof(uint32_t));
+
+    // Both flags survive the undo record encoding.
+    coin.nHeight = 1000;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << Using<TxInUndoFormatter>(coin);
+    Coin restored;
+    ss >> Using<TxInUndoFormatter>(restored);
+    BOOST_CHECK(restored.IsCoinBase());
+    BOOST_CHECK(restored.IsCoinStake());
+    BOOST_CHECK_EQUAL(restored.nHeight, 1000U);
+    BOOST_CHECK_EQUAL(restored.nTime, 12345U);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_extract_dirty)
+{
+    CCoinsViewTest base;
+    const COutPoint old_outpoint{InsecureRand256(), 0};
+    const COutPoint new_outpoint{InsecureRand256(), 0};
+    const Coin coin{CTxOut{1, CScript{}}, 1, /*fCoinBaseIn=*/false, /*fCoinStakeIn=*/false, /*nTimeIn=*/0};
+    {
+        CCoinsViewCacheTest setup{&base};
+        setup.AddCoin(old_outpoint, Coin{coin}, false);
+        setup.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(setup.Flush());
+    }
+
+    CCoinsViewPending pending{&base};
+    CCoinsViewCacheTest cache{&pending};
+    BOOST_CHECK(cache.SpendCoin(old_outpoint));
+    cache.AddCoin(new_outpoint, Coin{coin}, false);
+    const uint256 best_block{InsecureRand256()};
+    cache.SetBestBlock(best_block);
+
+    CCoinsMapMemoryResource resource;
+    CCoinsMap batch{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &resource};
+    cache.ExtractDirty(batch, /*evict_clean=*/false);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    // The spend now only lives in the batch; the new coin stays cached, but clean.
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK_EQUAL(cache.map().at(new_outpoint).flags, 0);
+
+    // Until it is written, the batch shadows the base view.
+    pending.SetPending(batch, best_block);
+    cache.Uncache(new_outpoint);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(cache.HaveCoin(new_outpoint));
+    BOOST_CHECK(!cache.HaveCoin(old_outpoint));
+    BOOST_CHECK(pending.GetBestBlock() == best_block);
+
+    pending.ClearPending();
+    BOOST_CHECK(base.BatchWrite(batch, best_block));
+    BOOST_CHECK(pending.GetBestBlock() == best_block);
+    CCoinsViewCacheTest fresh{&pending};
+    BOOST_CHECK(fresh.HaveCoin(new_outpoint));
+    BOOST_CHECK(!fresh.HaveCoin(old_outpoint));
+
+    // Nothing is dirty any more, so only eviction has an effect.
+    CCoinsMap empty_batch{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &resource};
+    BOOST_CHECK_EQUAL(cache.ExtractDirty(empty_batch, /*evict_clean=*/true), 0U);
+    BOOST_CHECK(empty_batch.empty());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <node/blockstorage.h>
+#include <node/coinsprefetch.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(prefetch_block_inputs)
+{
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    chainstate.ForceFlushStateToDisk();
+
+    // in_db is in the database, in_block is created by the block itself and
+    // missing does not exist at all.
+    const COutPoint in_db{m_coinbase_txns[0]->GetHash(), 0};
+    CMutableTransaction spend_db;
+    spend_db.vin.emplace_back(in_db);
+    spend_db.vout.emplace_back(1 * COIN, CScript{});
+    const COutPoint in_block{spend_db.GetHash(), 0};
+    CMutableTransaction spend_block;
+    spend_block.vin.emplace_back(in_block);
+    spend_block.vin.emplace_back(COutPoint{InsecureRand256(), 0});
+    spend_block.vout.emplace_back(1 * COIN, CScript{});
+
+    CBlock block;
+    block.vtx.push_back(m_coinbase_txns[1]);
+    block.vtx.push_back(MakeTransactionRef(spend_db));
+    block.vtx.push_back(MakeTransactionRef(spend_block));
+
+    LOCK(::cs_main);
+    const FlatFilePos pos{chainstate.m_blockman.SaveBlockToDisk(block, 101, chainstate.m_chain, Params(), nullptr)};
+    BOOST_REQUIRE(!pos.IsNull());
+
+    // Without threads, prefetching happens synchronously.
+    node::CoinsPrefetcher prefetcher{chainstate.CoinsDB(), /*threads=*/0};
+    CCoinsViewPending pending{&chainstate.CoinsDB()};
+    {
+        prefetcher.Prefetch({pos});
+        CCoinsViewCache cache{&pending};
+        BOOST_CHECK_EQUAL(prefetcher.Apply(block, cache, pending), 1U);
+        BOOST_CHECK(cache.HaveCoinInCache(in_db));
+        BOOST_CHECK(!cache.HaveCoinInCache(in_block));
+        // Results are handed out once.
+        CCoinsViewCache other{&pending};
+        BOOST_CHECK_EQUAL(prefetcher.Apply(block, other, pending), 0U);
+    }
+    {
+        // Entries the cache already has are left alone.
+        prefetcher.Prefetch({pos});
+        CCoinsViewCache cache{&pending};
+        BOOST_CHECK(cache.SpendCoin(in_db));
+        BOOST_CHECK_EQUAL(prefetcher.Apply(block, cache, pending), 0U);
+        BOOST_CHECK(!cache.HaveCoin(in_db));
+    }
+    {
+        // Nothing read before the database was written to is used.
+        prefetcher.Prefetch({pos});
+        prefetcher.Invalidate();
+        CCoinsViewCache cache{&pending};
+        BOOST_CHECK_EQUAL(prefetcher.Apply(block, cache, pending), 0U);
+    }
+    {
+        // Nor anything a background write may or may not have reached yet.
+        CCoinsMapMemoryResource resource;
+        CCoinsMap batch{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &resource};
+        batch.emplace(in_db, CCoinsCacheEntry{Coin{}, CCoinsCacheEntry::DIRTY});
+        pending.SetPending(batch, InsecureRand256());
+        prefetcher.Prefetch({pos});
+        CCoinsViewCache cache{&pending};
+        BOOST_CHECK_EQUAL(prefetcher.Apply(block, cache, pending), 0U);
+        pending.ClearPending();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
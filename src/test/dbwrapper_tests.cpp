@@ -412,4 +412,77 @@ BOOST_AUTO_TEST_CASE(unicodepath)
 }
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profile)
+{
+    fs::path ph = m_args.GetDataDirBase() / "dbwrapper_profile";
+    CDBWrapper dbw(ph, (1 << 20), false, false, false, DB_PROFILE_BLOCK_INDEX);
+    BOOST_CHECK(dbw.Write(uint8_t{'a'}, uint256::ONE));
+    uint256 res;
+    BOOST_CHECK(dbw.Read(uint8_t{'a'}, res));
+    BOOST_CHECK_EQUAL(res, uint256::ONE);
+    BOOST_CHECK(!dbw.Exists(uint8_t{'b'}));
+    BOOST_CHECK_EQUAL(dbw.GetName(), "dbwrapper_profile");
+    BOOST_CHECK(!dbw.GetFilesPerLevel().empty());
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_compaction)
+{
+    fs::path ph = m_args.GetDataDirBase() / "dbwrapper_compaction";
+    CDBWrapper dbw(ph, (1 << 20), false, false, false, DB_PROFILE_CHAINSTATE);
+
+    // Keys fall into four two-byte prefixes, the last of which cannot be
+    // incremented.
+    using Key = std::pair<std::pair<uint8_t, uint8_t>, uint32_t>;
+    const std::vector<std::pair<uint8_t, uint8_t>> prefixes{{'a', 0}, {'a', 1}, {'c', 0xff}, {0xff, 0xff}};
+    CDBBatch batch(dbw);
+    for (const auto& prefix : prefixes) {
+        for (uint32_t i = 0; i < 100; ++i) {
+            batch.Write(Key{prefix, i}, i);
+        }
+    }
+    BOOST_CHECK(dbw.WriteBatch(batch));
+
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t slices{1};
+        while (dbw.CompactNextSlice()) ++slices;
+        BOOST_CHECK_EQUAL(slices, prefixes.size());
+    }
+    uint32_t value;
+    BOOST_CHECK(dbw.Read(Key{{'c', 0xff}, 42}, value));
+    BOOST_CHECK_EQUAL(value, 42U);
+
+    const auto get_stats = [&] {
+        for (const auto& stats : g_db_compaction.GetStats().dbs) {
+            if (stats.name == "dbwrapper_compaction") return stats;
+        }
+        BOOST_FAIL("database is not registered");
+        return DBCompactionScheduler::DBStats{};
+    };
+    const auto deferred{g_db_compaction.GetStats().deferred};
+
+    // Nothing is compacted while validation is busy.
+    const std::chrono::seconds now{GetTime<std::chrono::seconds>()};
+    SetMockTime(now);
+    g_db_compaction.NotifyBusy();
+    BOOST_CHECK(!g_db_compaction.IsIdle());
+    BOOST_CHECK_EQUAL(g_db_compaction.RunOnce(std::chrono::hours{1}), 0);
+    BOOST_CHECK_EQUAL(g_db_compaction.GetStats().deferred, deferred + 1);
+
+    // Once idle, each database is compacted once.
+    SetMockTime(now + DB_COMPACTION_IDLE_TIME);
+    BOOST_CHECK(g_db_compaction.IsIdle());
+    BOOST_CHECK_GE(g_db_compaction.RunOnce(std::chrono::hours{1}), int(prefixes.size()));
+    BOOST_CHECK_EQUAL(get_stats().passes, 1U);
+    BOOST_CHECK_EQUAL(get_stats().slices, prefixes.size());
+    BOOST_CHECK_EQUAL(g_db_compaction.RunOnce(std::chrono::hours{1}), 0);
+
+    // And again after validation was busy in between.
+    g_db_compaction.NotifyBusy();
+    SetMockTime(now + 2 * DB_COMPACTION_IDLE_TIME);
+    BOOST_CHECK_GE(g_db_compaction.RunOnce(std::chrono::hours{1}), int(prefixes.size()));
+    BOOST_CHECK_EQUAL(get_stats().passes, 2U);
+    SetMockTime(0s);
+}
+
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,9 +6,11 @@
 
 #include <arith_uint256.h>
 #include <banman.h>
+#include <chain.h>
 #include <chainparams.h>
 #include <net.h>
 #include <net_processing.h>
+#include <policy/policy.h>
 #include <pubkey.h>
 #include <script/sign.h>
 #include <script/signingprovider.h>
@@ -16,12 +18,14 @@
 #include <serialize.h>
 #include <test/util/net.h>
 #include <test/util/setup_common.h>
+#include <timedata.h>
 #include <txorphanage.h>
 #include <util/string.h>
 #include <util/system.h>
 #include <util/time.h>
 #include <validation.h>
 
+#include <algorithm>
 #include <array>
 #include <stdint.h>
 
@@ -544,4 +548,111 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(orphanage.CountOrphans() == 0);
 }
 
+BOOST_AUTO_TEST_CASE(DoS_orphan_work_batch)
+{
+    TxOrphanageTest orphanage;
+    LOCK(g_cs_orphans);
+
+    auto make_child = [](const std::vector<COutPoint>& prevouts) {
+        CMutableTransaction tx;
+        for (const COutPoint& prevout : prevouts) {
+            tx.vin.emplace_back(prevout);
+        }
+        tx.vout.resize(2);
+        tx.vout[0].nValue = 1 * CENT;
+        tx.vout[1].nValue = 1 * CENT;
+        return MakeTransactionRef(tx);
+    };
+
+    // b <- c <- d chain (c spends both outputs of b), plus an unrelated e.
+    const CTransactionRef b = make_child({COutPoint{InsecureRand256(), 0}});
+    const CTransactionRef c = make_child({COutPoint{b->GetHash(), 1}, COutPoint{b->GetHash(), 0}});
+    const CTransactionRef d = make_child({COutPoint{c->GetHash(), 0}});
+    const CTransactionRef e = make_child({COutPoint{InsecureRand256(), 0}});
+    for (const auto& tx : {d, c, e, b}) {
+        BOOST_CHECK(orphanage.AddTx(tx, 0));
+    }
+
+    std::set<uint256> work_set{b->GetHash(), c->GetHash(), d->GetHash(), e->GetHash(), InsecureRand256()};
+    auto position = [](const auto& batch, const CTransactionRef& tx) {
+        return std::find_if(batch.begin(), batch.end(), [&](const auto& entry) { return entry.first == tx; }) - batch.begin();
+    };
+
+    // A partial batch only contains transactions whose in-set parents are ahead of them.
+    auto batch = orphanage.GetWorkBatch(work_set, 2, MAX_STANDARD_TX_WEIGHT);
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    BOOST_CHECK(position(batch, c) == 2 || position(batch, b) < position(batch, c));
+    BOOST_CHECK_EQUAL(position(batch, d), 2);
+    // The unknown txid was dropped, the rest is left for the next batch.
+    BOOST_CHECK_EQUAL(work_set.size(), 2U);
+
+    work_set = {b->GetHash(), c->GetHash(), d->GetHash(), e->GetHash()};
+    batch = orphanage.GetWorkBatch(work_set, 10, MAX_STANDARD_TX_WEIGHT);
+    BOOST_CHECK_EQUAL(batch.size(), 4U);
+    BOOST_CHECK(work_set.empty());
+    BOOST_CHECK_LT(position(batch, b), position(batch, c));
+    BOOST_CHECK_LT(position(batch, c), position(batch, d));
+
+    // The weight limit still lets a single transaction through.
+    work_set = {b->GetHash(), e->GetHash()};
+    batch = orphanage.GetWorkBatch(work_set, 10, 1);
+    BOOST_CHECK_EQUAL(batch.size(), 1U);
+    BOOST_CHECK_EQUAL(work_set.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(preprocess_message)
+{
+    CNode node{id++,
+               ServiceFlags(NODE_NETWORK | NODE_WITNESS),
+               /*sock=*/nullptr,
+               CAddress(ip(0xa0b0c001), NODE_NONE),
+               /*nKeyedNetGroupIn=*/0,
+               /*nLocalHostNonceIn=*/0,
+               CAddress(),
+               /*addrNameIn=*/"",
+               ConnectionType::INBOUND,
+               /*inbound_onion=*/false};
+    node.SetCommonVersion(PROTOCOL_VERSION);
+
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.nTime = GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME + 60;
+    mtx.vin.emplace_back(COutPoint{InsecureRand256(), 0});
+    mtx.vout.emplace_back(COIN, CScript() << OP_TRUE);
+    const CTransactionRef tx{MakeTransactionRef(mtx)};
+    const auto make_msg = [&tx](bool truncate) {
+        CDataStream payload{SER_NETWORK, PROTOCOL_VERSION};
+        payload << tx;
+        if (truncate) payload.resize(payload.size() - 1);
+        CNetMessage msg{std::move(payload)};
+        msg.m_type = NetMsgType::TX;
+        return msg;
+    };
+
+    // Nothing is decoded before the handshake settles the version
+    CNetMessage early{make_msg(false)};
+    m_node.peerman->PreprocessMessage(node, early);
+    BOOST_CHECK(!early.m_preparsed);
+    node.fSuccessfullyConnected = true;
+
+    // The transaction is decoded and prechecked, leaving the payload for the handler
+    CNetMessage msg{make_msg(false)};
+    const size_t size{msg.m_recv.size()};
+    m_node.peerman->PreprocessMessage(node, msg);
+    BOOST_REQUIRE(msg.m_preparsed);
+    msg.m_preparsed->m_done.wait();
+    BOOST_CHECK(msg.m_preparsed->m_parsed);
+    BOOST_CHECK_EQUAL(msg.m_preparsed->m_payload.size(), size);
+    BOOST_REQUIRE(msg.m_preparsed->m_tx);
+    BOOST_CHECK_EQUAL(msg.m_preparsed->m_tx->GetWitnessHash(), tx->GetWitnessHash());
+    BOOST_CHECK_EQUAL(msg.m_preparsed->m_tx_state.GetRejectReason(), "timestamp-too-far");
+
+    // Undecodable payloads are left to the handler
+    CNetMessage truncated{make_msg(true)};
+    m_node.peerman->PreprocessMessage(node, truncated);
+    BOOST_REQUIRE(truncated.m_preparsed);
+    truncated.m_preparsed->m_done.wait();
+    BOOST_CHECK(!truncated.m_preparsed->m_parsed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
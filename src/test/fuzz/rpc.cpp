@@ -120,6 +120,7 @@ const std::vector<std::string> RPC_COMMANDS_SAFE_FOR_FUZZING{
     "getchaintips",
     "getchaintxstats",
     "getconnectioncount",
+    "getdbcompactioninfo",
     "getdeploymentinfo",
     "getdescriptorinfo",
     "getdifficulty",
@@ -130,6 +131,7 @@ const std::vector<std::string> RPC_COMMANDS_SAFE_FOR_FUZZING{
     "getmempoolentry",
     "getmempoolinfo",
     "getmininginfo",
+    "getmsglatency",
     "getnettotals",
     "getnetworkhashps",
     "getnetworkinfo",
@@ -138,6 +140,7 @@ const std::vector<std::string> RPC_COMMANDS_SAFE_FOR_FUZZING{
     "getrawmempool",
     "getrawtransaction",
     "getrpcinfo",
+    "getschedulerinfo",
     "gettxout",
     "gettxoutsetinfo",
     "help",
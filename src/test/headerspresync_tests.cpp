@@ -0,0 +1,155 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <headerspresync.h>
+#include <pow.h>
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <test/util/setup_common.h>
+
+#include <deque>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(headerspresync_tests, BasicTestingSetup)
+
+namespace {
+
+/** A few indexed blocks to stage on top of. */
+struct ForkChain {
+    std::deque<CBlockIndex> blocks;
+    std::deque<uint256> hashes;
+
+    explicit ForkChain(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            CBlockIndex& block{blocks.emplace_back()};
+            block.pprev = i ? &blocks[i - 1] : nullptr;
+            block.nHeight = i;
+            block.nTime = 1600000000 + i * 60;
+            block.nBits = 0x1f00ffff;
+            block.nFlags = i % 2 ? CBlockIndex::BLOCK_PROOF_OF_STAKE : 0;
+            block.nChainTrust = (i ? blocks[i - 1].nChainTrust : arith_uint256{0}) + GetBlockTrust(block);
+            block.phashBlock = &hashes.emplace_back(ArithToUint256(arith_uint256{i + 1}));
+        }
+    }
+
+    const CBlockIndex& Tip() const { return blocks.back(); }
+};
+
+/** Headers continuing shadow (or fork, while shadow is empty) with the nBits
+ *  the difficulty rules require. shadow gets an entry per header. */
+std::vector<CBlockHeader> MakeHeaders(std::deque<CBlockIndex>& shadow, const CBlockIndex& fork, const uint256& hash_prev, size_t count, bool pos)
+{
+    std::vector<CBlockHeader> headers(count);
+    const CBlockIndex* prev{shadow.empty() ? &fork : &shadow.back()};
+    for (size_t i = 0; i < count; ++i) {
+        CBlockHeader& header{headers[i]};
+        header.nVersion = 1;
+        header.hashPrevBlock = i ? headers[i - 1].GetHash() : hash_prev;
+        header.nTime = prev->nTime + 60;
+        header.nNonce = i;
+        header.nFlags = pos ? CBlockIndex::BLOCK_PROOF_OF_STAKE : 0;
+        header.nBits = GetNextTargetRequired(prev, pos, Params().GetConsensus());
+        CBlockIndex& index{shadow.emplace_back(header)};
+        index.pprev = const_cast<CBlockIndex*>(prev);
+        index.nHeight = prev->nHeight + 1;
+        prev = &index;
+    }
+    return headers;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(presync_accumulates_trust)
+{
+    const Consensus::Params& params{Params().GetConsensus()};
+    const ForkChain fork{4};
+    HeadersPresyncState presync{fork.Tip()};
+    BOOST_CHECK_EQUAL(presync.GetTipHash(), fork.Tip().GetBlockHash());
+    BOOST_CHECK(presync.GetChainTrust() == fork.Tip().nChainTrust);
+
+    std::deque<CBlockIndex> shadow;
+    const std::vector<CBlockHeader> pow_headers{MakeHeaders(shadow, fork.Tip(), fork.Tip().GetBlockHash(), 10, /*pos=*/false)};
+    BOOST_CHECK(presync.Extends(pow_headers.front()));
+    BOOST_CHECK(presync.Append(pow_headers, params) == HeadersPresyncState::AppendResult::OK);
+    BOOST_CHECK_EQUAL(presync.Size(), 10U);
+    BOOST_CHECK_EQUAL(presync.GetTipHash(), pow_headers.back().GetHash());
+    // Proof-of-work blocks count one each.
+    BOOST_CHECK(presync.GetChainTrust() == fork.Tip().nChainTrust + 10);
+    BOOST_CHECK(!presync.Extends(pow_headers.front()));
+
+    const std::vector<CBlockHeader> pos_headers{MakeHeaders(shadow, fork.Tip(), presync.GetTipHash(), 5, /*pos=*/true)};
+    BOOST_CHECK(presync.Extends(pos_headers.front()));
+    BOOST_CHECK(presync.Append(pos_headers, params) == HeadersPresyncState::AppendResult::OK);
+    arith_uint256 expected{fork.Tip().nChainTrust + 10};
+    for (size_t i = 10; i < shadow.size(); ++i) {
+        BOOST_CHECK(GetBlockTrust(shadow[i]) > 1);
+        expected += GetBlockTrust(shadow[i]);
+    }
+    BOOST_CHECK(presync.GetChainTrust() == expected);
+
+    const std::vector<CBlockHeader> taken{presync.TakeHeaders()};
+    BOOST_CHECK_EQUAL(taken.size(), 15U);
+    BOOST_CHECK_EQUAL(taken.front().hashPrevBlock, fork.Tip().GetBlockHash());
+    BOOST_CHECK_EQUAL(taken.back().GetHash(), pos_headers.back().GetHash());
+    BOOST_CHECK_EQUAL(presync.Size(), 0U);
+    BOOST_CHECK(presync.GetChainTrust() == fork.Tip().nChainTrust);
+}
+
+BOOST_AUTO_TEST_CASE(presync_checks_diffbits)
+{
+    const Consensus::Params& params{Params().GetConsensus()};
+    const ForkChain fork{4};
+    HeadersPresyncState presync{fork.Tip()};
+
+    std::deque<CBlockIndex> shadow;
+    const std::vector<CBlockHeader> headers{MakeHeaders(shadow, fork.Tip(), fork.Tip().GetBlockHash(), 6, /*pos=*/true)};
+    BOOST_CHECK(presync.Append({headers.begin(), headers.begin() + 3}, params) == HeadersPresyncState::AppendResult::OK);
+    const arith_uint256 trust{presync.GetChainTrust()};
+
+    // A proof-of-stake header claiming a harder target than required would
+    // add trust nobody checked; the whole batch is refused instead.
+    std::vector<CBlockHeader> bad{headers.begin() + 3, headers.end()};
+    arith_uint256 target;
+    target.SetCompact(bad[1].nBits);
+    target >>= 8;
+    bad[1].nBits = target.GetCompact();
+    bad[2].hashPrevBlock = bad[1].GetHash();
+    BOOST_CHECK(presync.Append(bad, params) == HeadersPresyncState::AppendResult::BAD_DIFFBITS);
+    BOOST_CHECK_EQUAL(presync.Size(), 3U);
+    BOOST_CHECK_EQUAL(presync.GetTipHash(), headers[2].GetHash());
+    BOOST_CHECK(presync.GetChainTrust() == trust);
+
+    // The rolled back state still takes the honest continuation.
+    BOOST_CHECK(presync.Append({headers.begin() + 3, headers.end()}, params) == HeadersPresyncState::AppendResult::OK);
+    BOOST_CHECK_EQUAL(presync.Size(), 6U);
+    BOOST_CHECK(presync.GetChainTrust() > trust);
+}
+
+BOOST_AUTO_TEST_CASE(presync_respects_limit)
+{
+    const Consensus::Params& params{Params().GetConsensus()};
+    const ForkChain fork{4};
+    HeadersPresyncState presync{fork.Tip()};
+
+    std::deque<CBlockIndex> shadow;
+    const std::vector<CBlockHeader> headers{MakeHeaders(shadow, fork.Tip(), fork.Tip().GetBlockHash(), 11, /*pos=*/false)};
+    BOOST_CHECK(presync.Append({headers.begin(), headers.begin() + 8}, params, /*max_headers=*/10) == HeadersPresyncState::AppendResult::OK);
+
+    // Overflowing batches are refused as a whole and leave the state alone.
+    BOOST_CHECK(presync.Append({headers.begin() + 8, headers.end()}, params, /*max_headers=*/10) == HeadersPresyncState::AppendResult::TOO_MANY);
+    BOOST_CHECK_EQUAL(presync.Size(), 8U);
+    BOOST_CHECK_EQUAL(presync.GetTipHash(), headers[7].GetHash());
+    BOOST_CHECK(presync.GetChainTrust() == fork.Tip().nChainTrust + 8);
+
+    BOOST_CHECK(presync.Append({headers.begin() + 8, headers.begin() + 10}, params, /*max_headers=*/10) == HeadersPresyncState::AppendResult::OK);
+    BOOST_CHECK_EQUAL(presync.Size(), 10U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
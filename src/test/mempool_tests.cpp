@@ -524,23 +524,26 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(entry.Fee(1100LL).FromTx(tx6));
     pool.addUnchecked(entry.Fee(9000LL).FromTx(tx7));
 
-    // we only require this to remove, at max, 2 txn, because it's not clear what we're really optimizing for aside from that
+    // The cluster linearizes to the chunks [tx4] and [tx5, tx6, tx7], and
+    // eviction takes the lowest feerate chunk as a whole.
     pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx4.GetHash())));
-    BOOST_CHECK(pool.exists(GenTxid::Txid(tx6.GetHash())));
+    BOOST_CHECK(!pool.exists(GenTxid::Txid(tx5.GetHash())));
+    BOOST_CHECK(!pool.exists(GenTxid::Txid(tx6.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx7.GetHash())));
 
-    if (!pool.exists(GenTxid::Txid(tx5.GetHash())))
-        pool.addUnchecked(entry.Fee(1000LL).FromTx(tx5));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(tx5));
+    pool.addUnchecked(entry.Fee(1100LL).FromTx(tx6));
     pool.addUnchecked(entry.Fee(9000LL).FromTx(tx7));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/6/7
     BOOST_CHECK(pool.exists(GenTxid::Txid(tx4.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx5.GetHash())));
-    BOOST_CHECK(pool.exists(GenTxid::Txid(tx6.GetHash())));
+    BOOST_CHECK(!pool.exists(GenTxid::Txid(tx6.GetHash())));
     BOOST_CHECK(!pool.exists(GenTxid::Txid(tx7.GetHash())));
 
     pool.addUnchecked(entry.Fee(1000LL).FromTx(tx5));
+    pool.addUnchecked(entry.Fee(1100LL).FromTx(tx6));
     pool.addUnchecked(entry.Fee(9000LL).FromTx(tx7));
 
     std::vector<CTransactionRef> vtx;
@@ -777,4 +780,354 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 4ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // More children than fit inline
+    const CTransactionRef parent{make_tx({COIN, COIN, COIN})};
+    std::vector<CTransactionRef> children;
+    for (uint32_t i = 0; i < 3; ++i) {
+        children.push_back(make_tx({COIN - 1000}, {parent}, {i}));
+    }
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(parent));
+    for (const CTransactionRef& child : children) {
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(child));
+    }
+
+    const CTxMemPoolEntry& parent_entry{**pool.GetIter(parent->GetHash())};
+    BOOST_CHECK_EQUAL(parent_entry.GetMemPoolChildrenConst().size(), 3U);
+    std::vector<uint256> child_hashes;
+    for (const CTxMemPoolEntry& child : parent_entry.GetMemPoolChildrenConst()) {
+        child_hashes.push_back(child.GetTx().GetHash());
+    }
+    BOOST_CHECK(std::is_sorted(child_hashes.begin(), child_hashes.end()));
+    for (const CTransactionRef& child : children) {
+        const CTxMemPoolEntry& child_entry{**pool.GetIter(child->GetHash())};
+        BOOST_CHECK_EQUAL(child_entry.GetMemPoolParentsConst().size(), 1U);
+        BOOST_CHECK_EQUAL(child_entry.GetMemPoolParentsConst().count(parent_entry), 1U);
+        BOOST_CHECK_EQUAL(parent_entry.GetMemPoolChildrenConst().count(child_entry), 1U);
+    }
+
+    pool.removeRecursive(*children[1], REMOVAL_REASON_DUMMY);
+    BOOST_CHECK_EQUAL(parent_entry.GetMemPoolChildrenConst().size(), 2U);
+
+    pool.removeRecursive(*parent, REMOVAL_REASON_DUMMY);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDiamondAncestorsTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // a is reached through both b and c, and must count once.
+    const CTransactionRef a{make_tx({10 * COIN, 10 * COIN})};
+    const CTransactionRef b{make_tx({9 * COIN}, {a}, {0})};
+    const CTransactionRef c{make_tx({9 * COIN}, {a}, {1})};
+    const CTransactionRef d{make_tx({17 * COIN}, {b, c})};
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(b));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(c));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(d));
+
+    const CTxMemPool::txiter d_it{*pool.GetIter(d->GetHash())};
+    BOOST_CHECK_EQUAL(d_it->GetCountWithAncestors(), 4U);
+    CTxMemPool::setEntries ancestors;
+    std::string err;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*d_it, ancestors, 4, 1000000, 1000, 1000000, err, false));
+    BOOST_CHECK_EQUAL(ancestors.size(), 3U);
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*d_it, ancestors, 3, 1000000, 1000, 1000000, err, false));
+    BOOST_CHECK_EQUAL(err, "too many unconfirmed ancestors [limit: 3]");
+}
+
+BOOST_AUTO_TEST_CASE(ClusterLinearizeTest)
+{
+    // 0 pays little, 1 spends it and pays a lot, 2 is on its own in between.
+    const std::vector<FeeFrac> txs{{100, 100}, {1000, 100}, {300, 100}};
+    const std::vector<std::vector<uint32_t>> parents{{}, {0}, {}};
+    const std::vector<uint32_t> order{LinearizeCluster(txs, parents)};
+    BOOST_CHECK(order == std::vector<uint32_t>({0, 1, 2}));
+
+    std::vector<FeeFrac> linearized;
+    for (const uint32_t i : order) linearized.push_back(txs[i]);
+    const std::vector<LinearizationChunk> chunks{ChunkLinearization(linearized)};
+    BOOST_REQUIRE_EQUAL(chunks.size(), 2U);
+    BOOST_CHECK_EQUAL(chunks[0].end, 2U);
+    BOOST_CHECK_EQUAL(chunks[0].feerate.fee, 1100);
+    BOOST_CHECK_EQUAL(chunks[0].feerate.size, 200);
+    BOOST_CHECK_EQUAL(chunks[1].end, 3U);
+    BOOST_CHECK_EQUAL(chunks[1].feerate.fee, 300);
+
+    // Feerates compare exactly, also where doubles would round them together.
+    const FeeFrac big{(int64_t{1} << 53) + 1, 1};
+    const FeeFrac below{int64_t{1} << 53, 1};
+    BOOST_CHECK(big.HigherThan(below));
+    BOOST_CHECK(!below.HigherThan(big));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    const CTransactionRef a{make_tx({10 * COIN})};
+    const CTransactionRef b{make_tx({9 * COIN})};
+    const CTransactionRef c{make_tx({19 * COIN}, {a, b})};
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(2000LL).FromTx(b));
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+
+    // Spending both merges their clusters, and c pays for a.
+    pool.addUnchecked(entry.Fee(50000LL).FromTx(c));
+    BOOST_REQUIRE_EQUAL(pool.GetClusters().size(), 1U);
+    const CTxMemPool::Cluster& cluster{pool.GetClusters().begin()->second};
+    BOOST_REQUIRE_EQUAL(cluster.txs.size(), 3U);
+    BOOST_CHECK_EQUAL(cluster.chunks.size(), 1U);
+    BOOST_CHECK_EQUAL(cluster.txs[2]->GetTx().GetHash(), c->GetHash());
+    for (const CTxMemPool::txiter it : cluster.txs) {
+        BOOST_CHECK_EQUAL(it->m_chunk_feerate.fee, 53000);
+    }
+
+    // Removing c splits it again.
+    pool.removeRecursive(*c, REMOVAL_REASON_DUMMY);
+    BOOST_REQUIRE_EQUAL(pool.GetClusters().size(), 2U);
+    for (const auto& [id, cluster] : pool.GetClusters()) {
+        BOOST_REQUIRE_EQUAL(cluster.txs.size(), 1U);
+        BOOST_CHECK_EQUAL(cluster.txs[0]->m_chunk_feerate.fee, cluster.txs[0]->GetModifiedFee());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterLimitTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    const CTransactionRef a{make_tx({10 * COIN, 10 * COIN})};
+    const CTransactionRef b{make_tx({9 * COIN}, {a}, {0})};
+    const CTransactionRef c{make_tx({9 * COIN})};
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(b));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(c));
+
+    // A transaction spending b and c would join both their clusters.
+    CTxMemPool::setEntries ancestors{*pool.GetIter(a->GetHash()), *pool.GetIter(b->GetHash()), *pool.GetIter(c->GetHash())};
+    int64_t size{0};
+    for (const CTxMemPool::txiter it : ancestors) size += it->GetTxSize();
+    std::string err;
+    BOOST_CHECK(pool.CheckClusterLimits(ancestors, 100, 4, size + 100, err));
+    BOOST_CHECK(!pool.CheckClusterLimits(ancestors, 100, 3, size + 100, err));
+    BOOST_CHECK_EQUAL(err, "too many transactions in cluster [4 > 3]");
+    BOOST_CHECK(!pool.CheckClusterLimits(ancestors, 101, 4, size + 100, err));
+
+    // Spending c alone leaves a and b out of it.
+    ancestors = {*pool.GetIter(c->GetHash())};
+    const int64_t c_size{int64_t((*pool.GetIter(c->GetHash()))->GetTxSize())};
+    BOOST_CHECK(pool.CheckClusterLimits(ancestors, 100, 2, c_size + 100, err));
+    BOOST_CHECK(!pool.CheckClusterLimits(ancestors, 100, 1, c_size + 100, err));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterBlockTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    const CTransactionRef a{make_tx({10 * COIN, 10 * COIN})};
+    const CTransactionRef b{make_tx({9 * COIN}, {a}, {0})};
+    const CTransactionRef c{make_tx({9 * COIN}, {a}, {1})};
+    const CTransactionRef d{make_tx({8 * COIN}, {b})};
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(a));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(b));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(c));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(d));
+    BOOST_REQUIRE_EQUAL(pool.GetClusters().size(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetClusters().begin()->second.txs.size(), 4U);
+
+    // A block confirming a and double spending b takes b and d out as
+    // conflicts, and leaves c on its own.
+    const CTransactionRef conflict{make_tx({5 * COIN}, {a}, {0})};
+    pool.removeForBlock({a, conflict}, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.exists(GenTxid::Txid(c->GetHash())));
+    BOOST_REQUIRE_EQUAL(pool.GetClusters().size(), 1U);
+    const CTxMemPool::Cluster& cluster{pool.GetClusters().begin()->second};
+    BOOST_REQUIRE_EQUAL(cluster.txs.size(), 1U);
+    BOOST_CHECK_EQUAL(cluster.txs[0]->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(cluster.txs[0]->m_chunk_feerate.fee, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolInfoSortedTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction parent;
+    parent.vout.resize(1);
+    parent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    parent.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vout.resize(1);
+    child.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    child.vout[0].nValue = 9 * COIN;
+
+    CMutableTransaction low_fee;
+    low_fee.vout.resize(1);
+    low_fee.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    low_fee.vout[0].nValue = 5 * COIN;
+    {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(10000LL).FromTx(parent));
+        // A child paying far more still sorts after its parent, but takes
+        // it ahead of the lone low fee transaction.
+        pool.addUnchecked(entry.Fee(100000LL).FromTx(child));
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(low_fee));
+    }
+
+    const std::vector<TxMempoolInfo> infos{pool.infoSorted({
+        GenTxid::Txid(child.GetHash()),
+        GenTxid::Txid(low_fee.GetHash()),
+        GenTxid::Txid(uint256S("01")),
+        GenTxid::Wtxid(CTransaction(parent).GetWitnessHash()),
+        GenTxid::Txid(parent.GetHash()),
+    })};
+    BOOST_REQUIRE_EQUAL(infos.size(), 3U);
+    BOOST_CHECK_EQUAL(infos[0].tx->GetHash(), parent.GetHash());
+    BOOST_CHECK_EQUAL(infos[1].tx->GetHash(), child.GetHash());
+    BOOST_CHECK_EQUAL(infos[1].fee, 100000LL);
+    BOOST_CHECK_EQUAL(infos[2].tx->GetHash(), low_fee.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolOutpointSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    const CTransactionRef parent{make_tx({COIN, COIN})};
+    const CTransactionRef child{make_tx({COIN - 1000}, {parent}, {1})};
+    {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(parent));
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(child));
+    }
+
+    const auto snapshot{pool.GetOutpointSnapshot()};
+    Coin coin;
+    BOOST_CHECK(snapshot->GetCoin(COutPoint{parent->GetHash(), 0}, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, COIN);
+    BOOST_CHECK_EQUAL(coin.nHeight, MEMPOOL_HEIGHT);
+    BOOST_CHECK(!snapshot->GetCoin(COutPoint{parent->GetHash(), 2}, coin));
+    BOOST_CHECK(!snapshot->IsSpent(COutPoint{parent->GetHash(), 0}));
+    BOOST_CHECK(snapshot->IsSpent(COutPoint{parent->GetHash(), 1}));
+
+    // Shared until the mempool changes
+    BOOST_CHECK(pool.GetOutpointSnapshot() == snapshot);
+    WITH_LOCK(pool.cs, pool.removeRecursive(*child, REMOVAL_REASON_DUMMY));
+    const auto refreshed{pool.GetOutpointSnapshot()};
+    BOOST_CHECK(refreshed != snapshot);
+    BOOST_CHECK(!refreshed->IsSpent(COutPoint{parent->GetHash(), 1}));
+    BOOST_CHECK(!refreshed->GetCoin(COutPoint{child->GetHash(), 0}, coin));
+    // Earlier snapshots stay as they were
+    BOOST_CHECK(snapshot->IsSpent(COutPoint{parent->GetHash(), 1}));
+
+    // The new snapshot only copied the change
+    BOOST_CHECK(refreshed->m_base == snapshot->m_base);
+    BOOST_CHECK_EQUAL(refreshed->m_changes.Size(), 2U);
+
+    // Added back, the child is found again even though the base had it too
+    {
+        LOCK2(cs_main, pool.cs);
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(child));
+    }
+    const auto readded{pool.GetOutpointSnapshot()};
+    BOOST_CHECK(readded->IsSpent(COutPoint{parent->GetHash(), 1}));
+    BOOST_CHECK(readded->GetCoin(COutPoint{child->GetHash(), 0}, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, COIN - 1000);
+
+    // Enough changes make the next snapshot a full copy again
+    {
+        LOCK2(cs_main, pool.cs);
+        for (size_t i = 0; i <= MempoolOutpointSnapshot::MIN_CHANGES_BEFORE_COPY; ++i) {
+            pool.addUnchecked(entry.Fee(1000LL).FromTx(make_tx({COIN + CAmount(i)})));
+        }
+    }
+    const auto copied{pool.GetOutpointSnapshot()};
+    BOOST_CHECK(copied->m_base != snapshot->m_base);
+    BOOST_CHECK_EQUAL(copied->m_changes.Size(), 0U);
+    BOOST_CHECK(copied->GetCoin(COutPoint{child->GetHash(), 0}, coin));
+    BOOST_CHECK(copied->IsSpent(COutPoint{parent->GetHash(), 1}));
+}
+
+BOOST_AUTO_TEST_CASE(ChunkFeerateHistogramTest)
+{
+    // Every feerate falls into the bucket that starts at or below it
+    for (size_t i = 0; i + 1 < ChunkFeerateHistogram::BUCKETS; ++i) {
+        const uint64_t start{ChunkFeerateHistogram::BucketStart(i)};
+        const uint64_t next{ChunkFeerateHistogram::BucketStart(i + 1)};
+        BOOST_CHECK_LT(start, next);
+        if (next > (uint64_t{1} << 40)) continue;
+        BOOST_CHECK_EQUAL(ChunkFeerateHistogram::BucketFor({CAmount(start), 1000}), i);
+        BOOST_CHECK_EQUAL(ChunkFeerateHistogram::BucketFor({CAmount(next - 1), 1000}), i);
+    }
+    BOOST_CHECK_EQUAL(ChunkFeerateHistogram::BucketFor({-1000, 100}), 0U);
+    BOOST_CHECK_EQUAL(ChunkFeerateHistogram::BucketFor({std::numeric_limits<CAmount>::max(), 1}), ChunkFeerateHistogram::BUCKETS - 1);
+
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+    BOOST_CHECK_EQUAL(pool.GetFeerateHistogram().Lowest(), ChunkFeerateHistogram::BUCKETS);
+
+    std::vector<CTransactionRef> low, high;
+    for (int i = 0; i < 10; ++i) {
+        low.push_back(make_tx({COIN + i}));
+        pool.addUnchecked(entry.Fee(100LL).FromTx(low.back()));
+        high.push_back(make_tx({2 * COIN + i}));
+        pool.addUnchecked(entry.Fee(100000LL).FromTx(high.back()));
+    }
+    // A parent paid for by its child lands in the child's bucket
+    const CTransactionRef parent{make_tx({3 * COIN})};
+    pool.addUnchecked(entry.Fee(0LL).FromTx(parent));
+    const CTransactionRef child{make_tx({3 * COIN - 1000}, {parent})};
+    pool.addUnchecked(entry.Fee(1000000LL).FromTx(child));
+
+    const ChunkFeerateHistogram& histogram{pool.GetFeerateHistogram()};
+    const size_t low_bucket{ChunkFeerateHistogram::BucketFor({100, int64_t(GetVirtualTransactionSize(*low[0]))})};
+    const size_t high_bucket{ChunkFeerateHistogram::BucketFor({100000, int64_t(GetVirtualTransactionSize(*high[0]))})};
+    BOOST_CHECK_LT(low_bucket, high_bucket);
+    BOOST_CHECK_EQUAL(histogram.Lowest(), low_bucket);
+    BOOST_CHECK_EQUAL(histogram[low_bucket].chunks, 10U);
+    BOOST_CHECK_EQUAL(histogram[low_bucket].txs, 10U);
+    BOOST_CHECK_EQUAL(histogram[low_bucket].feerate.fee, 1000);
+    BOOST_CHECK_EQUAL(histogram[high_bucket].txs, 10U);
+    uint64_t txs{0};
+    for (size_t i = 0; i < ChunkFeerateHistogram::BUCKETS; ++i) txs += histogram[i].txs;
+    BOOST_CHECK_EQUAL(txs, pool.size());
+    BOOST_CHECK(!pool.GetMinChunkFeerate().HigherThan({100, int64_t(GetVirtualTransactionSize(*low[0]))}));
+
+    // Trimming by exactly the lowest bucket's usage evicts all of it at once
+    pool.TrimToSize(pool.DynamicMemoryUsage() - histogram[low_bucket].usage);
+    BOOST_CHECK_EQUAL(pool.size(), 12U);
+    for (const auto& tx : low) BOOST_CHECK(!pool.exists(GenTxid::Txid(tx->GetHash())));
+    for (const auto& tx : high) BOOST_CHECK(pool.exists(GenTxid::Txid(tx->GetHash())));
+    BOOST_CHECK_EQUAL(histogram[low_bucket].chunks, 0U);
+    BOOST_CHECK_EQUAL(histogram[low_bucket].usage, 0U);
+    BOOST_CHECK_GT(histogram.Lowest(), low_bucket);
+
+    // Less than a bucket goes chunk by chunk
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 11U);
+    BOOST_CHECK_EQUAL(histogram[high_bucket].txs, 9U);
+
+    pool.clear();
+    BOOST_CHECK_EQUAL(histogram.Lowest(), ChunkFeerateHistogram::BUCKETS);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
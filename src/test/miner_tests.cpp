@@ -7,8 +7,11 @@
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
+#include <kernel.h>
 #include <node/miner.h>
 #include <policy/policy.h>
+#include <script/sign.h>
+#include <script/signingprovider.h>
 #include <script/standard.h>
 #include <txmempool.h>
 #include <uint256.h>
@@ -16,14 +19,17 @@
 #include <util/system.h>
 #include <util/time.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <test/util/setup_common.h>
 
 #include <memory>
+#include <optional>
 
 #include <boost/test/unit_test.hpp>
 
 using node::BlockAssembler;
+using node::BlockTemplateCache;
 using node::CBlockTemplate;
 
 namespace miner_tests {
@@ -514,4 +520,123 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_FIXTURE_TEST_CASE(template_cache, TestChain100Setup)
+{
+    m_node.template_cache = std::make_unique<BlockTemplateCache>(*m_node.mempool);
+    BlockTemplateCache& cache{*m_node.template_cache};
+    RegisterValidationInterface(&cache);
+
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    const auto spend = [&](const CTransactionRef& input, CAmount fee) {
+        return MakeTransactionRef(CreateValidMempoolTransaction(input, 0, 0, coinbaseKey, script, input->vout[0].nValue - fee));
+    };
+    // Only transactions before version 3 carry a timestamp.
+    const auto spend_at = [&](const CTransactionRef& input, CAmount fee, uint32_t time) {
+        CMutableTransaction mtx;
+        mtx.nVersion = 2;
+        mtx.nTime = time;
+        mtx.vin.emplace_back(COutPoint{input->GetHash(), 0});
+        mtx.vout.emplace_back(input->vout[0].nValue - fee, script);
+        FillableSigningProvider keystore;
+        keystore.AddKey(coinbaseKey);
+        BOOST_REQUIRE(SignSignature(keystore, *input, mtx, 0, SIGHASH_ALL));
+        const CTransactionRef tx{MakeTransactionRef(mtx)};
+        BOOST_REQUIRE(WITH_LOCK(cs_main, return m_node.chainman->ProcessTransaction(tx)).m_result_type == MempoolAcceptResult::ResultType::VALID);
+        return tx;
+    };
+    const auto txids = [](const std::vector<CTransactionRef>& txs) {
+        std::vector<uint256> result;
+        for (const CTransactionRef& tx : txs) {
+            if (!tx->IsCoinBase()) result.push_back(tx->GetHash());
+        }
+        return result;
+    };
+    const auto create_block = [&] {
+        SyncWithValidationInterfaceQueue();
+        BlockAssembler assembler{m_node.chainman->ActiveChainstate(), *m_node.mempool, Params()};
+        return txids(assembler.CreateNewBlock(script, nullptr, nullptr, &m_node)->block.vtx);
+    };
+    // What the cache would hand out for the next template, if anything
+    const auto cached = [&]() -> std::optional<std::vector<uint256>> {
+        SyncWithValidationInterfaceQueue();
+        LOCK2(cs_main, m_node.mempool->cs);
+        const CBlockIndex* tip{m_node.chainman->ActiveChain().Tip()};
+        const unsigned int max_weight = std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, DEFAULT_BLOCK_MAX_WEIGHT);
+        const BlockTemplateCache::Key key{tip->GetBlockHash(), tip->nHeight + 1, tip->GetMedianTimePast(), uint32_t(GetTime()), max_weight, IsBTC16BIPsEnabled(tip->nTime)};
+        std::vector<BlockTemplateCache::Entry> entries;
+        uint64_t weight, sigops_cost;
+        CAmount fees;
+        if (!cache.Get(key, entries, weight, sigops_cost, fees)) return std::nullopt;
+        std::vector<CTransactionRef> txs;
+        for (const BlockTemplateCache::Entry& entry : entries) {
+            txs.push_back(entry.tx);
+        }
+        return txids(txs);
+    };
+    using Txids = std::vector<uint256>;
+
+    const int64_t now{GetTime()};
+    const CTransactionRef tx1{spend(m_coinbase_txns[0], 1 * COIN)};
+    BOOST_CHECK(!cached());
+    BOOST_CHECK(create_block() == Txids{tx1->GetHash()});
+    BOOST_CHECK(cached() == Txids{tx1->GetHash()});
+
+    // A transaction entering the mempool is appended.
+    const CTransactionRef tx2{spend(tx1, 2 * COIN)};
+    BOOST_CHECK(cached() == (Txids{tx1->GetHash(), tx2->GetHash()}));
+
+    // Those timestamped after the template are not, until the template is
+    // for a later time.
+    const CTransactionRef tx3{spend_at(tx2, 1 * COIN, now + 60)};
+    const CTransactionRef tx4{spend_at(tx3, 1 * COIN, now + 60)};
+    BOOST_CHECK(cached() == (Txids{tx1->GetHash(), tx2->GetHash()}));
+    BOOST_CHECK(create_block() == (Txids{tx1->GetHash(), tx2->GetHash()}));
+    SetMockTime(now + 60);
+    BOOST_CHECK(!cached());
+    BOOST_CHECK(create_block() == (Txids{tx1->GetHash(), tx2->GetHash(), tx3->GetHash(), tx4->GetHash()}));
+
+    // Transactions leaving the mempool are dropped.
+    WITH_LOCK(m_node.mempool->cs, m_node.mempool->removeRecursive(*tx3, MemPoolRemovalReason::EXPIRY));
+    BOOST_CHECK(cached() == (Txids{tx1->GetHash(), tx2->GetHash()}));
+
+    // A block starts over, once the next template is asked for.
+    CreateAndProcessBlock({CMutableTransaction{*tx1}}, script);
+    BOOST_CHECK(!cached());
+    BOOST_CHECK(create_block() == Txids{tx2->GetHash()});
+    BOOST_CHECK(cached() == Txids{tx2->GetHash()});
+
+    UnregisterValidationInterface(&cache);
+    SyncWithValidationInterfaceQueue();
+    m_node.template_cache.reset();
+}
+
+BOOST_FIXTURE_TEST_CASE(partial_chunk, TestChain100Setup)
+{
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    const auto spend = [&](const CTransactionRef& input, CAmount fee) {
+        return MakeTransactionRef(CreateValidMempoolTransaction(input, 0, 0, coinbaseKey, script, input->vout[0].nValue - fee));
+    };
+    const CTransactionRef parent{spend(m_coinbase_txns[0], 1 * COIN)};
+    const CTransactionRef medium{spend(m_coinbase_txns[1], 2 * COIN)};
+
+    // A child paying a lot makes one chunk with the low fee parent, ahead of
+    // the medium fee transaction, but it is not final yet.
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint{parent->GetHash(), 0}, CScript{}, CTxIn::SEQUENCE_FINAL - 1);
+    child.vout.emplace_back(parent->vout[0].nValue - 5 * COIN, script);
+    child.nLockTime = 1000;
+    {
+        LOCK2(cs_main, m_node.mempool->cs);
+        m_node.mempool->addUnchecked(TestMemPoolEntryHelper{}.Fee(5 * COIN).FromTx(child));
+    }
+
+    // Without the child, the parent goes after the medium fee transaction.
+    BlockAssembler assembler{m_node.chainman->ActiveChainstate(), *m_node.mempool, Params()};
+    const std::unique_ptr<CBlockTemplate> block_template{assembler.CreateNewBlock(script)};
+    const std::vector<CTransactionRef>& vtx{block_template->block.vtx};
+    BOOST_REQUIRE_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(vtx[1]->GetHash(), medium->GetHash());
+    BOOST_CHECK_EQUAL(vtx[2]->GetHash(), parent->GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -909,4 +909,30 @@ BOOST_AUTO_TEST_CASE(initial_advertise_from_version_message)
     TestOnlyResetTimeData();
 }
 
+BOOST_AUTO_TEST_CASE(latency_histogram_buckets)
+{
+    LatencyHistogram histogram;
+    histogram.Add(0us);
+    histogram.Add(1us);
+    histogram.Add(3us);
+    histogram.Add(1000us);
+    histogram.Add(-5us); // clock went backwards
+    histogram.Add(std::chrono::hours{1});
+
+    BOOST_CHECK_EQUAL(histogram.m_count, 6U);
+    BOOST_CHECK_EQUAL(histogram.m_buckets[0], 2U);
+    BOOST_CHECK_EQUAL(histogram.m_buckets[1], 1U);
+    BOOST_CHECK_EQUAL(histogram.m_buckets[2], 1U);
+    BOOST_CHECK_EQUAL(histogram.m_buckets[10], 1U); // [512, 1024)
+    BOOST_CHECK_EQUAL(histogram.m_buckets[LatencyHistogram::NUM_BUCKETS - 1], 1U);
+    BOOST_CHECK(histogram.m_total == 1004us + std::chrono::hours{1});
+
+    LatencyHistogram sum;
+    sum += histogram;
+    sum += histogram;
+    BOOST_CHECK_EQUAL(sum.m_count, 12U);
+    BOOST_CHECK_EQUAL(sum.m_buckets[0], 4U);
+    BOOST_CHECK(sum.m_total == 2 * histogram.m_total);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <memusage.h>
+#include <support/allocators/pool.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocating)
+{
+    auto resource = PoolResource<8, 8>(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // A freed block is handed out again for the next allocation of that size.
+    void* block = resource.Allocate(8, 8);
+    resource.Deallocate(block, 8, 8);
+    BOOST_CHECK_EQUAL(resource.Allocate(8, 8), block);
+    resource.Deallocate(block, 8, 8);
+
+    // Sizes beyond MAX_BLOCK_SIZE_BYTES and stricter alignments bypass the pool.
+    void* big = resource.Allocate(16, 8);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK(big != block && aligned != block);
+    resource.Deallocate(big, 16, 8);
+    resource.Deallocate(aligned, 8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // Exhausting a chunk allocates another one.
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < 1024 / 8 + 1; ++i) {
+        blocks.push_back(resource.Allocate(8, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    for (void* b : blocks) {
+        resource.Deallocate(b, 8, 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(unordered_map_with_pool)
+{
+    using Map = std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                   PoolAllocator<std::pair<const uint64_t, uint64_t>, sizeof(std::pair<const uint64_t, uint64_t>) + sizeof(void*) * 4>>;
+    Map::allocator_type::ResourceType resource{};
+    {
+        Map map{0, std::hash<uint64_t>{}, std::equal_to<uint64_t>{}, &resource};
+        for (uint64_t i = 0; i < 100000; ++i) {
+            map[i] = i * 2;
+        }
+        for (uint64_t i = 0; i < 100000; i += 2) {
+            map.erase(i);
+        }
+        for (uint64_t i = 1; i < 100000; i += 2) {
+            BOOST_CHECK_EQUAL(map.at(i), i * 2);
+        }
+        const size_t chunks = resource.NumAllocatedChunks();
+        BOOST_CHECK(chunks > 1);
+        // Erased nodes are reused rather than growing the pool.
+        for (uint64_t i = 0; i < 100000; i += 2) {
+            map[i] = i;
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+        BOOST_CHECK(memusage::DynamicUsage(map) >= chunks * resource.ChunkSizeBytes());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,7 +9,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include <functional>
+#include <future>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -169,6 +171,64 @@ BOOST_AUTO_TEST_CASE(singlethreadedscheduler_ordered)
     BOOST_CHECK_EQUAL(counter2, 100);
 }
 
+BOOST_AUTO_TEST_CASE(named_queues)
+{
+    CScheduler scheduler;
+
+    // A task blocked on another queue does not hold that queue up.
+    std::promise<void> unblock;
+    std::future<void> unblocked{unblock.get_future()};
+    bool was_unblocked{false};
+    scheduler.schedule([&] { was_unblocked = unblocked.wait_for(std::chrono::seconds{30}) == std::future_status::ready; },
+                       std::chrono::system_clock::now(), "slow");
+
+    // Tasks of one queue run one at a time, in order, whatever the number of threads.
+    int counter{0};
+    for (int i = 0; i < 100; ++i) {
+        scheduler.schedule([i, &counter] {
+            bool expectation = i == counter++;
+            assert(expectation);
+        }, std::chrono::system_clock::now(), "ordered");
+    }
+    scheduler.schedule([&] { unblock.set_value(); }, std::chrono::system_clock::now(), "fast");
+
+    for (int i = 0; i < 4; ++i) {
+        scheduler.m_service_threads.emplace_back([&] { scheduler.serviceQueue(); });
+    }
+    scheduler.StopWhenDrained();
+
+    BOOST_CHECK(was_unblocked);
+    BOOST_CHECK_EQUAL(counter, 100);
+    const auto stats{scheduler.GetQueueStats()};
+    BOOST_CHECK_EQUAL(stats.size(), 3U);
+    BOOST_CHECK_EQUAL(stats.at("ordered").tasks_run, 100U);
+    BOOST_CHECK_EQUAL(stats.at("ordered").pending, 0U);
+    BOOST_CHECK_EQUAL(stats.at("slow").tasks_run, 1U);
+    BOOST_CHECK(stats.at("ordered").max_latency <= stats.at("ordered").total_latency);
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    CScheduler scheduler;
+    const auto now{std::chrono::system_clock::now()};
+
+    // The high priority task goes first among the due ones, even when due later.
+    std::vector<std::string> order;
+    scheduler.schedule([&] { order.emplace_back("low"); }, now - std::chrono::seconds{2}, "a", CScheduler::Priority::LOW);
+    scheduler.schedule([&] { order.emplace_back("normal"); }, now - std::chrono::seconds{1}, "b");
+    scheduler.schedule([&] { order.emplace_back("high"); }, now, "c", CScheduler::Priority::HIGH);
+    // Priorities do not reorder the tasks of one queue.
+    scheduler.schedule([&] { order.emplace_back("low after high"); }, now, "c", CScheduler::Priority::LOW);
+    scheduler.schedule([&] { order.emplace_back("high after low"); }, now, "a", CScheduler::Priority::HIGH);
+
+    BOOST_CHECK_EQUAL(scheduler.GetQueueStats().at("a").pending, 2U);
+    scheduler.m_service_threads.emplace_back([&] { scheduler.serviceQueue(); });
+    scheduler.StopWhenDrained();
+
+    const std::vector<std::string> expected{"high", "normal", "low", "high after low", "low after high"};
+    BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+}
+
 BOOST_AUTO_TEST_CASE(mockforward)
 {
     CScheduler scheduler;
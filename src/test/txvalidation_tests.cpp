@@ -2,14 +2,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chain.h>
 #include <consensus/validation.h>
 #include <key_io.h>
 #include <policy/packages.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
+#include <script/sign.h>
+#include <script/signingprovider.h>
 #include <script/standard.h>
 #include <test/util/setup_common.h>
+#include <timedata.h>
 #include <validation.h>
 
 #include <boost/test/unit_test.hpp>
@@ -49,4 +53,136 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(result.m_state.GetRejectReason(), "coinbase");
     BOOST_CHECK(result.m_state.GetResult() == TxValidationResult::TX_CONSENSUS);
 }
+
+namespace {
+//! Regtest accepts non-standard transactions by default.
+struct StandardTestChain100Setup : public TestChain100Setup {
+    StandardTestChain100Setup() : TestChain100Setup{{"-acceptnonstdtxn=0"}} {}
+};
+} // namespace
+
+/**
+ * Ensure that the checks run ahead of the message handler reject each
+ * transaction for the same reason as the mempool does.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_prechecks, StandardTestChain100Setup)
+{
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    CMutableTransaction base;
+    base.nVersion = 2;
+    base.nTime = GetAdjustedTime();
+    base.vin.emplace_back(COutPoint{m_coinbase_txns[0]->GetHash(), 0});
+    base.vout.emplace_back(COIN, script);
+
+    std::vector<std::pair<CMutableTransaction, std::string>> rejects;
+    CMutableTransaction no_inputs{base};
+    no_inputs.vin.clear();
+    rejects.emplace_back(no_inputs, "bad-txns-vin-empty");
+    CMutableTransaction future{base};
+    future.nTime = GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME + 60;
+    rejects.emplace_back(future, "timestamp-too-far");
+    CMutableTransaction coinbase{base};
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << OP_11 << OP_EQUAL;
+    rejects.emplace_back(coinbase, "coinbase");
+    CMutableTransaction version{base};
+    version.nVersion = TX_MAX_STANDARD_VERSION + 1;
+    rejects.emplace_back(version, "version");
+    CMutableTransaction small{base};
+    small.vout[0] = CTxOut{0, CScript() << OP_RETURN};
+    rejects.emplace_back(small, "tx-size-small");
+
+    LOCK(cs_main);
+    for (const auto& [mtx, reason] : rejects) {
+        const CTransactionRef tx{MakeTransactionRef(mtx)};
+        TxValidationState state;
+        BOOST_CHECK(!PreCheckMempoolTransaction(*tx, state));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), reason);
+        const MempoolAcceptResult result{m_node.chainman->ProcessTransaction(tx)};
+        BOOST_CHECK(result.m_result_type == MempoolAcceptResult::ResultType::INVALID);
+        BOOST_CHECK_EQUAL(result.m_state.GetRejectReason(), reason);
+        BOOST_CHECK(result.m_state.GetResult() == state.GetResult());
+    }
+
+    TxValidationState state;
+    BOOST_CHECK(PreCheckMempoolTransaction(CTransaction{base}, state));
+    BOOST_CHECK(state.IsValid());
+}
+
+/**
+ * Ensure that each transaction of a batch is accepted or rejected on its own.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_batch, TestChain100Setup)
+{
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    const CTransactionRef parent{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 0, coinbaseKey, script,
+                                                                                  m_coinbase_txns[0]->vout[0].nValue - COIN, /*submit=*/false))};
+    const CTransactionRef child{MakeTransactionRef(CreateValidMempoolTransaction(parent, 0, 101, coinbaseKey, script,
+                                                                                 parent->vout[0].nValue - COIN, /*submit=*/false))};
+    CMutableTransaction orphan;
+    orphan.vin.emplace_back(COutPoint{uint256::ONE, 0});
+    orphan.vout.emplace_back(COIN, script);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_11 << OP_EQUAL;
+    coinbase.vout.emplace_back(COIN, script);
+
+    // Enough of them for the context-free checks to run on worker threads
+    std::vector<CTransactionRef> batch{parent, child, MakeTransactionRef(orphan)};
+    batch.resize(MEMPOOL_BATCH_PARALLEL_MIN, MakeTransactionRef(coinbase));
+
+    LOCK(cs_main);
+    const unsigned int initial_pool_size = m_node.mempool->size();
+    const std::vector<MempoolAcceptResult> results{AcceptToMemoryPoolBatch(m_node.chainman->ActiveChainstate(), batch, GetTime(), /*bypass_limits=*/false)};
+    BOOST_REQUIRE_EQUAL(results.size(), batch.size());
+    BOOST_CHECK(results[0].m_result_type == MempoolAcceptResult::ResultType::VALID);
+    BOOST_CHECK(results[1].m_result_type == MempoolAcceptResult::ResultType::VALID);
+    BOOST_CHECK(results[2].m_state.GetResult() == TxValidationResult::TX_MISSING_INPUTS);
+    for (size_t i = 3; i < results.size(); ++i) {
+        BOOST_CHECK_EQUAL(results[i].m_state.GetRejectReason(), "coinbase");
+    }
+    BOOST_CHECK_EQUAL(m_node.mempool->size(), initial_pool_size + 2);
+    BOOST_CHECK(m_node.mempool->exists(GenTxid::Txid(child->GetHash())));
+
+    // Later batches reuse the same workers.
+    const size_t workers{m_node.chainman->MempoolBatchWorkers().WorkerCount()};
+    BOOST_CHECK_GT(workers, 0U);
+    const std::vector<MempoolAcceptResult> again{AcceptToMemoryPoolBatch(m_node.chainman->ActiveChainstate(), batch, GetTime(), /*bypass_limits=*/false)};
+    BOOST_CHECK_EQUAL(again[1].m_state.GetRejectReason(), "txn-already-in-mempool");
+    BOOST_CHECK_EQUAL(m_node.chainman->MempoolBatchWorkers().WorkerCount(), workers);
+}
+
+/**
+ * Ensure that transactions with many inputs get the same verdict with their
+ * scripts checked on the script check threads.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_script_checks, TestChain100Setup)
+{
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    FillableSigningProvider keystore;
+    keystore.AddKey(coinbaseKey);
+
+    CMutableTransaction mtx;
+    CAmount total{0};
+    for (size_t i = 0; i < MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS; ++i) {
+        mtx.vin.emplace_back(COutPoint{m_coinbase_txns[i]->GetHash(), 0});
+        total += m_coinbase_txns[i]->vout[0].nValue;
+    }
+    mtx.vout.emplace_back(total - COIN, script);
+    for (size_t i = 0; i < mtx.vin.size(); ++i) {
+        BOOST_REQUIRE(SignSignature(keystore, *m_coinbase_txns[i], mtx, i, SIGHASH_ALL));
+    }
+    // The last input carries the signature of the first
+    CMutableTransaction bad{mtx};
+    bad.vin.back().scriptSig = mtx.vin.front().scriptSig;
+
+    LOCK(cs_main);
+    const MempoolAcceptResult bad_result{m_node.chainman->ProcessTransaction(MakeTransactionRef(bad))};
+    BOOST_CHECK(bad_result.m_result_type == MempoolAcceptResult::ResultType::INVALID);
+    BOOST_CHECK(bad_result.m_state.GetResult() == TxValidationResult::TX_CONSENSUS);
+    BOOST_CHECK(bad_result.m_state.GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+
+    const MempoolAcceptResult result{m_node.chainman->ProcessTransaction(MakeTransactionRef(mtx))};
+    BOOST_CHECK(result.m_result_type == MempoolAcceptResult::ResultType::VALID);
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -151,7 +151,7 @@ ChainTestingSetup::ChainTestingSetup(const std::string& chainName, const std::ve
     // We have to run a scheduler thread to prevent ActivateBestChain
     // from blocking due to queue overrun.
     m_node.scheduler = std::make_unique<CScheduler>();
-    m_node.scheduler->m_service_thread = std::thread(util::TraceThread, "scheduler", [&] { m_node.scheduler->serviceQueue(); });
+    m_node.scheduler->m_service_threads.emplace_back(util::TraceThread, "scheduler", [&] { m_node.scheduler->serviceQueue(); });
     GetMainSignals().RegisterBackgroundSignalScheduler(*m_node.scheduler);
 
     m_node.mempool = std::make_unique<CTxMemPool>(1);
@@ -237,7 +237,7 @@ TestingSetup::TestingSetup(const std::string& chainName, const std::vector<const
 TestChain100Setup::TestChain100Setup(const std::vector<const char*>& extra_args)
     : TestingSetup{CBaseChainParams::REGTEST, extra_args}
 {
-    SetMockTime(1598887952);
+    SetMockTime(1680357000);
     constexpr std::array<unsigned char, 32> vchKey = {
         {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1}};
     coinbaseKey.Set(vchKey.begin(), vchKey.end(), true);
@@ -249,7 +249,7 @@ TestChain100Setup::TestChain100Setup(const std::vector<const char*>& extra_args)
         LOCK(::cs_main);
         assert(
             m_node.chainman->ActiveChain().Tip()->GetBlockHash().ToString() ==
-            "571d80a9967ae599cec0448b0b0ba1cfb606f584d8069bd7166b86854ba7a191");
+            "59e8ca7e5534b5e5207c3d8c1c690e2f772b99bcc1d5f8f4ed30bc72210d1985");
     }
 }
 
@@ -279,7 +279,7 @@ CBlock TestChain100Setup::CreateBlock(
     }
     RegenerateCommitments(block, *Assert(m_node.chainman));
 
-    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+    while (!CheckProofOfWork(block.ComputeHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
 
     return block;
 }
@@ -0,0 +1,82 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <util/threadpool.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(util_threadpool_tests)
+
+BOOST_AUTO_TEST_CASE(threadpool_inline_when_not_started)
+{
+    ThreadPool pool{"test"};
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 0U);
+    const auto caller = std::this_thread::get_id();
+    std::future<std::thread::id> f = pool.Submit([] { return std::this_thread::get_id(); });
+    BOOST_CHECK(f.get() == caller);
+}
+
+BOOST_AUTO_TEST_CASE(threadpool_runs_all_tasks)
+{
+    ThreadPool pool{"test"};
+    pool.Start(4);
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 4U);
+
+    std::atomic<int> counter{0};
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 1000; ++i) {
+        results.push_back(pool.Submit([&counter, i] { ++counter; return i * 2; }));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK_EQUAL(results[i].get(), i * 2);
+    }
+    BOOST_CHECK_EQUAL(counter.load(), 1000);
+
+    pool.Stop();
+    BOOST_CHECK_EQUAL(pool.WorkerCount(), 0U);
+    // Restarting a stopped pool is allowed.
+    pool.Start(1);
+    BOOST_CHECK_EQUAL(pool.Submit([] { return 7; }).get(), 7);
+}
+
+BOOST_AUTO_TEST_CASE(threadpool_propagates_exceptions)
+{
+    ThreadPool pool{"test"};
+    pool.Start(2);
+    std::future<void> f = pool.Submit([] { throw std::runtime_error("boom"); });
+    BOOST_CHECK_THROW(f.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(threadpool_stop_breaks_pending)
+{
+    ThreadPool pool{"test"};
+    pool.Start(1);
+
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> gate = release.get_future().share();
+    std::future<void> blocker = pool.Submit([&started, gate] { started.set_value(); gate.wait(); });
+    std::future<int> pending = pool.Submit([] { return 1; });
+    started.get_future().wait();
+
+    // Let the blocker finish only once Stop() has already discarded the queue.
+    std::thread releaser{[&release] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        release.set_value();
+    }};
+    pool.Stop();
+    releaser.join();
+
+    blocker.get();
+    BOOST_CHECK_THROW(pending.get(), std::future_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,10 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 //
 #include <chainparams.h>
+#include <clientversion.h>
 #include <consensus/validation.h>
 #include <node/utxo_snapshot.h>
 #include <random.h>
 #include <rpc/blockchain.h>
+#include <script/script.h>
+#include <streams.h>
 #include <sync.h>
 #include <test/util/chainstate.h>
 #include <test/util/setup_common.h>
@@ -16,6 +19,7 @@
 
 #include <tinyformat.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -392,4 +396,83 @@ BOOST_FIXTURE_TEST_CASE(chainstatemanager_loadblockindex, TestChain100Setup)
     BOOST_CHECK_EQUAL(cs2.setBlockIndexCandidates.size(), num_indexes);
 }
 
+
+//! Columnar snapshot chunks survive a round trip, and corrupt ones are refused.
+BOOST_AUTO_TEST_CASE(snapshot_chunk_roundtrip)
+{
+    const CScript stake_script{CScript{} << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG};
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    for (int tx = 0; tx < 50; ++tx) {
+        const uint256 txid{InsecureRand256()};
+        const int height{int(InsecureRandRange(1000))};
+        const int time{1600000000 + int(InsecureRandRange(100000))};
+        for (uint32_t n = 0; n < 4; ++n) {
+            if (InsecureRandBool()) continue;
+            const CScript script{InsecureRandBool() ? stake_script : CScript{} << OP_RETURN << g_insecure_rand_ctx.randbytes(InsecureRandRange(40))};
+            coins.emplace_back(COutPoint{txid, n + tx}, Coin{CTxOut{CAmount(InsecureRandRange(100 * COIN)), script}, height, tx % 7 == 0, tx % 5 == 0, time});
+        }
+    }
+    // A coin whose transaction data does not match its siblings.
+    coins.emplace_back(COutPoint{coins.back().first.hash, coins.back().first.n + 1}, Coin{CTxOut{1, stake_script}, 0, false, false, 0});
+
+    const auto sorted = [](std::vector<std::pair<COutPoint, Coin>> v) {
+        std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        return v;
+    };
+    const node::SnapshotChunk chunk{node::EncodeSnapshotChunk(coins)};
+    BOOST_CHECK_EQUAL(chunk.m_coins_count, coins.size());
+
+    CDataStream stream{SER_DISK, CLIENT_VERSION};
+    stream << chunk;
+    node::SnapshotChunk read;
+    stream >> read;
+    std::vector<std::pair<COutPoint, Coin>> decoded;
+    BOOST_REQUIRE(node::DecodeSnapshotChunk(read, decoded));
+    const auto expected{sorted(coins)};
+    decoded = sorted(decoded);
+    BOOST_REQUIRE_EQUAL(decoded.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const auto& [outpoint, coin] = decoded[i];
+        BOOST_CHECK(outpoint == expected[i].first);
+        BOOST_CHECK(coin.out == expected[i].second.out);
+        BOOST_CHECK_EQUAL(coin.nHeight, expected[i].second.nHeight);
+        BOOST_CHECK_EQUAL(coin.IsCoinBase(), expected[i].second.IsCoinBase());
+        BOOST_CHECK_EQUAL(coin.IsCoinStake(), expected[i].second.IsCoinStake());
+        BOOST_CHECK_EQUAL(coin.nTime, expected[i].second.nTime);
+    }
+
+    node::SnapshotChunk corrupt{chunk};
+    corrupt.m_payload[corrupt.m_payload.size() / 2] ^= 1;
+    BOOST_CHECK(!node::DecodeSnapshotChunk(corrupt, decoded));
+    corrupt = chunk;
+    ++corrupt.m_coins_count;
+    BOOST_CHECK(!node::DecodeSnapshotChunk(corrupt, decoded));
+}
+
+//! Columnar snapshots load like legacy ones, and are checked against their MuHash.
+BOOST_FIXTURE_TEST_CASE(chainstatemanager_activate_columnar_snapshot, TestChain100Setup)
+{
+    ChainstateManager& chainman = *Assert(m_node.chainman);
+    mineBlocks(10);
+
+    BOOST_REQUIRE(!CreateAndActivateUTXOSnapshot(
+        m_node, m_path_root, [](CAutoFile& auto_infile, SnapshotMetadata& metadata) {
+            BOOST_CHECK(metadata.m_format == node::SnapshotFormat::COLUMNAR);
+            metadata.m_muhash = uint256::ONE;
+        }, node::SnapshotFormat::COLUMNAR));
+    BOOST_REQUIRE(!CreateAndActivateUTXOSnapshot(
+        m_node, m_path_root, [](CAutoFile& auto_infile, SnapshotMetadata& metadata) {
+            // Coins count is larger than coins in file
+            metadata.m_coins_count += 1;
+        }, node::SnapshotFormat::COLUMNAR));
+    BOOST_CHECK(!chainman.SnapshotBlockhash());
+
+    BOOST_REQUIRE(CreateAndActivateUTXOSnapshot(m_node, m_path_root, NoMalleation, node::SnapshotFormat::COLUMNAR));
+    BOOST_CHECK_EQUAL(*chainman.SnapshotBlockhash(), WITH_LOCK(::cs_main, return chainman.ActiveTip()->GetBlockHash()));
+    LOCK(::cs_main);
+    for (const CTransactionRef& txn : m_coinbase_txns) {
+        BOOST_CHECK(chainman.ActiveChainstate().CoinsTip().HaveCoin(COutPoint{txn->GetHash(), 0}));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,16 +3,28 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chainparams.h>
+#include <clientversion.h>
 #include <consensus/amount.h>
+#include <fs.h>
 #include <net.h>
+#include <node/blockstorage.h>
+#include <script/script.h>
 #include <signet.h>
+#include <streams.h>
+#include <txdb.h>
+#include <txmempool.h>
 #include <uint256.h>
+#include <undo.h>
 #include <validation.h>
 
 #include <test/util/setup_common.h>
 
 #include <boost/test/unit_test.hpp>
 
+#include <fstream>
+#include <iterator>
+#include <map>
+
 BOOST_FIXTURE_TEST_SUITE(validation_tests, TestingSetup)
 
 BOOST_AUTO_TEST_CASE(signet_parse_tests)
@@ -91,7 +103,7 @@ BOOST_AUTO_TEST_CASE(test_assumeutxo)
     }
 
     const auto out110 = *ExpectedAssumeutxo(110, *params);
-    BOOST_CHECK_EQUAL(out110.hash_serialized.ToString(), "1ebbf5850204c0bdb15bf030f47c7fe91d45c44c712697e4509ba67adb01c618");
+    BOOST_CHECK_EQUAL(out110.hash_serialized.ToString(), "020a8579c585f3b7f8219f05d2c6940dbeb168c25426b5e2e9e2fee98061516e");
     BOOST_CHECK_EQUAL(out110.nChainTx, 110U);
 
     const auto out210 = *ExpectedAssumeutxo(200, *params);
@@ -99,4 +111,213 @@ BOOST_AUTO_TEST_CASE(test_assumeutxo)
     BOOST_CHECK_EQUAL(out210.nChainTx, 200U);
 }
 
+//! Blocks we stored carry a checksum, and a bad checksum falls back to re-checking the header.
+BOOST_FIXTURE_TEST_CASE(block_read_checksum, TestChain100Setup)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    CBlockIndex* tip{WITH_LOCK(::cs_main, return m_node.chainman->ActiveChain().Tip())};
+
+    CBlock block;
+    BOOST_REQUIRE(node::ReadBlockFromDisk(block, tip, consensus));
+    {
+        LOCK(::cs_main);
+        BOOST_CHECK(tip->nStatus & BLOCK_HAVE_CHECKSUM);
+        BOOST_CHECK_EQUAL(tip->nDataChecksum, node::GetBlockChecksum(block));
+        tip->nDataChecksum ^= 1;
+    }
+
+    CBlock reread;
+    BOOST_CHECK(node::ReadBlockFromDisk(reread, tip, consensus));
+    BOOST_CHECK(reread.GetHash() == block.GetHash());
+
+    node::fParanoidBlockReads = true;
+    BOOST_CHECK(node::ReadBlockFromDisk(reread, tip, consensus));
+    node::fParanoidBlockReads = node::DEFAULT_PARANOID_BLOCK_READS;
+
+    WITH_LOCK(::cs_main, tip->nDataChecksum ^= 1);
+}
+
+//! An index entry rewritten by a version that doesn't know about checksums
+//! keeps BLOCK_HAVE_CHECKSUM, but the checksum itself is only trusted from
+//! its own record.
+BOOST_AUTO_TEST_CASE(block_checksum_record)
+{
+    LOCK(::cs_main);
+    CBlockTreeDB db{/*nCacheSize=*/1 << 20, /*fMemory=*/true};
+
+    CBlockHeader header_new;
+    header_new.nNonce = 1;
+    const uint256 hash_new{header_new.GetHash()};
+    CBlockHeader header_old;
+    header_old.nNonce = 2;
+    const uint256 hash_old{header_old.GetHash()};
+
+    CBlockIndex index_new{header_new};
+    index_new.phashBlock = &hash_new;
+    index_new.nStatus = BLOCK_HAVE_DATA | BLOCK_HAVE_CHECKSUM;
+    index_new.nDataChecksum = 0x12345678;
+    CBlockIndex index_old{header_old};
+    index_old.phashBlock = &hash_old;
+    index_old.nStatus = BLOCK_HAVE_DATA | BLOCK_HAVE_CHECKSUM;
+    index_old.nDataChecksum = 0x12345678;
+
+    BOOST_REQUIRE(db.WriteBatchSync({}, /*nLastFile=*/0, {&index_new}));
+    // What an older version leaves behind: the entry, but no checksum record.
+    BOOST_REQUIRE(db.Write(std::make_pair(uint8_t{'b'}, hash_old), CDiskBlockIndex{&index_old}));
+
+    std::map<uint256, CBlockIndex> loaded;
+    BOOST_REQUIRE(db.LoadBlockIndexGuts(Params().GetConsensus(), [&](const uint256& hash) -> CBlockIndex* {
+        if (hash.IsNull()) return nullptr;
+        const auto [it, inserted]{loaded.try_emplace(hash)};
+        it->second.phashBlock = &it->first;
+        return &it->second;
+    }));
+    BOOST_REQUIRE_EQUAL(loaded.size(), 2U);
+    BOOST_CHECK(loaded.at(hash_new).nStatus & BLOCK_HAVE_CHECKSUM);
+    BOOST_CHECK_EQUAL(loaded.at(hash_new).nDataChecksum, 0x12345678U);
+    BOOST_CHECK(!(loaded.at(hash_old).nStatus & BLOCK_HAVE_CHECKSUM));
+    BOOST_CHECK(loaded.at(hash_old).nStatus & BLOCK_HAVE_DATA);
+}
+
+BOOST_FIXTURE_TEST_CASE(block_read_mapped, TestChain100Setup)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const auto read_tip = [&] {
+        const CBlockIndex* tip{WITH_LOCK(::cs_main, return m_node.chainman->ActiveChain().Tip())};
+        const FlatFilePos pos{WITH_LOCK(::cs_main, return tip->GetBlockPos())};
+
+        CBlock block;
+        BOOST_REQUIRE(node::ReadBlockFromDisk(block, pos, consensus));
+        BOOST_CHECK(block.GetHash() == tip->GetBlockHash());
+
+        std::vector<uint8_t> raw;
+        BOOST_REQUIRE(node::ReadRawBlockFromDisk(raw, pos, Params().MessageStart()));
+        CBlock from_raw;
+        CDataStream{raw, SER_DISK, CLIENT_VERSION} >> from_raw;
+        BOOST_CHECK(from_raw.GetHash() == block.GetHash());
+    };
+
+    // Reading maps the block file, and blocks appended to it afterwards are
+    // read through the same (or a refreshed) mapping.
+    read_tip();
+    mineBlocks(1);
+    read_tip();
+
+    // A position past the end of the file fails instead of reading out of bounds.
+    CBlock block;
+    const FlatFilePos bogus{WITH_LOCK(::cs_main, return m_node.chainman->ActiveChain().Tip()->GetBlockPos().nFile), 0x7fffffff};
+    BOOST_CHECK(!node::ReadBlockFromDisk(block, bogus, consensus));
+}
+
+//! Undo data is kept in memory and only reaches the rev files when block files are flushed.
+BOOST_FIXTURE_TEST_CASE(undo_data_batched, TestChain100Setup)
+{
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    const auto read_undo = [](const CBlockIndex* pindex) {
+        CBlockUndo undo;
+        BOOST_REQUIRE(node::UndoReadFromDisk(undo, pindex));
+        CDataStream stream{SER_DISK, CLIENT_VERSION};
+        stream << undo;
+        return stream.str();
+    };
+    const auto record_on_disk = [&](const CBlockIndex* pindex) {
+        const FlatFilePos pos{WITH_LOCK(::cs_main, return pindex->GetUndoPos())};
+        CAutoFile file{fsbridge::fopen(gArgs.GetBlocksDirPath() / strprintf("rev%05u.dat", pos.nFile), "rb"), SER_DISK, CLIENT_VERSION};
+        BOOST_REQUIRE(!file.IsNull());
+        BOOST_REQUIRE_EQUAL(fseek(file.Get(), pos.nPos - 8, SEEK_SET), 0);
+        CMessageHeader::MessageStartChars magic;
+        file >> magic;
+        return std::equal(std::begin(magic), std::end(magic), Params().MessageStart());
+    };
+
+    const CScript script{GetScriptForDestination(PKHash(coinbaseKey.GetPubKey()))};
+    const CMutableTransaction tx{CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 0, coinbaseKey, script, 1 * COIN, /*submit=*/false)};
+    CreateAndProcessBlock({tx}, script);
+    const CBlockIndex* tip{WITH_LOCK(::cs_main, return chainstate.m_chain.Tip())};
+    const CBlockIndex* first{WITH_LOCK(::cs_main, return chainstate.m_chain[1])};
+    const std::string tip_undo{read_undo(tip)};
+    const std::string first_undo{read_undo(first)};
+    BOOST_CHECK(!record_on_disk(tip));
+
+    chainstate.ForceFlushStateToDisk();
+    BOOST_CHECK(record_on_disk(tip));
+    BOOST_CHECK(record_on_disk(first));
+    BOOST_CHECK(read_undo(tip) == tip_undo);
+    BOOST_CHECK(read_undo(first) == first_undo);
+
+    // The spent coinbase comes back from the cached undo data.
+    BlockValidationState state;
+    BOOST_CHECK(chainstate.InvalidateBlock(state, const_cast<CBlockIndex*>(tip)));
+    BOOST_CHECK(chainstate.CoinsTip().HaveCoin(COutPoint{m_coinbase_txns[0]->GetHash(), 0}));
+}
+
+//! Records that do not hold a block are rescanned even when later records were parsed ahead.
+BOOST_FIXTURE_TEST_CASE(load_external_block_file_pipelined, TestChain100Setup)
+{
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    const CBlock block{CreateBlock({}, CScript{} << OP_TRUE, chainstate)};
+    const auto& magic{Params().MessageStart()};
+
+    CDataStream record{SER_DISK, CLIENT_VERSION};
+    record << magic << uint32_t(::GetSerializeSize(block, CLIENT_VERSION)) << block;
+    // A record whose payload fails to deserialize, as its transaction count is
+    // out of range, while the actual block record hides inside it.
+    const std::vector<unsigned char> junk(88, 0xff);
+    CDataStream data{SER_DISK, CLIENT_VERSION};
+    data << Span{junk}.first(5) << magic << uint32_t(junk.size() + record.size()) << Span{junk};
+    data.write(MakeByteSpan(record));
+
+    const fs::path path{m_args.GetDataDirBase() / "loadblock.dat"};
+    {
+        CAutoFile file{fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION};
+        file.write(MakeByteSpan(data));
+    }
+    g_reindex_threads = 2;
+    chainstate.LoadExternalBlockFile(fsbridge::fopen(path, "rb"));
+    g_reindex_threads = 0;
+
+    LOCK(::cs_main);
+    const CBlockIndex* pindex{m_node.chainman->m_blockman.LookupBlockIndex(block.GetHash())};
+    BOOST_REQUIRE(pindex);
+    BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+}
+
+//! mempool.dat records are checksummed, and a corrupt one takes its descendants with it.
+BOOST_FIXTURE_TEST_CASE(mempool_dump_checksum, TestChain100Setup)
+{
+    CTxMemPool& pool{*m_node.mempool};
+    CChainState& chainstate{m_node.chainman->ActiveChainstate()};
+    const CScript script{CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG};
+    const CTransactionRef parent{MakeTransactionRef(CreateValidMempoolTransaction(m_coinbase_txns[0], 0, 0, coinbaseKey, script,
+                                                                                  m_coinbase_txns[0]->vout[0].nValue - COIN))};
+    const CTransactionRef child{MakeTransactionRef(CreateValidMempoolTransaction(parent, 0, 101, coinbaseKey, script,
+                                                                                 parent->vout[0].nValue - COIN))};
+    BOOST_REQUIRE_EQUAL(pool.size(), 2U);
+    BOOST_REQUIRE(DumpMempool(pool, fsbridge::fopen, /*skip_file_commit=*/true));
+
+    WITH_LOCK(pool.cs, pool.removeRecursive(*parent, MemPoolRemovalReason::EXPIRY));
+    BOOST_REQUIRE_EQUAL(pool.size(), 0U);
+    BOOST_CHECK(LoadMempool(pool, chainstate));
+    BOOST_CHECK(pool.exists(GenTxid::Txid(parent->GetHash())));
+    BOOST_CHECK(pool.exists(GenTxid::Txid(child->GetHash())));
+
+    // Flip a bit in the parent, which comes right after the version and its record size.
+    const fs::path path{gArgs.GetDataDirNet() / "mempool.dat"};
+    std::vector<uint8_t> data;
+    {
+        std::ifstream file{path, std::ios::binary};
+        data.assign(std::istreambuf_iterator<char>{file}, {});
+    }
+    BOOST_REQUIRE_GT(data.size(), 16U);
+    data[16] ^= 1;
+    {
+        std::ofstream file{path, std::ios::binary | std::ios::trunc};
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    WITH_LOCK(pool.cs, pool.removeRecursive(*parent, MemPoolRemovalReason::EXPIRY));
+    BOOST_CHECK(LoadMempool(pool, chainstate));
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
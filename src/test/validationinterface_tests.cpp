@@ -10,6 +10,10 @@
 #include <util/check.h>
 #include <validationinterface.h>
 
+#include <future>
+#include <memory>
+#include <vector>
+
 BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, TestingSetup)
 
 struct TestSubscriberNoop final : public CValidationInterface {
@@ -91,4 +95,53 @@ BOOST_AUTO_TEST_CASE(unregister_all_during_call)
     BOOST_CHECK(destroyed);
 }
 
+struct TestSubscriberSequences final : public CValidationInterface {
+    std::vector<uint64_t> m_sequences;
+    std::function<void()> m_on_call;
+    void TransactionAddedToMempool(const CTransactionRef&, uint64_t mempool_sequence) override
+    {
+        m_sequences.push_back(mempool_sequence);
+        if (m_on_call) m_on_call();
+    }
+};
+
+//! Every subscriber gets its callbacks in order, and a slow one does not hold up the others.
+BOOST_AUTO_TEST_CASE(parallel_subscriber_queues)
+{
+    // Give the subscriber queues a second thread to run in parallel on.
+    m_node.scheduler->m_service_threads.emplace_back([&] { m_node.scheduler->serviceQueue(); });
+
+    std::promise<void> release;
+    std::shared_future<void> released{release.get_future()};
+    auto slow = std::make_shared<TestSubscriberSequences>();
+    slow->m_on_call = [released] { released.wait(); };
+
+    std::promise<void> done;
+    auto fast = std::make_shared<TestSubscriberSequences>();
+    fast->m_on_call = [&] {
+        if (fast->m_sequences.size() == 5) done.set_value();
+    };
+    RegisterSharedValidationInterface(slow);
+    RegisterSharedValidationInterface(fast);
+
+    const CTransactionRef tx{MakeTransactionRef(CMutableTransaction{})};
+    for (uint64_t sequence = 0; sequence < 5; ++sequence) {
+        GetMainSignals().TransactionAddedToMempool(tx, sequence);
+    }
+    BOOST_CHECK(done.get_future().wait_for(std::chrono::seconds{30}) == std::future_status::ready);
+    // The slow subscriber is stuck in its first callback.
+    BOOST_CHECK_GE(GetMainSignals().CallbacksPending(), 4U);
+    BOOST_CHECK_GE(GetMainSignals().CallbackQueueDepths().size(), 3U);
+
+    release.set_value();
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(GetMainSignals().CallbacksPending(), 0U);
+    const std::vector<uint64_t> expected{0, 1, 2, 3, 4};
+    BOOST_CHECK(slow->m_sequences == expected);
+    BOOST_CHECK(fast->m_sequences == expected);
+
+    UnregisterSharedValidationInterface(slow);
+    UnregisterSharedValidationInterface(fast);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
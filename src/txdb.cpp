@@ -15,18 +15,24 @@
 #include <util/translation.h>
 #include <util/vector.h>
 
+#include <algorithm>
 #include <stdint.h>
 
 static constexpr uint8_t DB_COIN{'C'};
 static constexpr uint8_t DB_COINS{'c'};
 static constexpr uint8_t DB_BLOCK_FILES{'f'};
 static constexpr uint8_t DB_BLOCK_INDEX{'b'};
+//! CRC32C of a stored block, see CBlockIndex::nDataChecksum. A record of its
+//! own, because versions that don't know about it rewrite DB_BLOCK_INDEX
+//! entries without it, but keep their BLOCK_HAVE_CHECKSUM bit.
+static constexpr uint8_t DB_BLOCK_CHECKSUM{'K'};
 
 static constexpr uint8_t DB_BEST_BLOCK{'B'};
 static constexpr uint8_t DB_HEAD_BLOCKS{'H'};
 static constexpr uint8_t DB_FLAG{'F'};
 static constexpr uint8_t DB_REINDEX_FLAG{'R'};
 static constexpr uint8_t DB_LAST_BLOCK{'l'};
+static constexpr uint8_t DB_BLOCK_INDEX_SNAPSHOT{'S'};
 
 // Keys used in previous version that might still be found in the DB:
 static constexpr uint8_t DB_TXINDEX_BLOCK{'T'};
@@ -63,7 +69,7 @@ struct CoinEntry {
 }
 
 CCoinsViewDB::CCoinsViewDB(fs::path ldb_path, size_t nCacheSize, bool fMemory, bool fWipe) :
-    m_db(std::make_unique<CDBWrapper>(ldb_path, nCacheSize, fMemory, fWipe, true)),
+    m_db(std::make_unique<CDBWrapper>(ldb_path, nCacheSize, fMemory, fWipe, /*obfuscate=*/true, DB_PROFILE_CHAINSTATE)),
     m_ldb_path(ldb_path),
     m_is_memory(fMemory) { }
 
@@ -76,7 +82,7 @@ void CCoinsViewDB::ResizeCache(size_t new_cache_size)
         // filesystem lock.
         m_db.reset();
         m_db = std::make_unique<CDBWrapper>(
-            m_ldb_path, new_cache_size, m_is_memory, /*fWipe*/ false, /*obfuscate*/ true);
+            m_ldb_path, new_cache_size, m_is_memory, /*fWipe*/ false, /*obfuscate*/ true, DB_PROFILE_CHAINSTATE);
     }
 }
 
@@ -104,6 +110,14 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteBatches(mapCoins, hashBlock, &mapCoins);
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteBatches(mapCoins, hashBlock, nullptr);
+}
+
+bool CCoinsViewDB::WriteBatches(const CCoinsMap &mapCoins, const uint256 &hashBlock, CCoinsMap *erase_from) {
     CDBBatch batch(*m_db);
     size_t count = 0;
     size_t changed = 0;
@@ -128,7 +142,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, Vector(hashBlock, old_tip));
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -138,8 +152,8 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        CCoinsMap::const_iterator itOld = it++;
+        if (erase_from) erase_from->erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             m_db->WriteBatch(batch);
@@ -169,7 +183,7 @@ size_t CCoinsViewDB::EstimateSize() const
     return m_db->EstimateSize(DB_COIN, uint8_t(DB_COIN + 1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.GetDataDirNet() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.GetDataDirNet() / "blocks" / "index", nCacheSize, fMemory, fWipe, /*obfuscate=*/false, DB_PROFILE_BLOCK_INDEX) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -191,6 +205,18 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshotId(uint64_t id) {
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, id, /*fSync=*/true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotId(uint64_t& id) {
+    return Read(DB_BLOCK_INDEX_SNAPSHOT, id);
+}
+
+bool CBlockTreeDB::EraseBlockIndexSnapshotId() {
+    return Erase(DB_BLOCK_INDEX_SNAPSHOT, /*fSync=*/true);
+}
+
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
 class CCoinsViewDBCursor: public CCoinsViewCursor
 {
@@ -278,6 +304,9 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        if ((*it)->nStatus & BLOCK_HAVE_CHECKSUM) {
+            batch.Write(std::make_pair(DB_BLOCK_CHECKSUM, (*it)->GetBlockHash()), (*it)->nDataChecksum);
+        }
     }
     return WriteBatch(batch, true);
 }
@@ -298,6 +327,23 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
 {
     AssertLockHeld(::cs_main);
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    // Checksums come sorted by block hash, so they can be looked up below
+    // without a map.
+    std::vector<std::pair<uint256, uint32_t>> checksums;
+    pcursor->Seek(std::make_pair(DB_BLOCK_CHECKSUM, uint256()));
+    while (pcursor->Valid()) {
+        if (ShutdownRequested()) return false;
+        std::pair<uint8_t, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_CHECKSUM) break;
+        uint32_t checksum;
+        if (!pcursor->GetValue(checksum)) {
+            return error("%s: failed to read block checksum", __func__);
+        }
+        checksums.emplace_back(key.second, checksum);
+        pcursor->Next();
+    }
+
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
 
     // Load m_block_index
@@ -321,6 +367,15 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                if (pindexNew->nStatus & BLOCK_HAVE_CHECKSUM) {
+                    // The bit only counts with a matching checksum record.
+                    const auto checksum{std::lower_bound(checksums.begin(), checksums.end(), std::make_pair(pindexNew->GetBlockHash(), uint32_t{0}))};
+                    if (checksum != checksums.end() && checksum->first == pindexNew->GetBlockHash()) {
+                        pindexNew->nDataChecksum = checksum->second;
+                    } else {
+                        pindexNew->nStatus &= ~BLOCK_HAVE_CHECKSUM;
+                    }
+                }
 
                  // nowp related block index fields
                 pindexNew->nMint          = diskindex.nMint;
@@ -63,6 +63,9 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    //! Like BatchWrite(), but leaves mapCoins untouched so that it can be read
+    //! concurrently, e.g. through a CCoinsViewPending.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
     std::unique_ptr<CCoinsViewCursor> Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
@@ -71,6 +74,11 @@ public:
 
     //! Dynamically alter the underlying leveldb cache size.
     void ResizeCache(size_t new_cache_size) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+private:
+    //! Write the dirty entries of mapCoins in -dbbatchsize batches, erasing
+    //! every entry from erase_from (if set) as it is written.
+    bool WriteBatches(const CCoinsMap &mapCoins, const uint256 &hashBlock, CCoinsMap *erase_from);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -79,9 +87,14 @@ class CBlockTreeDB : public CDBWrapper
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo)
+        EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
+    //! Identifier of the block index snapshot written at the last clean shutdown, see node/blockindexsnapshot.h
+    bool WriteBlockIndexSnapshotId(uint64_t id);
+    bool ReadBlockIndexSnapshotId(uint64_t& id);
+    bool EraseBlockIndexSnapshotId();
     bool WriteReindexing(bool fReindexing);
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
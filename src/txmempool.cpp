@@ -7,6 +7,7 @@
 
 #include <chain.h>
 #include <coins.h>
+#include <crypto/common.h>
 #include <consensus/consensus.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
@@ -15,13 +16,16 @@
 #include <policy/settings.h>
 #include <reverse_iterator.h>
 #include <timedata.h>
+#include <util/check.h>
 #include <util/moneystr.h>
 #include <util/system.h>
 #include <util/time.h>
 #include <validationinterface.h>
 
 #include <chainparams.h>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <optional>
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -122,8 +126,9 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap& cachedDescendan
                                       const std::set<uint256>& setExclude, std::set<uint256>& descendants_to_remove,
                                       uint64_t ancestor_size_limit, uint64_t ancestor_count_limit)
 {
-    CTxMemPoolEntry::Children stageEntries, descendants;
-    stageEntries = updateIt->GetMemPoolChildrenConst();
+    // A reorg can leave far more descendants than an entry links to directly.
+    std::set<CTxMemPoolEntry::CTxMemPoolEntryRef, CompareIteratorByHash> stageEntries, descendants;
+    stageEntries.insert(updateIt->GetMemPoolChildrenConst().begin(), updateIt->GetMemPoolChildrenConst().end());
 
     while (!stageEntries.empty()) {
         const CTxMemPoolEntry& descendant = *stageEntries.begin();
@@ -208,11 +213,13 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
                 if (!visited(childIter) && !setAlreadyIncluded.count(childHash)) {
                     UpdateChild(it, childIter, true);
                     UpdateParent(childIter, it, true);
+                    MergeClusters(it, childIter);
                 }
             }
         } // release epoch guard for UpdateForDescendants
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded, descendants_to_remove, ancestor_size_limit, ancestor_count_limit);
     }
+    UpdateClusters();
 
     for (const auto& txid : descendants_to_remove) {
         // This txid may have been removed already in a prior call to removeRecursive.
@@ -226,7 +233,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 bool CTxMemPool::CalculateAncestorsAndCheckLimits(size_t entry_size,
                                                   size_t entry_count,
                                                   setEntries& setAncestors,
-                                                  CTxMemPoolEntry::Parents& staged_ancestors,
+                                                  const CTxMemPoolEntry::Parents& staged_parents,
                                                   uint64_t limitAncestorCount,
                                                   uint64_t limitAncestorSize,
                                                   uint64_t limitDescendantCount,
@@ -235,12 +242,21 @@ bool CTxMemPool::CalculateAncestorsAndCheckLimits(size_t entry_size,
 {
     size_t totalSizeWithAncestors = entry_size;
 
+    // Entries are marked as they are staged, so every ancestor is staged and
+    // inserted into setAncestors only once.
+    WITH_FRESH_EPOCH(m_epoch);
+    std::vector<txiter> staged_ancestors;
+    staged_ancestors.reserve(staged_parents.size());
+    for (const CTxMemPoolEntry& parent : staged_parents) {
+        const txiter parent_it{mapTx.iterator_to(parent)};
+        if (!visited(parent_it)) staged_ancestors.push_back(parent_it);
+    }
+
     while (!staged_ancestors.empty()) {
-        const CTxMemPoolEntry& stage = staged_ancestors.begin()->get();
-        txiter stageit = mapTx.iterator_to(stage);
+        const txiter stageit{staged_ancestors.back()};
+        staged_ancestors.pop_back();
 
         setAncestors.insert(stageit);
-        staged_ancestors.erase(stage);
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry_size > limitDescendantSize) {
@@ -259,8 +275,8 @@ bool CTxMemPool::CalculateAncestorsAndCheckLimits(size_t entry_size,
             txiter parent_it = mapTx.iterator_to(parent);
 
             // If this is a new ancestor, add it.
-            if (setAncestors.count(parent_it) == 0) {
-                staged_ancestors.insert(parent);
+            if (!visited(parent_it)) {
+                staged_ancestors.push_back(parent_it);
             }
             if (staged_ancestors.size() + setAncestors.size() + entry_count > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
@@ -307,6 +323,35 @@ bool CTxMemPool::CheckPackageLimits(const Package& package,
     return ret;
 }
 
+bool CTxMemPool::CheckClusterLimits(const setEntries& ancestors,
+                                    int64_t vsize,
+                                    uint64_t limitClusterCount,
+                                    uint64_t limitClusterSize,
+                                    std::string& errString) const
+{
+    AssertLockHeld(cs);
+    uint64_t count{1};
+    int64_t size{vsize};
+    std::set<uint64_t> clusters;
+    for (const txiter it : ancestors) {
+        if (!clusters.insert(it->m_cluster_id).second) continue;
+        const Cluster& cluster{m_clusters.at(it->m_cluster_id)};
+        count += cluster.txs.size();
+        for (const LinearizationChunk& chunk : cluster.chunks) {
+            size += chunk.feerate.size;
+        }
+    }
+    if (count > limitClusterCount) {
+        errString = strprintf("too many transactions in cluster [%u > %u]", count, limitClusterCount);
+        return false;
+    }
+    if (uint64_t(size) > limitClusterSize) {
+        errString = strprintf("exceeds cluster size limit [%u > %u]", size, limitClusterSize);
+        return false;
+    }
+    return true;
+}
+
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry,
                                            setEntries &setAncestors,
                                            uint64_t limitAncestorCount,
@@ -337,7 +382,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry,
         // If we're not searching for parents, we require this to already be an
         // entry in the mempool and use the entry's cached parents.
         txiter it = mapTx.iterator_to(entry);
-        staged_ancestors = it->GetMemPoolParentsConst();
+        return CalculateAncestorsAndCheckLimits(entry.GetTxSize(), /* entry_count */ 1,
+                                                setAncestors, it->GetMemPoolParentsConst(),
+                                                limitAncestorCount, limitAncestorSize,
+                                                limitDescendantCount, limitDescendantSize, errString);
     }
 
     return CalculateAncestorsAndCheckLimits(entry.GetTxSize(), /* entry_count */ 1,
@@ -519,18 +567,50 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
     // In that case, our disconnect block logic will call UpdateTransactionsFromBlock
     // to clean up the mess we're leaving here.
 
-    // Update ancestors with information about this tx
-    for (const auto& pit : GetIterSet(setParentTransactions)) {
+    // The new transaction joins the clusters of its parents
+    const setEntries parents{GetIterSet(setParentTransactions)};
+    std::set<uint64_t> parent_clusters;
+    for (const txiter pit : parents) {
+        parent_clusters.insert(pit->m_cluster_id);
+    }
+    if (parent_clusters.size() == 1 && !m_dirty_clusters.count(*parent_clusters.begin())) {
+        // It can go after everything of the one cluster, which only needs
+        // chunking again.
+        const auto cluster{m_clusters.find(*parent_clusters.begin())};
+        std::vector<txiter> txs{std::move(cluster->second.txs)};
+        EraseCluster(cluster);
+        txs.push_back(newit);
+        for (const txiter pit : parents) {
             UpdateParent(newit, pit, true);
+        }
+        StoreCluster(*parent_clusters.begin(), std::move(txs), /*linearized=*/true);
+    } else {
+        newit->m_cluster_id = m_next_cluster_id++;
+        m_clusters[newit->m_cluster_id].txs.push_back(newit);
+        m_dirty_clusters.insert(newit->m_cluster_id);
+        for (const txiter pit : parents) {
+            UpdateParent(newit, pit, true);
+            MergeClusters(newit, pit);
+        }
     }
+
+    // Update ancestors with information about this tx
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    ++m_outpoint_generation;
+    if (m_outpoint_base) {
+        m_outpoint_changes.Add(newit->GetSharedTx());
+        TrimOutpointChanges();
+    }
     totalTxSize += entry.GetTxSize();
+    m_total_fee += entry.GetFee();
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
+
+    UpdateClusters();
 }
 
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
@@ -549,6 +629,10 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
+    if (m_outpoint_base) {
+        m_outpoint_changes.Remove(it->GetTx());
+        TrimOutpointChanges();
+    }
 
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
@@ -562,9 +646,22 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     totalTxSize -= it->GetTxSize();
     m_total_fee -= it->GetFee();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+    cachedInnerUsage -= it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
     mapTx.erase(it);
     nTransactionsUpdated++;
+    ++m_outpoint_generation;
+}
+
+void CTxMemPool::TrimOutpointChanges()
+{
+    AssertLockHeld(cs);
+    const size_t base_size{m_outpoint_base->m_txs.size() + m_outpoint_base->m_spent.size()};
+    if (m_outpoint_changes.Size() <= std::max(MempoolOutpointSnapshot::MIN_CHANGES_BEFORE_COPY,
+                                              base_size / MempoolOutpointSnapshot::CHANGES_PER_COPY_DIVISOR)) {
+        return;
+    }
+    m_outpoint_base.reset();
+    m_outpoint_changes.Clear();
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -679,27 +776,55 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
         if (i != mapTx.end())
             entries.push_back(&*i);
     }
+    // Take the block's transactions and everything conflicting with them out
+    // at once, so that the clusters they leave behind are relinearized once.
+    setEntries confirmed;
+    setEntries conflicts;
     for (const auto& tx : vtx)
     {
         txiter it = mapTx.find(tx->GetHash());
         if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+            confirmed.insert(it);
+        }
+        for (const CTxIn& txin : tx->vin) {
+            auto next = mapNextTx.find(txin.prevout);
+            if (next != mapNextTx.end() && *next->second != *tx) {
+                const txiter conflict{mapTx.find(next->second->GetHash())};
+                ClearPrioritisation(conflict->GetTx().GetHash());
+                CalculateDescendants(conflict, conflicts);
+            }
         }
-        removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
     }
+    setEntries stage{confirmed};
+    stage.insert(conflicts.begin(), conflicts.end());
+    // The conflicts go along with all their descendants, so updating the
+    // descendants of everything staged is only needed for the confirmed ones,
+    // but harmless for the rest.
+    UpdateForRemoveFromMempool(stage, true);
+    RemoveFromClusters(stage);
+    for (txiter it : stage) {
+        removeUnchecked(it, confirmed.count(it) ? MemPoolRemovalReason::BLOCK : MemPoolRemovalReason::CONFLICT);
+    }
+    UpdateClusters();
 }
 
 void CTxMemPool::_clear()
 {
     mapTx.clear();
     mapNextTx.clear();
+    m_clusters.clear();
+    m_cluster_tails.clear();
+    m_dirty_clusters.clear();
+    m_cluster_usage = 0;
+    m_feerate_histogram.Clear();
     totalTxSize = 0;
     m_total_fee = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    ++m_outpoint_generation;
+    m_outpoint_base.reset();
+    m_outpoint_changes.Clear();
 }
 
 void CTxMemPool::clear()
@@ -721,16 +846,15 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
     uint64_t checkTotal = 0;
     CAmount check_total_fee{0};
     uint64_t innerUsage = 0;
-    uint64_t prev_ancestor_count{0};
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(&active_coins_tip));
 
-    for (const auto& it : GetSortedDepthAndScore()) {
+    for (const auto& it : GetSortedMiningOrder()) {
         checkTotal += it->GetTxSize();
         check_total_fee += it->GetFee();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        innerUsage += memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+        innerUsage += it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
         CTxMemPoolEntry::Parents setParentCheck;
         for (const CTxIn &txin : tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
@@ -740,7 +864,7 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 setParentCheck.insert(*it2);
             }
-            // We are iterating through the mempool entries sorted in order by ancestor count.
+            // We are iterating through the mempool entries in mining order.
             // All parents must have been checked before their children and their coins added to
             // the mempoolDuplicate coins cache.
             assert(mempoolDuplicate.HaveCoin(txin.prevout));
@@ -775,9 +899,17 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
         assert(it->GetSizeWithAncestors() == nSizeCheck);
         assert(it->GetSigOpCostWithAncestors() == nSigOpCheck);
         assert(it->GetModFeesWithAncestors() == nFeesCheck);
-        // Sanity check: we are walking in ascending ancestor count order.
-        assert(prev_ancestor_count <= it->GetCountWithAncestors());
-        prev_ancestor_count = it->GetCountWithAncestors();
+
+        // Check the entry's place in its cluster: after its parents, before its children.
+        const auto cluster = m_clusters.find(it->m_cluster_id);
+        assert(cluster != m_clusters.end());
+        assert(it->m_cluster_pos < cluster->second.txs.size() && cluster->second.txs[it->m_cluster_pos] == it);
+        for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+            assert(parent.m_cluster_id == it->m_cluster_id && parent.m_cluster_pos < it->m_cluster_pos);
+        }
+        for (const CTxMemPoolEntry& child : it->GetMemPoolChildrenConst()) {
+            assert(child.m_cluster_id == it->m_cluster_id && child.m_cluster_pos > it->m_cluster_pos);
+        }
 
         // Check children against mapNextTx
         CTxMemPoolEntry::Children setChildrenCheck;
@@ -811,43 +943,49 @@ void CTxMemPool::check(const CCoinsViewCache& active_coins_tip, int64_t spendhei
         assert(&tx == it->second);
     }
 
+    size_t cluster_txs{0};
+    size_t cluster_usage{0};
+    for (const auto& [id, cluster] : m_clusters) {
+        assert(!cluster.chunks.empty() && cluster.chunks.back().end == cluster.txs.size());
+        for (size_t i = 1; i < cluster.chunks.size(); ++i) {
+            assert(!cluster.chunks[i].feerate.HigherThan(cluster.chunks[i - 1].feerate));
+        }
+        assert(m_cluster_tails.count({cluster.chunks.back().feerate, id}));
+        cluster_txs += cluster.txs.size();
+        cluster_usage += cluster.usage;
+    }
+    assert(cluster_txs == mapTx.size());
+    assert(m_cluster_tails.size() == m_clusters.size());
+    assert(cluster_usage == m_cluster_usage);
+    assert(m_dirty_clusters.empty());
+
     assert(totalTxSize == checkTotal);
     assert(m_total_fee == check_total_fee);
     assert(innerUsage == cachedInnerUsage);
 }
 
-bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb, bool wtxid)
+bool CTxMemPool::CompareMiningOrder(const uint256& hasha, const uint256& hashb, bool wtxid)
 {
     LOCK(cs);
     indexed_transaction_set::const_iterator i = wtxid ? get_iter_from_wtxid(hasha) : mapTx.find(hasha);
     if (i == mapTx.end()) return false;
     indexed_transaction_set::const_iterator j = wtxid ? get_iter_from_wtxid(hashb) : mapTx.find(hashb);
     if (j == mapTx.end()) return true;
-    uint64_t counta = i->GetCountWithAncestors();
-    uint64_t countb = j->GetCountWithAncestors();
-    if (counta == countb) {
-        return CompareTxMemPoolEntryByScore()(*i, *j);
-    }
-    return counta < countb;
+    return CompareTxMemPoolEntryByMiningOrder()(*i, *j);
 }
 
 namespace {
-class DepthAndScoreComparator
+class MiningOrderComparator
 {
 public:
     bool operator()(const CTxMemPool::indexed_transaction_set::const_iterator& a, const CTxMemPool::indexed_transaction_set::const_iterator& b)
     {
-        uint64_t counta = a->GetCountWithAncestors();
-        uint64_t countb = b->GetCountWithAncestors();
-        if (counta == countb) {
-            return CompareTxMemPoolEntryByScore()(*a, *b);
-        }
-        return counta < countb;
+        return CompareTxMemPoolEntryByMiningOrder()(*a, *b);
     }
 };
 } // namespace
 
-std::vector<CTxMemPool::indexed_transaction_set::const_iterator> CTxMemPool::GetSortedDepthAndScore() const
+std::vector<CTxMemPool::indexed_transaction_set::const_iterator> CTxMemPool::GetSortedMiningOrder() const
 {
     std::vector<indexed_transaction_set::const_iterator> iters;
     AssertLockHeld(cs);
@@ -857,14 +995,14 @@ std::vector<CTxMemPool::indexed_transaction_set::const_iterator> CTxMemPool::Get
     for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi) {
         iters.push_back(mi);
     }
-    std::sort(iters.begin(), iters.end(), DepthAndScoreComparator());
+    std::sort(iters.begin(), iters.end(), MiningOrderComparator());
     return iters;
 }
 
 void CTxMemPool::queryHashes(std::vector<uint256>& vtxid) const
 {
     LOCK(cs);
-    auto iters = GetSortedDepthAndScore();
+    auto iters = GetSortedMiningOrder();
 
     vtxid.clear();
     vtxid.reserve(mapTx.size());
@@ -881,7 +1019,7 @@ static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator
 std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
 {
     LOCK(cs);
-    auto iters = GetSortedDepthAndScore();
+    auto iters = GetSortedMiningOrder();
 
     std::vector<TxMempoolInfo> ret;
     ret.reserve(mapTx.size());
@@ -892,6 +1030,56 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+std::shared_ptr<const MempoolOutpointSnapshot> CTxMemPool::GetOutpointSnapshot() const
+{
+    {
+        LOCK(m_outpoint_snapshot_mutex);
+        if (m_outpoint_snapshot && m_outpoint_snapshot->m_generation == m_outpoint_generation) return m_outpoint_snapshot;
+    }
+
+    LOCK(cs);
+    // Another caller may have taken it while we waited for cs, which keeps
+    // the generation from moving.
+    LOCK(m_outpoint_snapshot_mutex);
+    if (m_outpoint_snapshot && m_outpoint_snapshot->m_generation == m_outpoint_generation) return m_outpoint_snapshot;
+    if (!m_outpoint_base) {
+        auto base{std::make_shared<MempoolOutpointSnapshot::Outpoints>()};
+        base->m_txs.reserve(mapTx.size());
+        for (const CTxMemPoolEntry& entry : mapTx) {
+            base->m_txs.emplace(entry.GetTx().GetHash(), entry.GetSharedTx());
+        }
+        base->m_spent.reserve(mapNextTx.size());
+        for (const auto& [prevout, tx] : mapNextTx) {
+            base->m_spent.insert(*prevout);
+        }
+        m_outpoint_base = std::move(base);
+        m_outpoint_changes.Clear();
+    }
+    auto snapshot{std::make_shared<const MempoolOutpointSnapshot>(m_outpoint_generation, m_outpoint_base, m_outpoint_changes)};
+    m_outpoint_snapshot = snapshot;
+    return snapshot;
+}
+
+std::vector<TxMempoolInfo> CTxMemPool::infoSorted(const std::vector<GenTxid>& gtxids) const
+{
+    LOCK(cs);
+    std::vector<indexed_transaction_set::const_iterator> iters;
+    iters.reserve(gtxids.size());
+    for (const GenTxid& gtxid : gtxids) {
+        indexed_transaction_set::const_iterator i = (gtxid.IsWtxid() ? get_iter_from_wtxid(gtxid.GetHash()) : mapTx.find(gtxid.GetHash()));
+        if (i != mapTx.end()) iters.push_back(i);
+    }
+    std::sort(iters.begin(), iters.end(), MiningOrderComparator());
+    iters.erase(std::unique(iters.begin(), iters.end()), iters.end());
+
+    std::vector<TxMempoolInfo> ret;
+    ret.reserve(iters.size());
+    for (auto it : iters) {
+        ret.push_back(GetInfo(it));
+    }
+    return ret;
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -934,6 +1122,11 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            // The linearization stays valid, only the chunks change
+            const auto cluster{m_clusters.find(it->m_cluster_id)};
+            std::vector<txiter> txs{std::move(cluster->second.txs)};
+            EraseCluster(cluster);
+            StoreCluster(it->m_cluster_id, std::move(txs), /*linearized=*/true);
             ++nTransactionsUpdated;
         }
     }
@@ -1012,6 +1205,110 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+void MempoolOutpointSnapshot::Changes::Add(const CTransactionRef& tx)
+{
+    m_txs[tx->GetHash()] = tx;
+    m_removed_txs.erase(tx->GetHash());
+    for (const CTxIn& txin : tx->vin) {
+        m_unspent.erase(txin.prevout);
+        m_spent.insert(txin.prevout);
+    }
+}
+
+void MempoolOutpointSnapshot::Changes::Remove(const CTransaction& tx)
+{
+    // Recorded as removed even if added since the base, as the base may have
+    // had it before that.
+    m_txs.erase(tx.GetHash());
+    m_removed_txs.insert(tx.GetHash());
+    for (const CTxIn& txin : tx.vin) {
+        m_spent.erase(txin.prevout);
+        m_unspent.insert(txin.prevout);
+    }
+}
+
+void MempoolOutpointSnapshot::Changes::Clear()
+{
+    m_txs.clear();
+    m_spent.clear();
+    m_removed_txs.clear();
+    m_unspent.clear();
+}
+
+bool MempoolOutpointSnapshot::IsSpent(const COutPoint& outpoint) const
+{
+    if (m_changes.m_spent.count(outpoint)) return true;
+    if (m_changes.m_unspent.count(outpoint)) return false;
+    return m_base->m_spent.count(outpoint) != 0;
+}
+
+bool MempoolOutpointSnapshot::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    auto it{m_changes.m_txs.find(outpoint.hash)};
+    if (it == m_changes.m_txs.end()) {
+        if (m_changes.m_removed_txs.count(outpoint.hash)) return false;
+        it = m_base->m_txs.find(outpoint.hash);
+        if (it == m_base->m_txs.end()) return false;
+    }
+    if (outpoint.n >= it->second->vout.size()) return false;
+    const CTransaction& tx{*it->second};
+    coin = Coin(tx.vout[outpoint.n], MEMPOOL_HEIGHT, false, tx.IsCoinStake(), tx.nTime);
+    return true;
+}
+
+uint64_t ChunkFeerateHistogram::FeePerK(const FeeFrac& feerate)
+{
+    if (feerate.fee <= 0 || feerate.size <= 0) return 0;
+    // In floating point, as fees with modifications can overflow when scaled.
+    const double rate{double(feerate.fee) * 1000 / feerate.size};
+    constexpr uint64_t MAX_RATE{std::numeric_limits<int64_t>::max()};
+    return rate >= double(MAX_RATE) ? MAX_RATE : uint64_t(rate);
+}
+
+size_t ChunkFeerateHistogram::BucketFor(const FeeFrac& feerate)
+{
+    const uint64_t value{FeePerK(feerate)};
+    constexpr uint64_t SUBDIVISIONS{uint64_t{1} << SUBDIVISION_BITS};
+    if (value < SUBDIVISIONS) return value;
+    const int exponent = CountBits(value) - 1;
+    return (size_t(exponent - SUBDIVISION_BITS + 1) << SUBDIVISION_BITS) | ((value >> (exponent - SUBDIVISION_BITS)) & (SUBDIVISIONS - 1));
+}
+
+uint64_t ChunkFeerateHistogram::BucketStart(size_t bucket)
+{
+    constexpr uint64_t SUBDIVISIONS{uint64_t{1} << SUBDIVISION_BITS};
+    if (bucket < SUBDIVISIONS) return bucket;
+    const int shift = int(bucket >> SUBDIVISION_BITS) - 1;
+    return (SUBDIVISIONS | (bucket & (SUBDIVISIONS - 1))) << shift;
+}
+
+void ChunkFeerateHistogram::Add(const FeeFrac& feerate, uint64_t txs, size_t usage)
+{
+    Bucket& bucket{m_buckets[BucketFor(feerate)]};
+    ++bucket.chunks;
+    bucket.txs += txs;
+    bucket.feerate += feerate;
+    bucket.usage += usage;
+}
+
+void ChunkFeerateHistogram::Remove(const FeeFrac& feerate, uint64_t txs, size_t usage)
+{
+    Bucket& bucket{m_buckets[BucketFor(feerate)]};
+    Assume(bucket.chunks > 0 && bucket.txs >= txs && bucket.usage >= usage);
+    --bucket.chunks;
+    bucket.txs -= txs;
+    bucket.feerate -= feerate;
+    bucket.usage -= usage;
+}
+
+size_t ChunkFeerateHistogram::Lowest() const
+{
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        if (m_buckets[bucket].chunks) return bucket;
+    }
+    return BUCKETS;
+}
+
 void CCoinsViewMemPool::PackageAddTransaction(const CTransactionRef& tx)
 {
     for (unsigned int n = 0; n < tx->vout.size(); ++n) {
@@ -1019,10 +1316,14 @@ void CCoinsViewMemPool::PackageAddTransaction(const CTransactionRef& tx)
     }
 }
 
+// Estimate the overhead of mapTx to be 18 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+// Each ordered index, like tx_time, takes three pointers of that per entry.
+static size_t MapTxEntryOverhead() { return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 18 * sizeof(void*)); }
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return MapTxEntryOverhead() * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage +
+           memusage::DynamicUsage(m_clusters) + memusage::DynamicUsage(m_cluster_tails) + m_cluster_usage;
 }
 
 void CTxMemPool::RemoveUnbroadcastTx(const uint256& txid, const bool unchecked) {
@@ -1037,9 +1338,11 @@ void CTxMemPool::RemoveUnbroadcastTx(const uint256& txid, const bool unchecked)
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
     AssertLockHeld(cs);
     UpdateForRemoveFromMempool(stage, updateDescendants);
+    RemoveFromClusters(stage);
     for (txiter it : stage) {
         removeUnchecked(it, reason);
     }
+    UpdateClusters();
 }
 
 int CTxMemPool::Expire(std::chrono::seconds time)
@@ -1071,34 +1374,58 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry)
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Children s;
-    if (add && entry->GetMemPoolChildren().insert(*child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolChildren().erase(*child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Children& children = entry->GetMemPoolChildren();
+    cachedInnerUsage -= children.DynamicMemoryUsage();
+    if (add) {
+        children.insert(*child);
+    } else {
+        children.erase(*child);
     }
+    // Only spilling past the inline capacity changes the usage
+    cachedInnerUsage += children.DynamicMemoryUsage();
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Parents s;
-    if (add && entry->GetMemPoolParents().insert(*parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolParents().erase(*parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Parents& parents = entry->GetMemPoolParents();
+    cachedInnerUsage -= parents.DynamicMemoryUsage();
+    if (add) {
+        parents.insert(*parent);
+    } else {
+        parents.erase(*parent);
     }
+    cachedInnerUsage += parents.DynamicMemoryUsage();
 }
 
 void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     AssertLockHeld(cs);
 
     unsigned nTxnRemoved = 0;
-    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
-
+    size_t usage{DynamicMemoryUsage()};
+    while (!mapTx.empty() && usage > sizelimit) {
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        const size_t lowest{m_feerate_histogram.Lowest()};
+        if (m_feerate_histogram[lowest].usage <= usage - sizelimit) {
+            // The whole lowest bucket has to go. Chunks only get worse further
+            // along a linearization, so its chunks are the last ones of the
+            // clusters whose last chunk is in it, and removing them leaves no
+            // descendants behind.
+            for (const auto& [tail_feerate, id] : m_cluster_tails) {
+                if (ChunkFeerateHistogram::BucketFor(tail_feerate) > lowest) break;
+                const Cluster& cluster{m_clusters.at(id)};
+                size_t chunk{cluster.chunks.size()};
+                while (chunk > 0 && ChunkFeerateHistogram::BucketFor(cluster.chunks[chunk - 1].feerate) <= lowest) --chunk;
+                stage.insert(cluster.txs.begin() + (chunk > 0 ? cluster.chunks[chunk - 1].end : 0), cluster.txs.end());
+            }
+        }
+        if (stage.empty()) {
+            // Evict the worst last chunk of any cluster. Being last in the
+            // linearization, its transactions have no descendants outside of it.
+            const Cluster& cluster{m_clusters.at(m_cluster_tails.begin()->second)};
+            const size_t begin{cluster.chunks.size() > 1 ? cluster.chunks[cluster.chunks.size() - 2].end : 0};
+            stage.insert(cluster.txs.begin() + begin, cluster.txs.end());
+        }
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -1116,6 +1443,7 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
                 }
             }
         }
+        usage = DynamicMemoryUsage();
     }
 }
 
@@ -1164,3 +1492,133 @@ void CTxMemPool::SetIsLoaded(bool loaded)
     LOCK(cs);
     m_is_loaded = loaded;
 }
+
+void CTxMemPool::MergeClusters(txiter a, txiter b)
+{
+    AssertLockHeld(cs);
+    auto keep = m_clusters.find(a->m_cluster_id);
+    auto merge = m_clusters.find(b->m_cluster_id);
+    if (keep == merge) return;
+    // Move the transactions of the smaller cluster over.
+    if (keep->second.txs.size() < merge->second.txs.size()) std::swap(keep, merge);
+    for (const txiter it : merge->second.txs) {
+        it->m_cluster_id = keep->first;
+        keep->second.txs.push_back(it);
+    }
+    m_dirty_clusters.insert(keep->first);
+    m_dirty_clusters.erase(merge->first);
+    EraseCluster(merge);
+}
+
+void CTxMemPool::RemoveFromClusters(const setEntries& stage)
+{
+    AssertLockHeld(cs);
+    std::set<uint64_t> clusters;
+    for (const txiter it : stage) {
+        clusters.insert(it->m_cluster_id);
+    }
+    for (const uint64_t id : clusters) {
+        std::vector<txiter>& txs{m_clusters.at(id).txs};
+        txs.erase(std::remove_if(txs.begin(), txs.end(), [&stage](txiter it) { return stage.count(it); }), txs.end());
+        m_dirty_clusters.insert(id);
+    }
+}
+
+void CTxMemPool::UpdateClusters()
+{
+    AssertLockHeld(cs);
+    for (const uint64_t id : m_dirty_clusters) {
+        const auto cluster = m_clusters.find(id);
+        if (cluster == m_clusters.end()) continue;
+        const std::vector<txiter> txs{std::move(cluster->second.txs)};
+        EraseCluster(cluster);
+
+        // Removals may have left the cluster in several pieces; the first
+        // keeps its id.
+        bool first{true};
+        WITH_FRESH_EPOCH(m_epoch);
+        for (const txiter root : txs) {
+            if (visited(root)) continue;
+            std::vector<txiter> component{root};
+            for (size_t i = 0; i < component.size(); ++i) {
+                for (const CTxMemPoolEntry& parent : component[i]->GetMemPoolParentsConst()) {
+                    const txiter parent_it{mapTx.iterator_to(parent)};
+                    if (!visited(parent_it)) component.push_back(parent_it);
+                }
+                for (const CTxMemPoolEntry& child : component[i]->GetMemPoolChildrenConst()) {
+                    const txiter child_it{mapTx.iterator_to(child)};
+                    if (!visited(child_it)) component.push_back(child_it);
+                }
+            }
+            StoreCluster(first ? id : m_next_cluster_id++, std::move(component));
+            first = false;
+        }
+    }
+    m_dirty_clusters.clear();
+}
+
+void CTxMemPool::StoreCluster(uint64_t id, std::vector<txiter> txs, bool linearized)
+{
+    AssertLockHeld(cs);
+    std::vector<FeeFrac> feerates;
+    feerates.reserve(txs.size());
+    for (uint32_t i = 0; i < txs.size(); ++i) {
+        txs[i]->m_cluster_id = id;
+        txs[i]->m_cluster_pos = i;
+        feerates.push_back({txs[i]->GetModifiedFee(), int64_t(txs[i]->GetTxSize())});
+    }
+
+    Cluster& cluster{m_clusters[id]};
+    if (linearized) {
+        cluster.txs = std::move(txs);
+        cluster.chunks = ChunkLinearization(feerates);
+    } else {
+        std::vector<std::vector<uint32_t>> parents(txs.size());
+        for (uint32_t i = 0; i < txs.size(); ++i) {
+            for (const CTxMemPoolEntry& parent : txs[i]->GetMemPoolParentsConst()) {
+                parents[i].push_back(parent.m_cluster_pos);
+            }
+        }
+        cluster.txs.reserve(txs.size());
+        std::vector<FeeFrac> order;
+        order.reserve(txs.size());
+        for (const uint32_t i : LinearizeCluster(feerates, parents)) {
+            txs[i]->m_cluster_pos = cluster.txs.size();
+            cluster.txs.push_back(txs[i]);
+            order.push_back(feerates[i]);
+        }
+        cluster.chunks = ChunkLinearization(order);
+    }
+    cluster.chunk_usage.reserve(cluster.chunks.size());
+    uint32_t begin{0};
+    for (const LinearizationChunk& chunk : cluster.chunks) {
+        size_t usage{0};
+        for (uint32_t i = begin; i < chunk.end; ++i) {
+            cluster.txs[i]->m_chunk_feerate = chunk.feerate;
+            usage += MapTxEntryOverhead() + cluster.txs[i]->DynamicMemoryUsage();
+        }
+        cluster.chunk_usage.push_back(usage);
+        m_feerate_histogram.Add(chunk.feerate, chunk.end - begin, usage);
+        begin = chunk.end;
+    }
+    m_cluster_tails.emplace(cluster.chunks.back().feerate, id);
+    cluster.usage = memusage::DynamicUsage(cluster.txs) + memusage::DynamicUsage(cluster.chunks) + memusage::DynamicUsage(cluster.chunk_usage);
+    m_cluster_usage += cluster.usage;
+}
+
+void CTxMemPool::EraseCluster(std::unordered_map<uint64_t, Cluster>::iterator cluster)
+{
+    AssertLockHeld(cs);
+    // The chunks are as stored, even if the transactions have changed since.
+    const std::vector<LinearizationChunk>& chunks{cluster->second.chunks};
+    if (!chunks.empty()) {
+        m_cluster_tails.erase({chunks.back().feerate, cluster->first});
+    }
+    uint32_t begin{0};
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        m_feerate_histogram.Remove(chunks[i].feerate, chunks[i].end - begin, cluster->second.chunk_usage[i]);
+        begin = chunks[i].end;
+    }
+    m_cluster_usage -= cluster->second.usage;
+    m_clusters.erase(cluster);
+}
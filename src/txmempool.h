@@ -6,18 +6,28 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <cluster_linearize.h>
 #include <coins.h>
 #include <consensus/amount.h>
 #include <indirectmap.h>
+#include <memusage.h>
 #include <policy/packages.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <random.h>
 #include <sync.h>
@@ -34,8 +44,9 @@ class CChain;
 class CChainState;
 extern RecursiveMutex cs_main;
 
-/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
-static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8).
+ *  Must fit in the 30 bits of Coin::nHeight. */
+static const uint32_t MEMPOOL_HEIGHT = 0x3FFFFFFF;
 
 struct LockPoints {
     // Will be set to the blockchain height and median time past
@@ -69,6 +80,78 @@ struct CompareIteratorByHash {
     }
 };
 
+/**
+ * Set of links between mempool entries, as a vector sorted by CompareIteratorByHash.
+ *
+ * Most entries have a parent or two and as few children, which then sit
+ * inside the entry itself rather than in separately allocated set nodes.
+ * Iterating yields the linked entries as std::reference_wrapper<const Entry>.
+ */
+template <typename Entry, unsigned int N>
+class SortedLinks
+{
+    using Links = prevector<N, const Entry*>;
+    Links m_links;
+
+    typename Links::iterator LowerBound(const Entry* link)
+    {
+        return std::lower_bound(m_links.begin(), m_links.end(), link, CompareIteratorByHash{});
+    }
+
+public:
+    using value_type = std::reference_wrapper<const Entry>;
+
+    class const_iterator
+    {
+        typename Links::const_iterator m_it;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::reference_wrapper<const Entry>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        explicit const_iterator(typename Links::const_iterator it) : m_it{it} {}
+        value_type operator*() const { return **m_it; }
+        const_iterator& operator++() { ++m_it; return *this; }
+        const_iterator operator++(int) { const_iterator copy{*this}; ++m_it; return copy; }
+        bool operator==(const const_iterator& other) const { return m_it == other.m_it; }
+        bool operator!=(const const_iterator& other) const { return m_it != other.m_it; }
+    };
+
+    const_iterator begin() const { return const_iterator{m_links.begin()}; }
+    const_iterator end() const { return const_iterator{m_links.end()}; }
+    size_t size() const { return m_links.size(); }
+    bool empty() const { return m_links.empty(); }
+
+    size_t count(const Entry& link) const
+    {
+        const auto it{std::lower_bound(m_links.begin(), m_links.end(), &link, CompareIteratorByHash{})};
+        return it != m_links.end() && *it == &link;
+    }
+
+    std::pair<const_iterator, bool> insert(const Entry& link)
+    {
+        auto it{LowerBound(&link)};
+        if (it != m_links.end() && *it == &link) return {const_iterator{it}, false};
+        it = m_links.insert(it, &link);
+        return {const_iterator{it}, true};
+    }
+
+    size_t erase(const Entry& link)
+    {
+        const auto it{LowerBound(&link)};
+        if (it == m_links.end() || *it != &link) return 0;
+        m_links.erase(it);
+        return 1;
+    }
+
+    void clear() { m_links.clear(); }
+
+    size_t DynamicMemoryUsage() const { return memusage::DynamicUsage(m_links); }
+};
+
 /** \class CTxMemPoolEntry
  *
  * CTxMemPoolEntry stores data about the corresponding transaction, as well
@@ -86,8 +169,8 @@ class CTxMemPoolEntry
 public:
     typedef std::reference_wrapper<const CTxMemPoolEntry> CTxMemPoolEntryRef;
     // two aliases, should the types ever diverge
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Parents;
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Children;
+    typedef SortedLinks<CTxMemPoolEntry, 2> Parents;
+    typedef SortedLinks<CTxMemPoolEntry, 2> Children;
 
 private:
     const CTransactionRef tx;
@@ -162,6 +245,9 @@ public:
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
     mutable Epoch::Marker m_epoch_marker; //!< epoch when last touched, useful for graph algorithms
+    mutable uint64_t m_cluster_id{0}; //!< Key of the entry's cluster in the mempool's m_clusters
+    mutable uint32_t m_cluster_pos{0}; //!< Position in the cluster's linearization
+    mutable FeeFrac m_chunk_feerate; //!< Feerate of the linearization chunk the entry is in
 };
 
 // extracts a transaction hash from CTxMemPoolEntry or CTransactionRef
@@ -194,6 +280,15 @@ struct mempoolentry_wtxid
     }
 };
 
+// extracts a transaction's timestamp from CTxMemPoolEntry
+struct mempoolentry_txtime
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().nTime;
+    }
+};
 
 /** \class CompareTxMemPoolEntryByDescendantScore
  *
@@ -311,11 +406,29 @@ public:
     }
 };
 
+/** \class CompareTxMemPoolEntryByMiningOrder
+ *
+ *  Sort entries in the order they would be mined in: by the feerate of the
+ *  chunk of their cluster they are in, and by linearization within a cluster.
+ */
+class CompareTxMemPoolEntryByMiningOrder
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        if (a.m_cluster_id == b.m_cluster_id) return a.m_cluster_pos < b.m_cluster_pos;
+        if (a.m_chunk_feerate.HigherThan(b.m_chunk_feerate)) return true;
+        if (b.m_chunk_feerate.HigherThan(a.m_chunk_feerate)) return false;
+        return a.m_cluster_id < b.m_cluster_id;
+    }
+};
+
 // Multi_index tag names
 struct descendant_score {};
 struct entry_time {};
 struct ancestor_score {};
 struct index_by_wtxid {};
+struct tx_time {};
 
 /**
  * Information about a mempool transaction.
@@ -350,6 +463,93 @@ enum class MemPoolRemovalReason {
     REPLACED,    //!< Removed for replacement
 };
 
+/**
+ * The outputs created and spent by the mempool's transactions at one point in
+ * time. A snapshot never changes once taken, so it can be read without holding
+ * cs_main or the mempool lock. See CTxMemPool::GetOutpointSnapshot().
+ *
+ * A snapshot is a full copy of the outpoints, its base, which it shares with
+ * the snapshots taken after it, plus the changes the mempool made since that
+ * base was copied.
+ */
+class MempoolOutpointSnapshot
+{
+public:
+    struct Outpoints {
+        std::unordered_map<uint256, CTransactionRef, SaltedTxidHasher> m_txs;
+        std::unordered_set<COutPoint, SaltedOutpointHasher> m_spent;
+    };
+
+    /** Changes to a base. Where they overlap, the later change wins. */
+    struct Changes : Outpoints {
+        std::unordered_set<uint256, SaltedTxidHasher> m_removed_txs;
+        std::unordered_set<COutPoint, SaltedOutpointHasher> m_unspent;
+
+        void Add(const CTransactionRef& tx);
+        void Remove(const CTransaction& tx);
+        void Clear();
+        size_t Size() const { return m_txs.size() + m_spent.size() + m_removed_txs.size() + m_unspent.size(); }
+    };
+
+    //! A base is copied again once the changes to it outgrow this fraction of it,
+    //! and no earlier than after MIN_CHANGES_BEFORE_COPY changes.
+    static constexpr size_t CHANGES_PER_COPY_DIVISOR{8};
+    static constexpr size_t MIN_CHANGES_BEFORE_COPY{1000};
+
+    MempoolOutpointSnapshot(uint64_t generation, std::shared_ptr<const Outpoints> base, Changes changes)
+        : m_generation{generation}, m_base{std::move(base)}, m_changes{std::move(changes)} {}
+
+    //! Value of the mempool's outpoint generation counter when taken
+    const uint64_t m_generation;
+    const std::shared_ptr<const Outpoints> m_base;
+    const Changes m_changes;
+
+    /** Whether a mempool transaction spends outpoint. */
+    bool IsSpent(const COutPoint& outpoint) const;
+
+    /** Look up an output of a mempool transaction, whether or not the mempool spends it. */
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+};
+
+/**
+ * Totals of the mempool's chunks (see CTxMemPool's Clusters section), bucketed
+ * by feerate in size classes: each power of two of sat/kvB is split into
+ * 2^SUBDIVISION_BITS buckets, so that no bucket is wider than a quarter of
+ * its lowest feerate while the whole range fits in a fixed number of them.
+ */
+class ChunkFeerateHistogram
+{
+public:
+    static constexpr int SUBDIVISION_BITS{2};
+    static constexpr size_t BUCKETS{(64 - SUBDIVISION_BITS) << SUBDIVISION_BITS};
+
+    struct Bucket {
+        uint64_t chunks{0};
+        uint64_t txs{0};
+        FeeFrac feerate;
+        //! Memory usage of the transactions' entries.
+        size_t usage{0};
+    };
+
+    /** A feerate in sat/kvB, rounded down, and zero if it is not positive. */
+    static uint64_t FeePerK(const FeeFrac& feerate);
+    /** The bucket a chunk of this feerate falls into. */
+    static size_t BucketFor(const FeeFrac& feerate);
+    /** The lowest feerate, in sat/kvB, of a bucket. */
+    static uint64_t BucketStart(size_t bucket);
+
+    void Add(const FeeFrac& feerate, uint64_t txs, size_t usage);
+    void Remove(const FeeFrac& feerate, uint64_t txs, size_t usage);
+    void Clear() { *this = {}; }
+
+    const Bucket& operator[](size_t bucket) const { return m_buckets[bucket]; }
+    /** The lowest bucket with any chunks in it, or BUCKETS if there are none. */
+    size_t Lowest() const;
+
+private:
+    std::array<Bucket, BUCKETS> m_buckets;
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain transactions
  * that may be included in the next block.
@@ -419,6 +619,21 @@ enum class MemPoolRemovalReason {
  * CalculateMemPoolAncestors() takes configurable limits that are designed to
  * prevent these calculations from being too CPU intensive.
  *
+ * Clusters:
+ *
+ * The transactions are also grouped into clusters, the connected components
+ * of the graph of parent/child links, in m_clusters. Each cluster is kept
+ * linearized (see LinearizeCluster()) and split into chunks, so that taking
+ * the best remaining chunk of any cluster gives one consistent order for the
+ * whole mempool. Mining (BlockAssembler), eviction (TrimToSize()) and relay
+ * (infoSorted()) use that order rather than walking ancestor and descendant
+ * sets. A cluster is relinearized by UpdateClusters() at the end of every
+ * operation that merges clusters or takes transactions out of them, once for
+ * all the clusters it touched. A transaction joining a single cluster is put
+ * after all of it, and a fee change keeps the linearization; either way only
+ * the chunks are computed again. Clusters are bounded by the cluster limits
+ * at acceptance (see CheckClusterLimits()).
+ *
  */
 class CTxMemPool
 {
@@ -435,6 +650,15 @@ protected:
     // This number is incremented once every time a transaction
     // is added or removed from the mempool for any reason.
     mutable uint64_t m_sequence_number GUARDED_BY(cs){1};
+    //! Incremented on every change to the outpoints the mempool creates or spends
+    std::atomic<uint64_t> m_outpoint_generation{0};
+
+    mutable Mutex m_outpoint_snapshot_mutex;
+    mutable std::shared_ptr<const MempoolOutpointSnapshot> m_outpoint_snapshot GUARDED_BY(m_outpoint_snapshot_mutex);
+    //! Base of the next outpoint snapshot and the changes made since it was
+    //! copied. Changes are only recorded while there is a base.
+    mutable std::shared_ptr<const MempoolOutpointSnapshot::Outpoints> m_outpoint_base GUARDED_BY(cs);
+    mutable MempoolOutpointSnapshot::Changes m_outpoint_changes GUARDED_BY(cs);
 
     bool m_is_loaded GUARDED_BY(cs){false};
 
@@ -470,6 +694,11 @@ public:
                 boost::multi_index::tag<ancestor_score>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by transaction timestamp, which may not be later than the block's
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<tx_time>,
+                mempoolentry_txtime
             >
         >
     > indexed_transaction_set;
@@ -509,15 +738,47 @@ public:
 
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
+    /** A connected component of the mempool's dependency graph. */
+    struct Cluster {
+        //! The cluster's transactions, in linearized order.
+        std::vector<txiter> txs;
+        //! How txs splits into chunks, in order of non-increasing feerate.
+        std::vector<LinearizationChunk> chunks;
+        //! Memory usage of each chunk's entries, as added to m_feerate_histogram.
+        std::vector<size_t> chunk_usage;
+        //! Memory usage as accounted for in m_cluster_usage.
+        size_t usage{0};
+    };
+
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
+    /** Orders the last chunks of the clusters by feerate, worst first. */
+    struct CompareClusterTail {
+        bool operator()(const std::pair<FeeFrac, uint64_t>& a, const std::pair<FeeFrac, uint64_t>& b) const
+        {
+            if (b.first.HigherThan(a.first)) return true;
+            if (a.first.HigherThan(b.first)) return false;
+            return a.second < b.second;
+        }
+    };
+    std::unordered_map<uint64_t, Cluster> m_clusters GUARDED_BY(cs);
+    //! Feerate of the last chunk of every cluster, which is what eviction takes first.
+    std::set<std::pair<FeeFrac, uint64_t>, CompareClusterTail> m_cluster_tails GUARDED_BY(cs);
+    //! Clusters to be split up and relinearized by UpdateClusters().
+    std::set<uint64_t> m_dirty_clusters GUARDED_BY(cs);
+    uint64_t m_next_cluster_id GUARDED_BY(cs){1};
+    //! Memory used by the transaction and chunk vectors of all clusters.
+    size_t m_cluster_usage GUARDED_BY(cs){0};
+    //! Every chunk of every cluster, by feerate.
+    ChunkFeerateHistogram m_feerate_histogram GUARDED_BY(cs);
+
 
     void UpdateParent(txiter entry, txiter parent, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
     void UpdateChild(txiter entry, txiter child, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
-    std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    std::vector<indexed_transaction_set::const_iterator> GetSortedMiningOrder() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     /**
      * Track locally submitted transactions to periodically retry initial broadcast.
@@ -526,22 +787,23 @@ private:
 
 
     /**
-     * Helper function to calculate all in-mempool ancestors of staged_ancestors and apply ancestor
-     * and descendant limits (including staged_ancestors thsemselves, entry_size and entry_count).
+     * Helper function to calculate all in-mempool ancestors of staged_parents and apply ancestor
+     * and descendant limits (including staged_parents themselves, entry_size and entry_count).
+     * Uses the mempool epoch to visit each ancestor once.
      * param@[in]   entry_size          Virtual size to include in the limits.
      * param@[in]   entry_count         How many entries to include in the limits.
-     * param@[in]   staged_ancestors    Should contain entries in the mempool.
+     * param@[in]   staged_parents      Should contain entries in the mempool.
      * param@[out]  setAncestors        Will be populated with all mempool ancestors.
      */
     bool CalculateAncestorsAndCheckLimits(size_t entry_size,
                                           size_t entry_count,
                                           setEntries& setAncestors,
-                                          CTxMemPoolEntry::Parents &staged_ancestors,
+                                          const CTxMemPoolEntry::Parents& staged_parents,
                                           uint64_t limitAncestorCount,
                                           uint64_t limitAncestorSize,
                                           uint64_t limitDescendantCount,
                                           uint64_t limitDescendantSize,
-                                          std::string &errString) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+                                          std::string &errString) const EXCLUSIVE_LOCKS_REQUIRED(cs) LOCKS_EXCLUDED(m_epoch);
 
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx GUARDED_BY(cs);
@@ -589,7 +851,8 @@ public:
 
     void clear();
     void _clear() EXCLUSIVE_LOCKS_REQUIRED(cs); //lock free
-    bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb, bool wtxid=false);
+    /** Whether hasha would be mined before hashb, or hashb is not in the mempool. */
+    bool CompareMiningOrder(const uint256& hasha, const uint256& hashb, bool wtxid=false);
     void queryHashes(std::vector<uint256>& vtxid) const;
     bool isSpent(const COutPoint& outpoint) const;
     unsigned int GetTransactionsUpdated() const;
@@ -653,7 +916,7 @@ public:
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
      *    look up parents from mapLinks. Must be true for entries not in the mempool
      */
-    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs) LOCKS_EXCLUDED(m_epoch);
 
     /** Calculate all in-mempool ancestors of a set of transactions not already in the mempool and
      * check ancestor and descendant limits. Heuristics are used to estimate the ancestor and
@@ -675,7 +938,21 @@ public:
                             uint64_t limitAncestorSize,
                             uint64_t limitDescendantCount,
                             uint64_t limitDescendantSize,
-                            std::string &errString) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+                            std::string &errString) const EXCLUSIVE_LOCKS_REQUIRED(cs) LOCKS_EXCLUDED(m_epoch);
+
+    /** Check the cluster a new transaction would form with the clusters of
+     *  its in-mempool ancestors against the cluster limits.
+     * @param[in]       ancestors               In-mempool ancestors of the transaction.
+     * @param[in]       vsize                   Virtual size of the transaction.
+     * @param[in]       limitClusterCount       Max number of txns in the cluster.
+     * @param[in]       limitClusterSize        Max virtual size of the cluster.
+     * @param[out]      errString               Populated with error reason if a limit is hit.
+     */
+    bool CheckClusterLimits(const setEntries& ancestors,
+                            int64_t vsize,
+                            uint64_t limitClusterCount,
+                            uint64_t limitClusterSize,
+                            std::string& errString) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
@@ -683,6 +960,8 @@ public:
     void CalculateDescendants(txiter it, setEntries& setDescendants) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
+      *  Whole buckets of m_feerate_histogram are evicted at once while they fit in
+      *  what has to go, and single chunks after that.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
       */
@@ -723,6 +1002,26 @@ public:
         return m_total_fee;
     }
 
+    /** Feerate of the chunk that TrimToSize() would evict first, or zero when empty. */
+    FeeFrac GetMinChunkFeerate() const EXCLUSIVE_LOCKS_REQUIRED(cs)
+    {
+        AssertLockHeld(cs);
+        return m_cluster_tails.empty() ? FeeFrac{} : m_cluster_tails.begin()->first;
+    }
+
+    /** The mempool's clusters, by id. */
+    const std::unordered_map<uint64_t, Cluster>& GetClusters() const EXCLUSIVE_LOCKS_REQUIRED(cs)
+    {
+        AssertLockHeld(cs);
+        return m_clusters;
+    }
+
+    const ChunkFeerateHistogram& GetFeerateHistogram() const EXCLUSIVE_LOCKS_REQUIRED(cs)
+    {
+        AssertLockHeld(cs);
+        return m_feerate_histogram;
+    }
+
     bool exists(const GenTxid& gtxid) const
     {
         LOCK(cs);
@@ -740,6 +1039,18 @@ public:
     }
     TxMempoolInfo info(const GenTxid& gtxid) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /**
+     * The outputs the mempool currently creates and spends. The snapshot is
+     * shared by every caller until the mempool changes, and only taken again,
+     * under cs but not cs_main, when asked for after that. Taking it again
+     * copies the changes since the last full copy, and only makes a full copy
+     * once those have grown large.
+     */
+    std::shared_ptr<const MempoolOutpointSnapshot> GetOutpointSnapshot() const EXCLUSIVE_LOCKS_REQUIRED(!cs, !m_outpoint_snapshot_mutex);
+    /** Info for those of gtxids still in the mempool, looked up under a single
+     *  lock and ordered like CompareMiningOrder(), so that parents come before
+     *  their children. Duplicates are returned once. */
+    std::vector<TxMempoolInfo> infoSorted(const std::vector<GenTxid>& gtxids) const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -834,6 +1145,21 @@ private:
      *  removal.
      */
     void removeUnchecked(txiter entry, MemPoolRemovalReason reason) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Drops the outpoint snapshot base once the changes recorded since it
+     *  was copied have outgrown it, see MempoolOutpointSnapshot. */
+    void TrimOutpointChanges() EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /** Merge the clusters of a and b, leaving the result to be relinearized. */
+    void MergeClusters(txiter a, txiter b) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Take the entries of stage out of their clusters, before they are removed. */
+    void RemoveFromClusters(const setEntries& stage) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Split the clusters marked in m_dirty_clusters into their connected components and linearize them. */
+    void UpdateClusters() EXCLUSIVE_LOCKS_REQUIRED(cs) LOCKS_EXCLUDED(m_epoch);
+    /** Store txs, which must be connected, as cluster id in linearized order.
+     *  If linearized, txs are already in a valid order and only get chunked. */
+    void StoreCluster(uint64_t id, std::vector<txiter> txs, bool linearized = false) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Drop cluster from m_clusters and the eviction and memory accounting. */
+    void EraseCluster(std::unordered_map<uint64_t, Cluster>::iterator cluster) EXCLUSIVE_LOCKS_REQUIRED(cs);
 public:
     /** visited marks a CTxMemPoolEntry as having been traversed
      * during the lifetime of the most recently created Epoch::Guard
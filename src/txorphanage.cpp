@@ -9,6 +9,7 @@
 #include <policy/policy.h>
 
 #include <cassert>
+#include <deque>
 
 /** Expiration time for orphan transactions in seconds */
 static constexpr int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
@@ -151,6 +152,60 @@ void TxOrphanage::AddChildrenToWorkSet(const CTransaction& tx, std::set<uint256>
     }
 }
 
+std::vector<std::pair<CTransactionRef, NodeId>> TxOrphanage::GetWorkBatch(std::set<uint256>& orphan_work_set, size_t max_count, int64_t max_weight) const
+{
+    AssertLockHeld(g_cs_orphans);
+
+    // Kahn's algorithm over the work set. The work set is bounded by
+    // -maxorphantx, so this stays cheap even when every orphan is queued.
+    std::map<uint256, std::set<uint256>> in_set_parents;
+    for (auto it = orphan_work_set.begin(); it != orphan_work_set.end();) {
+        const auto orphan_it = m_orphans.find(*it);
+        if (orphan_it == m_orphans.end()) {
+            it = orphan_work_set.erase(it);
+            continue;
+        }
+        std::set<uint256>& parents = in_set_parents[*it];
+        for (const CTxIn& txin : orphan_it->second.tx->vin) {
+            if (orphan_work_set.count(txin.prevout.hash)) parents.insert(txin.prevout.hash);
+        }
+        ++it;
+    }
+
+    std::deque<uint256> ready;
+    for (const auto& [txid, parents] : in_set_parents) {
+        if (parents.empty()) ready.push_back(txid);
+    }
+
+    std::vector<std::pair<CTransactionRef, NodeId>> batch;
+    int64_t batch_weight{0};
+    while (!ready.empty() && batch.size() < max_count) {
+        const uint256 txid = ready.front();
+        ready.pop_front();
+        const OrphanTx& orphan = m_orphans.find(txid)->second;
+
+        const int64_t weight{GetTransactionWeight(*orphan.tx)};
+        if (!batch.empty() && batch_weight + weight > max_weight) break;
+        batch_weight += weight;
+        batch.emplace_back(orphan.tx, orphan.fromPeer);
+        orphan_work_set.erase(txid);
+
+        // Release children whose in-set parents are now all ahead of them.
+        for (unsigned int i = 0; i < orphan.tx->vout.size(); i++) {
+            const auto it_by_prev = m_outpoint_to_orphan_it.find(COutPoint(txid, i));
+            if (it_by_prev == m_outpoint_to_orphan_it.end()) continue;
+            for (const auto& child_it : it_by_prev->second) {
+                const auto it_parents = in_set_parents.find(child_it->first);
+                if (it_parents == in_set_parents.end()) continue;
+                if (it_parents->second.erase(txid) && it_parents->second.empty()) {
+                    ready.push_back(child_it->first);
+                }
+            }
+        }
+    }
+    return batch;
+}
+
 bool TxOrphanage::HaveTx(const GenTxid& gtxid) const
 {
     LOCK(g_cs_orphans);
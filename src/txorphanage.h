@@ -47,6 +47,13 @@ public:
      * (ie orphans that may have found their final missing parent, and so should be reconsidered for the mempool) */
     void AddChildrenToWorkSet(const CTransaction& tx, std::set<uint256>& orphan_work_set) const EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans);
 
+    /** Take up to max_count orphans (and at most max_weight in total, but always at
+     * least one) out of a peer's work set so that they can be resolved together.
+     * The batch is sorted topologically: an orphan spending outputs of another
+     * orphan from the work set comes after it. Work set entries that are no
+     * longer in the orphanage are dropped. */
+    std::vector<std::pair<CTransactionRef, NodeId>> GetWorkBatch(std::set<uint256>& orphan_work_set, size_t max_count, int64_t max_weight) const EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans);
+
     /** Return how many entries exist in the orphange */
     size_t Size() LOCKS_EXCLUDED(::g_cs_orphans)
     {
@@ -69,6 +69,8 @@ void DirectoryCommit(const fs::path &dirname);
 bool TruncateFile(FILE *file, unsigned int length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
+/** Tell the OS that file is about to be read sequentially, so it can read ahead further. Advisory only. */
+void AdviseSequentialRead(FILE *file);
 
 /**
  * Rename src to dest.
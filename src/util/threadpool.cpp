@@ -0,0 +1,62 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <util/threadpool.h>
+
+#include <tinyformat.h>
+#include <util/threadnames.h>
+
+#include <cassert>
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+void ThreadPool::Start(int num_threads)
+{
+    LOCK(m_mutex);
+    assert(m_workers.empty());
+    m_interrupt = false;
+    for (int n = 0; n < num_threads; ++n) {
+        m_workers.emplace_back([this, n] {
+            util::ThreadRename(strprintf("%s.%i", m_name, n));
+            WorkerThread();
+        });
+    }
+}
+
+void ThreadPool::Stop()
+{
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> dropped;
+    {
+        LOCK(m_mutex);
+        m_interrupt = true;
+        workers.swap(m_workers);
+        dropped.swap(m_queue);
+    }
+    m_cond.notify_all();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    // Destroying the queued packaged_tasks outside the lock breaks their
+    // promises, which wakes up anyone still waiting on them.
+    dropped.clear();
+}
+
+void ThreadPool::WorkerThread()
+{
+    WAIT_LOCK(m_mutex, lock);
+    while (true) {
+        m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_interrupt || !m_queue.empty(); });
+        if (m_interrupt) return;
+        std::function<void()> task = std::move(m_queue.front());
+        m_queue.pop_front();
+        {
+            REVERSE_LOCK(lock);
+            task();
+        }
+    }
+}
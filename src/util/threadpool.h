@@ -0,0 +1,91 @@
+// Copyright (c) 2023 The Nowp developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_THREADPOOL_H
+#define BITCOIN_UTIL_THREADPOOL_H
+
+#include <sync.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Fixed-size pool of worker threads servicing a FIFO queue of tasks.
+ *
+ * Unlike CCheckQueue, which batches homogeneous checks for a single master
+ * thread, the pool accepts arbitrary callables from any thread and hands a
+ * std::future back to the submitter.
+ *
+ * Usage:
+ *
+ * ThreadPool pool{"worker"};
+ * pool.Start(4);
+ * std::future<int> f = pool.Submit([] { return 42; });
+ * ...
+ * pool.Stop(); // joins the workers, tasks still queued are dropped
+ *
+ * A pool that has not been started (or was started with zero threads) runs
+ * submitted tasks synchronously on the calling thread, so callers do not need
+ * a separate code path for the disabled case.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::string name) : m_name{std::move(name)} {}
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** Spawn num_threads workers named "<name>.<n>". Must not already be running. */
+    void Start(int num_threads);
+
+    /** Stop and join all workers. Tasks that have not started yet are discarded,
+     *  which makes their futures report std::future_errc::broken_promise. */
+    void Stop();
+
+    /** Queue a task and return a future for its result. */
+    template <typename F>
+    auto Submit(F&& fn) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        std::future<R> result = task->get_future();
+        {
+            LOCK(m_mutex);
+            if (!m_workers.empty()) {
+                m_queue.emplace_back([task] { (*task)(); });
+                m_cond.notify_one();
+                return result;
+            }
+        }
+        (*task)();
+        return result;
+    }
+
+    /** Number of worker threads currently running. */
+    size_t WorkerCount() const { return WITH_LOCK(m_mutex, return m_workers.size()); }
+
+    /** Number of tasks waiting for a worker. */
+    size_t QueueSize() const { return WITH_LOCK(m_mutex, return m_queue.size()); }
+
+private:
+    void WorkerThread();
+
+    const std::string m_name;
+    mutable Mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()>> m_queue GUARDED_BY(m_mutex);
+    std::vector<std::thread> m_workers GUARDED_BY(m_mutex);
+    bool m_interrupt GUARDED_BY(m_mutex){false};
+};
+
+#endif // BITCOIN_UTIL_THREADPOOL_H
@@ -15,6 +15,7 @@
 #include <consensus/tx_check.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/muhash.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
 #include <hash.h>
@@ -22,6 +23,7 @@
 #include <index/txindex.h>
 #include <logging.h>
 #include <logging/timer.h>
+#include <memusage.h>
 #include <net.h>
 #include <node/blockstorage.h>
 #include <node/coinstats.h>
@@ -49,14 +51,21 @@
 #include <util/moneystr.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/threadnames.h>
+#include <util/threadpool.h>
 #include <util/trace.h>
 #include <util/translation.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <crc32c/crc32c.h>
+
 #include <algorithm>
+#include <deque>
+#include <future>
 #include <numeric>
 #include <optional>
+#include <unordered_map>
 #include <kernel.h>
 #include <bignum.h>
 #include <wallet/wallet.h>
@@ -74,7 +83,10 @@ using node::CoinStatsHashType;
 using node::GetUTXOStats;
 using node::OpenBlockFile;
 using node::ReadBlockFromDisk;
+using node::SnapshotChunk;
+using node::SnapshotFormat;
 using node::SnapshotMetadata;
+using node::TxOutSer;
 using node::UNDOFILE_CHUNK_SIZE;
 using node::UndoReadFromDisk;
 using node::fImporting;
@@ -95,6 +107,8 @@ static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
 static constexpr std::chrono::hours DATABASE_WRITE_INTERVAL{1};
 /** Time to wait between flushing chainstate to disk. */
 static constexpr std::chrono::hours DATABASE_FLUSH_INTERVAL{24};
+/** Minimum time between two background writes of the coins cache, each of which walks the whole cache. */
+static constexpr std::chrono::seconds INCREMENTAL_COINS_FLUSH_INTERVAL{10};
 /** Maximum age of our tip for us to be considered current for fee estimation */
 static constexpr std::chrono::hours MAX_FEE_ESTIMATION_TIP_AGE{3};
 const std::vector<std::string> CHECKLEVEL_DOC {
@@ -142,6 +156,8 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 bool g_parallel_script_checks{false};
+bool g_incremental_coins_flush{DEFAULT_INCREMENTAL_COINS_FLUSH};
+int g_reindex_threads{0};
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
@@ -315,21 +331,28 @@ void CChainState::MaybeUpdateMempoolForReorg(
     // Iterate disconnectpool in reverse, so that we add transactions
     // back to the mempool starting with the earliest transaction that had
     // been previously seen in a block.
+    std::vector<CTransactionRef> resurrected;
     auto it = disconnectpool.queuedTx.get<insertion_order>().rbegin();
     while (it != disconnectpool.queuedTx.get<insertion_order>().rend()) {
-        // ignore validation errors in resurrected transactions
-        if (!fAddToMempool || (*it)->IsCoinBase() || (*it)->IsCoinStake() ||
-            AcceptToMemoryPool(*this, *it, GetTime(),
-                /*bypass_limits=*/true, /*test_accept=*/false).m_result_type !=
-                    MempoolAcceptResult::ResultType::VALID) {
-            // If the transaction doesn't make it in to the mempool, remove any
-            // transactions that depend on it (which would now be orphans).
+        if (!fAddToMempool || (*it)->IsCoinBase() || (*it)->IsCoinStake()) {
+            // Remove any transactions that depend on it (which would now be orphans).
             m_mempool->removeRecursive(**it, MemPoolRemovalReason::REORG);
-        } else if (m_mempool->exists(GenTxid::Txid((*it)->GetHash()))) {
-            vHashUpdate.push_back((*it)->GetHash());
+        } else {
+            resurrected.push_back(*it);
         }
         ++it;
     }
+    // ignore validation errors in resurrected transactions
+    const std::vector<MempoolAcceptResult> results{AcceptToMemoryPoolBatch(*this, resurrected, GetTime(), /*bypass_limits=*/true)};
+    for (size_t i = 0; i < resurrected.size(); ++i) {
+        if (results[i].m_result_type != MempoolAcceptResult::ResultType::VALID) {
+            // If the transaction doesn't make it in to the mempool, remove any
+            // transactions that depend on it (which would now be orphans).
+            m_mempool->removeRecursive(*resurrected[i], MemPoolRemovalReason::REORG);
+        } else if (m_mempool->exists(GenTxid::Txid(resurrected[i]->GetHash()))) {
+            vHashUpdate.push_back(resurrected[i]->GetHash());
+        }
+    }
     disconnectpool.queuedTx.clear();
     // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
     // no in-mempool children, which is generally not true when adding
@@ -397,6 +420,36 @@ void CChainState::MaybeUpdateMempoolForReorg(
         std::chrono::hours{gArgs.GetIntArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY)});
 }
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+/**
+ * CheckInputScripts() for mempool policy, spreading the inputs of a large
+ * transaction over the script check threads. Block validation needs cs_main
+ * as much as mempool acceptance does, so it never waits behind these checks.
+ * Signatures are cached as they verify, which makes working out the reject
+ * reason of a failure on this thread cheap.
+ */
+static bool CheckPolicyInputScripts(const CTransaction& tx, TxValidationState& state,
+                                    const CCoinsViewCache& view, unsigned int flags,
+                                    PrecomputedTransactionData& txdata)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!g_parallel_script_checks || tx.vin.size() < MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS) {
+        return CheckInputScripts(tx, state, view, flags, /*cacheSigStore=*/true, /*cacheFullScriptStore=*/false, txdata);
+    }
+
+    std::vector<CScriptCheck> checks;
+    if (!CheckInputScripts(tx, state, view, flags, /*cacheSigStore=*/true, /*cacheFullScriptStore=*/false, txdata, &checks)) {
+        return false;
+    }
+    // Nothing is queued on a script execution cache hit
+    if (checks.empty()) return true;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(checks);
+    if (control.Wait()) return true;
+    return CheckInputScripts(tx, state, view, flags, /*cacheSigStore=*/true, /*cacheFullScriptStore=*/false, txdata);
+}
+
 /**
 * Checks to avoid mempool polluting consensus critical paths since cached
 * signature and script validity results will be reused if we validate this
@@ -448,7 +501,9 @@ public:
         m_limit_ancestors(gArgs.GetIntArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT)),
         m_limit_ancestor_size(gArgs.GetIntArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000),
         m_limit_descendants(gArgs.GetIntArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT)),
-        m_limit_descendant_size(gArgs.GetIntArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000) {
+        m_limit_descendant_size(gArgs.GetIntArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000),
+        m_limit_cluster_count(gArgs.GetIntArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT)),
+        m_limit_cluster_size(gArgs.GetIntArg("-limitclustersize", DEFAULT_CLUSTER_SIZE_LIMIT)*1000) {
     }
 
     // We put the arguments we're handed into a struct, so we can pass them
@@ -490,6 +545,20 @@ public:
             };
         }
 
+        /** Parameters for one transaction of a batch. The mempool is only trimmed once the whole
+         * batch has been submitted. */
+        static ATMPArgs BatchAccept(const CChainParams& chainparams, int64_t accept_time,
+                                    bool bypass_limits, std::vector<COutPoint>& coins_to_uncache) {
+            return ATMPArgs{/* m_chainparams */ chainparams,
+                            /* m_accept_time */ accept_time,
+                            /* m_bypass_limits */ bypass_limits,
+                            /* m_coins_to_uncache */ coins_to_uncache,
+                            /* m_test_accept */ false,
+                            /* m_allow_bip125_replacement */ true,
+                            /* m_package_submission */ true,
+            };
+        }
+
         /** Parameters for test package mempool validation through testmempoolaccept. */
         static ATMPArgs PackageTestAccept(const CChainParams& chainparams, int64_t accept_time,
                                           std::vector<COutPoint>& coins_to_uncache) {
@@ -536,6 +605,20 @@ public:
      */
     PackageMempoolAcceptResult AcceptPackage(const Package& package, ATMPArgs& args) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Batch acceptance. Unlike a package, each transaction stands or falls on its own, exactly as
+     * with AcceptSingleTransaction(), but the mempool lock is taken once for the whole batch and
+     * the mempool is only trimmed at the end. Parents must come before their children.
+     *
+     * @param[in]   prechecks         Outcome of PreCheckMempoolTransaction() for every transaction.
+     * @param[out]  coins_to_uncache  Coins to uncache for every transaction, see ATMPArgs.
+     */
+    std::vector<MempoolAcceptResult> AcceptTransactionBatch(const std::vector<CTransactionRef>& txns,
+                                                            const std::vector<TxValidationState>& prechecks,
+                                                            const std::vector<int64_t>& accept_times, bool bypass_limits,
+                                                            std::vector<std::vector<COutPoint>>& coins_to_uncache)
+        EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
     // All the intermediate state that gets passed between the various levels
     // of checking a given transaction.
@@ -628,6 +711,9 @@ private:
     // in-mempool conflicts; see below).
     size_t m_limit_descendants;
     size_t m_limit_descendant_size;
+    // Bounds the work of linearizing the cluster a transaction joins.
+    const size_t m_limit_cluster_count;
+    const size_t m_limit_cluster_size;
 };
 
 bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
@@ -804,6 +890,10 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
         }
     }
 
+    if (!m_pool.CheckClusterLimits(ws.m_ancestors, ws.m_vsize, m_limit_cluster_count, m_limit_cluster_size, errString)) {
+        return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-large-cluster", errString);
+    }
+
     return true;
 }
 
@@ -842,7 +932,7 @@ bool MemPoolAccept::PolicyScriptChecks(const ATMPArgs& args, Workspace& ws)
 
     // Check input scripts and signatures.
     // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-    if (!CheckInputScripts(tx, state, m_view, scriptVerifyFlags, true, false, ws.m_precomputed_txdata)) {
+    if (!CheckPolicyInputScripts(tx, state, m_view, scriptVerifyFlags, ws.m_precomputed_txdata)) {
         // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
         // need to turn both off, and compare against just turning off CLEANSTACK
         // to see if the failure is specifically due to witness validation.
@@ -1191,8 +1281,78 @@ PackageMempoolAcceptResult MemPoolAccept::AcceptPackage(const Package& package,
     return submission_result;
 }
 
+std::vector<MempoolAcceptResult> MemPoolAccept::AcceptTransactionBatch(const std::vector<CTransactionRef>& txns,
+                                                                       const std::vector<TxValidationState>& prechecks,
+                                                                       const std::vector<int64_t>& accept_times, bool bypass_limits,
+                                                                       std::vector<std::vector<COutPoint>>& coins_to_uncache)
+{
+    AssertLockHeld(cs_main);
+    LOCK(m_pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
+
+    std::vector<Workspace> workspaces;
+    workspaces.reserve(txns.size());
+    std::vector<bool> submitted(txns.size(), false);
+    for (size_t i = 0; i < txns.size(); ++i) {
+        Workspace& ws = workspaces.emplace_back(txns[i]);
+        if (prechecks[i].IsInvalid()) {
+            ws.m_state = prechecks[i];
+            continue;
+        }
+        auto args = ATMPArgs::BatchAccept(m_active_chainstate.m_params, accept_times[i], bypass_limits, coins_to_uncache[i]);
+        // Submit every transaction right away, so that later ones can spend it.
+        if (!PreChecks(args, ws) || !PolicyScriptChecks(args, ws) || !ConsensusScriptChecks(args, ws)) continue;
+        submitted[i] = Finalize(args, ws);
+        // Announce each transaction as it enters the pool, in the order single
+        // accepts would, so one that LimitMempoolSize() evicts below is still
+        // announced before its removal.
+        if (submitted[i]) GetMainSignals().TransactionAddedToMempool(ws.m_ptx, m_pool.GetAndIncrementSequence());
+    }
+
+    if (!bypass_limits) {
+        LimitMempoolSize(m_pool, m_active_chainstate.CoinsTip(),
+                         gArgs.GetIntArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
+                         std::chrono::hours{gArgs.GetIntArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY)});
+    }
+
+    std::vector<MempoolAcceptResult> results;
+    results.reserve(txns.size());
+    for (size_t i = 0; i < txns.size(); ++i) {
+        Workspace& ws = workspaces[i];
+        if (submitted[i] && m_pool.exists(GenTxid::Wtxid(ws.m_ptx->GetWitnessHash()))) {
+            results.push_back(MempoolAcceptResult::Success(std::move(ws.m_replaced_transactions), ws.m_vsize, ws.m_base_fees));
+        } else {
+            if (submitted[i]) ws.m_state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "mempool full");
+            results.push_back(MempoolAcceptResult::Failure(ws.m_state));
+        }
+    }
+    return results;
+}
+
 } // anon namespace
 
+bool PreCheckMempoolTransaction(const CTransaction& tx, TxValidationState& state)
+{
+    // The leading checks of MemPoolAccept::PreChecks, in the same order, so that
+    // a transaction is rejected for the same reason whichever path it takes.
+    if (!CheckTransaction(tx, state)) {
+        return false; // state filled in by CheckTransaction
+    }
+    if (tx.nTime > GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME)
+        return state.Invalid(TxValidationResult::TX_CONSENSUS, "timestamp-too-far");
+
+    if (tx.IsCoinBase() || tx.IsCoinStake())
+        return state.Invalid(TxValidationResult::TX_CONSENSUS, "coinbase");
+
+    std::string reason;
+    if (fRequireStandard && !IsStandardTx(tx, reason))
+        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, reason);
+
+    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
+        return state.Invalid(TxValidationResult::TX_NOT_STANDARD, "tx-size-small");
+
+    return true;
+}
+
 MempoolAcceptResult AcceptToMemoryPool(CChainState& active_chainstate, const CTransactionRef& tx,
                                        int64_t accept_time, bool bypass_limits, bool test_accept)
     EXCLUSIVE_LOCKS_REQUIRED(::cs_main)
@@ -1220,6 +1380,55 @@ MempoolAcceptResult AcceptToMemoryPool(CChainState& active_chainstate, const CTr
     return result;
 }
 
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CChainState& active_chainstate, const std::vector<CTransactionRef>& txs,
+                                                         int64_t accept_time, bool bypass_limits)
+{
+    return AcceptToMemoryPoolBatch(active_chainstate, txs, std::vector<int64_t>(txs.size(), accept_time), bypass_limits);
+}
+
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CChainState& active_chainstate, const std::vector<CTransactionRef>& txs,
+                                                         const std::vector<int64_t>& accept_times, bool bypass_limits)
+{
+    AssertLockHeld(::cs_main);
+    assert(accept_times.size() == txs.size());
+    assert(active_chainstate.GetMempool() != nullptr);
+    CTxMemPool& pool{*active_chainstate.GetMempool()};
+
+    // These checks need neither the chain nor the mempool.
+    std::vector<TxValidationState> prechecks(txs.size());
+    const auto precheck = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            PreCheckMempoolTransaction(*txs[i], prechecks[i]);
+        }
+    };
+    if (txs.size() >= MEMPOOL_BATCH_PARALLEL_MIN) {
+        ThreadPool& workers{active_chainstate.m_chainman.MempoolBatchWorkers()};
+        const size_t chunk{(txs.size() + workers.WorkerCount() - 1) / workers.WorkerCount()};
+        std::vector<std::future<void>> done;
+        for (size_t begin = 0; begin < txs.size(); begin += chunk) {
+            done.push_back(workers.Submit([&precheck, begin, end = std::min(txs.size(), begin + chunk)] { precheck(begin, end); }));
+        }
+        for (auto& result : done) {
+            result.get();
+        }
+    } else {
+        precheck(0, txs.size());
+    }
+
+    std::vector<std::vector<COutPoint>> coins_to_uncache(txs.size());
+    const std::vector<MempoolAcceptResult> results{MemPoolAccept(pool, active_chainstate).AcceptTransactionBatch(txs, prechecks, accept_times, bypass_limits, coins_to_uncache)};
+    for (size_t i = 0; i < txs.size(); ++i) {
+        if (results[i].m_result_type == MempoolAcceptResult::ResultType::VALID) continue;
+        // See AcceptToMemoryPool()
+        for (const COutPoint& outpoint : coins_to_uncache[i]) {
+            active_chainstate.CoinsTip().Uncache(outpoint);
+        }
+    }
+    BlockValidationState state_dummy;
+    active_chainstate.FlushStateToDisk(state_dummy, FlushStateMode::PERIODIC);
+    return results;
+}
+
 PackageMempoolAcceptResult ProcessNewPackage(CChainState& active_chainstate, CTxMemPool& pool,
                                                    const Package& package, bool test_accept)
 {
@@ -1277,12 +1486,18 @@ CoinsViews::CoinsViews(
     bool in_memory,
     bool should_wipe) : m_dbview(
                             gArgs.GetDataDirNet() / ldb_name, cache_size_bytes, in_memory, should_wipe),
-                        m_catcherview(&m_dbview) {}
+                        m_catcherview(&m_dbview),
+                        m_pendingview(&m_catcherview)
+{
+    if (node::g_coins_prefetch_threads > 0) {
+        m_prefetcher = std::make_unique<node::CoinsPrefetcher>(m_dbview, node::g_coins_prefetch_threads);
+    }
+}
 
 void CoinsViews::InitCache()
 {
     AssertLockHeld(::cs_main);
-    m_cacheview = std::make_unique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview = std::make_unique<CCoinsViewCache>(&m_pendingview);
 }
 
 CChainState::CChainState(
@@ -1679,8 +1894,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void StartScriptCheckWorkerThreads(int threads_num)
 {
     scriptcheckqueue.StartWorkerThreads(threads_num);
@@ -2176,6 +2389,7 @@ CoinsCacheSizeState CChainState::GetCoinsCacheSizeState(
     AssertLockHeld(::cs_main);
     const int64_t nMempoolUsage = m_mempool ? m_mempool->DynamicMemoryUsage() : 0;
     int64_t cacheSize = CoinsTip().DynamicMemoryUsage();
+    if (m_coins_views->m_flush) cacheSize += m_coins_views->m_flush->m_usage;
     int64_t nTotalSpace =
         max_coins_cache_size_bytes + std::max<int64_t>(int64_t(max_mempool_size_bytes) - nMempoolUsage, 0);
 
@@ -2211,6 +2425,11 @@ bool CChainState::FlushStateToDisk(
     {
         bool fDoFullFlush = false;
 
+        // Pick up a background coins write that has finished in the meantime.
+        if (!FinishCoinsFlush(/*wait=*/false)) {
+            return AbortNode(state, "Failed to write to coin database");
+        }
+
         CoinsCacheSizeState cache_state = GetCoinsCacheSizeState();
         LOCK(m_blockman.cs_LastBlockFile);
             // make sure we don't prune above the blockfilterindexes bestblocks
@@ -2238,8 +2457,18 @@ bool CChainState::FlushStateToDisk(
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + DATABASE_FLUSH_INTERVAL;
         // Combine all conditions that result in a full cache flush.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush;
+        // Unless we are out of memory or asked to, write the dirty coins in the
+        // background instead, and keep the cache warm. Start well before the
+        // cache is full so that it rarely gets there; one write at a time.
+        bool fIncrementalFlush = false;
+        if (g_incremental_coins_flush && mode == FlushStateMode::PERIODIC) {
+            const bool fCacheHalfFull = coins_mem_usage > m_coinstip_cache_size_bytes / 2;
+            fIncrementalFlush = (fDoFullFlush || fCacheHalfFull) && !m_coins_views->m_flush &&
+                                nNow > nLastFlush + INCREMENTAL_COINS_FLUSH_INTERVAL;
+            fDoFullFlush = false;
+        }
         // Write blocks and block index to disk.
-        if (fDoFullFlush || fPeriodicWrite) {
+        if (fDoFullFlush || fPeriodicWrite || fIncrementalFlush) {
             // Ensure we can write block index
             if (!CheckDiskSpace(gArgs.GetBlocksDirPath())) {
                 return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
@@ -2274,9 +2503,14 @@ bool CChainState::FlushStateToDisk(
             if (!CheckDiskSpace(gArgs.GetDataDirNet(), 48 * 2 * 2 * CoinsTip().GetCacheSize())) {
                 return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
             }
+            // A background write must land before anything newer.
+            if (!FinishCoinsFlush(/*wait=*/true)) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
             // Flush the chainstate (which may refer to block index entries).
             if (!CoinsTip().Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            ResetCoinsPrefetch();
             nLastFlush = nNow;
             full_flush_completed = true;
             TRACE4(utxocache, flush,
@@ -2284,6 +2518,32 @@ bool CChainState::FlushStateToDisk(
                    (u_int32_t)mode,
                    (u_int64_t)coins_count,
                    (u_int64_t)coins_mem_usage);
+        } else if (fIncrementalFlush && !CoinsTip().GetBestBlock().IsNull()) {
+            LOG_TIME_MILLIS_WITH_CATEGORY(strprintf("start background write of coins cache (%d coins, %.2fkB)",
+                coins_count, coins_mem_usage / 1000), BCLog::BENCH);
+
+            if (!CheckDiskSpace(gArgs.GetDataDirNet(), 48 * 2 * 2 * CoinsTip().GetCacheSize())) {
+                return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
+            }
+            auto flush = std::make_unique<CoinsFlush>();
+            // Under memory pressure, also drop the coins that were already
+            // clean: they stay readable from the database, and everything
+            // handed to the writer remains readable through m_pendingview.
+            flush->m_usage = CoinsTip().ExtractDirty(flush->m_coins, /*evict_clean=*/fCacheLarge);
+            flush->m_usage += memusage::DynamicUsage(flush->m_coins);
+            flush->m_locator = m_chain.GetLocator();
+            const uint256 best_block = CoinsTip().GetBestBlock();
+            m_coins_views->m_pendingview.SetPending(flush->m_coins, best_block);
+            // The writer records the transition from the old to the new best
+            // block in DB_HEAD_BLOCKS first, exactly like a synchronous flush,
+            // so an interrupted write is rolled forward by ReplayBlocks().
+            flush->m_result = std::async(std::launch::async, [&db = CoinsDB(), &coins = flush->m_coins, best_block] {
+                util::ThreadRename("coinsflush");
+                return db.WriteCoins(coins, best_block);
+            });
+            m_coins_views->m_flush = std::move(flush);
+            ResetCoinsPrefetch();
+            nLastFlush = nNow;
         }
     }
     if (full_flush_completed) {
@@ -2296,6 +2556,23 @@ bool CChainState::FlushStateToDisk(
     return true;
 }
 
+bool CChainState::FinishCoinsFlush(bool wait)
+{
+    AssertLockHeld(::cs_main);
+    if (!m_coins_views->m_flush) return true;
+    if (!wait && m_coins_views->m_flush->m_result.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+        return true;
+    }
+    m_coins_views->m_flush->m_result.wait();
+    const std::unique_ptr<CoinsFlush> flush{std::move(m_coins_views->m_flush)};
+    m_coins_views->m_pendingview.ClearPending();
+    ResetCoinsPrefetch();
+    if (!flush->m_result.get()) return false;
+    // Update best block in wallet (so we can detect restored wallets).
+    GetMainSignals().ChainStateFlushed(flush->m_locator);
+    return true;
+}
+
 void CChainState::ForceFlushStateToDisk()
 {
     BlockValidationState state;
@@ -2420,6 +2697,9 @@ bool CChainState::DisconnectTip(BlockValidationState& state, DisconnectedBlockTr
     }
 
     m_chain.SetTip(pindexDelete->pprev);
+    // The blocks queued for prefetching may sit on the branch that is being
+    // disconnected, e.g. by InvalidateBlock().
+    ResetCoinsPrefetch();
 
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
@@ -2486,6 +2766,8 @@ bool CChainState::ConnectTip(BlockValidationState& state, CBlockIndex* pindexNew
     if (m_mempool) AssertLockHeld(m_mempool->cs);
 
     assert(pindexNew->pprev == m_chain.Tip());
+    // Keep the databases from being compacted while blocks are connected.
+    g_db_compaction.NotifyBusy();
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
@@ -2499,6 +2781,10 @@ bool CChainState::ConnectTip(BlockValidationState& state, CBlockIndex* pindexNew
         pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
+    if (m_coins_views->m_prefetcher) {
+        const size_t prefetched{m_coins_views->m_prefetcher->Apply(blockConnecting, CoinsTip(), m_coins_views->m_pendingview)};
+        LogPrint(BCLog::BENCH, "  - Prefetched inputs: %u\n", prefetched);
+    }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
@@ -2623,6 +2909,40 @@ void CChainState::PruneBlockIndexCandidates() {
  *
  * @returns true unless a system error occurred
  */
+void CChainState::PrefetchCoins(const CBlockIndex* pindexMostWork)
+{
+    AssertLockHeld(cs_main);
+    if (!m_coins_views->m_prefetcher) return;
+    // The next block is connected right away, before its inputs could be
+    // read, so start with the one after it.
+    int start{m_chain.Height() + 2};
+    const int end{std::min(pindexMostWork->nHeight, m_chain.Height() + 1 + node::COINS_PREFETCH_BLOCKS)};
+    if (m_coins_prefetch_tip && pindexMostWork->GetAncestor(m_coins_prefetch_tip->nHeight) == m_coins_prefetch_tip) {
+        start = std::max(start, m_coins_prefetch_tip->nHeight + 1);
+    }
+    if (start > end) return;
+
+    std::vector<FlatFilePos> positions(end - start + 1);
+    const CBlockIndex* const last{pindexMostWork->GetAncestor(end)};
+    const CBlockIndex* pindex{last};
+    for (int height = end; height >= start; --height, pindex = pindex->pprev) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) return;
+        positions[height - start] = pindex->GetBlockPos();
+    }
+    m_coins_prefetch_tip = last;
+    m_coins_views->m_prefetcher->Prefetch(std::move(positions));
+}
+
+void CChainState::ResetCoinsPrefetch()
+{
+    AssertLockHeld(cs_main);
+    if (!m_coins_views->m_prefetcher) return;
+    m_coins_views->m_prefetcher->Invalidate();
+    // Nothing beyond the fork point with the active chain is prefetched any
+    // more, so the next PrefetchCoins() queues those blocks again.
+    if (m_coins_prefetch_tip) m_coins_prefetch_tip = m_chain.FindFork(m_coins_prefetch_tip);
+}
+
 bool CChainState::ActivateBestChainStep(BlockValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace)
 {
     AssertLockHeld(cs_main);
@@ -2649,6 +2969,8 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, CBlockIndex
         fBlocksDisconnected = true;
     }
 
+    PrefetchCoins(pindexMostWork);
+
     // Build list of new blocks to connect (in descending height order).
     std::vector<CBlockIndex*> vpindexToConnect;
     bool fContinue = true;
@@ -2740,7 +3062,9 @@ static bool NotifyHeaderTip(CChainState& chainstate) LOCKS_EXCLUDED(cs_main) {
 static void LimitValidationInterfaceQueue() LOCKS_EXCLUDED(cs_main) {
     AssertLockNotHeld(cs_main);
 
-    if (GetMainSignals().CallbacksPending() > 10) {
+    const size_t pending{GetMainSignals().CallbacksPending()};
+    if (pending > MAX_VALIDATION_CALLBACKS_PENDING) {
+        LogPrint(BCLog::VALIDATION, "Waiting for a validation interface queue with %u pending callbacks\n", pending);
         SyncWithValidationInterfaceQueue();
     }
 }
@@ -3066,7 +3390,8 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
-    pindexNew->nStatus |= BLOCK_HAVE_DATA;
+    pindexNew->nDataChecksum = node::GetBlockChecksum(block);
+    pindexNew->nStatus |= BLOCK_HAVE_DATA | BLOCK_HAVE_CHECKSUM;
     if (pindexNew->pprev && IsBTC16BIPsEnabled(pindexNew->pprev->nTime)) {
         pindexNew->nStatus |= BLOCK_OPT_WITNESS;
     }
@@ -4052,6 +4377,46 @@ bool CChainState::LoadGenesisBlock()
     return true;
 }
 
+namespace {
+/** A block parsed and hashed ahead of the import loop in LoadExternalBlockFile(). */
+struct ParsedBlock {
+    std::shared_ptr<CBlock> block;
+    uint256 hash;
+    //! Bytes the block took up, less than its record if that was padded.
+    size_t size{0};
+    //! Set if the record could not be deserialized.
+    std::string error;
+};
+
+ParsedBlock ParseBlock(const std::vector<unsigned char>& data)
+{
+    ParsedBlock parsed;
+    try {
+        SpanReader stream{SER_DISK, CLIENT_VERSION, data};
+        auto block = std::make_shared<CBlock>();
+        stream >> *block;
+        parsed.size = data.size() - stream.size();
+        parsed.hash = block->GetHash();
+        // Fill the PoW cache, so that CheckPOW() finds the GhostRider hash
+        // instead of computing it under cs_main.
+        if (block->IsProofOfWork()) block->GetPOWHash();
+        parsed.block = std::move(block);
+    } catch (const std::exception& e) {
+        parsed.error = e.what();
+    }
+    return parsed;
+}
+
+/** A block record found by the scan, waiting for its block to be parsed. */
+struct PendingBlock {
+    //! Where the scan resumes if the record turns out not to hold a block.
+    uint64_t rewind;
+    uint64_t block_pos;
+    unsigned int size;
+    std::future<ParsedBlock> parsed;
+};
+} // namespace
+
 void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
 {
     AssertLockNotHeld(m_chainstate_mutex);
@@ -4059,47 +4424,101 @@ void CChainState::LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
     static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+    // The file is scanned for block records on this thread, while a pool
+    // deserializes and hashes the blocks found; they are then imported in file
+    // order. Without threads, only one record is scanned ahead.
+    ThreadPool pool{"loadblk"};
+    if (g_reindex_threads > 0) pool.Start(g_reindex_threads);
+    const size_t max_pending{g_reindex_threads > 0 ? 16 * size_t(g_reindex_threads) : 1};
+    const size_t bytes_ahead{g_reindex_threads > 0 ? REINDEX_BYTES_AHEAD : 0};
+    std::deque<PendingBlock> pending;
+    size_t pending_bytes{0};
+
     int nLoaded = 0;
+    AdviseSequentialRead(fileIn);
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor.
+        // Everything scanned ahead must stay in the buffer, so that the scan can
+        // go back to any pending record that turns out not to hold a block.
+        const uint64_t rewind_limit{MAX_BLOCK_SERIALIZED_SIZE + 8 + bytes_ahead};
+        CBufferedFile blkdat(fileIn, rewind_limit + MAX_BLOCK_SERIALIZED_SIZE, rewind_limit, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        bool scanned{false};
+        while (true) {
             if (ShutdownRequested()) return;
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(m_params.MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> buf;
-                if (memcmp(buf, m_params.MessageStart(), CMessageHeader::MESSAGE_START_SIZE)) {
+            while (!scanned && (pending.empty() || (pending.size() < max_pending && pending_bytes < bytes_ahead))) {
+                // Position first: a rescan may start well before where the
+                // last record read ended.
+                blkdat.SetPos(nRewind);
+                if (blkdat.eof()) {
+                    scanned = true;
+                    break;
+                }
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                    blkdat.FindByte(m_params.MessageStart()[0]);
+                    nRewind = blkdat.GetPos() + 1;
+                    blkdat >> buf;
+                    if (memcmp(buf, m_params.MessageStart(), CMessageHeader::MESSAGE_START_SIZE)) {
+                        continue;
+                    }
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    scanned = true;
+                    break;
+                }
+                // read the record, and leave the block to the pool
+                const uint64_t nBlockPos = blkdat.GetPos();
+                std::vector<unsigned char> data(nSize);
+                try {
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    blkdat.read(MakeWritableByteSpan(data));
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                     continue;
                 }
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                pending.push_back({nRewind, nBlockPos, nSize, pool.Submit([data = std::move(data)] { return ParseBlock(data); })});
+                pending_bytes += nSize + 8;
+                nRewind = nBlockPos + nSize;
+            }
+            if (pending.empty()) break;
+
+            PendingBlock next{std::move(pending.front())};
+            pending.pop_front();
+            pending_bytes -= next.size + 8;
+            ParsedBlock parsed{next.parsed.get()};
+            if (!parsed.error.empty() || parsed.size != next.size) {
+                // The records scanned past this one may not be where a serial
+                // scan would have found them. Drop them, and resume the scan
+                // inside the record if it held no block, or right after the
+                // block otherwise.
+                pending.clear();
+                pending_bytes = 0;
+                scanned = false;
+                if (!parsed.error.empty()) {
+                    nRewind = next.rewind;
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, parsed.error);
                     continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+                }
+                nRewind = next.block_pos + parsed.size;
             }
+
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                    dbp->nPos = next.block_pos;
+                std::shared_ptr<CBlock> pblock = std::move(parsed.block);
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
+                const uint256& hash = parsed.hash;
                 {
                     LOCK(cs_main);
                     // detect out of order blocks, and store them for later
@@ -4384,6 +4803,17 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
         // Cache sizes are unchanged, no need to continue.
         return true;
     }
+    BlockValidationState state;
+    // The database is reopened below, so let a background write finish first.
+    try {
+        if (!FinishCoinsFlush(/*wait=*/true)) {
+            return AbortNode(state, "Failed to write to coin database");
+        }
+    } catch (const std::runtime_error& e) {
+        return AbortNode(state, std::string("System error while flushing: ") + e.what());
+    }
+    if (m_coins_views->m_prefetcher) m_coins_views->m_prefetcher->Stop();
+    ResetCoinsPrefetch();
     size_t old_coinstip_size = m_coinstip_cache_size_bytes;
     m_coinstip_cache_size_bytes = coinstip_size;
     m_coinsdb_cache_size_bytes = coinsdb_size;
@@ -4394,7 +4824,6 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
     LogPrintf("[%s] resized coinstip cache to %.1f MiB\n",
         this->ToString(), coinstip_size * (1.0 / 1024 / 1024));
 
-    BlockValidationState state;
     bool ret;
 
     if (coinstip_size > old_coinstip_size) {
@@ -4408,7 +4837,34 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
     return ret;
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** mempool.dat with the transactions stored back to back */
+static const uint64_t MEMPOOL_DUMP_VERSION_NO_CHECKSUM = 1;
+/** mempool.dat with every transaction in a checksummed record that links to its parents */
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+/** Number of mempool.dat transactions submitted to the mempool per cs_main lock */
+static constexpr size_t MEMPOOL_LOAD_BATCH_SIZE{1000};
+
+/** Decode the payload of mempool record number record, returning false if it is malformed. */
+static bool DecodeMempoolRecord(const std::vector<unsigned char>& payload, uint64_t record, CTransactionRef& tx,
+                                int64_t& time, int64_t& fee_delta, std::vector<uint64_t>& parents)
+{
+    try {
+        CDataStream stream{payload, SER_DISK, CLIENT_VERSION};
+        uint64_t parent_count;
+        stream >> tx >> time >> fee_delta >> VARINT(parent_count);
+        parents.clear();
+        for (uint64_t i = 0; i < parent_count; ++i) {
+            uint64_t parent;
+            stream >> VARINT(parent);
+            // Parents are always dumped before their children.
+            if (parent >= record) return false;
+            parents.push_back(parent);
+        }
+        return stream.empty();
+    } catch (const std::ios_base::failure&) {
+        return false;
+    }
+}
 
 bool LoadMempool(CTxMemPool& pool, CChainState& active_chainstate, FopenFn mockable_fopen_function)
 {
@@ -4423,53 +4879,109 @@ bool LoadMempool(CTxMemPool& pool, CChainState& active_chainstate, FopenFn mocka
     int64_t count = 0;
     int64_t expired = 0;
     int64_t failed = 0;
+    int64_t corrupt = 0;
     int64_t already_there = 0;
     int64_t unbroadcast = 0;
     int64_t nNow = GetTime();
 
+    // Whether each record read so far is known not to have made it into the
+    // mempool, in which case neither can its descendants.
+    std::vector<bool> dropped;
+    std::vector<CTransactionRef> batch_txs;
+    std::vector<int64_t> batch_times;
+    std::vector<uint64_t> batch_records;
+    const auto submit_batch = [&] {
+        if (batch_txs.empty()) return;
+        LOCK(cs_main);
+        const std::vector<MempoolAcceptResult> results{AcceptToMemoryPoolBatch(active_chainstate, batch_txs, batch_times, /*bypass_limits=*/false)};
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].m_result_type == MempoolAcceptResult::ResultType::VALID) {
+                ++count;
+            } else if (pool.exists(GenTxid::Txid(batch_txs[i]->GetHash()))) {
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) having loaded it while we were processing
+                // mempool transactions; consider these as valid, instead of
+                // failed, but mark them as 'already there'
+                ++already_there;
+            } else {
+                ++failed;
+                dropped[batch_records[i]] = true;
+            }
+        }
+        batch_txs.clear();
+        batch_times.clear();
+        batch_records.clear();
+    };
+    const auto add_record = [&](const CTransactionRef& tx, int64_t nTime, int64_t nFeeDelta, const std::vector<uint64_t>& parents) {
+        const uint64_t record{dropped.size()};
+        dropped.push_back(false);
+        CAmount amountdelta = nFeeDelta;
+        if (amountdelta) {
+            pool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        }
+        if (nTime <= nNow - nExpiryTimeout) {
+            ++expired;
+            dropped[record] = true;
+        } else if (std::any_of(parents.begin(), parents.end(), [&](uint64_t parent) { return dropped[parent]; })) {
+            ++failed;
+            dropped[record] = true;
+        } else {
+            batch_txs.push_back(tx);
+            batch_times.push_back(nTime);
+            batch_records.push_back(record);
+            if (batch_txs.size() >= MEMPOOL_LOAD_BATCH_SIZE) submit_batch();
+        }
+    };
+
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
-            return false;
-        }
-        uint64_t num;
-        file >> num;
-        while (num) {
-            --num;
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                pool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        if (version == MEMPOOL_DUMP_VERSION_NO_CHECKSUM) {
+            uint64_t num;
+            file >> num;
+            while (num) {
+                --num;
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+                add_record(tx, nTime, nFeeDelta, /*parents=*/{});
+                if (ShutdownRequested())
+                    return false;
             }
-            if (nTime > nNow - nExpiryTimeout) {
-                LOCK(cs_main);
-                const auto& accepted = AcceptToMemoryPool(active_chainstate, tx, nTime, /*bypass_limits=*/false, /*test_accept=*/false);
-                if (accepted.m_result_type == MempoolAcceptResult::ResultType::VALID) {
-                    ++count;
+        } else if (version == MEMPOOL_DUMP_VERSION) {
+            std::vector<unsigned char> payload;
+            std::vector<uint64_t> parents;
+            while (true) {
+                uint64_t size;
+                file >> VARINT(size);
+                if (size == 0) break;
+                if (size > MAX_SIZE) throw std::ios_base::failure("mempool record too large");
+                payload.resize(size);
+                file.read(MakeWritableByteSpan(payload));
+                uint32_t checksum;
+                file >> checksum;
+
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                if (crc32c::Crc32c(payload.data(), payload.size()) != checksum ||
+                    !DecodeMempoolRecord(payload, dropped.size(), tx, nTime, nFeeDelta, parents)) {
+                    ++corrupt;
+                    dropped.push_back(true);
                 } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (pool.exists(GenTxid::Txid(tx->GetHash()))) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
+                    add_record(tx, nTime, nFeeDelta, parents);
                 }
-            } else {
-                ++expired;
+                if (ShutdownRequested())
+                    return false;
             }
-            if (ShutdownRequested())
-                return false;
+        } else {
+            return false;
         }
+        submit_batch();
+
         std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
 
@@ -4490,7 +5002,7 @@ bool LoadMempool(CTxMemPool& pool, CChainState& active_chainstate, FopenFn mocka
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there, %i waiting for initial broadcast\n", count, failed, expired, already_there, unbroadcast);
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i corrupt, %i already there, %i waiting for initial broadcast\n", count, failed, expired, corrupt, already_there, unbroadcast);
     return true;
 }
 
@@ -4527,13 +5039,34 @@ bool DumpMempool(const CTxMemPool& pool, FopenFn mockable_fopen_function, bool s
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
 
-        file << (uint64_t)vinfo.size();
+        // infoAll() returns the transactions in mining order, so parents
+        // always get their record number before their children.
+        std::unordered_map<uint256, uint64_t, SaltedTxidHasher> records;
+        std::vector<uint64_t> parents;
+        std::vector<unsigned char> payload;
         for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << int64_t{count_seconds(i.m_time)};
-            file << int64_t{i.nFeeDelta};
+            parents.clear();
+            for (const CTxIn& txin : i.tx->vin) {
+                const auto it{records.find(txin.prevout.hash)};
+                if (it != records.end()) parents.push_back(it->second);
+            }
+            std::sort(parents.begin(), parents.end());
+            parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+
+            payload.clear();
+            CVectorWriter writer{SER_DISK, CLIENT_VERSION, payload, 0};
+            writer << *(i.tx) << int64_t{count_seconds(i.m_time)} << int64_t{i.nFeeDelta} << VARINT(uint64_t{parents.size()});
+            for (const uint64_t parent : parents) {
+                writer << VARINT(parent);
+            }
+            file << VARINT(uint64_t{payload.size()});
+            file.write(MakeByteSpan(payload));
+            file << crc32c::Crc32c(payload.data(), payload.size());
+
+            records.emplace(i.tx->GetHash(), records.size());
             mapDeltas.erase(i.tx->GetHash());
         }
+        file << VARINT(uint64_t{0});
 
         file << mapDeltas;
 
@@ -4704,6 +5237,15 @@ std::optional<uint256> ChainstateManager::SnapshotBlockhash() const
     return std::nullopt;
 }
 
+ThreadPool& ChainstateManager::MempoolBatchWorkers()
+{
+    AssertLockHeld(::cs_main);
+    if (m_mempool_batch_workers.WorkerCount() == 0) {
+        m_mempool_batch_workers.Start(std::clamp(GetNumCores() - 1, 1, MAX_MEMPOOL_BATCH_THREADS));
+    }
+    return m_mempool_batch_workers;
+}
+
 std::vector<CChainState*> ChainstateManager::GetAll()
 {
     LOCK(::cs_main);
@@ -4850,6 +5392,23 @@ static void FlushSnapshotToDisk(CCoinsViewCache& coins_cache, bool snapshot_load
     coins_cache.Flush();
 }
 
+namespace {
+struct DecodedSnapshotChunk {
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    MuHash3072 muhash;
+};
+
+std::optional<DecodedSnapshotChunk> DecodeAndHashSnapshotChunk(const SnapshotChunk& chunk)
+{
+    DecodedSnapshotChunk decoded;
+    if (!node::DecodeSnapshotChunk(chunk, decoded.coins)) return std::nullopt;
+    for (const auto& [outpoint, coin] : decoded.coins) {
+        decoded.muhash.Insert(MakeUCharSpan(TxOutSer(outpoint, coin)));
+    }
+    return decoded;
+}
+} // namespace
+
 bool ChainstateManager::PopulateAndValidateSnapshot(
     CChainState& snapshot_chainstate,
     CAutoFile& coins_file,
@@ -4889,24 +5448,18 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
     LogPrintf("[snapshot] loading coins from snapshot %s\n", base_blockhash.ToString());
     int64_t coins_processed{0};
 
-    while (coins_left > 0) {
-        try {
-            coins_file >> outpoint;
-            coins_file >> coin;
-        } catch (const std::ios_base::failure&) {
-            LogPrintf("[snapshot] bad snapshot format or truncated snapshot after deserializing %d coins\n",
-                      coins_count - coins_left);
-            return false;
-        }
-        if (coin.nHeight > base_height ||
-            outpoint.n >= std::numeric_limits<decltype(outpoint.n)>::max() // Avoid integer wrap-around in coinstats.cpp:ApplyHash
+    // Adds a deserialized coin to the cache. Returns false if the snapshot
+    // is bad or loading it should stop.
+    const auto add_coin = [&](COutPoint&& snapshot_outpoint, Coin&& snapshot_coin) {
+        if (snapshot_coin.nHeight > base_height ||
+            snapshot_outpoint.n >= std::numeric_limits<decltype(snapshot_outpoint.n)>::max() // Avoid integer wrap-around in coinstats.cpp:ApplyHash
         ) {
             LogPrintf("[snapshot] bad snapshot data after deserializing %d coins\n",
                       coins_count - coins_left);
             return false;
         }
 
-        coins_cache.EmplaceCoinInternalDANGER(std::move(outpoint), std::move(coin));
+        coins_cache.EmplaceCoinInternalDANGER(std::move(snapshot_outpoint), std::move(snapshot_coin));
 
         --coins_left;
         ++coins_processed;
@@ -4940,6 +5493,65 @@ bool ChainstateManager::PopulateAndValidateSnapshot(
                 FlushSnapshotToDisk(coins_cache, /*snapshot_loaded=*/false);
             }
         }
+        return true;
+    };
+
+    if (metadata.m_format == SnapshotFormat::COLUMNAR) {
+        // Chunks are read here and checked, decoded and hashed on a pool, while
+        // the coins of the chunks before them go into the cache.
+        ThreadPool pool{"snapshot"};
+        pool.Start(std::clamp(GetNumCores() - 1, 1, node::MAX_SNAPSHOT_THREADS));
+        std::deque<std::future<std::optional<DecodedSnapshotChunk>>> chunks;
+        uint64_t coins_read{0};
+        MuHash3072 muhash;
+        while (coins_left > 0) {
+            while (coins_read < coins_count && chunks.size() < 2 * pool.WorkerCount()) {
+                SnapshotChunk chunk;
+                try {
+                    coins_file >> chunk;
+                } catch (const std::ios_base::failure&) {
+                    LogPrintf("[snapshot] bad snapshot format or truncated snapshot after reading %d coins\n",
+                              coins_read);
+                    return false;
+                }
+                if (chunk.m_coins_count == 0 || chunk.m_coins_count > coins_count - coins_read) {
+                    LogPrintf("[snapshot] bad snapshot chunk size after reading %d coins\n", coins_read);
+                    return false;
+                }
+                coins_read += chunk.m_coins_count;
+                chunks.push_back(pool.Submit([chunk = std::move(chunk)] { return DecodeAndHashSnapshotChunk(chunk); }));
+            }
+            std::optional<DecodedSnapshotChunk> decoded{chunks.front().get()};
+            chunks.pop_front();
+            if (!decoded) {
+                LogPrintf("[snapshot] corrupt snapshot chunk after deserializing %d coins\n",
+                          coins_count - coins_left);
+                return false;
+            }
+            muhash *= decoded->muhash;
+            for (auto& [chunk_outpoint, chunk_coin] : decoded->coins) {
+                if (!add_coin(std::move(chunk_outpoint), std::move(chunk_coin))) return false;
+            }
+        }
+        uint256 muhash_result;
+        muhash.Finalize(muhash_result);
+        if (muhash_result != metadata.m_muhash) {
+            LogPrintf("[snapshot] bad snapshot - coins hash to %s instead of %s\n",
+                      muhash_result.ToString(), metadata.m_muhash.ToString());
+            return false;
+        }
+    } else {
+        while (coins_left > 0) {
+            try {
+                coins_file >> outpoint;
+                coins_file >> coin;
+            } catch (const std::ios_base::failure&) {
+                LogPrintf("[snapshot] bad snapshot format or truncated snapshot after deserializing %d coins\n",
+                          coins_count - coins_left);
+                return false;
+            }
+            if (!add_coin(std::move(outpoint), std::move(coin))) return false;
+        }
     }
 
     // Important that we set this. This and the coins_cache accesses above are
@@ -16,6 +16,7 @@
 #include <consensus/amount.h>
 #include <fs.h>
 #include <node/blockstorage.h>
+#include <node/coinsprefetch.h>
 #include <policy/packages.h>
 #include <script/script_error.h>
 #include <sync.h>
@@ -25,10 +26,12 @@
 #include <uint256.h>
 #include <util/check.h>
 #include <util/hasher.h>
+#include <util/threadpool.h>
 #include <util/translation.h>
 #include <wallet/wallet.h>
 
 #include <atomic>
+#include <future>
 #include <map>
 #include <memory>
 #include <optional>
@@ -67,6 +70,10 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a mempool cluster */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 64;
+/** Default for -limitclustersize, maximum kilobytes of a mempool cluster */
+static const unsigned int DEFAULT_CLUSTER_SIZE_LIMIT = 101;
 
 // If a package is submitted, it must be within the mempool's ancestor/descendant limits. Since a
 // submitted package must be child-with-unconfirmed-parents (all of the transactions are an ancestor
@@ -76,13 +83,21 @@ static_assert(DEFAULT_DESCENDANT_LIMIT >= MAX_PACKAGE_COUNT);
 static_assert(DEFAULT_ANCESTOR_LIMIT >= MAX_PACKAGE_COUNT);
 static_assert(DEFAULT_ANCESTOR_SIZE_LIMIT >= MAX_PACKAGE_SIZE);
 static_assert(DEFAULT_DESCENDANT_SIZE_LIMIT >= MAX_PACKAGE_SIZE);
+static_assert(DEFAULT_CLUSTER_LIMIT >= MAX_PACKAGE_COUNT);
+static_assert(DEFAULT_CLUSTER_SIZE_LIMIT >= MAX_PACKAGE_SIZE);
 
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
+/** Batches of at least this many transactions run their context-free checks on worker threads */
+static constexpr size_t MEMPOOL_BATCH_PARALLEL_MIN{64};
+/** Maximum number of threads a mempool batch runs its context-free checks on */
+static constexpr int MAX_MEMPOOL_BATCH_THREADS{4};
 /** Maximum number of dedicated script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 15;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Transactions with at least this many inputs have their scripts checked on the script-checking threads when entering the mempool */
+static constexpr size_t MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS{8};
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = true;  // nowp: txindex is required for PoS calculations (might change in the future)
@@ -90,6 +105,12 @@ static constexpr bool DEFAULT_COINSTATSINDEX{false};
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -incrementalcoinsflush */
+static constexpr bool DEFAULT_INCREMENTAL_COINS_FLUSH{true};
+/** Maximum for -reindexthreads */
+static constexpr int MAX_REINDEX_THREADS{16};
+/** How many bytes of block data LoadExternalBlockFile() parses ahead of the block it is importing */
+static constexpr size_t REINDEX_BYTES_AHEAD{16 << 20};
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of ActiveChain().Tip() will not be pruned. */
@@ -122,6 +143,10 @@ extern uint256 g_best_block;
  * False indicates all script checking is done on the main threadMessageHandler thread.
  */
 extern bool g_parallel_script_checks;
+/** Whether periodic coins cache flushes are written in the background, see CChainState::FlushStateToDisk(). */
+extern bool g_incremental_coins_flush;
+/** Number of threads parsing and hashing blocks ahead of LoadExternalBlockFile(), 0 to disable. Set from -reindexthreads. */
+extern int g_reindex_threads;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -264,6 +289,28 @@ MempoolAcceptResult AcceptToMemoryPool(CChainState& active_chainstate, const CTr
                                        int64_t accept_time, bool bypass_limits, bool test_accept)
     EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/**
+ * Try to add each of a batch of transactions to the mempool, as AcceptToMemoryPool() would
+ * one at a time. The context-free checks of a large batch run in parallel before any lock is
+ * taken, and the rest happens under a single hold of the mempool lock, with the mempool
+ * trimmed once at the end. Parents must come before their children.
+ *
+ * @param[in]  active_chainstate  Reference to the active chainstate.
+ * @param[in]  txs                The transactions to submit for mempool acceptance.
+ * @param[in]  accept_time        The timestamp for adding the transactions to the mempool.
+ * @param[in]  bypass_limits      When true, don't enforce mempool fee and capacity limits.
+ *
+ * @returns a MempoolAcceptResult for every transaction, in the order of txs.
+ */
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CChainState& active_chainstate, const std::vector<CTransactionRef>& txs,
+                                                         int64_t accept_time, bool bypass_limits)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** AcceptToMemoryPoolBatch() with its own accept time for every transaction. */
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CChainState& active_chainstate, const std::vector<CTransactionRef>& txs,
+                                                         const std::vector<int64_t>& accept_times, bool bypass_limits)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /**
 * Validate (and maybe submit) a package to the mempool. See doc/policy/packages.md for full details
 * on package validation rules.
@@ -275,6 +322,17 @@ MempoolAcceptResult AcceptToMemoryPool(CChainState& active_chainstate, const CTr
 PackageMempoolAcceptResult ProcessNewPackage(CChainState& active_chainstate, CTxMemPool& pool,
                                                    const Package& txns, bool test_accept)
                                                    EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/**
+ * Run the mempool acceptance checks that come first in AcceptToMemoryPool() and
+ * need neither the chain nor the mempool: CheckTransaction(), the timestamp
+ * limit, the coinbase/coinstake rule, standardness and the minimum non-witness
+ * size. They run in the same order, so a transaction failing here is rejected
+ * by AcceptToMemoryPool() with the same state, and callers may run this without
+ * cs_main and reject early.
+ */
+bool PreCheckMempoolTransaction(const CTransaction& tx, TxValidationState& state);
+
 /** Transaction validation functions */
 
 /**
@@ -409,6 +467,16 @@ enum class FlushStateMode {
  * ultimately falling back on cache misses to the canonical store of UTXOs on
  * disk, `m_dbview`.
  */
+/** A batch of dirty coins being written to the coins database on a background thread. */
+struct CoinsFlush {
+    CCoinsMapMemoryResource m_resource{};
+    CCoinsMap m_coins{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &m_resource};
+    //! Memory usage of m_coins, accounted against the coins cache.
+    size_t m_usage{0};
+    CBlockLocator m_locator;
+    std::future<bool> m_result;
+};
+
 class CoinsViews {
 
 public:
@@ -419,10 +487,20 @@ public:
     //! This view wraps access to the leveldb instance and handles read errors gracefully.
     CCoinsViewErrorCatcher m_catcherview GUARDED_BY(cs_main);
 
+    //! This view serves the coins of an in-flight m_flush ahead of the (stale) database.
+    CCoinsViewPending m_pendingview GUARDED_BY(cs_main);
+
     //! This is the top layer of the cache hierarchy - it keeps as many coins in memory as
     //! can fit per the dbcache setting.
     std::unique_ptr<CCoinsViewCache> m_cacheview GUARDED_BY(cs_main);
 
+    //! The background write of dirty coins to m_dbview, if any. Declared last so
+    //! that destruction waits for the write before tearing down the views.
+    std::unique_ptr<CoinsFlush> m_flush GUARDED_BY(cs_main);
+
+    //! Reads the inputs of upcoming blocks from m_dbview ahead of time, if enabled.
+    std::unique_ptr<node::CoinsPrefetcher> m_prefetcher GUARDED_BY(cs_main);
+
     //! This constructor initializes CCoinsViewDB and CCoinsViewErrorCatcher instances, but it
     //! *does not* create a CCoinsViewCache instance by default. This is done separately because the
     //! presence of the cache has implications on whether or not we're allowed to flush the cache's
@@ -626,6 +704,15 @@ public:
     //! Unconditionally flush all changes to disk.
     void ForceFlushStateToDisk();
 
+    /**
+     * Collect the result of the background coins write started by
+     * FlushStateToDisk(), if any, notifying ChainStateFlushed on success.
+     * Unless wait is set, a write that is still running is left alone.
+     *
+     * @returns false if the write failed; throws on database errors.
+     */
+    bool FinishCoinsFlush(bool wait) EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+
     /**
      * Find the best known block, and make it the tip of the block chain. The
      * result is either failure or an activated best chain. pblock is either
@@ -721,6 +808,14 @@ private:
     bool ActivateBestChainStep(BlockValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_mempool->cs);
     bool ConnectTip(BlockValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_mempool->cs);
 
+    //! Queue the inputs of the blocks after the next one towards pindexMostWork for prefetching.
+    void PrefetchCoins(const CBlockIndex* pindexMostWork) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    //! Last block whose inputs were queued by PrefetchCoins().
+    const CBlockIndex* m_coins_prefetch_tip GUARDED_BY(::cs_main){nullptr};
+    //! Drop the prefetched coins, e.g. after a database write or when the tip moves back,
+    //! and rewind m_coins_prefetch_tip to where it forks off the active chain.
+    void ResetCoinsPrefetch() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     void InvalidBlockFound(CBlockIndex* pindex, const BlockValidationState& state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CBlockIndex* FindMostWorkChain() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     void ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pindexNew, const FlatFilePos& pos) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -834,6 +929,10 @@ private:
     bool m_snapshot_validated{false};
 
     CBlockIndex* m_best_invalid;
+
+    //! Runs the context-free checks of large mempool batches, see MempoolBatchWorkers().
+    ThreadPool m_mempool_batch_workers{"mempoolbatch"};
+
     friend bool node::BlockManager::LoadBlockIndex(const Consensus::Params&, ChainstateManager&);
 
     //! Internal helper for ActivateSnapshot().
@@ -903,6 +1002,10 @@ public:
     //! Get all chainstates currently being used.
     std::vector<CChainState*> GetAll();
 
+    //! The workers AcceptToMemoryPoolBatch() runs context-free checks on.
+    //! They are started on first use and live as long as this manager.
+    ThreadPool& MempoolBatchWorkers() EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+
     //! Construct and activate a Chainstate on the basis of UTXO snapshot data.
     //!
     //! Steps:
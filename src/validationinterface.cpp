@@ -12,9 +12,17 @@
 #include <primitives/transaction.h>
 #include <scheduler.h>
 
+#include <tinyformat.h>
+
+#include <algorithm>
+#include <atomic>
 #include <future>
+#include <list>
+#include <map>
+#include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 //! The MainSignalsInstance manages a list of shared_ptr<CValidationInterface>
 //! callbacks.
@@ -23,30 +31,73 @@
 //! registered, and a std::list is to used to store the callbacks that are
 //! currently registered as well as any callbacks that are just unregistered
 //! and about to be deleted when they are done executing.
+//!
+//! Every subscriber gets its background callbacks on a queue of its own, so a
+//! slow subscriber only holds up itself. The queues run in parallel on the
+//! scheduler threads, each one in order.
 struct MainSignalsInstance {
 private:
+    //! A queue of background callbacks. Queues are never destroyed before the
+    //! instance, as the scheduler may still be about to run them, but are
+    //! handed to new subscribers once their previous one is gone.
+    struct SubscriberQueue {
+        std::string name;
+        SingleThreadedSchedulerClient client;
+        SubscriberQueue(CScheduler* scheduler, std::string name_in)
+            : name(std::move(name_in)), client(scheduler, name) {}
+    };
+
     Mutex m_mutex;
-    //! List entries consist of a callback pointer and reference count. The
-    //! count is equal to the number of current executions of that entry, plus 1
-    //! if it's registered. It cannot be 0 because that would imply it is
-    //! unregistered and also not being executed (so shouldn't exist).
-    struct ListEntry { std::shared_ptr<CValidationInterface> callbacks; int count = 1; };
+    CScheduler* const m_scheduler;
+    //! List entries consist of a callback pointer, a reference count and the
+    //! queue of the subscriber's background callbacks. The count is equal to
+    //! the number of current executions and queued background callbacks of
+    //! that entry, plus 1 if it's registered. It cannot be 0 because that
+    //! would imply it is unregistered and also not being executed (so
+    //! shouldn't exist).
+    struct ListEntry { std::shared_ptr<CValidationInterface> callbacks; int count = 1; bool registered = true; SubscriberQueue* queue; };
     std::list<ListEntry> m_list GUARDED_BY(m_mutex);
     std::unordered_map<CValidationInterface*, std::list<ListEntry>::iterator> m_map GUARDED_BY(m_mutex);
+    std::list<SubscriberQueue> m_queues GUARDED_BY(m_mutex);
+    std::vector<SubscriberQueue*> m_free_queues GUARDED_BY(m_mutex);
 
-public:
-    // We are not allowed to assume the scheduler only runs in one thread,
-    // but must ensure all callbacks happen in-order, so we end up creating
-    // our own queue here :(
-    SingleThreadedSchedulerClient m_schedulerClient;
+    void Release(std::list<ListEntry>::iterator it) EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        if (--it->count) return;
+        m_free_queues.push_back(it->queue);
+        m_list.erase(it);
+    }
+
+    std::vector<SubscriberQueue*> AllQueues() EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        std::vector<SubscriberQueue*> queues{&m_default_queue};
+        for (SubscriberQueue& queue : m_queues) {
+            queues.push_back(&queue);
+        }
+        return queues;
+    }
 
-    explicit MainSignalsInstance(CScheduler *pscheduler) : m_schedulerClient(pscheduler) {}
+    //! Queue for functions that are not addressed to any one subscriber
+    SubscriberQueue m_default_queue;
+
+public:
+    explicit MainSignalsInstance(CScheduler *pscheduler) : m_scheduler(pscheduler), m_default_queue(pscheduler, "validationinterface") {}
 
     void Register(std::shared_ptr<CValidationInterface> callbacks)
     {
         LOCK(m_mutex);
         auto inserted = m_map.emplace(callbacks.get(), m_list.end());
-        if (inserted.second) inserted.first->second = m_list.emplace(m_list.end());
+        if (inserted.second) {
+            SubscriberQueue* queue;
+            if (m_free_queues.empty()) {
+                queue = &m_queues.emplace_back(m_scheduler, strprintf("validationinterface.%d", m_queues.size()));
+            } else {
+                queue = m_free_queues.back();
+                m_free_queues.pop_back();
+            }
+            inserted.first->second = m_list.emplace(m_list.end());
+            inserted.first->second->queue = queue;
+        }
         inserted.first->second->callbacks = std::move(callbacks);
     }
 
@@ -55,7 +106,8 @@ public:
         LOCK(m_mutex);
         auto it = m_map.find(callbacks);
         if (it != m_map.end()) {
-            if (!--it->second->count) m_list.erase(it->second);
+            it->second->registered = false;
+            Release(it->second);
             m_map.erase(it);
         }
     }
@@ -68,7 +120,8 @@ public:
     {
         LOCK(m_mutex);
         for (const auto& entry : m_map) {
-            if (!--entry.second->count) m_list.erase(entry.second);
+            entry.second->registered = false;
+            Release(entry.second);
         }
         m_map.clear();
     }
@@ -77,14 +130,79 @@ public:
     {
         WAIT_LOCK(m_mutex, lock);
         for (auto it = m_list.begin(); it != m_list.end();) {
+            if (!it->registered) {
+                ++it;
+                continue;
+            }
             ++it->count;
             {
                 REVERSE_LOCK(lock);
                 f(*it->callbacks);
             }
-            it = --it->count ? std::next(it) : m_list.erase(it);
+            auto next = std::next(it);
+            Release(it);
+            it = next;
         }
     }
+
+    //! Queue f for every registered subscriber, to be called on its queue
+    //! unless it is unregistered by then.
+    template<typename F> void Enqueue(F f)
+    {
+        LOCK(m_mutex);
+        for (auto it = m_list.begin(); it != m_list.end(); ++it) {
+            if (!it->registered) continue;
+            ++it->count;
+            it->queue->client.AddToProcessQueue([this, it, f] {
+                WAIT_LOCK(m_mutex, lock);
+                if (it->registered) {
+                    REVERSE_LOCK(lock);
+                    f(*it->callbacks);
+                }
+                Release(it);
+            });
+        }
+    }
+
+    //! Call func once every queue is done with what was queued before.
+    void CallAfterQueued(std::function<void()> func)
+    {
+        LOCK(m_mutex);
+        const std::vector<SubscriberQueue*> queues{AllQueues()};
+        auto remaining = std::make_shared<std::atomic<size_t>>(queues.size());
+        auto shared_func = std::make_shared<std::function<void()>>(std::move(func));
+        for (SubscriberQueue* queue : queues) {
+            queue->client.AddToProcessQueue([remaining, shared_func] {
+                if (--*remaining == 0) (*shared_func)();
+            });
+        }
+    }
+
+    void EmptyQueues()
+    {
+        const std::vector<SubscriberQueue*> queues{WITH_LOCK(m_mutex, return AllQueues())};
+        // Callbacks may queue more callbacks, on their queue or another.
+        bool pending{true};
+        while (pending) {
+            pending = false;
+            for (SubscriberQueue* queue : queues) {
+                queue->client.EmptyQueue();
+            }
+            for (SubscriberQueue* queue : queues) {
+                pending |= queue->client.CallbacksPending() > 0;
+            }
+        }
+    }
+
+    std::map<std::string, size_t> QueueDepths()
+    {
+        const std::vector<SubscriberQueue*> queues{WITH_LOCK(m_mutex, return AllQueues())};
+        std::map<std::string, size_t> depths;
+        for (SubscriberQueue* queue : queues) {
+            depths.emplace(queue->name, queue->client.CallbacksPending());
+        }
+        return depths;
+    }
 };
 
 static CMainSignals g_signals;
@@ -103,14 +221,24 @@ void CMainSignals::UnregisterBackgroundSignalScheduler()
 void CMainSignals::FlushBackgroundCallbacks()
 {
     if (m_internals) {
-        m_internals->m_schedulerClient.EmptyQueue();
+        m_internals->EmptyQueues();
     }
 }
 
 size_t CMainSignals::CallbacksPending()
 {
     if (!m_internals) return 0;
-    return m_internals->m_schedulerClient.CallbacksPending();
+    size_t pending{0};
+    for (const auto& [name, depth] : m_internals->QueueDepths()) {
+        pending = std::max(pending, depth);
+    }
+    return pending;
+}
+
+std::map<std::string, size_t> CMainSignals::CallbackQueueDepths()
+{
+    if (!m_internals) return {};
+    return m_internals->QueueDepths();
 }
 
 CMainSignals& GetMainSignals()
@@ -154,7 +282,7 @@ void UnregisterAllValidationInterfaces()
 
 void CallFunctionInValidationInterfaceQueue(std::function<void()> func)
 {
-    g_signals.m_internals->m_schedulerClient.AddToProcessQueue(std::move(func));
+    g_signals.m_internals->CallAfterQueued(std::move(func));
 }
 
 void SyncWithValidationInterfaceQueue()
@@ -172,14 +300,14 @@ void SyncWithValidationInterfaceQueue()
 // evaluating arguments when logging is not enabled.
 //
 // NOTE: The lambda captures all local variables by value.
-#define ENQUEUE_AND_LOG_EVENT(event, fmt, name, ...)           \
-    do {                                                       \
-        auto local_name = (name);                              \
-        LOG_EVENT("Enqueuing " fmt, local_name, __VA_ARGS__);  \
-        m_internals->m_schedulerClient.AddToProcessQueue([=] { \
-            LOG_EVENT(fmt, local_name, __VA_ARGS__);           \
-            event();                                           \
-        });                                                    \
+#define ENQUEUE_AND_LOG_EVENT(event, fmt, name, ...)                          \
+    do {                                                                      \
+        auto local_name = (name);                                             \
+        LOG_EVENT("Enqueuing " fmt, local_name, __VA_ARGS__);                 \
+        m_internals->Enqueue([=](CValidationInterface& callbacks) {           \
+            LOG_EVENT(fmt, local_name, __VA_ARGS__);                          \
+            event(callbacks);                                                 \
+        });                                                                   \
     } while (0)
 
 #define LOG_EVENT(fmt, ...) \
@@ -190,8 +318,8 @@ void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockInd
     // the chain actually updates. One way to ensure this is for the caller to invoke this signal
     // in the same critical section where the chain is updated
 
-    auto event = [pindexNew, pindexFork, fInitialDownload, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload); });
+    auto event = [pindexNew, pindexFork, fInitialDownload](CValidationInterface& callbacks) {
+        callbacks.UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: new block hash=%s fork block hash=%s (in IBD=%s)", __func__,
                           pindexNew->GetBlockHash().ToString(),
@@ -200,8 +328,8 @@ void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockInd
 }
 
 void CMainSignals::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) {
-    auto event = [tx, mempool_sequence, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.TransactionAddedToMempool(tx, mempool_sequence); });
+    auto event = [tx, mempool_sequence](CValidationInterface& callbacks) {
+        callbacks.TransactionAddedToMempool(tx, mempool_sequence);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: txid=%s wtxid=%s", __func__,
                           tx->GetHash().ToString(),
@@ -209,8 +337,8 @@ void CMainSignals::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t
 }
 
 void CMainSignals::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) {
-    auto event = [tx, reason, mempool_sequence, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.TransactionRemovedFromMempool(tx, reason, mempool_sequence); });
+    auto event = [tx, reason, mempool_sequence](CValidationInterface& callbacks) {
+        callbacks.TransactionRemovedFromMempool(tx, reason, mempool_sequence);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: txid=%s wtxid=%s", __func__,
                           tx->GetHash().ToString(),
@@ -218,8 +346,8 @@ void CMainSignals::TransactionRemovedFromMempool(const CTransactionRef& tx, MemP
 }
 
 void CMainSignals::BlockConnected(const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex) {
-    auto event = [pblock, pindex, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.BlockConnected(pblock, pindex); });
+    auto event = [pblock, pindex](CValidationInterface& callbacks) {
+        callbacks.BlockConnected(pblock, pindex);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s block height=%d", __func__,
                           pblock->GetHash().ToString(),
@@ -228,8 +356,8 @@ void CMainSignals::BlockConnected(const std::shared_ptr<const CBlock> &pblock, c
 
 void CMainSignals::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
 {
-    auto event = [pblock, pindex, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.BlockDisconnected(pblock, pindex); });
+    auto event = [pblock, pindex](CValidationInterface& callbacks) {
+        callbacks.BlockDisconnected(pblock, pindex);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s block height=%d", __func__,
                           pblock->GetHash().ToString(),
@@ -237,8 +365,8 @@ void CMainSignals::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock
 }
 
 void CMainSignals::ChainStateFlushed(const CBlockLocator &locator) {
-    auto event = [locator, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.ChainStateFlushed(locator); });
+    auto event = [locator](CValidationInterface& callbacks) {
+        callbacks.ChainStateFlushed(locator);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s", __func__,
                           locator.IsNull() ? "null" : locator.vHave.front().ToString());
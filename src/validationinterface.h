@@ -10,7 +10,9 @@
 #include <sync.h>
 
 #include <functional>
+#include <map>
 #include <memory>
+#include <string>
 
 extern RecursiveMutex cs_main;
 class BlockValidationState;
@@ -39,9 +41,14 @@ void RegisterSharedValidationInterface(std::shared_ptr<CValidationInterface> cal
 /** Unregister subscriber */
 void UnregisterSharedValidationInterface(std::shared_ptr<CValidationInterface> callbacks);
 
+/** Background callbacks the slowest subscriber may have queued before validation waits for it to catch up */
+static constexpr size_t MAX_VALIDATION_CALLBACKS_PENDING{10};
+
 /**
- * Pushes a function to callback onto the notification queue, guaranteeing any
+ * Pushes a function to callback onto the notification queues, guaranteeing any
  * callbacks generated prior to now are finished when the function is called.
+ * Each subscriber has a queue of its own; the function runs on whichever of
+ * them gets to it last, and only holds that one up.
  *
  * Be very careful blocking on func to be called if any locks are held -
  * validation interface clients may not be able to make progress as they often
@@ -193,7 +200,10 @@ public:
     /** Call any remaining callbacks on the calling thread */
     void FlushBackgroundCallbacks();
 
+    /** Number of background callbacks waiting on the deepest subscriber queue */
     size_t CallbacksPending();
+    /** Number of background callbacks waiting on every queue, by scheduler queue name */
+    std::map<std::string, size_t> CallbackQueueDepths();
 
 
     void UpdatedBlockTip(const CBlockIndex *, const CBlockIndex *, bool fInitialDownload);
@@ -26,7 +26,7 @@ class DumptxoutsetTest(BitcoinTestFramework):
         self.generate(node, COINBASE_MATURITY)
 
         FILENAME = 'txoutset.dat'
-        out = node.dumptxoutset(FILENAME)
+        out = node.dumptxoutset(FILENAME, 'legacy')
         expected_path = Path(node.datadir) / self.chain / FILENAME
 
         assert expected_path.is_file()
@@ -53,5 +53,16 @@ class DumptxoutsetTest(BitcoinTestFramework):
         assert_raises_rpc_error(
             -8, '{} already exists'.format(FILENAME),  node.dumptxoutset, FILENAME)
 
+        # The columnar format holds the same coins in a smaller file.
+        COLUMNAR_FILENAME = 'txoutset_columnar.dat'
+        columnar_out = node.dumptxoutset(COLUMNAR_FILENAME)
+        columnar_path = Path(node.datadir) / self.chain / COLUMNAR_FILENAME
+        assert_equal(columnar_out['coins_written'], out['coins_written'])
+        assert_equal(columnar_out['txoutset_hash'], out['txoutset_hash'])
+        assert columnar_path.stat().st_size < expected_path.stat().st_size
+
+        assert_raises_rpc_error(
+            -8, 'Unknown snapshot format: flat', node.dumptxoutset, 'txoutset_flat.dat', 'flat')
+
 if __name__ == '__main__':
     DumptxoutsetTest().main()
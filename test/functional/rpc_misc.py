@@ -54,6 +54,14 @@ class RpcMiscTest(BitcoinTestFramework):
 
         assert_raises_rpc_error(-8, "unknown mode foobar", node.getmemoryinfo, mode="foobar")
 
+        self.log.info("test getschedulerinfo")
+        queues = {queue['name']: queue for queue in node.getschedulerinfo()}
+        # The peer eviction check is scheduled at startup
+        assert 'net' in queues
+        for queue in queues.values():
+            assert_greater_than_or_equal(queue['pending'], 0)
+            assert_greater_than_or_equal(queue['total_latency'], queue['max_latency'])
+
         self.log.info("test logging rpc and help")
 
         # Test toggling a logging category on/off/on with the logging RPC.
@@ -65,6 +65,7 @@ class NetTest(BitcoinTestFramework):
         self.test_connection_count()
         self.test_getpeerinfo()
         self.test_getnettotals()
+        self.test_getmsglatency()
         self.test_getnetworkinfo()
         self.test_getaddednodeinfo()
         self.test_service_flags()
@@ -124,6 +125,18 @@ class NetTest(BitcoinTestFramework):
             self.wait_until(lambda: peer_after()['bytesrecv_per_msg'].get('pong', 0) >= peer_before['bytesrecv_per_msg'].get('pong', 0) + 32, timeout=1)
             self.wait_until(lambda: peer_after()['bytessent_per_msg'].get('ping', 0) >= peer_before['bytessent_per_msg'].get('ping', 0) + 32, timeout=1)
 
+    def test_getmsglatency(self):
+        self.log.info("Test getmsglatency")
+        pongs_before = self.nodes[0].getmsglatency().get('pong', {'process': {'count': 0}})['process']['count']
+        self.nodes[0].ping()
+        self.wait_until(lambda: self.nodes[0].getmsglatency().get('pong', {'process': {'count': 0}})['process']['count'] >= pongs_before + 2, timeout=1)
+
+        latency = self.nodes[0].getmsglatency()['pong']
+        for histogram in ('queue', 'deserialize', 'process'):
+            assert_equal(sum(latency[histogram]['buckets']), latency[histogram]['count'])
+        for peer in self.nodes[0].getpeerinfo():
+            assert_greater_than(peer['latency_per_msg']['pong']['process']['count'], 0)
+
     def test_getnetworkinfo(self):
         self.log.info("Test getnetworkinfo")
         info = self.nodes[0].getnetworkinfo()